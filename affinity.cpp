@@ -0,0 +1,167 @@
+#include "affinity.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+#include "metrics.h"
+
+#if defined(CHATROOM_HAVE_NUMA)
+#include <numa.h>
+#endif
+
+namespace Affinity {
+
+namespace {
+
+Plan g_plan;
+
+std::atomic<int64_t>& BindFailures() {
+    static std::atomic<int64_t>& c = Metrics::Counter("affinity.numa_bind_failures");
+    return c;
+}
+
+std::atomic<int64_t>& PinFailures() {
+    static std::atomic<int64_t>& c = Metrics::Counter("affinity.pin_failures");
+    return c;
+}
+
+bool ParseCpu(const std::string& s, int* out) {
+    if (s.empty() || s.size() > 5) return false;
+    for (char c : s) {
+        if (c < '0' || c > '9') return false;
+    }
+    *out = std::atoi(s.c_str());
+    return *out < CPU_SETSIZE;
+}
+
+#if !defined(CHATROOM_HAVE_NUMA)
+constexpr int kMpolPreferred = 1;   // <numaif.h> ships with libnuma
+#endif
+
+bool BindToNode(void* p, size_t bytes, int node) {
+#if defined(CHATROOM_HAVE_NUMA)
+    if (numa_available() < 0 || node > numa_max_node()) return false;
+    numa_tonode_memory(p, bytes, node);
+    return true;
+#else
+    if (node >= static_cast<int>(sizeof(unsigned long) * 8)) return false;
+    unsigned long mask = 1UL << node;
+    return ::syscall(SYS_mbind, p, bytes, kMpolPreferred, &mask, sizeof(mask) * 8 + 1, 0) == 0;
+#endif
+}
+
+} // namespace
+
+bool ParseCpuList(const std::string& text, std::vector<int>* cpus) {
+    std::vector<int> out;
+    size_t pos = 0;
+    while (pos <= text.size()) {
+        size_t comma = text.find(',', pos);
+        if (comma == std::string::npos) comma = text.size();
+        std::string item = text.substr(pos, comma - pos);
+        size_t dash = item.find('-');
+        int lo = 0, hi = 0;
+        if (dash == std::string::npos) {
+            if (!ParseCpu(item, &lo)) return false;
+            hi = lo;
+        } else if (!ParseCpu(item.substr(0, dash), &lo) || !ParseCpu(item.substr(dash + 1), &hi) || hi < lo) {
+            return false;
+        }
+        for (int c = lo; c <= hi; ++c) out.push_back(c);
+        pos = comma + 1;
+    }
+    *cpus = std::move(out);
+    return !cpus->empty();
+}
+
+bool Configure(const Plan& plan, std::string* error) {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (::sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (const std::vector<int>* list : {&plan.io, &plan.workers, &plan.log}) {
+            for (int c : *list) {
+                if (!CPU_ISSET(c, &allowed)) {
+                    *error = "CPU " + std::to_string(c) + " is not available to this process";
+                    return false;
+                }
+            }
+        }
+    }
+    g_plan = plan;
+    return true;
+}
+
+bool PinSelf(Role role, int index) {
+    switch (role) {
+        case Role::kIo:
+            return g_plan.io.empty() || PinCurrentThread(g_plan.io);
+        case Role::kWorker:
+            if (g_plan.workers.empty()) return true;
+            return PinCurrentThread({g_plan.workers[static_cast<size_t>(index) % g_plan.workers.size()]});
+        case Role::kLog:
+            return g_plan.log.empty() || PinCurrentThread(g_plan.log);
+    }
+    return false;
+}
+
+bool PinCurrentThread(const std::vector<int>& cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (cpus.empty()) {
+        long n = ::sysconf(_SC_NPROCESSORS_CONF);
+        for (long c = 0; c < n && c < CPU_SETSIZE; ++c) CPU_SET(c, &set);
+    } else {
+        for (int c : cpus) CPU_SET(c, &set);
+    }
+    if (::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set) != 0) {
+        PinFailures().fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+int NodeOfCpu(int cpu) {
+#if defined(CHATROOM_HAVE_NUMA)
+    if (numa_available() >= 0) return numa_node_of_cpu(cpu);
+#endif
+    // /sys/devices/system/cpu/cpuN/nodeM
+    std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+    DIR* d = ::opendir(dir.c_str());
+    if (!d) return -1;
+    int node = -1;
+    while (dirent* e = ::readdir(d)) {
+        if (std::strncmp(e->d_name, "node", 4) == 0 && e->d_name[4] >= '0' && e->d_name[4] <= '9') {
+            node = std::atoi(e->d_name + 4);
+            break;
+        }
+    }
+    ::closedir(d);
+    return node;
+}
+
+int IoNode() {
+    return g_plan.io.empty() ? -1 : NodeOfCpu(g_plan.io.front());
+}
+
+void* AllocOnNode(size_t bytes, int node) {
+    if (bytes == 0) bytes = 1;
+    void* p = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return nullptr;
+    // Bind before first touch so the pages are faulted in on node.
+    if (node >= 0 && !BindToNode(p, bytes, node)) BindFailures().fetch_add(1, std::memory_order_relaxed);
+    return p;
+}
+
+void FreeOnNode(void* p, size_t bytes) {
+    if (p) ::munmap(p, bytes ? bytes : 1);
+}
+
+} // namespace Affinity
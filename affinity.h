@@ -0,0 +1,70 @@
+#ifndef AFFINITY_H_
+#define AFFINITY_H_
+
+#include <cstddef>
+#include <new>
+#include <string>
+#include <vector>
+
+// CPU pinning and NUMA-local allocation.
+//
+// The server's threads fall into three roles, each with an optional CPU list
+// (--cpus-io, --cpus-workers, --cpus-log):
+//  - kIo:     the accept loop; session readers and mailbox writers are
+//             spawned from it and inherit its mask;
+//  - kWorker: fan-out workers (fanout.h), one CPU each, round-robin;
+//  - kLog:    the WAL committer and the snapshot writer.
+// An empty list leaves that role unpinned.
+//
+// Long-lived shared arrays (the connection table) are placed on the NUMA node
+// of the first I/O CPU, via libnuma when the build found it and the mbind
+// system call otherwise. Per-connection buffers are allocated by the pinned
+// threads themselves, so first-touch already keeps them local.
+
+namespace Affinity {
+
+enum class Role { kIo, kWorker, kLog };
+
+struct Plan {
+    std::vector<int> io;
+    std::vector<int> workers;
+    std::vector<int> log;
+};
+
+// "0-3,8,10-11" -> {0,1,2,3,8,10,11}. False on a syntax error.
+bool ParseCpuList(const std::string& text, std::vector<int>* cpus);
+
+// Set before starting threads; later PinSelf calls use it. Fails, naming
+// the CPU in *error, if a listed CPU is outside the process's allowed set.
+bool Configure(const Plan& plan, std::string* error);
+
+// Pin the calling thread for role. index picks the CPU for kWorker; the
+// other roles get their whole list. No-op (true) when the list is empty.
+bool PinSelf(Role role, int index = 0);
+
+// Pin the calling thread to cpus; empty = every online CPU.
+bool PinCurrentThread(const std::vector<int>& cpus);
+
+// NUMA node of cpu, or -1 if unknown.
+int NodeOfCpu(int cpu);
+
+// Node for shared I/O-side structures: that of the first kIo CPU, or -1.
+int IoNode();
+
+// Page-aligned, zeroed memory bound to node (plain allocation if node < 0
+// or binding fails). Release with FreeOnNode.
+void* AllocOnNode(size_t bytes, int node);
+void FreeOnNode(void* p, size_t bytes);
+
+// n default-constructed T on node; never freed (process lifetime tables).
+template <class T>
+T* NewArrayOnNode(size_t n, int node) {
+    T* p = static_cast<T*>(AllocOnNode(n * sizeof(T), node));
+    if (!p) throw std::bad_alloc();
+    for (size_t i = 0; i < n; ++i) new (p + i) T();
+    return p;
+}
+
+} // namespace Affinity
+
+#endif // AFFINITY_H_
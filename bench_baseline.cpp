@@ -0,0 +1,298 @@
+#include "bench_baseline.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+
+namespace BenchBaseline {
+
+namespace {
+
+struct Samples {
+    std::string unit;
+    std::vector<double> values;
+};
+
+std::map<std::string, Samples> g_samples;
+
+double Median(std::vector<double> v) {
+    if (v.empty()) return 0;
+    std::sort(v.begin(), v.end());
+    size_t n = v.size();
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+enum class Direction { kHigherIsBetter, kLowerIsBetter, kMustNotGrow, kInformational };
+
+bool EndsWith(const std::string& s, const std::string& suffix) {
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+Direction DirectionOf(const std::string& name, const std::string& unit) {
+    if (EndsWith(name, ".out_of_order") || EndsWith(name, ".leaked_slots") || EndsWith(name, ".misses") ||
+        EndsWith(name, ".TIMEOUT")) {
+        return Direction::kMustNotGrow;
+    }
+    if (EndsWith(unit, "/s")) return Direction::kHigherIsBetter;
+    std::string base = unit.substr(0, unit.find('/'));
+    if (base == "us" || base == "ms" || base == "ns") return Direction::kLowerIsBetter;
+    return Direction::kInformational;
+}
+
+std::string Quote(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+// Just enough JSON for the files WriteJson() produces: nested objects,
+// strings and numbers.
+class Parser {
+public:
+    explicit Parser(const std::string& text) : s_(text) {}
+
+    bool ParseFile(Info* info, Results* out) {
+        if (!Expect('{')) return false;
+        if (Peek('}')) return true;
+        do {
+            std::string key;
+            if (!String(&key) || !Expect(':')) return false;
+            if (key == "metrics") {
+                if (!Metrics(out)) return false;
+            } else if (key == "info") {
+                if (!Strings(info)) return false;
+            } else if (!Skip()) {
+                return false;
+            }
+        } while (Consume(','));
+        return Expect('}');
+    }
+
+private:
+    bool Metrics(Results* out) {
+        if (!Expect('{')) return false;
+        if (Consume('}')) return true;
+        do {
+            std::string name;
+            Summary sum;
+            if (!String(&name) || !Expect(':') || !Expect('{')) return false;
+            do {
+                std::string field;
+                if (!String(&field) || !Expect(':')) return false;
+                double v = 0;
+                if (field == "unit") {
+                    if (!String(&sum.unit)) return false;
+                } else if (field == "median" || field == "mad" || field == "runs") {
+                    if (!Number(&v)) return false;
+                    if (field == "median") sum.median = v;
+                    else if (field == "mad") sum.mad = v;
+                    else sum.runs = static_cast<size_t>(v);
+                } else if (!Skip()) {
+                    return false;
+                }
+            } while (Consume(','));
+            if (!Expect('}')) return false;
+            (*out)[name] = sum;
+        } while (Consume(','));
+        return Expect('}');
+    }
+
+    bool Strings(Info* out) {
+        if (!Expect('{')) return false;
+        if (Consume('}')) return true;
+        do {
+            std::string key, value;
+            if (!String(&key) || !Expect(':') || !String(&value)) return false;
+            (*out)[key] = value;
+        } while (Consume(','));
+        return Expect('}');
+    }
+
+    // Any value we do not interpret.
+    bool Skip() {
+        Space();
+        if (Peek('"')) {
+            std::string ignored;
+            return String(&ignored);
+        }
+        if (Consume('{')) {
+            if (Consume('}')) return true;
+            do {
+                std::string key;
+                if (!String(&key) || !Expect(':') || !Skip()) return false;
+            } while (Consume(','));
+            return Expect('}');
+        }
+        double ignored = 0;
+        return Number(&ignored);
+    }
+
+    bool String(std::string* out) {
+        if (!Expect('"')) return false;
+        out->clear();
+        while (i_ < s_.size() && s_[i_] != '"') {
+            if (s_[i_] == '\\' && i_ + 1 < s_.size()) ++i_;
+            *out += s_[i_++];
+        }
+        return Expect('"');
+    }
+
+    bool Number(double* out) {
+        Space();
+        const char* begin = s_.c_str() + i_;
+        char* end = nullptr;
+        *out = std::strtod(begin, &end);
+        if (end == begin) return false;
+        i_ += static_cast<size_t>(end - begin);
+        return true;
+    }
+
+    void Space() {
+        while (i_ < s_.size() && std::isspace(static_cast<unsigned char>(s_[i_]))) ++i_;
+    }
+    bool Peek(char c) {
+        Space();
+        return i_ < s_.size() && s_[i_] == c;
+    }
+    bool Consume(char c) {
+        if (!Peek(c)) return false;
+        ++i_;
+        return true;
+    }
+    bool Expect(char c) { return Consume(c); }
+
+    const std::string& s_;
+    size_t i_ = 0;
+};
+
+} // namespace
+
+void Record(const std::string& name, double value, const std::string& unit) {
+    Samples& s = g_samples[name];
+    s.unit = unit;
+    s.values.push_back(value);
+}
+
+Results Summarize() {
+    Results out;
+    for (const auto& kv : g_samples) {
+        Summary sum;
+        sum.unit = kv.second.unit;
+        sum.median = Median(kv.second.values);
+        std::vector<double> dev;
+        for (double v : kv.second.values) dev.push_back(std::fabs(v - sum.median));
+        sum.mad = Median(dev);
+        sum.runs = kv.second.values.size();
+        out[kv.first] = sum;
+    }
+    return out;
+}
+
+bool WriteJson(const std::string& path, const Info& info, const Results& results, std::string* error) {
+    std::ofstream out(path, std::ios::trunc);
+    if (!out) {
+        *error = "cannot write " + path;
+        return false;
+    }
+    out << std::setprecision(6) << "{\n  \"info\": {";
+    bool first = true;
+    for (const auto& kv : info) {
+        out << (first ? "" : ", ") << Quote(kv.first) << ": " << Quote(kv.second);
+        first = false;
+    }
+    out << "},\n  \"metrics\": {";
+    first = true;
+    for (const auto& kv : results) {
+        out << (first ? "\n" : ",\n") << "    " << Quote(kv.first) << ": {\"unit\": " << Quote(kv.second.unit)
+            << ", \"median\": " << kv.second.median << ", \"mad\": " << kv.second.mad
+            << ", \"runs\": " << kv.second.runs << "}";
+        first = false;
+    }
+    out << "\n  }\n}\n";
+    if (!out.flush()) {
+        *error = "write failed: " + path;
+        return false;
+    }
+    return true;
+}
+
+bool ReadJson(const std::string& path, Info* info, Results* out, std::string* error) {
+    std::ifstream in(path);
+    if (!in) {
+        *error = "cannot read " + path;
+        return false;
+    }
+    std::stringstream ss;
+    ss << in.rdbuf();
+    std::string text = ss.str();
+    Parser parser(text);
+    if (!parser.ParseFile(info, out)) {
+        *error = "malformed baseline " + path;
+        return false;
+    }
+    return true;
+}
+
+int Compare(const Results& baseline, const Results& current, double tolerance, std::ostream& out) {
+    int regressions = 0;
+    char line[256];
+    for (const auto& kv : current) {
+        const std::string& name = kv.first;
+        const Summary& cur = kv.second;
+        Direction dir = DirectionOf(name, cur.unit);
+        auto it = baseline.find(name);
+        if (it == baseline.end()) {
+            // A timeout is a failure even if the baseline never saw one.
+            bool bad = dir == Direction::kMustNotGrow && cur.median > 0;
+            regressions += bad;
+            std::snprintf(line, sizeof(line), "%-40s %12s %12.2f  %s\n", name.c_str(), "-", cur.median,
+                          bad ? "REGRESSION" : "new");
+            out << line;
+            continue;
+        }
+        const Summary& base = it->second;
+        double slack = std::max(tolerance * std::fabs(base.median), 3 * 1.4826 * std::max(base.mad, cur.mad));
+        double delta = cur.median - base.median;
+        const char* verdict = "ok";
+        switch (dir) {
+            case Direction::kHigherIsBetter:
+                verdict = delta < -slack ? "REGRESSION" : delta > slack ? "improved" : "ok";
+                break;
+            case Direction::kLowerIsBetter:
+                verdict = delta > slack ? "REGRESSION" : delta < -slack ? "improved" : "ok";
+                break;
+            case Direction::kMustNotGrow:
+                verdict = cur.median > base.median ? "REGRESSION" : "ok";
+                break;
+            case Direction::kInformational:
+                verdict = "info";
+                break;
+        }
+        if (verdict[0] == 'R') ++regressions;
+        double pct = base.median != 0 ? 100.0 * delta / std::fabs(base.median) : 0;
+        std::snprintf(line, sizeof(line), "%-40s %12.2f %12.2f %+7.1f%%  %s\n", name.c_str(), base.median,
+                      cur.median, pct, verdict);
+        out << line;
+    }
+    // A metric that stopped being reported (a suite that crashed, was
+    // skipped or renamed it) must not pass the gate silently.
+    for (const auto& kv : baseline) {
+        if (current.count(kv.first)) continue;
+        ++regressions;
+        std::snprintf(line, sizeof(line), "%-40s %12.2f %12s  %s\n", kv.first.c_str(), kv.second.median, "-",
+                      "REGRESSION (missing)");
+        out << line;
+    }
+    return regressions;
+}
+
+} // namespace BenchBaseline
@@ -0,0 +1,60 @@
+#ifndef BENCH_BASELINE_H_
+#define BENCH_BASELINE_H_
+
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <vector>
+
+// Regression gate for chat_benchmarks.
+//
+// Every reported value is recorded as one sample; after --repeat runs each
+// metric is summarized as median and MAD (median absolute deviation) and
+// written as JSON:
+//
+//   {"info": {"build": "Release", "cpus": "8"},
+//    "metrics": {"fanout[1000].enqueue": {"unit": "us/broadcast",
+//                "median": 41.2, "mad": 1.3, "runs": 5}, ...}}
+//
+// The same file format is the stored baseline (bench/baseline.json). "info"
+// describes where the numbers came from; a mismatch with the current run is
+// reported, since a baseline only means something on comparable builds and
+// hosts.
+// Compare() decides direction from the unit ("/s" higher is better; us, ms,
+// ns lower is better; counts of correctness problems such as out_of_order
+// must not grow; everything else is informational) and flags a metric only
+// when it moved the wrong way by more than
+//
+//   max(tolerance * baseline, 3 * 1.4826 * max(baseline MAD, current MAD))
+//
+// so a noisy metric needs a proportionally larger shift to fail the gate. A
+// baseline metric the current run does not report at all is a regression,
+// so compare against a baseline recorded with the same suites.
+
+namespace BenchBaseline {
+
+struct Summary {
+    std::string unit;
+    double median = 0;
+    double mad = 0;
+    size_t runs = 0;
+};
+
+using Results = std::map<std::string, Summary>;
+using Info = std::map<std::string, std::string>;
+
+// Add one sample of name. Not thread-safe; called from the driver thread.
+void Record(const std::string& name, double value, const std::string& unit);
+
+Results Summarize();
+
+bool WriteJson(const std::string& path, const Info& info, const Results& results, std::string* error);
+bool ReadJson(const std::string& path, Info* info, Results* out, std::string* error);
+
+// Print one line per compared or missing metric to out; returns the number
+// of regressions.
+int Compare(const Results& baseline, const Results& current, double tolerance, std::ostream& out);
+
+} // namespace BenchBaseline
+
+#endif // BENCH_BASELINE_H_
@@ -0,0 +1,955 @@
+// benchmarks.cpp
+// Routing benchmarks driven over the simulated network (netsim.h).
+// Links the real services and ClientHandler (server.cpp built with TEST_BUILD)
+// against netsim.cpp instead of network.cpp, so no real sockets are used.
+//
+// Usage: chat_benchmarks [--suite=all|fanout|slow|storm|wal|affinity|codec|registry|startup|zerocopy|
+//                                watch|topics|regression]
+//                        [--clients=N] [--messages=N] [--latency-us=N]
+//                        [--fanout-workers=N] [--cpus=LIST]
+//                        [--repeat=N] [--json=PATH] [--baseline=PATH] [--tolerance=FRACTION]
+//
+// --suite=regression runs a fixed set with fixed sizes (codec, registry,
+// 1k/10k-client broadcast, logging, startup), independent of --clients and
+// --messages, so its numbers are comparable across commits. With --json the
+// median/MAD of every metric over --repeat runs is written out; with
+// --baseline it is compared against a stored file (bench_baseline.h) and
+// the exit status is 1 if anything regressed. `cmake --build . --target
+// bench` runs exactly that against bench/baseline.json.
+//
+// --suite=zerocopy is the exception to the simulated network: it writes
+// large frames to real loopback TCP connections, copied and with
+// MSG_ZEROCOPY, to show where --zerocopy pays off on this kernel.
+
+#include <arpa/inet.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common.h"
+#include "affinity.h"
+#include "bench_baseline.h"
+#include "connection_table.h"
+#include "fanout.h"
+#include "memory_budget.h"
+#include "metrics.h"
+#include "netsim.h"
+#include "network.h"
+#include "outbound.h"
+#include "services.h"
+#include "file_io.h"
+#include "history.h"
+#include "log_format.h"
+#include "snapshot.h"
+#include "topics.h"
+#include "wal.h"
+#include "watchlist.h"
+
+namespace ClientHandler {
+void ServeClient(Socket client_socket);
+}
+
+namespace {
+
+constexpr int kPort = 40000;
+
+// Set in a --repeat child: reported samples also go to the parent here.
+int g_sample_fd = -1;
+
+// A suite gave up waiting for its deliveries; the run exits non-zero.
+bool g_timed_out = false;
+
+struct Options {
+    std::string suite = "all";
+    int clients = 1000;
+    int messages = 20;
+    long long latency_us = 0;
+    int fanout_workers = 0;     ///< > 0: repeat the fanout suite on the pool
+    std::vector<int> cpus;      ///< affinity suite; empty = every allowed CPU
+    int repeat = 1;             ///< run the selected suites this many times
+    std::string json;           ///< write median/MAD per metric here
+    std::string baseline;       ///< compare against this file, exit 1 on regression
+    double tolerance = 0.10;    ///< minimum relative change that counts
+};
+
+// A client end on the driver side plus its server end.
+struct SimClient {
+    Socket client = -1;
+    Socket server = -1;
+    ConnectionTable::ConnId conn;
+    std::string name;
+    long long received = 0;
+};
+
+using Clock = std::chrono::steady_clock;
+
+double SecondsSince(Clock::time_point t0) {
+    return std::chrono::duration<double>(Clock::now() - t0).count();
+}
+
+void Report(const std::string& name, double value, const std::string& unit) {
+    std::printf("%-36s %14.2f %s\n", name.c_str(), value, unit.c_str());
+    std::fflush(stdout);
+    BenchBaseline::Record(name, value, unit);
+    if (g_sample_fd >= 0) {
+        std::string line = name + "\t" + std::to_string(value) + "\t" + unit + "\n";
+        if (::write(g_sample_fd, line.data(), line.size()) < 0) std::perror("sample pipe");
+    }
+}
+
+void ReportTimeout(const std::string& tag) {
+    Report(tag + ".TIMEOUT", 1, "");
+    g_timed_out = true;
+}
+
+// Drive the virtual clock until done() or the real-time budget runs out.
+// Between checks the driver either jumps to the next arrival or sleeps until
+// a server thread writes something.
+bool Pump(const std::function<bool()>& done, double budget_s = 60.0) {
+    Clock::time_point t0 = Clock::now();
+    for (;;) {
+        uint64_t v = NetSim::Version();
+        if (done()) return true;
+        if (SecondsSince(t0) > budget_s) return false;
+        if (!NetSim::AdvanceToNextEvent()) NetSim::WaitForChange(v, 20);
+    }
+}
+
+void DrainAll(std::vector<SimClient>& clients) {
+    for (SimClient& c : clients) {
+        while (NetSim::TryReceive(c.client)) ++c.received;
+    }
+}
+
+// Register n connections straight into the routing layer (no auth frames),
+// the way ServeClient does after a successful handshake.
+std::vector<SimClient> AttachClients(int listener, int n) {
+    std::vector<SimClient> clients(n);
+    for (int i = 0; i < n; ++i) {
+        SimClient& c = clients[i];
+        c.client = NetworkLayer::Connect("sim", kPort);
+        c.server = NetworkLayer::Accept(listener);
+        c.conn = ConnectionTable::Acquire(c.server);
+        Outbound::Open(c.conn, c.server);
+        c.name = "bench" + std::to_string(i);
+        User u{};
+        u.id = c.server;
+        u.uid = UserIds::Intern(c.name);
+        u.username = c.name;
+        u.connected = true;
+        u.joined_at = NowEpochMs();
+        UserManager::AddUser(u, c.server);
+    }
+    return clients;
+}
+
+void DetachClients(std::vector<SimClient>& clients) {
+    for (SimClient& c : clients) {
+        UserManager::RemoveUser(c.name);
+        NetSim::Disconnect(c.client);
+        Outbound::Close(c.conn);
+        ConnectionTable::Release(c.conn);
+        NetworkLayer::Close(c.server);
+    }
+}
+
+Message PublicMessage(const std::string& sender, const std::string& text) {
+    Message m;
+    m.type = MessageType::PUBLIC_MESSAGE;
+    m.timestamp = NowEpochMs();
+    m.sender_username = sender;
+    m.content = text;
+    return m;
+}
+
+// Broadcast fan-out: one sender, every client must receive every message, in
+// order. With workers > 0 the broadcasts go through the fan-out pool.
+void RunFanout(const Options& opt, int workers, std::string tag = "") {
+    Fanout::Options pool;
+    pool.workers = workers;
+    pool.inline_below = 0;
+    pool.chunk_slots = std::max<size_t>(64, opt.clients / (workers * 4 + 1));
+    Fanout::Start(pool);
+    NetSim::Reset();
+    NetSim::LinkParams link;
+    link.latency_us = opt.latency_us;
+    NetSim::SetDefaultLink(link);
+    Socket listener = NetworkLayer::StartServer(kPort);
+    std::vector<SimClient> clients = AttachClients(listener, opt.clients);
+
+    Clock::time_point t0 = Clock::now();
+    for (int i = 0; i < opt.messages; ++i) {
+        MessageRouter::BroadcastPublic(PublicMessage("bench0", "fanout " + std::to_string(i)));
+    }
+    double enqueue_s = SecondsSince(t0);
+    long long out_of_order = 0;
+    bool ok = Pump([&] {
+        for (SimClient& c : clients) {
+            while (auto m = NetSim::TryReceive(c.client)) {
+                if (m->content != "fanout " + std::to_string(c.received)) ++out_of_order;
+                ++c.received;
+            }
+        }
+        for (const SimClient& c : clients) {
+            if (c.received < opt.messages) return false;
+        }
+        return true;
+    });
+    double total_s = SecondsSince(t0);
+
+    if (tag.empty()) {
+        tag = workers > 0 ? "fanout_pool[" + std::to_string(workers) + "x" + std::to_string(opt.clients) + "]"
+                          : "fanout[" + std::to_string(opt.clients) + "]";
+    }
+    Report(tag + ".enqueue", enqueue_s * 1e6 / opt.messages, "us/broadcast");
+    Report(tag + ".deliveries", (double)opt.clients * opt.messages / total_s, "frames/s");
+    Report(tag + ".virtual_time", (double)NetSim::Now(), "us");
+    Report(tag + ".out_of_order", (double)out_of_order, "frames");
+    if (!ok) ReportTimeout(tag);
+    Fanout::Stop();
+    DetachClients(clients);
+    NetworkLayer::Close(listener);
+}
+
+// One client with a small receive window that never reads. The others must
+// still get everything; the slow one is shed once its mailbox fills or its
+// memory budget (kept small here) runs out. Healthy readers keep up with the
+// sender, as real ones would: the sender waits whenever they fall kSlack
+// frames behind, so their backlog stays well inside the budget however fast
+// the sending thread runs compared to their writers.
+void RunSlowConsumer(const Options& opt) {
+    constexpr int kSlack = 256;
+    MemoryBudget::Limits limits;
+    limits.per_connection_bytes = 128 * 1024;
+    MemoryBudget::Configure(limits);
+    std::atomic<int64_t>& shed = Metrics::Counter("mem.shed.frames");
+    int64_t shed0 = shed.load();
+    NetSim::Reset();
+    NetSim::SetDefaultLink(NetSim::LinkParams{});
+    Socket listener = NetworkLayer::StartServer(kPort);
+    int n = std::max(2, opt.clients / 10);
+    std::vector<SimClient> clients = AttachClients(listener, n);
+
+    NetSim::LinkParams slow;
+    slow.recv_window_bytes = 64 * 1024;
+    NetSim::SetLink(clients[0].server, slow);
+    std::vector<SimClient> readers(clients.begin() + 1, clients.end());
+
+    int messages = opt.messages * 500;
+    unsigned long long dropped0 = Outbound::DroppedFrames();
+    Clock::time_point t0 = Clock::now();
+    // True once every healthy reader has all but slack of the sent frames.
+    auto caught_up = [&](int sent, int slack) {
+        DrainAll(readers);
+        for (const SimClient& c : readers) {
+            if (c.received < sent - slack) return false;
+        }
+        return true;
+    };
+    bool ok = true;
+    for (int i = 0; i < messages && ok; ++i) {
+        MessageRouter::BroadcastPublic(PublicMessage("bench1", "slow consumer " + std::to_string(i)));
+        if (i % kSlack == 0) ok = Pump([&] { return caught_up(i + 1, kSlack); });
+    }
+    ok = ok && Pump([&] { return caught_up(messages, 0); });
+    double total_s = SecondsSince(t0);
+
+    NetSim::EndpointStats st = NetSim::GetStats(clients[0].server);
+    const std::string tag = "slow[" + std::to_string(n) + "]";
+    Report(tag + ".healthy_deliveries", (double)(n - 1) * messages / total_s, "frames/s");
+    Report(tag + ".slow_blocked_writes", (double)st.blocked_writes, "writes");
+    Report(tag + ".dropped_frames", (double)(Outbound::DroppedFrames() - dropped0), "frames");
+    Report(tag + ".shed_frames", (double)(shed.load() - shed0), "frames");
+    // Only the slow one may lose frames.
+    long long healthy_missing = 0;
+    for (const SimClient& c : readers) healthy_missing += std::max(0LL, messages - c.received);
+    Report(tag + ".healthy_missing", (double)healthy_missing, "frames");
+    Report(tag + ".send_queue_bytes", (double)MemoryBudget::Used(MemoryBudget::Category::kSendQueue), "bytes");
+    if (!ok) ReportTimeout(tag);
+    DetachClients(clients);
+    NetworkLayer::Close(listener);
+    MemoryBudget::Configure(MemoryBudget::Limits{});
+}
+
+// Full ServeClient path: every client authenticates, then all of them drop
+// and reconnect at once, repeatedly. Join/leave broadcasts make this O(n^2).
+void RunReconnectStorm(const Options& opt) {
+    NetSim::Reset();
+    NetSim::LinkParams link;
+    link.latency_us = opt.latency_us;
+    NetSim::SetDefaultLink(link);
+    Socket listener = NetworkLayer::StartServer(kPort);
+    std::thread acceptor([listener] {
+        for (;;) {
+            Socket s;
+            try {
+                s = NetworkLayer::Accept(listener);
+            } catch (...) {
+                return;
+            }
+            std::thread(ClientHandler::ServeClient, s).detach();
+        }
+    });
+
+    int n = std::max(2, opt.clients / 10);
+    const int rounds = 3;
+    double worst_round_s = 0;
+    Clock::time_point t0 = Clock::now();
+    for (int round = 0; round < rounds; ++round) {
+        Clock::time_point r0 = Clock::now();
+        std::vector<Socket> socks(n);
+        std::vector<int> stage(n, 0);   // 0 = wait prompt, 1 = wait accept, 2 = online
+        for (int i = 0; i < n; ++i) socks[i] = NetworkLayer::Connect("sim", kPort);
+        Pump([&] {
+            bool all = true;
+            for (int i = 0; i < n; ++i) {
+                while (auto m = NetSim::TryReceive(socks[i])) {
+                    if (stage[i] == 0 && m->content == "ENTER_USERNAME") {
+                        Message reply;
+                        reply.type = MessageType::COMMAND_RESPONSE;
+                        reply.timestamp = NowEpochMs();
+                        reply.content = "storm" + std::to_string(i);
+                        NetworkLayer::SendMessage(socks[i], reply);
+                        stage[i] = 1;
+                    } else if (stage[i] == 1 && m->content == "USERNAME_ACCEPTED") {
+                        stage[i] = 2;
+                    }
+                }
+                all = all && stage[i] == 2;
+            }
+            return all;
+        });
+        for (Socket s : socks) NetSim::Disconnect(s);
+        Pump([&] { return ConnectionTable::LiveCount() == 0; });
+        worst_round_s = std::max(worst_round_s, SecondsSince(r0));
+    }
+
+    const std::string tag = "storm[" + std::to_string(n) + "]";
+    Report(tag + ".reconnects", (double)n * rounds / SecondsSince(t0), "sessions/s");
+    Report(tag + ".worst_round", worst_round_s * 1e3, "ms");
+    Report(tag + ".leaked_slots", (double)ConnectionTable::LiveCount(), "slots");
+    NetworkLayer::Close(listener);
+    acceptor.join();
+}
+
+double Percentile(std::vector<double>& v, double p) {
+    if (v.empty()) return 0;
+    size_t k = std::min(v.size() - 1, static_cast<size_t>(p * v.size()));
+    std::nth_element(v.begin(), v.begin() + k, v.end());
+    return v[k];
+}
+
+// Durable logging cost. Each producer appends one log line and waits until
+// it is durable before the next, like a client waiting for its own echo in
+// --durability=group mode. Uses a real file in the working directory, so the
+// numbers are those of the underlying disk's fdatasync. quick: only the
+// best-effort and default group-commit modes.
+void RunWal(const Options& opt, bool quick = false) {
+    struct Mode {
+        const char* name;
+        bool durable;
+        int window_us;
+        size_t max_batch;
+    };
+    const Mode modes[] = {
+        {"best_effort", false, 0, 0},
+        {"sync_each", true, 0, 1},
+        {"group_0us", true, 0, 256},
+        {"group_200us", true, 200, 256},
+        {"group_1000us", true, 1000, 256},
+    };
+    const int producers = std::min(opt.clients, 64);
+    const int per_producer = opt.messages * 10;
+    const std::string path = "chat_bench_wal.tmp";
+    const std::string line(100, 'x');
+    std::atomic<int64_t>& commits = Metrics::Counter("wal.commits");
+    std::atomic<int64_t>& records = Metrics::Counter("wal.records");
+
+    for (const Mode& mode : modes) {
+        if (quick && mode.name != std::string("best_effort") && mode.name != std::string("group_200us")) continue;
+        std::remove(path.c_str());
+        if (mode.durable) {
+            Wal::Options w;
+            w.path = path;
+            w.group_window_us = mode.window_us;
+            w.max_batch = mode.max_batch;
+            if (!Wal::Open(w)) return;
+        }
+        int64_t commits0 = commits.load(), records0 = records.load();
+        std::vector<std::vector<double>> lat(producers);
+        Clock::time_point t0 = Clock::now();
+        std::vector<std::thread> threads;
+        for (int p = 0; p < producers; ++p) {
+            threads.emplace_back([&, p] {
+                for (int i = 0; i < per_producer; ++i) {
+                    Clock::time_point a = Clock::now();
+                    if (mode.durable) {
+                        std::promise<void> done;
+                        if (Wal::Append(line + "\n", [&done](bool) { done.set_value(); })) done.get_future().wait();
+                    } else {
+                        File::AppendLine(path, line);
+                    }
+                    lat[p].push_back(std::chrono::duration<double, std::micro>(Clock::now() - a).count());
+                }
+            });
+        }
+        for (std::thread& t : threads) t.join();
+        double total_s = SecondsSince(t0);
+        if (mode.durable) Wal::Close();
+
+        std::vector<double> all;
+        for (auto& v : lat) all.insert(all.end(), v.begin(), v.end());
+        const std::string tag = std::string("wal[") + std::to_string(producers) + "]." + mode.name;
+        Report(tag + ".rate", all.size() / total_s, "records/s");
+        Report(tag + ".p50", Percentile(all, 0.50), "us");
+        Report(tag + ".p99", Percentile(all, 0.99), "us");
+        if (mode.durable) {
+            int64_t c = commits.load() - commits0;
+            Report(tag + ".batch", c ? (double)(records.load() - records0) / c : 0, "records/commit");
+        }
+    }
+    std::remove(path.c_str());
+}
+
+// Pooled fan-out with every thread free to migrate, then with the driver and
+// mailbox writers on the first CPU and one fan-out worker per remaining CPU.
+void RunAffinity(const Options& opt) {
+    std::vector<int> cpus = opt.cpus;
+    if (cpus.empty()) {
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        ::sched_getaffinity(0, sizeof(allowed), &allowed);
+        for (int c = 0; c < CPU_SETSIZE; ++c) {
+            if (CPU_ISSET(c, &allowed)) cpus.push_back(c);
+        }
+    }
+    int workers = opt.fanout_workers > 0 ? opt.fanout_workers : std::max<int>(1, (int)cpus.size() - 1);
+    const std::string n = std::to_string(workers) + "x" + std::to_string(opt.clients);
+    std::string error;
+
+    Affinity::Configure(Affinity::Plan{}, &error);
+    RunFanout(opt, workers, "affinity_unpinned[" + n + "]");
+
+    Affinity::Plan plan;
+    plan.io = {cpus.front()};
+    plan.workers.assign(cpus.size() > 1 ? cpus.begin() + 1 : cpus.begin(), cpus.end());
+    if (!Affinity::Configure(plan, &error)) {
+        std::cerr << "affinity: " << error << "\n";
+        return;
+    }
+    Affinity::PinSelf(Affinity::Role::kIo);     // writers spawned by AttachClients inherit it
+    RunFanout(opt, workers, "affinity_pinned[" + n + "]");
+    Affinity::PinCurrentThread({});
+    Affinity::Configure(Affinity::Plan{}, &error);
+}
+
+// Wire encoding cost per message, outside any connection.
+void RunCodec() {
+    const int iterations = 200000;
+    for (size_t size : {size_t{64}, size_t{1024}}) {
+        Message m = PublicMessage("codec_sender", std::string(size, 'x'));
+        const std::string tag = "codec[" + std::to_string(size) + "]";
+        size_t sink = 0;
+        Clock::time_point t0 = Clock::now();
+        for (int i = 0; i < iterations; ++i) sink += NetworkLayer::Serialize(m).size();
+        Report(tag + ".serialize", SecondsSince(t0) * 1e9 / iterations, "ns/op");
+
+        const std::vector<char> bytes = NetworkLayer::Serialize(m);
+        t0 = Clock::now();
+        for (int i = 0; i < iterations; ++i) sink += NetworkLayer::Deserialize(bytes).content.size();
+        Report(tag + ".deserialize", SecondsSince(t0) * 1e9 / iterations, "ns/op");
+
+        t0 = Clock::now();
+        for (int i = 0; i < iterations; ++i) sink += NetworkLayer::EncodeFrame(m)->size();
+        Report(tag + ".encode_frame", SecondsSince(t0) * 1e9 / iterations, "ns/op");
+        if (sink == 0) std::cerr << "codec: nothing encoded\n";
+    }
+}
+
+double ThreadCpuSeconds() {
+    timespec ts;
+    ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) * 1e-9;
+}
+
+// Zero-copy completions read from sock's error queue; *copied counts those
+// the kernel copied anyway.
+size_t ReapZeroCopy(int sock, size_t* copied) {
+    size_t n = 0;
+    for (;;) {
+        char control[128];
+        msghdr mh{};
+        mh.msg_control = control;
+        mh.msg_controllen = sizeof(control);
+        if (::recvmsg(sock, &mh, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) return n;
+        for (cmsghdr* cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+            if (cm->cmsg_level != SOL_IP || cm->cmsg_type != IP_RECVERR) continue;
+            sock_extended_err err;
+            std::memcpy(&err, CMSG_DATA(cm), sizeof(err));
+            if (err.ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+            n += err.ee_data - err.ee_info + 1;
+            if (err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) *copied += err.ee_data - err.ee_info + 1;
+        }
+    }
+}
+
+// Sender CPU per broadcast of one large frame to several real TCP peers,
+// copied and with MSG_ZEROCOPY (completions reaped as the server's writers
+// do). Over loopback the kernel copies zero-copy data on delivery, so the
+// copied fraction shows whether this host can benefit at all.
+void RunZeroCopy() {
+    const int peers = 8;
+    const int broadcasts = 200;
+    int listener = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        ::listen(listener, peers) != 0 || ::getsockname(listener, reinterpret_cast<sockaddr*>(&addr), &len) != 0) {
+        std::perror("zerocopy: listen");
+        if (listener >= 0) ::close(listener);
+        return;
+    }
+    std::vector<int> senders;
+    std::vector<std::thread> drains;
+    for (int i = 0; i < peers; ++i) {
+        int s = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (s < 0 || ::connect(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            std::perror("zerocopy: connect");
+            break;
+        }
+        int r = ::accept(listener, nullptr, nullptr);
+        senders.push_back(s);
+        drains.emplace_back([r] {
+            std::vector<char> buf(1 << 16);
+            while (::recv(r, buf.data(), buf.size(), 0) > 0) {}
+            ::close(r);
+        });
+    }
+    ::close(listener);
+
+    int one = 1;
+    bool zerocopy = !senders.empty();
+    for (int s : senders) {
+        zerocopy = zerocopy && ::setsockopt(s, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+    }
+    for (size_t size : {size_t{16} << 10, size_t{256} << 10}) {
+        const std::string tag = "zerocopy[" + std::to_string(size >> 10) + "K]";
+        std::vector<char> frame(size, 'z');
+        for (bool zc : {false, true}) {
+            if (zc && !zerocopy) {
+                std::cerr << "zerocopy: SO_ZEROCOPY not supported\n";
+                break;
+            }
+            size_t sent_calls = 0, completed = 0, copied = 0;
+            double cpu0 = ThreadCpuSeconds();
+            for (int b = 0; b < broadcasts; ++b) {
+                for (int s : senders) {
+                    size_t off = 0;
+                    while (off < size) {
+                        ssize_t n = ::send(s, frame.data() + off, size - off, MSG_NOSIGNAL | (zc ? MSG_ZEROCOPY : 0));
+                        if (n < 0 && (errno == EINTR || errno == ENOBUFS)) {
+                            if (zc) completed += ReapZeroCopy(s, &copied);
+                            continue;
+                        }
+                        if (n <= 0) break;
+                        off += static_cast<size_t>(n);
+                        if (zc) ++sent_calls;
+                    }
+                    if (zc) completed += ReapZeroCopy(s, &copied);
+                }
+            }
+            // The buffer may only be reused once every send has completed
+            Clock::time_point t0 = Clock::now();
+            while (zc && completed < sent_calls && SecondsSince(t0) < 5) {
+                for (int s : senders) completed += ReapZeroCopy(s, &copied);
+            }
+            double cpu_us = (ThreadCpuSeconds() - cpu0) * 1e6 / broadcasts;
+            Report(tag + (zc ? ".zerocopy_cpu" : ".copy_cpu"), cpu_us, "us/broadcast");
+            if (zc) Report(tag + ".copied", sent_calls ? 100.0 * copied / sent_calls : 0, "%");
+        }
+    }
+    for (int s : senders) ::close(s);
+    for (std::thread& t : drains) t.join();
+}
+
+// Mention/keyword matching per public message: the shared automaton
+// (watchlist.h) against testing every watched pattern in turn, with 1k and
+// 10k online users each watching "@name" and two ticket tags.
+void RunWatch() {
+    const int messages = 2000;
+    for (int users : {1000, 10000}) {
+        const std::string tag = "watch[" + std::to_string(users) + "]";
+        std::vector<UserId> ids;
+        std::vector<std::string> patterns;
+        std::string error;
+        for (int i = 0; i < users; ++i) {
+            UserId id = UserIds::Intern("watch_user" + std::to_string(i));
+            ids.push_back(id);
+            Watchlist::AddUser(id);
+            patterns.push_back("@watch_user" + std::to_string(i));
+            for (int k : {i, (i + users / 2) % users}) {
+                patterns.push_back("ticket-" + std::to_string(k));
+                Watchlist::Watch(id, patterns.back(), &error);
+            }
+        }
+        std::vector<std::string> texts;
+        for (int m = 0; m < messages; ++m) {
+            texts.push_back("hey @watch_user" + std::to_string(m * 7 % users) + " the fix for ticket-" +
+                            std::to_string(m * 13 % users) + " is done, can you take a look before the standup?");
+        }
+
+        size_t hits = 0;
+        Clock::time_point t0 = Clock::now();
+        for (const std::string& text : texts) hits += Watchlist::Match(text).size();
+        Report(tag + ".automaton", SecondsSince(t0) * 1e9 / messages, "ns/message");
+
+        // Case folding and word boundaries left out: the naive scan is
+        // slower than this even without them.
+        size_t naive_hits = 0;
+        t0 = Clock::now();
+        for (const std::string& text : texts) {
+            for (const std::string& p : patterns) naive_hits += text.find(p) != std::string::npos;
+        }
+        Report(tag + ".naive", SecondsSince(t0) * 1e9 / messages, "ns/message");
+        if (hits == 0 || naive_hits == 0) std::cerr << "watch: nothing matched\n";
+
+        for (UserId id : ids) Watchlist::RemoveUser(id);
+    }
+}
+
+// pattern against topic one level at a time, as a per-subscription check
+// would do it ("*" one level, final "#" the rest).
+bool TopicMatches(const std::string& pattern, const std::string& topic) {
+    size_t p = 0, t = 0;
+    for (;;) {
+        size_t pe = pattern.find('.', p);
+        std::string level = pattern.substr(p, pe == std::string::npos ? std::string::npos : pe - p);
+        if (level == "#") return true;
+        size_t te = topic.find('.', t);
+        if (level != "*" && level != topic.substr(t, te == std::string::npos ? std::string::npos : te - t)) {
+            return false;
+        }
+        if (te == std::string::npos) return pe == std::string::npos || pattern.compare(pe + 1, std::string::npos, "#") == 0;
+        if (pe == std::string::npos) return false;
+        p = pe + 1;
+        t = te + 1;
+    }
+}
+
+// Topic matching per published event with 100 and 1000 subscribed bots,
+// each following one sender exactly, the same sender in any room, and
+// presence.#: the shared trie (topics.h) against checking every
+// subscription in turn.
+void RunTopics() {
+    const int events = 20000;
+    for (int bots : {100, 1000}) {
+        const std::string tag = "topics[" + std::to_string(bots) + "]";
+        std::vector<UserId> ids;
+        std::vector<std::string> patterns;
+        std::string error;
+        for (int i = 0; i < bots; ++i) {
+            UserId id = UserIds::Intern("topic_bot" + std::to_string(i));
+            ids.push_back(id);
+            for (const std::string& p : {"room.main.msg.user" + std::to_string(i),
+                                         "room.*.msg.user" + std::to_string(i), std::string("presence.#")}) {
+                Topics::Subscribe(id, p, &error);
+                patterns.push_back(p);
+            }
+        }
+        std::vector<std::string> topics;
+        for (int e = 0; e < events; ++e) topics.push_back("room.main.msg.user" + std::to_string(e * 7 % bots));
+
+        size_t hits = 0;
+        Clock::time_point t0 = Clock::now();
+        for (const std::string& topic : topics) hits += Topics::Match(topic).size();
+        Report(tag + ".trie", SecondsSince(t0) * 1e9 / events, "ns/event");
+
+        size_t naive_hits = 0;
+        t0 = Clock::now();
+        for (const std::string& topic : topics) {
+            for (const std::string& p : patterns) naive_hits += TopicMatches(p, topic);
+        }
+        Report(tag + ".naive", SecondsSince(t0) * 1e9 / events, "ns/event");
+        if (hits != static_cast<size_t>(events) || naive_hits != 2 * static_cast<size_t>(events)) {
+            std::cerr << "topics: unexpected matches " << hits << "/" << naive_hits << "\n";
+        }
+
+        for (UserId id : ids) Topics::RemoveSubscriber(id);
+    }
+}
+
+// Registry under contention: reader threads resolve names to sockets (the
+// private-message path) while one thread keeps logging users out and back
+// in, taking the registry and connection table write locks.
+void RunRegistry() {
+    const int users = 1000;
+    const int churned = 64;         // the last users, owned by the churn thread
+    const int readers = 8;
+    const int lookups = 100000;     // per reader
+    NetSim::Reset();
+    NetSim::SetDefaultLink(NetSim::LinkParams{});
+    Socket listener = NetworkLayer::StartServer(kPort);
+    std::vector<SimClient> clients = AttachClients(listener, users);
+
+    std::atomic<bool> stop{false};
+    std::atomic<long long> churn_ops{0};
+    Clock::time_point t0 = Clock::now();
+    std::thread churn([&] {
+        for (long long i = 0; !stop.load(std::memory_order_relaxed); ++i) {
+            SimClient& c = clients[users - churned + i % churned];
+            UserManager::RemoveUser(c.name);
+            User u{};
+            u.id = c.server;
+            u.uid = UserIds::Find(c.name);
+            u.username = c.name;
+            u.connected = true;
+            u.joined_at = NowEpochMs();
+            UserManager::AddUser(u, c.server);
+            churn_ops.fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+    std::vector<std::thread> threads;
+    std::atomic<long long> misses{0};
+    for (int r = 0; r < readers; ++r) {
+        threads.emplace_back([&, r] {
+            for (int i = 0; i < lookups; ++i) {
+                const SimClient& c = clients[(i * 7 + r * 131) % (users - churned)];
+                if (UserManager::GetSocket(c.name) != c.server) misses.fetch_add(1);
+            }
+        });
+    }
+    for (std::thread& t : threads) t.join();
+    double total_s = SecondsSince(t0);
+    stop = true;
+    churn.join();
+
+    const std::string tag = "registry[" + std::to_string(readers) + "x" + std::to_string(users) + "]";
+    Report(tag + ".lookups", (double)readers * lookups / total_s, "ops/s");
+    Report(tag + ".churn", churn_ops.load() / total_s, "ops/s");
+    Report(tag + ".misses", (double)misses.load(), "lookups");
+    DetachClients(clients);
+    NetworkLayer::Close(listener);
+}
+
+// Warm start over a synthetic 100k-line log: log tail only, then from a
+// snapshot plus the lines written after it.
+void RunStartup() {
+    const std::string log = "chat_bench_startup.log.tmp";
+    const std::string snap = "chat_bench_startup.snap.tmp";
+    const int lines = 100000;
+    auto append = [&](int from, int to) {
+        FILE* f = std::fopen(log.c_str(), from == 0 ? "w" : "a");
+        if (!f) return false;
+        UserId actor = UserIds::Intern("startup_user");
+        for (int i = from; i < to; ++i) {
+            LogEntry e{};
+            e.timestamp = 1700000000000LL + i;
+            e.event_type = MessageType::PUBLIC_MESSAGE;
+            e.actor_id = actor;
+            e.target_id = kNoUser;
+            e.content = "startup line " + std::to_string(i) + std::string(40, 'x');
+            std::string text = LogFormat::FormatLine(e);
+            std::fprintf(f, "%s\n", text.c_str());
+        }
+        return std::fclose(f) == 0;
+    };
+    std::remove(snap.c_str());
+    if (!append(0, lines)) {
+        std::cerr << "startup: cannot write " << log << "\n";
+        return;
+    }
+    History::Configure(500);
+    Snapshot::WarmStartStats cold = Snapshot::WarmStart(snap, log);
+    Report("startup.log_tail", cold.elapsed_ms, "ms");
+
+    Snapshot::Write(snap);
+    append(lines, lines + 1000);
+    Snapshot::WarmStartStats warm = Snapshot::WarmStart(snap, log);
+    Report("startup.snapshot", warm.elapsed_ms, "ms");
+    Report("startup.snapshot_replayed", (double)warm.replayed_lines, "lines");
+    std::remove(log.c_str());
+    std::remove(snap.c_str());
+}
+
+// The fixed regression set; sizes never follow the command line.
+void RunRegression(const Options& opt) {
+    RunCodec();
+    RunRegistry();
+    Options fanout = opt;
+    fanout.latency_us = 0;
+    fanout.clients = 1000;
+    fanout.messages = 20;
+    RunFanout(fanout, 0);
+    fanout.clients = 10000;
+    fanout.messages = 10;
+    RunFanout(fanout, 0);
+    Options wal = opt;
+    wal.clients = 16;
+    wal.messages = 20;
+    RunWal(wal, true);
+    RunStartup();
+}
+
+void RunSuites(const Options& opt) {
+    bool all = opt.suite == "all";
+    if (all || opt.suite == "fanout") {
+        RunFanout(opt, 0);
+        if (opt.fanout_workers > 0) RunFanout(opt, opt.fanout_workers);
+    }
+    if (all || opt.suite == "slow") RunSlowConsumer(opt);
+    if (all || opt.suite == "storm") RunReconnectStorm(opt);
+    if (all || opt.suite == "wal") RunWal(opt);
+    if (all || opt.suite == "affinity") RunAffinity(opt);
+    if (all || opt.suite == "codec") RunCodec();
+    if (all || opt.suite == "registry") RunRegistry();
+    if (all || opt.suite == "startup") RunStartup();
+    if (all || opt.suite == "zerocopy") RunZeroCopy();
+    if (all || opt.suite == "watch") RunWatch();
+    if (all || opt.suite == "topics") RunTopics();
+    if (opt.suite == "regression") RunRegression(opt);
+}
+
+// One repetition in a fresh child process, so heap growth, threads and
+// interned names left by one run cannot skew the next (10k simulated
+// clients also would not fit in memory twice). The child's samples come
+// back over a pipe and are recorded here.
+bool RunIsolated(const Options& opt) {
+    int fds[2];
+    if (::pipe(fds) != 0) return false;
+    std::fflush(stdout);
+    pid_t pid = ::fork();
+    if (pid < 0) return false;
+    if (pid == 0) {
+        ::close(fds[0]);
+        g_sample_fd = fds[1];
+        RunSuites(opt);
+        std::fflush(stdout);
+        ::_exit(g_timed_out ? 1 : 0);     // skip destructors racing detached threads
+    }
+    ::close(fds[1]);
+    std::string data;
+    char buf[4096];
+    for (ssize_t n; (n = ::read(fds[0], buf, sizeof(buf))) != 0;) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        data.append(buf, static_cast<size_t>(n));
+    }
+    ::close(fds[0]);
+    int status = 0;
+    ::waitpid(pid, &status, 0);
+    size_t pos = 0;
+    for (size_t nl; (nl = data.find('\n', pos)) != std::string::npos; pos = nl + 1) {
+        std::string line = data.substr(pos, nl - pos);
+        size_t a = line.find('\t'), b = line.rfind('\t');
+        if (a == std::string::npos || a == b) continue;
+        BenchBaseline::Record(line.substr(0, a), std::atof(line.c_str() + a + 1), line.substr(b + 1));
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+bool ParseArgs(int argc, char** argv, Options* opt) {
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        auto value = [&](const char* key) -> const char* {
+            size_t n = std::char_traits<char>::length(key);
+            return a.compare(0, n, key) == 0 ? a.c_str() + n : nullptr;
+        };
+        if (const char* v = value("--suite=")) opt->suite = v;
+        else if (const char* v = value("--clients=")) opt->clients = std::atoi(v);
+        else if (const char* v = value("--messages=")) opt->messages = std::atoi(v);
+        else if (const char* v = value("--latency-us=")) opt->latency_us = std::atoll(v);
+        else if (const char* v = value("--fanout-workers=")) opt->fanout_workers = std::atoi(v);
+        else if (const char* v = value("--repeat=")) opt->repeat = std::atoi(v);
+        else if (const char* v = value("--json=")) opt->json = v;
+        else if (const char* v = value("--baseline=")) opt->baseline = v;
+        else if (const char* v = value("--tolerance=")) opt->tolerance = std::atof(v);
+        else if (const char* v = value("--cpus=")) {
+            if (!Affinity::ParseCpuList(v, &opt->cpus)) {
+                std::cerr << "bad cpu list: " << v << "\n";
+                return false;
+            }
+        }
+        else {
+            std::cerr << "unknown argument: " << a << "\n";
+            return false;
+        }
+    }
+    return opt->clients > 0 && opt->messages > 0 && opt->repeat > 0 && opt->tolerance >= 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options opt;
+    if (!ParseArgs(argc, argv, &opt)) {
+        std::cerr << "usage: chat_benchmarks [--suite=all|fanout|slow|storm|wal|affinity|codec|registry|startup|"
+                     "zerocopy|watch|topics|regression] [--clients=N] [--messages=N] [--latency-us=N] [--fanout-workers=N] [--cpus=LIST] "
+                     "[--repeat=N] [--json=PATH] [--baseline=PATH] [--tolerance=FRACTION]\n";
+        return 2;
+    }
+    LoggingService::Initialize("/dev/null");
+
+    if (opt.repeat == 1) {
+        RunSuites(opt);
+    } else {
+        for (int run = 0; run < opt.repeat; ++run) {
+            std::printf("# run %d/%d\n", run + 1, opt.repeat);
+            if (!RunIsolated(opt)) {
+                std::cerr << "run " << run + 1 << " failed\n";
+                return 1;
+            }
+        }
+    }
+
+    BenchBaseline::Results results = BenchBaseline::Summarize();
+    BenchBaseline::Info info;
+    info["build"] = CHATROOM_BUILD_TYPE;
+    info["cpus"] = std::to_string(std::thread::hardware_concurrency());
+    std::string error;
+    if (!opt.json.empty() && !BenchBaseline::WriteJson(opt.json, info, results, &error)) {
+        std::cerr << error << "\n";
+        return 1;
+    }
+    if (!opt.baseline.empty()) {
+        BenchBaseline::Results baseline;
+        BenchBaseline::Info baseline_info;
+        if (!BenchBaseline::ReadJson(opt.baseline, &baseline_info, &baseline, &error)) {
+            std::cerr << error << "\n";
+            return 1;
+        }
+        for (const auto& kv : info) {
+            auto it = baseline_info.find(kv.first);
+            if (it == baseline_info.end() || it->second != kv.second) {
+                std::printf("warning: baseline %s is '%s', this run '%s'\n", kv.first.c_str(),
+                            it == baseline_info.end() ? "" : it->second.c_str(), kv.second.c_str());
+            }
+        }
+        std::printf("\n%-40s %12s %12s\n", "metric", "baseline", "current");
+        int regressions = BenchBaseline::Compare(baseline, results, opt.tolerance, std::cout);
+        std::cout << regressions << " regression(s) against " << opt.baseline << std::endl;
+        if (regressions > 0) return 1;
+    }
+    return g_timed_out ? 1 : 0;
+}
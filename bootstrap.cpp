@@ -0,0 +1,178 @@
+#include "bootstrap.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include "metrics.h"
+
+namespace Bootstrap {
+
+namespace {
+std::mutex g_print_mu;
+} // namespace
+
+void PrintLine(std::ostream& out, const std::string& text) {
+    std::lock_guard<std::mutex> lock(g_print_mu);
+    out << text << '\n' << std::flush;
+}
+
+Plan::~Plan() {
+    WaitDeferred();
+}
+
+void Plan::Add(const std::string& name, std::vector<std::string> deps, std::function<bool()> fn) {
+    AddPhase(name, std::move(deps), std::move(fn), false);
+}
+
+void Plan::AddDeferred(const std::string& name, std::vector<std::string> deps, std::function<bool()> fn) {
+    AddPhase(name, std::move(deps), std::move(fn), true);
+}
+
+void Plan::AddPhase(const std::string& name, std::vector<std::string> deps, std::function<bool()> fn,
+                    bool deferred) {
+    Phase phase;
+    phase.fn = std::move(fn);
+    phase.timing.name = name;
+    phase.timing.deferred = deferred;
+    for (const std::string& dep : deps) {
+        size_t i = 0;
+        while (i < phases_.size() && phases_[i].timing.name != dep) ++i;
+        if (i == phases_.size()) throw std::logic_error("bootstrap phase " + name + ": unknown dependency " + dep);
+        if (phases_[i].timing.deferred && !deferred) {
+            throw std::logic_error("bootstrap phase " + name + " cannot wait for deferred " + dep);
+        }
+        phase.deps.push_back(i);
+    }
+    phases_.push_back(std::move(phase));
+}
+
+bool Plan::RunCritical(std::string* failed) {
+    return Run(false, failed);
+}
+
+void Plan::StartDeferred() {
+    deferred_ = std::thread([this] {
+        std::string failed;
+        if (!Run(true, &failed)) PrintLine(std::cerr, "Bootstrap: deferred phase failed: " + failed);
+    });
+}
+
+void Plan::WaitDeferred() {
+    if (deferred_.joinable()) deferred_.join();
+}
+
+// Schedules on the calling thread; every runnable phase gets its own thread.
+bool Plan::Run(bool deferred, std::string* failed) {
+    std::vector<std::thread> threads;
+    std::unique_lock<std::mutex> lock(mu_);
+    size_t running = 0;
+    std::string first_failure;
+    for (;;) {
+        bool pending = false;
+        for (size_t i = 0; i < phases_.size(); ++i) {
+            Phase& p = phases_[i];
+            if (p.timing.deferred != deferred || p.status != Status::kPending) continue;
+            bool ready = true, blocked = false;
+            for (size_t d : p.deps) {
+                Status s = phases_[d].status;
+                blocked = blocked || s == Status::kFailed;
+                ready = ready && s == Status::kDone;
+            }
+            if (blocked) {
+                p.status = Status::kFailed;
+                if (first_failure.empty()) first_failure = p.timing.name + ": dependency failed";
+                continue;
+            }
+            if (!ready) {
+                pending = true;
+                continue;
+            }
+            p.status = Status::kRunning;
+            ++running;
+            threads.emplace_back([this, i, &running, &first_failure] {
+                Phase& p = phases_[i];
+                auto start = std::chrono::steady_clock::now();
+                bool ok = false;
+                std::string error;
+                try {
+                    ok = p.fn();
+                } catch (const std::exception& e) {
+                    error = e.what();
+                }
+                auto end = std::chrono::steady_clock::now();
+                std::lock_guard<std::mutex> done(mu_);
+                p.timing.ok = ok;
+                p.timing.start_ms = std::chrono::duration<double, std::milli>(start - t0_).count();
+                p.timing.elapsed_ms = std::chrono::duration<double, std::milli>(end - start).count();
+                p.status = ok ? Status::kDone : Status::kFailed;
+                if (!ok && first_failure.empty()) first_failure = p.timing.name + (error.empty() ? "" : ": " + error);
+                Metrics::Counter("bootstrap." + p.timing.name + ".us")
+                    .store(static_cast<int64_t>(p.timing.elapsed_ms * 1000), std::memory_order_relaxed);
+                --running;
+                cv_.notify_all();
+            });
+        }
+        if (running == 0 && !pending) break;
+        cv_.wait(lock);
+    }
+    lock.unlock();
+    for (std::thread& t : threads) t.join();
+
+    for (const Phase& p : phases_) {
+        if (p.timing.deferred != deferred) continue;
+        std::ostringstream line;
+        line << "Bootstrap: " << p.timing.name << (deferred ? " (deferred)" : "") << " "
+             << (p.status == Status::kDone ? "" : "FAILED ") << p.timing.elapsed_ms << " ms at +"
+             << p.timing.start_ms << " ms";
+        PrintLine(std::cout, line.str());
+    }
+    if (!first_failure.empty()) *failed = first_failure;
+    return first_failure.empty();
+}
+
+std::vector<Timing> Plan::Timings() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    std::vector<Timing> out;
+    for (const Phase& p : phases_) out.push_back(p.timing);
+    return out;
+}
+
+bool NotifyReady(const std::string& status, int ready_fd) {
+    bool ok = true;
+    std::string msg = "READY=1\nSTATUS=" + status + "\nMAINPID=" + std::to_string(::getpid()) + "\n";
+
+    // sd_notify(3) protocol: one datagram to the socket named in the
+    // environment; a leading '@' means the abstract namespace.
+    if (const char* path = std::getenv("NOTIFY_SOCKET")) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        size_t len = std::strlen(path);
+        int fd = ::socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 || len == 0 || len >= sizeof(addr.sun_path) || (path[0] != '/' && path[0] != '@')) {
+            ok = false;
+        } else {
+            std::memcpy(addr.sun_path, path, len);
+            if (path[0] == '@') addr.sun_path[0] = '\0';
+            socklen_t alen = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + len);
+            ok = ::sendto(fd, msg.data(), msg.size(), MSG_NOSIGNAL, reinterpret_cast<sockaddr*>(&addr), alen) ==
+                 static_cast<ssize_t>(msg.size());
+        }
+        if (fd >= 0) ::close(fd);
+    }
+
+    // --ready-fd: the same text, then close so a reader sees EOF.
+    if (ready_fd >= 0) {
+        ok = ::write(ready_fd, msg.data(), msg.size()) == static_cast<ssize_t>(msg.size()) && ok;
+        ::close(ready_fd);
+    }
+    return ok;
+}
+
+} // namespace Bootstrap
@@ -0,0 +1,95 @@
+#ifndef BOOTSTRAP_H_
+#define BOOTSTRAP_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <iosfwd>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Server start-up as a graph of named phases.
+//
+// Each phase lists the phases it needs; RunCritical() starts every phase on
+// its own thread as soon as its dependencies have finished, so independent
+// subsystems (warm start, worker pools, socket options...) initialise in
+// parallel. Deferred phases are for work a client does not need before the
+// listener is up (snapshot writer, metrics, welcome announcement);
+// StartDeferred() runs them the same way in the background once the caller
+// is serving. A deferred phase may depend on critical ones, not the reverse.
+//
+// Every phase's start offset and duration are kept for Timings(), logged as
+// "Bootstrap: ..." lines and exported as bootstrap.<phase>.us counters. A
+// failing phase (fn returns false) fails every phase that depends on it.
+//
+// NotifyReady() tells an orchestrator the server accepts connections: an
+// sd_notify-style "READY=1" datagram to $NOTIFY_SOCKET and/or a line on an
+// inherited --ready-fd.
+
+namespace Bootstrap {
+
+struct Timing {
+    std::string name;
+    bool deferred = false;
+    bool ok = false;
+    double start_ms = 0;            ///< since the plan started
+    double elapsed_ms = 0;
+};
+
+class Plan {
+public:
+    Plan() = default;
+    ~Plan();                        // waits for deferred phases
+
+    Plan(const Plan&) = delete;
+    Plan& operator=(const Plan&) = delete;
+
+    // deps must name phases added earlier.
+    void Add(const std::string& name, std::vector<std::string> deps, std::function<bool()> fn);
+    void AddDeferred(const std::string& name, std::vector<std::string> deps, std::function<bool()> fn);
+
+    // Run all critical phases; false with *failed set to the first failed
+    // phase.
+    bool RunCritical(std::string* failed);
+
+    // Run deferred phases on a background thread; returns immediately.
+    void StartDeferred();
+
+    // Block until the deferred phases have finished.
+    void WaitDeferred();
+
+    std::vector<Timing> Timings() const;
+
+private:
+    enum class Status { kPending, kRunning, kDone, kFailed };
+
+    struct Phase {
+        std::vector<size_t> deps;
+        std::function<bool()> fn;
+        Status status = Status::kPending;
+        Timing timing;
+    };
+
+    void AddPhase(const std::string& name, std::vector<std::string> deps, std::function<bool()> fn, bool deferred);
+    bool Run(bool deferred, std::string* failed);
+
+    std::vector<Phase> phases_;
+    std::chrono::steady_clock::time_point t0_ = std::chrono::steady_clock::now();
+    mutable std::mutex mu_;
+    std::condition_variable cv_;
+    std::thread deferred_;
+};
+
+// Write text plus a newline to out as one unit. Phases run on parallel
+// threads; lines printed through here never interleave with each other.
+void PrintLine(std::ostream& out, const std::string& text);
+
+// Report readiness to whoever supervises the process. ready_fd < 0: only
+// $NOTIFY_SOCKET (if set). Returns false if a requested channel failed.
+bool NotifyReady(const std::string& status, int ready_fd);
+
+} // namespace Bootstrap
+
+#endif // BOOTSTRAP_H_
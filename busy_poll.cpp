@@ -0,0 +1,61 @@
+#include "busy_poll.h"
+
+#include <sys/socket.h>
+
+#include "metrics.h"
+
+namespace BusyPoll {
+
+std::atomic<bool> g_enabled{false};
+
+namespace {
+
+Options g_options;
+
+std::atomic<int64_t>& SpinHits() {
+    static std::atomic<int64_t>& c = Metrics::Counter("busy_poll.spin_hits");
+    return c;
+}
+
+std::atomic<int64_t>& Parks() {
+    static std::atomic<int64_t>& c = Metrics::Counter("busy_poll.parks");
+    return c;
+}
+
+std::atomic<int64_t>& SockoptFailures() {
+    static std::atomic<int64_t>& c = Metrics::Counter("busy_poll.sockopt_failures");
+    return c;
+}
+
+} // namespace
+
+void Configure(const Options& options) {
+    g_options = options;
+    g_enabled.store(options.enabled, std::memory_order_relaxed);
+}
+
+const Options& Get() {
+    return g_options;
+}
+
+void ApplySocket(Socket sock) {
+    if (!Enabled() || g_options.so_busy_poll_us <= 0) return;
+#ifdef SO_BUSY_POLL
+    int us = g_options.so_busy_poll_us;
+    if (::setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &us, sizeof(us)) != 0) {
+        SockoptFailures().fetch_add(1, std::memory_order_relaxed);
+    }
+#else
+    (void)sock;
+#endif
+}
+
+void CountSpinHit() {
+    SpinHits().fetch_add(1, std::memory_order_relaxed);
+}
+
+void CountPark() {
+    Parks().fetch_add(1, std::memory_order_relaxed);
+}
+
+} // namespace BusyPoll
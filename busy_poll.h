@@ -0,0 +1,71 @@
+#ifndef BUSY_POLL_H_
+#define BUSY_POLL_H_
+
+#include <atomic>
+#include <chrono>
+
+#include "common.h"
+
+// Spin-then-park policy for latency-critical deployments.
+//
+// With the mode on, a thread that would block waiting for work first spins
+// for up to spin_us re-checking for it, and only then parks (blocking recv,
+// eventfd read). Session readers (network.cpp) and mailbox writers
+// (outbound.cpp) use it, so a message arriving within the window is handled
+// without a sleep/wake-up round trip. Accepted sockets also get
+// SO_BUSY_POLL, letting the kernel poll the device queue on recv where the
+// driver supports it.
+//
+// Costs a core per thread while spinning; meant for dedicated hosts with few,
+// busy connections. Off by default.
+
+namespace BusyPoll {
+
+struct Options {
+    bool enabled = false;
+    int spin_us = 50;               ///< spin window before parking
+    int so_busy_poll_us = 50;       ///< SO_BUSY_POLL on accepted sockets, 0 = leave unset
+};
+
+extern std::atomic<bool> g_enabled;
+
+void Configure(const Options& options);
+const Options& Get();
+
+inline bool Enabled() {
+    return g_enabled.load(std::memory_order_relaxed);
+}
+
+inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// Spin until ready() holds or the window closes; returns the last ready().
+template <class Ready>
+bool SpinUntil(Ready ready) {
+    if (ready()) return true;
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(Get().spin_us);
+    for (;;) {
+        for (int i = 0; i < 8; ++i) {
+            CpuRelax();
+            if (ready()) return true;
+        }
+        if (std::chrono::steady_clock::now() >= deadline) return ready();
+    }
+}
+
+// Apply SO_BUSY_POLL to sock when enabled. Failures (EPERM without
+// CAP_NET_ADMIN above net.core.busy_read) are counted, not fatal.
+void ApplySocket(Socket sock);
+
+// Outcome counters for the spin phase.
+void CountSpinHit();
+void CountPark();
+
+} // namespace BusyPoll
+
+#endif // BUSY_POLL_H_
@@ -8,10 +8,22 @@
 #include <csignal>
 #include <optional>
 #include <cstdlib>
+#include <cstdint>
+#include <cstdio>
+#include <condition_variable>
+#include <fstream>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <sys/stat.h>
 
 #include "common.h"
 #include "network.h"
 #include "console.h"
+#include "presence.h"
 
 
 namespace ClientCLI {
@@ -21,6 +33,236 @@ void InputLoop(Socket sock);
 void ReceiveLoop(Socket sock);
 void RunClient(const std::string &server_host, int server_port);
 
+// ========== Sending ==========
+// The input loop, the receive loop (file acks) and an upload thread all
+// write to the socket; one frame at a time.
+static std::mutex g_send_mutex;
+
+static bool Send(Socket sock, const Message &msg) {
+    std::lock_guard<std::mutex> lock(g_send_mutex);
+    return NetworkLayer::SendMessage(sock, msg);
+}
+
+static Message MakeMessage(MessageType type, const std::string &content, const std::string &target = "") {
+    Message msg;
+    msg.type = type;
+    msg.timestamp = NowEpochMs();
+    msg.sender_username = "";
+    msg.target_username = target;
+    msg.content = content;
+    return msg;
+}
+
+// ========== File transfer ==========
+// One upload at a time; downloads are written by the receive loop.
+namespace Files {
+
+struct Download {
+    std::string path;
+    std::ofstream out;
+    uint64_t size = 0;
+    uint64_t received = 0;
+};
+
+static std::mutex g_mutex;
+static std::condition_variable g_cv;
+static std::string g_upload_path;          // non-empty while an upload runs
+static uint64_t g_upload_id = 0;
+static uint64_t g_upload_acked = 0;
+static bool g_upload_failed = false;
+static std::multimap<uint64_t, std::string> g_wanted;   // id -> save paths, in request order
+static std::map<uint64_t, Download> g_downloads;        // by transfer id; receive loop only
+
+static void Offer(Socket sock, const std::string &path) {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        Console::Print("Cannot share " + path);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        if (!g_upload_path.empty()) {
+            Console::Print("An upload is already running.");
+            return;
+        }
+        g_upload_path = path;
+        g_upload_id = 0;
+        g_upload_acked = 0;
+        g_upload_failed = false;
+    }
+    size_t slash = path.find_last_of('/');
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+    Send(sock, MakeMessage(MessageType::FILE_OFFER, std::to_string(st.st_size) + " " + name));
+}
+
+// Upload thread: chunks of at most `chunk` bytes, never more than `window`
+// bytes ahead of the server's FILE_ACK.
+static void Upload(Socket sock, uint64_t id, size_t chunk, size_t window) {
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        path = g_upload_path;
+    }
+    window = std::max(window, chunk);
+    std::ifstream in(path, std::ios::binary);
+    std::vector<char> buf(chunk);
+    uint64_t sent = 0;
+    bool ok = static_cast<bool>(in);
+    while (ok) {
+        in.read(buf.data(), static_cast<std::streamsize>(buf.size()));
+        size_t n = static_cast<size_t>(in.gcount());
+        if (n == 0) break;
+        {
+            std::unique_lock<std::mutex> lock(g_mutex);
+            g_cv.wait(lock, [&] { return g_upload_failed || sent - g_upload_acked + n <= window; });
+            ok = !g_upload_failed;
+        }
+        if (ok) ok = Send(sock, MakeMessage(MessageType::FILE_CHUNK, std::string(buf.data(), n), std::to_string(id)));
+        sent += n;
+    }
+    std::unique_lock<std::mutex> lock(g_mutex);
+    // A chunk that never left will never be acknowledged.
+    if (!ok) g_upload_failed = true;
+    g_cv.wait(lock, [&] { return g_upload_failed || g_upload_acked >= sent; });
+    Console::Print(g_upload_failed || !ok ? "Upload of " + path + " failed."
+                                          : "Uploaded " + path + " as file " + std::to_string(id) + ".");
+    g_upload_path.clear();
+}
+
+static void Want(Socket sock, const std::string &args) {
+    size_t space = args.find(' ');
+    std::string id = args.substr(0, space);
+    char *end = nullptr;
+    uint64_t n = std::strtoull(id.c_str(), &end, 10);
+    if (id.empty() || *end != '\0') {
+        Console::Print("usage: /getfile ID [PATH]");
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        g_wanted.emplace(n, space == std::string::npos ? "" : args.substr(space + 1));
+    }
+    Send(sock, MakeMessage(MessageType::FILE_GET, id));
+}
+
+// COMMAND_RESPONSE lines of the file protocol; false if msg is not one.
+static bool OnResponse(Socket sock, const std::string &text) {
+    if (text.rfind("FILE_READY ", 0) == 0) {
+        unsigned long long id = 0, chunk = 0, window = 0;
+        if (std::sscanf(text.c_str() + 11, "%llu %llu %llu", &id, &chunk, &window) == 3 && chunk > 0) {
+            {
+                std::lock_guard<std::mutex> lock(g_mutex);
+                g_upload_id = id;
+            }
+            std::thread(Upload, sock, id, static_cast<size_t>(chunk), static_cast<size_t>(window)).detach();
+        }
+    } else if (text.rfind("FILE_REJECTED busy ", 0) == 0) {
+        // A download refused: this session already runs the most it may.
+        unsigned long long id = std::strtoull(text.c_str() + 19, nullptr, 10);
+        Console::Print("[FILE] too many downloads running, try file " + std::to_string(id) + " again later");
+        std::lock_guard<std::mutex> lock(g_mutex);
+        auto it = g_wanted.lower_bound(id);
+        if (it != g_wanted.end() && it->first == id) g_wanted.erase(it);
+    } else if (text.rfind("FILE_REJECTED", 0) == 0) {
+        Console::Print("[FILE] rejected:" + text.substr(13));
+        std::lock_guard<std::mutex> lock(g_mutex);
+        if (g_upload_id == 0) {
+            g_upload_path.clear();   // the offer itself was refused
+        } else {
+            g_upload_failed = true;
+            g_cv.notify_all();
+        }
+    } else if (text.rfind("FILE_START ", 0) == 0) {
+        unsigned long long id = 0, transfer = 0, size = 0;
+        int name_at = 0;
+        if (std::sscanf(text.c_str() + 11, "%llu %llu %llu %n", &id, &transfer, &size, &name_at) < 3) return true;
+        std::string path;
+        {
+            std::lock_guard<std::mutex> lock(g_mutex);
+            // FILE_START replies come in request order.
+            auto it = g_wanted.lower_bound(id);
+            if (it == g_wanted.end() || it->first != id) return true;
+            path = it->second;
+            g_wanted.erase(it);
+        }
+        if (path.empty()) path = std::to_string(id) + "-" + std::string(text.c_str() + 11 + name_at);
+        for (const auto &running : g_downloads) {
+            if (running.second.path == path) path += "." + std::to_string(transfer);
+        }
+        Download &d = g_downloads[transfer];
+        d.path = path;
+        d.size = size;
+        d.out.open(path, std::ios::binary | std::ios::trunc);
+        if (!d.out) Console::Print("Cannot write " + path);
+        Console::Print("Downloading file " + std::to_string(id) + " to " + path + "...");
+    } else if (text.rfind("FILE_NOT_FOUND", 0) == 0) {
+        Console::Print("[FILE] no such file:" + text.substr(14));
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static void OnAck(const std::string &text) {
+    unsigned long long id = 0, bytes = 0;
+    if (std::sscanf(text.c_str(), "%llu %llu", &id, &bytes) != 2) return;
+    std::lock_guard<std::mutex> lock(g_mutex);
+    if (id == g_upload_id && bytes > g_upload_acked) g_upload_acked = bytes;
+    g_cv.notify_all();
+}
+
+static void OnData(Socket sock, const Message &msg) {
+    uint64_t transfer = std::strtoull(msg.target_username.c_str(), nullptr, 10);
+    auto it = g_downloads.find(transfer);
+    if (it == g_downloads.end()) return;
+    Download &d = it->second;
+    d.out.write(msg.content.data(), static_cast<std::streamsize>(msg.content.size()));
+    d.received += msg.content.size();
+    // Acknowledge what is stored so the server sends the next chunks.
+    Send(sock, MakeMessage(MessageType::FILE_ACK, std::to_string(transfer) + " " + std::to_string(d.received)));
+    if (d.received < d.size) return;
+    d.out.close();
+    Console::Print(d.out ? "Saved " + d.path + " (" + std::to_string(d.size) + " bytes)." : "Writing " + d.path + " failed.");
+    g_downloads.erase(it);
+}
+
+} // namespace Files
+
+// ========== Server-side lists ==========
+// "/add ARG", "/remove ARG" and "/list" edit a per-session list on the server
+// as "+ARG", "-ARG" or "" (keyword watches, topic subscriptions).
+static bool ListEdit(const std::string &line, const std::string &add, const std::string &remove,
+                     const std::string &list, std::string *content) {
+    if (line == list) {
+        *content = "";
+    } else if (line.rfind(add, 0) == 0) {
+        *content = "+" + line.substr(add.size());
+    } else if (line.rfind(remove, 0) == 0) {
+        *content = "-" + line.substr(remove.size());
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// COMMAND_RESPONSE replies printed with a label; false if text is none.
+static bool PrintLabeledReply(const std::string &text) {
+    static const std::pair<std::string, std::string> kReplies[] = {
+        {"ADMIN ", "[ADMIN] "},
+        {"WATCHING ", "Watching: "},
+        {"WATCH_REJECTED ", "Watch rejected: "},
+        {"SUBSCRIBED ", "Topics: "},
+        {"SUBSCRIBE_REJECTED ", "Subscribe rejected: "},
+    };
+    for (const auto &reply : kReplies) {
+        if (text.rfind(reply.first, 0) == 0) {
+            Console::Print(reply.second + text.substr(reply.first.size()));
+            return true;
+        }
+    }
+    return false;
+}
+
 // ========== InputLoop ==========
 void InputLoop(Socket sock) {
     while (true) {
@@ -37,13 +279,39 @@ void InputLoop(Socket sock) {
         if (line == "/bye") {
             msg.type = MessageType::COMMAND_RESPONSE;
             msg.content = "BYE";
-            NetworkLayer::SendMessage(sock, msg);
+            Send(sock, msg);
             NetworkLayer::Close(sock);
             break;
         } else if (line == "/list") {
             msg.type = MessageType::USER_LIST_REQUEST;
             msg.content = "";
-            NetworkLayer::SendMessage(sock, msg);
+            Send(sock, msg);
+        } else if (line == "/history" || line.rfind("/history ", 0) == 0) {
+            msg.type = MessageType::HISTORY_REQUEST;
+            msg.content = line.size() > 9 ? line.substr(9) : "";
+            Send(sock, msg);
+        } else if (line == "/typing" || line.rfind("/status ", 0) == 0) {
+            // presence: "/typing", or "/status online|away|busy"
+            msg.type = MessageType::PRESENCE_UPDATE;
+            msg.content = line == "/typing" ? "typing" : line.substr(8);
+            Send(sock, msg);
+        } else if (line.rfind("/sendfile ", 0) == 0) {
+            Files::Offer(sock, line.substr(10));
+        } else if (line.rfind("/getfile ", 0) == 0) {
+            Files::Want(sock, line.substr(9));
+        } else if (ListEdit(line, "/watch ", "/unwatch ", "/watching", &msg.content)) {
+            msg.type = MessageType::WATCH_UPDATE;
+            Send(sock, msg);
+        } else if (ListEdit(line, "/subscribe ", "/unsubscribe ", "/topics", &msg.content)) {
+            msg.type = MessageType::TOPIC_SUBSCRIBE;
+            Send(sock, msg);
+        } else if (line.rfind("/admin ", 0) == 0) {
+            // operator command, e.g. "/admin PROFILE 30"; token from $CHAT_ADMIN_TOKEN
+            const char* token = std::getenv("CHAT_ADMIN_TOKEN");
+            msg.type = MessageType::ADMIN_REQUEST;
+            msg.target_username = token ? token : "";
+            msg.content = line.substr(7);
+            Send(sock, msg);
         } else if (!line.empty() && line[0] == '@') {
             // private message: format "@user message..."
             size_t spacePos = line.find(' ');
@@ -53,12 +321,12 @@ void InputLoop(Socket sock) {
                 msg.type = MessageType::PRIVATE_MESSAGE;
                 msg.target_username = target;
                 msg.content = content;
-                NetworkLayer::SendMessage(sock, msg);
+                Send(sock, msg);
             }
         } else {
             msg.type = MessageType::PUBLIC_MESSAGE;
             msg.content = line;
-            NetworkLayer::SendMessage(sock, msg);
+            Send(sock, msg);
         }
     }
 }
@@ -83,6 +351,36 @@ void ReceiveLoop(Socket sock) {
         }
 
         switch (msg.type) {
+            case MessageType::COMMAND_RESPONSE:
+                if (!PrintLabeledReply(msg.content)) Files::OnResponse(sock, msg.content);
+                break;
+            case MessageType::FILE_ACK:
+                Files::OnAck(msg.content);
+                break;
+            case MessageType::FILE_DATA:
+                Files::OnData(sock, msg);
+                break;
+            case MessageType::FILE_AVAILABLE: {
+                // "ID SIZE NAME"
+                size_t a = msg.content.find(' ');
+                size_t b = a == std::string::npos ? a : msg.content.find(' ', a + 1);
+                if (b != std::string::npos) {
+                    Console::Print("[FILE] " + msg.sender_username + " shared " + msg.content.substr(b + 1) + " (" +
+                                   msg.content.substr(a + 1, b - a - 1) + " bytes): /getfile " +
+                                   msg.content.substr(0, a));
+                }
+                break;
+            }
+            case MessageType::WATCH_NOTIFY: {
+                // "@alice,deploy": the message itself arrived as a PUBLIC_MESSAGE
+                bool mentioned = msg.content.find('@') == 0 || msg.content.find(",@") != std::string::npos;
+                Console::Print("[!] " + msg.sender_username +
+                               (mentioned ? " mentioned you" : " matched your watch: " + msg.content));
+                break;
+            }
+            case MessageType::TOPIC_EVENT:
+                Console::Print("[" + msg.target_username + "] " + msg.sender_username + ": " + msg.content);
+                break;
             case MessageType::USER_LIST_RESPONSE:
                 Console::Print("Online: " + msg.content);
                 break;
@@ -101,6 +399,23 @@ void ReceiveLoop(Socket sock) {
             case MessageType::USER_LEFT:
                 Console::Print("* " + msg.sender_username + " left the chat *");
                 break;
+            case MessageType::PRESENCE_DELTA:
+                // "alice=t,bob=a": one line per user
+                for (size_t pos = 0; pos < msg.content.size();) {
+                    size_t comma = msg.content.find(',', pos);
+                    if (comma == std::string::npos) comma = msg.content.size();
+                    std::string item = msg.content.substr(pos, comma - pos);
+                    size_t eq = item.find('=');
+                    Presence::Status status;
+                    if (eq != std::string::npos && eq + 1 < item.size() && Presence::FromCode(item[eq + 1], &status)) {
+                        Console::Print("* " + item.substr(0, eq) +
+                                       (status == Presence::Status::kTyping
+                                            ? " is typing..."
+                                            : " is " + std::string(Presence::Name(status))) + " *");
+                    }
+                    pos = comma + 1;
+                }
+                break;
             default:
                 // ignore other message types
                 break;
@@ -144,6 +459,8 @@ void RunClient(const std::string &server_host, int server_port) {
             break;
         } else if (msg.type == MessageType::COMMAND_RESPONSE && msg.content == "USERNAME_TAKEN") {
             Console::Print("Username already taken, try another:");
+        } else if (msg.type == MessageType::COMMAND_RESPONSE && msg.content == "USERNAME_INVALID") {
+            Console::Print("Usernames must be non-empty, not \"Server\", and may not contain ',' or '=', try another:");
         }
     }
 
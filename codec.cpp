@@ -0,0 +1,117 @@
+#include "network.h"
+
+#include <arpa/inet.h>
+
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+// Wire codec shared by the socket implementation (network.cpp) and the
+// in-process simulator (netsim.cpp).
+
+namespace NetworkLayer {
+
+// ------------------ Serialization ------------------
+
+static void SerializeInto(const Message &msg, std::vector<char> &buffer) {
+    auto write_int32 = [&](int32_t v) {
+        int32_t netv = htonl(v);
+        const char *p = reinterpret_cast<const char *>(&netv);
+        buffer.insert(buffer.end(), p, p + sizeof(netv));
+    };
+    auto write_int64 = [&](int64_t v) {
+        // convert to network order manually (big-endian)
+        uint64_t uv = static_cast<uint64_t>(v);
+        for (int i = 7; i >= 0; --i) {
+            buffer.push_back(static_cast<char>((uv >> (i * 8)) & 0xFF));
+        }
+    };
+    auto write_string = [&](const std::string &s) {
+        write_int32(static_cast<int32_t>(s.size()));
+        buffer.insert(buffer.end(), s.begin(), s.end());
+    };
+
+    write_int32(static_cast<int32_t>(msg.type));
+    write_int64(msg.timestamp);
+    write_string(msg.sender_username);
+    write_string(msg.target_username);
+    write_string(msg.content);
+}
+
+std::vector<char> Serialize(const Message &msg) {
+    std::vector<char> buffer;
+    SerializeInto(msg, buffer);
+    return buffer;
+}
+
+Frame EncodeFrame(const Message &msg) {
+    auto frame = std::make_shared<std::vector<char>>();
+    frame->reserve(4 + 4 + 8 + 12 + msg.sender_username.size() +
+                   msg.target_username.size() + msg.content.size());
+    frame->resize(4);
+    SerializeInto(msg, *frame);
+    int32_t net_len = htonl(static_cast<int32_t>(frame->size() - 4));
+    std::memcpy(frame->data(), &net_len, sizeof(net_len));
+    return frame;
+}
+
+Frame EncodeFrameHeader(const Message &msg, size_t content_bytes) {
+    Message head;
+    head.type = msg.type;
+    head.timestamp = msg.timestamp;
+    head.sender_username = msg.sender_username;
+    head.target_username = msg.target_username;
+    auto frame = std::make_shared<std::vector<char>>();
+    frame->resize(4);
+    SerializeInto(head, *frame);
+    // The content length is the last field written; it precedes the bytes.
+    int32_t net_content = htonl(static_cast<int32_t>(content_bytes));
+    std::memcpy(frame->data() + frame->size() - 4, &net_content, sizeof(net_content));
+    int32_t net_len = htonl(static_cast<int32_t>(frame->size() - 4 + content_bytes));
+    std::memcpy(frame->data(), &net_len, sizeof(net_len));
+    return frame;
+}
+
+Message Deserialize(const std::vector<char> &data) {
+    size_t pos = 0;
+    auto read_int32 = [&](int32_t &out) {
+        if (pos + 4 > data.size()) throw std::runtime_error("Deserialize: truncated int32");
+        int32_t netv;
+        std::memcpy(&netv, &data[pos], 4);
+        pos += 4;
+        out = ntohl(netv);
+    };
+
+    // [修正] 将参数类型从 int64_t& 改为 long long&
+    auto read_int64 = [&](long long &out) {
+        if (pos + 8 > data.size()) throw std::runtime_error("Deserialize: truncated int64");
+        uint64_t uv = 0;
+        for (int i = 0; i < 8; ++i) {
+            uv = (uv << 8) | (static_cast<unsigned char>(data[pos + i]));
+        }
+        pos += 8;
+        out = static_cast<long long>(uv);
+    };
+
+    auto read_string = [&](std::string &out) {
+        int32_t len;
+        read_int32(len);
+        if (len < 0 || pos + static_cast<size_t>(len) > data.size())
+            throw std::runtime_error("Deserialize: invalid string length");
+        out.assign(&data[pos], &data[pos + len]);
+        pos += len;
+    };
+
+    Message msg;
+    int32_t type_i32;
+    read_int32(type_i32);
+    msg.type = static_cast<MessageType>(type_i32);
+    read_int64(msg.timestamp); // 现在类型完全匹配了
+    read_string(msg.sender_username);
+    read_string(msg.target_username);
+    read_string(msg.content);
+
+    return msg;
+}
+
+} // namespace NetworkLayer
@@ -24,8 +24,15 @@
  */
 using Socket = int;
 
+/**
+ * @brief Interned username id (see user_ids.h); 0 means "no user".
+ */
+using UserId = uint32_t;
+constexpr UserId kNoUser = 0;
+
 struct User {
     int id;                     ///< Unique identifier (e.g., socket descriptor)
+    UserId uid;                 ///< Interned id of username
     std::string username;       ///< Unique username
     bool connected;             ///< Connection status (true if online)
     long long joined_at;        ///< Time the user joined (epoch timestamp)
@@ -42,7 +49,21 @@ enum class MessageType {
     USER_LEFT,                  ///< Notification when a user exits the chat
     USER_LIST_REQUEST,          ///< Client command to request online users
     USER_LIST_RESPONSE,         ///< Server response with current user list
-    COMMAND_RESPONSE            ///< Generic response to commands (acknowledge, error, etc.)
+    COMMAND_RESPONSE,           ///< Generic response to commands (acknowledge, error, etc.)
+    HISTORY_REQUEST,            ///< Client asks for recent room history; content is an optional count
+    PRESENCE_UPDATE,            ///< Client status change; content is "online", "typing", "away" or "busy"
+    PRESENCE_DELTA,             ///< Coalesced status changes, "alice=t,bob=a" (see presence.h)
+    FILE_OFFER,                 ///< Client starts an upload; content is "SIZE NAME" (see file_transfer.h)
+    FILE_CHUNK,                 ///< Upload data; target_username is the transfer id, content the bytes
+    FILE_ACK,                   ///< "TRANSFER BYTES" received so far (server->uploader, downloader->server)
+    FILE_AVAILABLE,             ///< Broadcast once an upload is complete; content is "ID SIZE NAME"
+    FILE_GET,                   ///< Client asks to download a file; content is the id
+    FILE_DATA,                  ///< Download data; target_username is the transfer id, timestamp the offset
+    WATCH_UPDATE,               ///< "+word" / "-word" changes a keyword watch, "" lists them (see watchlist.h)
+    WATCH_NOTIFY,               ///< A public message from sender hit the watches listed in content, "@alice,deploy"
+    TOPIC_SUBSCRIBE,            ///< "+pattern" / "-pattern" changes a subscription, "" lists them (see topics.h)
+    TOPIC_EVENT,                ///< Published event; target_username is the topic, content the payload
+    ADMIN_REQUEST               ///< Operator command "<name> [args]"; target_username carries the admin token
 };
 
 /**
@@ -63,8 +84,9 @@ struct Message {
 struct LogEntry {
     long long timestamp;        ///< When the event occurred (epoch timestamp)
     MessageType event_type;     ///< Type of event (message, join, leave, etc.)
-    std::string actor;          ///< User or "Server" responsible for the event
-    std::string target;         ///< Recipient (only for private messages, empty otherwise)
+    UserId actor_id;            ///< User or "Server" responsible for the event
+    UserId target_id;           ///< Recipient (only for private messages, kNoUser otherwise)
+    std::string target_name;    ///< Raw recipient name when it is not a known user (target_id == kNoUser)
     std::string content;        ///< Text content or event description
 };
 
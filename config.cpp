@@ -0,0 +1,363 @@
+#include "config.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <vector>
+
+namespace Config {
+
+namespace {
+
+bool ParseInt(const std::string& s, long long* out) {
+    if (s.empty()) return false;
+    errno = 0;
+    char* end = nullptr;
+    long long v = std::strtoll(s.c_str(), &end, 10);
+    if (errno != 0 || *end != '\0') return false;
+    *out = v;
+    return true;
+}
+
+// "512", "64K", "8M", "1G"
+bool ParseSize(const std::string& s, size_t* out) {
+    if (s.empty()) return false;
+    size_t shift = 0;
+    std::string digits = s;
+    switch (s.back()) {
+        case 'K': case 'k': shift = 10; break;
+        case 'M': case 'm': shift = 20; break;
+        case 'G': case 'g': shift = 30; break;
+        default: break;
+    }
+    if (shift) digits.pop_back();
+    long long v = 0;
+    if (!ParseInt(digits, &v) || v <= 0) return false;
+    *out = static_cast<size_t>(v) << shift;
+    return true;
+}
+
+struct Option {
+    const char* name;       ///< without the leading "--"
+    const char* arg;
+    const char* help;
+    std::function<bool(const std::string&, ServerConfig*)> apply;
+};
+
+bool ParseOnOff(const std::string& s, bool* out) {
+    if (s != "on" && s != "off") return false;
+    *out = s == "on";
+    return true;
+}
+
+// Socket option sizes are ints.
+bool ParseSockSize(const std::string& s, std::optional<int>* out) {
+    size_t n = 0;
+    if (!ParseSize(s, &n) || n > static_cast<size_t>(INT_MAX)) return false;
+    *out = static_cast<int>(n);
+    return true;
+}
+
+bool ApplyPort(const std::string& v, ServerConfig* c) {
+    long long port = 0;
+    if (!ParseInt(v, &port) || port <= 0 || port > 65535) return false;
+    c->port = static_cast<int>(port);
+    return true;
+}
+
+const std::vector<Option>& Options() {
+    static const std::vector<Option> options = {
+        {"port", "N", "listen port (default 12345)", ApplyPort},
+        {"log-file", "PATH", "chat log (default chat_history.log)",
+         [](const std::string& v, ServerConfig* c) { c->log_file = v; return !v.empty(); }},
+        {"max-frame", "SIZE", "largest accepted frame (default 1M)",
+         [](const std::string& v, ServerConfig* c) { return ParseSize(v, &c->limits.max_frame_bytes); }},
+        {"conn-budget", "SIZE", "queued bytes per connection (default 8M)",
+         [](const std::string& v, ServerConfig* c) { return ParseSize(v, &c->limits.per_connection_bytes); }},
+        {"global-budget", "SIZE", "buffered bytes across the server (default 1G)",
+         [](const std::string& v, ServerConfig* c) { return ParseSize(v, &c->limits.global_bytes); }},
+        {"metrics-file", "PATH", "periodically rewrite PATH with all metrics",
+         [](const std::string& v, ServerConfig* c) { c->metrics_file = v; return !v.empty(); }},
+        {"metrics-interval-ms", "N", "metrics file refresh period (default 1000)",
+         [](const std::string& v, ServerConfig* c) {
+             long long ms = 0;
+             if (!ParseInt(v, &ms) || ms <= 0) return false;
+             c->metrics_interval_ms = static_cast<int>(ms);
+             return true;
+         }},
+        {"history", "N", "room events kept for /history and snapshots (default 500)",
+         [](const std::string& v, ServerConfig* c) {
+             long long n = 0;
+             if (!ParseInt(v, &n) || n < 0) return false;
+             c->history_entries = static_cast<size_t>(n);
+             return true;
+         }},
+        {"snapshot-file", "PATH", "state snapshot for warm start (default chat_state.snap)",
+         [](const std::string& v, ServerConfig* c) { c->snapshot_file = v; return !v.empty(); }},
+        {"snapshot-interval-s", "N", "snapshot period, 0 disables writing (default 30)",
+         [](const std::string& v, ServerConfig* c) {
+             long long s = 0;
+             if (!ParseInt(v, &s) || s < 0) return false;
+             c->snapshot_interval_s = static_cast<int>(s);
+             return true;
+         }},
+        {"durability", "MODE", "none (best effort) or group (ack after fdatasync)",
+         [](const std::string& v, ServerConfig* c) {
+             if (v != "none" && v != "group") return false;
+             c->durable = v == "group";
+             return true;
+         }},
+        {"group-commit-us", "N", "max wait to grow a commit batch (default 200)",
+         [](const std::string& v, ServerConfig* c) {
+             long long us = 0;
+             if (!ParseInt(v, &us) || us < 0) return false;
+             c->group_commit_us = static_cast<int>(us);
+             return true;
+         }},
+        {"group-commit-max", "N", "records that end the wait early (default 256)",
+         [](const std::string& v, ServerConfig* c) {
+             long long n = 0;
+             if (!ParseInt(v, &n) || n <= 0) return false;
+             c->group_commit_max = static_cast<size_t>(n);
+             return true;
+         }},
+        {"trace", "on|off", "record trace probes from startup (\"ADMIN TRACE on\" arms them later)",
+         [](const std::string& v, ServerConfig* c) {
+             if (v != "on" && v != "off") return false;
+             c->trace = v == "on";
+             return true;
+         }},
+        {"trace-file", "PREFIX", "SIGUSR1 trace dumps go to PREFIX.<pid>.<n>.txt",
+         [](const std::string& v, ServerConfig* c) { c->trace_file = v; return !v.empty(); }},
+        {"fanout-workers", "N|auto", "broadcast fan-out threads, 0 keeps fan-out inline (default auto)",
+         [](const std::string& v, ServerConfig* c) {
+             if (v == "auto") {
+                 c->fanout.workers = -1;
+                 return true;
+             }
+             long long n = 0;
+             if (!ParseInt(v, &n) || n < 0 || n > 256) return false;
+             c->fanout.workers = static_cast<int>(n);
+             return true;
+         }},
+        {"fanout-threshold", "N", "connections below which broadcasts stay inline (default 1024)",
+         [](const std::string& v, ServerConfig* c) {
+             long long n = 0;
+             if (!ParseInt(v, &n) || n < 0) return false;
+             c->fanout.inline_below = static_cast<size_t>(n);
+             return true;
+         }},
+        {"fanout-chunk", "N", "connection slots per fan-out task (default 2048)",
+         [](const std::string& v, ServerConfig* c) {
+             long long n = 0;
+             if (!ParseInt(v, &n) || n <= 0) return false;
+             c->fanout.chunk_slots = static_cast<size_t>(n);
+             return true;
+         }},
+        {"cpus-io", "LIST", "pin the accept loop and connection threads to LIST",
+         [](const std::string& v, ServerConfig* c) { return Affinity::ParseCpuList(v, &c->affinity.io); }},
+        {"cpus-workers", "LIST", "pin fan-out workers, one CPU each from LIST",
+         [](const std::string& v, ServerConfig* c) { return Affinity::ParseCpuList(v, &c->affinity.workers); }},
+        {"cpus-log", "LIST", "pin the WAL committer and snapshot writer to LIST",
+         [](const std::string& v, ServerConfig* c) { return Affinity::ParseCpuList(v, &c->affinity.log); }},
+        {"busy-poll", "on|off", "spin before sleeping in recv and mailbox writers (dedicated hosts)",
+         [](const std::string& v, ServerConfig* c) {
+             if (v != "on" && v != "off") return false;
+             c->busy_poll.enabled = v == "on";
+             return true;
+         }},
+        {"busy-poll-spin-us", "N", "spin window before parking (default 50)",
+         [](const std::string& v, ServerConfig* c) {
+             long long us = 0;
+             if (!ParseInt(v, &us) || us < 0 || us > 1000000) return false;
+             c->busy_poll.spin_us = static_cast<int>(us);
+             return true;
+         }},
+        {"so-busy-poll-us", "N", "SO_BUSY_POLL on accepted sockets in busy-poll mode, 0 = unset (default 50)",
+         [](const std::string& v, ServerConfig* c) {
+             long long us = 0;
+             if (!ParseInt(v, &us) || us < 0 || us > 1000000) return false;
+             c->busy_poll.so_busy_poll_us = static_cast<int>(us);
+             return true;
+         }},
+        {"socket-profile", "NAME", "TCP preset: default|latency|throughput|mobile (default default)",
+         [](const std::string& v, ServerConfig* c) {
+             SocketProfile::Profile p;
+             if (!SocketProfile::Preset(v, &p)) return false;
+             c->socket_profile = v;
+             return true;
+         }},
+        {"tcp-nodelay", "on|off", "override the profile's TCP_NODELAY",
+         [](const std::string& v, ServerConfig* c) {
+             bool on = false;
+             if (!ParseOnOff(v, &on)) return false;
+             c->socket_overrides.nodelay = on;
+             return true;
+         }},
+        {"tcp-quickack", "on|off", "override the profile's TCP_QUICKACK",
+         [](const std::string& v, ServerConfig* c) {
+             bool on = false;
+             if (!ParseOnOff(v, &on)) return false;
+             c->socket_overrides.quickack = on;
+             return true;
+         }},
+        {"sndbuf", "SIZE", "SO_SNDBUF for accepted sockets",
+         [](const std::string& v, ServerConfig* c) { return ParseSockSize(v, &c->socket_overrides.sndbuf); }},
+        {"rcvbuf", "SIZE", "SO_RCVBUF for accepted sockets",
+         [](const std::string& v, ServerConfig* c) { return ParseSockSize(v, &c->socket_overrides.rcvbuf); }},
+        {"notsent-lowat", "SIZE", "TCP_NOTSENT_LOWAT: unsent bytes a writer may leave in the kernel",
+         [](const std::string& v, ServerConfig* c) {
+             return ParseSockSize(v, &c->socket_overrides.notsent_lowat);
+         }},
+        {"keepalive", "IDLE,INTERVAL,COUNT|off", "TCP keepalive timings in seconds, probes",
+         [](const std::string& v, ServerConfig* c) {
+             SocketProfile::Keepalive k;
+             if (!SocketProfile::ParseKeepalive(v, &k)) return false;
+             c->socket_overrides.keepalive = k;
+             return true;
+         }},
+        {"listen-backlog", "N", "listen() backlog (default SOMAXCONN)",
+         [](const std::string& v, ServerConfig* c) {
+             long long n = 0;
+             if (!ParseInt(v, &n) || n <= 0 || n > INT_MAX) return false;
+             c->socket_overrides.backlog = static_cast<int>(n);
+             return true;
+         }},
+        {"profile-seconds", "N", "length of a SIGUSR2 / ADMIN PROFILE capture (default 10)",
+         [](const std::string& v, ServerConfig* c) {
+             long long n = 0;
+             if (!ParseInt(v, &n) || n <= 0 || n > 3600) return false;
+             c->profiler.seconds = static_cast<int>(n);
+             return true;
+         }},
+        {"profile-hz", "N", "profiler samples per CPU-second (default 99)",
+         [](const std::string& v, ServerConfig* c) {
+             long long n = 0;
+             if (!ParseInt(v, &n) || n <= 0 || n > 10000) return false;
+             c->profiler.hz = static_cast<int>(n);
+             return true;
+         }},
+        {"profile-file", "PREFIX", "folded-stack captures go to PREFIX.<pid>.<n>.folded",
+         [](const std::string& v, ServerConfig* c) { c->profile_file = v; return !v.empty(); }},
+        {"admins", "NAME,...", "users allowed to send ADMIN commands (e.g. /admin PROFILE)",
+         [](const std::string& v, ServerConfig* c) {
+             c->admins.clear();
+             for (size_t pos = 0; pos <= v.size();) {
+                 size_t comma = v.find(',', pos);
+                 if (comma == std::string::npos) comma = v.size();
+                 if (comma > pos) c->admins.push_back(v.substr(pos, comma - pos));
+                 pos = comma + 1;
+             }
+             return !c->admins.empty();
+         }},
+        {"admin-token-file", "PATH", "file holding the token ADMIN requests must carry (required with --admins)",
+         [](const std::string& v, ServerConfig* c) { c->admin_token_file = v; return !v.empty(); }},
+        {"ready-fd", "N", "write READY=1 to inherited fd N once listening ($NOTIFY_SOCKET is also honoured)",
+         [](const std::string& v, ServerConfig* c) {
+             long long fd = 0;
+             if (!ParseInt(v, &fd) || fd < 0 || fd > INT_MAX) return false;
+             c->ready_fd = static_cast<int>(fd);
+             return true;
+         }},
+        {"drain-timeout-ms", "N", "on SIGINT/SIGTERM, time sessions get to flush before they are cut off",
+         [](const std::string& v, ServerConfig* c) {
+             long long ms = 0;
+             if (!ParseInt(v, &ms) || ms < 0 || ms > 600000) return false;
+             c->drain_timeout_ms = static_cast<int>(ms);
+             return true;
+         }},
+        {"presence-tick-ms", "N", "interval of coalesced typing/away status updates (0 = presence off)",
+         [](const std::string& v, ServerConfig* c) {
+             long long ms = 0;
+             if (!ParseInt(v, &ms) || ms < 0 || ms > 60000) return false;
+             c->presence_tick_ms = static_cast<int>(ms);
+             return true;
+         }},
+        {"spool-dir", "PATH", "directory for files being shared (default chat_spool)",
+         [](const std::string& v, ServerConfig* c) { c->files.spool_dir = v; return !v.empty(); }},
+        {"max-file-size", "SIZE", "largest file a user may share (default 64M)",
+         [](const std::string& v, ServerConfig* c) {
+             return ParseSize(v, &c->files.max_file_bytes) && c->files.max_file_bytes > 0;
+         }},
+        {"file-chunk", "SIZE", "file bytes per frame, up and down (default 64K)",
+         [](const std::string& v, ServerConfig* c) {
+             return ParseSize(v, &c->files.chunk_bytes) && c->files.chunk_bytes > 0;
+         }},
+        {"file-window", "SIZE", "unacknowledged file bytes per transfer (default 256K)",
+         [](const std::string& v, ServerConfig* c) {
+             return ParseSize(v, &c->files.window_bytes) && c->files.window_bytes > 0;
+         }},
+        {"spool-budget", "SIZE", "shared files kept at once; oldest are dropped first (default 1G)",
+         [](const std::string& v, ServerConfig* c) { return ParseSize(v, &c->files.spool_bytes); }},
+        {"zerocopy", "SIZE|off", "send frames of at least SIZE with MSG_ZEROCOPY (default off)",
+         [](const std::string& v, ServerConfig* c) {
+             if (v == "off") {
+                 c->zerocopy_bytes = 0;
+                 return true;
+             }
+             return ParseSize(v, &c->zerocopy_bytes) && c->zerocopy_bytes > 0;
+         }},
+    };
+    return options;
+}
+
+} // namespace
+
+bool ParseArgs(int argc, char** argv, ServerConfig* config, std::string* error) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 2, "--") != 0) {
+            // Legacy form: chat_server <port>
+            if (i == 1) {
+                if (!ApplyPort(arg, config)) {
+                    std::cerr << "Invalid port argument, using default 12345\n";
+                }
+                continue;
+            }
+            *error = "unexpected argument: " + arg;
+            return false;
+        }
+        size_t eq = arg.find('=');
+        std::string name = arg.substr(2, eq == std::string::npos ? std::string::npos : eq - 2);
+        const Option* opt = nullptr;
+        for (const Option& o : Options()) {
+            if (name == o.name) opt = &o;
+        }
+        if (!opt) {
+            *error = "unknown option: " + arg;
+            return false;
+        }
+        std::string value;
+        if (eq != std::string::npos) {
+            value = arg.substr(eq + 1);
+        } else if (i + 1 < argc) {
+            value = argv[++i];
+        }
+        if (!opt->apply(value, config)) {
+            *error = "bad value for --" + name + ": '" + value + "'";
+            return false;
+        }
+    }
+    // Names are not authenticated: admins also need the token.
+    if (!config->admins.empty() && config->admin_token_file.empty()) {
+        *error = "--admins needs --admin-token-file";
+        return false;
+    }
+    return true;
+}
+
+std::string Usage() {
+    std::string out = "usage: chat_server [port] [options]\n";
+    for (const Option& o : Options()) {
+        std::string flag = std::string("  --") + o.name + "=" + o.arg;
+        flag.resize(std::max<size_t>(flag.size() + 1, 32), ' ');
+        out += flag + o.help + "\n";
+    }
+    return out;
+}
+
+} // namespace Config
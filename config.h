@@ -0,0 +1,79 @@
+#ifndef CONFIG_H_
+#define CONFIG_H_
+
+#include <string>
+#include <vector>
+
+#include "affinity.h"
+#include "busy_poll.h"
+#include "fanout.h"
+#include "file_transfer.h"
+#include "memory_budget.h"
+#include "profiler.h"
+#include "socket_profile.h"
+
+// Server command line.
+//
+//   chat_server [port] [--port=N] [--log-file=PATH]
+//               [--max-frame=SIZE] [--conn-budget=SIZE] [--global-budget=SIZE]
+//               [--metrics-file=PATH] [--metrics-interval-ms=N]
+//               [--history=N] [--snapshot-file=PATH] [--snapshot-interval-s=N]
+//               [--durability=none|group] [--group-commit-us=N] [--group-commit-max=N]
+//               [--trace=on|off] [--trace-file=PREFIX]
+//               [--fanout-workers=N|auto] [--fanout-threshold=N] [--fanout-chunk=N]
+//               [--cpus-io=LIST] [--cpus-workers=LIST] [--cpus-log=LIST]
+//               [--busy-poll=on|off] [--busy-poll-spin-us=N] [--so-busy-poll-us=N]
+//               [--socket-profile=NAME] [--tcp-nodelay=on|off] [--tcp-quickack=on|off]
+//               [--sndbuf=SIZE] [--rcvbuf=SIZE] [--notsent-lowat=SIZE]
+//               [--keepalive=IDLE,INTERVAL,COUNT|off] [--listen-backlog=N]
+//               [--profile-seconds=N] [--profile-hz=N] [--profile-file=PREFIX]
+//               [--admins=NAME,...] [--admin-token-file=PATH] [--ready-fd=N] [--drain-timeout-ms=N]
+//               [--presence-tick-ms=N] [--spool-dir=PATH] [--max-file-size=SIZE]
+//               [--file-chunk=SIZE] [--file-window=SIZE] [--spool-budget=SIZE]
+//               [--zerocopy=SIZE|off]
+//
+// SIZE accepts a K, M or G suffix (powers of 1024); LIST is a CPU list such
+// as "0-3,8". A bare first argument is the port, as before. New options are
+// added to the table in config.cpp.
+
+struct ServerConfig {
+    int port = 12345;
+    std::string log_file = "chat_history.log";
+    MemoryBudget::Limits limits;
+    std::string metrics_file;           ///< empty = no metrics reporter
+    int metrics_interval_ms = 1000;
+    size_t history_entries = 500;
+    std::string snapshot_file = "chat_state.snap";
+    int snapshot_interval_s = 30;       ///< 0 = never write snapshots
+    bool durable = false;               ///< --durability=group: log through wal.h
+    int group_commit_us = 200;
+    size_t group_commit_max = 256;
+    bool trace = false;                 ///< record trace.h probes from startup
+    std::string trace_file = "chat_trace";  ///< SIGUSR1 dumps to PREFIX.<pid>.<n>.txt
+    Fanout::Options fanout{-1};         ///< workers -1: one per extra core
+    Affinity::Plan affinity;            ///< empty lists = unpinned
+    BusyPoll::Options busy_poll;
+    std::string socket_profile = "default";     ///< SocketProfile preset name
+    SocketProfile::Overrides socket_overrides;  ///< individual --tcp-* etc. flags
+    Profiler::Options profiler;
+    std::string profile_file = "chat_profile";  ///< captures go to PREFIX.<pid>.<n>.folded
+    std::vector<std::string> admins;            ///< may send ADMIN commands
+    std::string admin_token_file;               ///< secret ADMIN requests must carry; needed with admins
+    int ready_fd = -1;                          ///< "READY=1" is written here once listening
+    int drain_timeout_ms = 5000;                ///< SIGINT/SIGTERM: time to flush before forcing
+    int presence_tick_ms = 200;                 ///< status deltas go out this often; 0 = off
+    FileTransfer::Options files;                ///< spool and flow control for shared files
+    size_t zerocopy_bytes = 0;                  ///< MSG_ZEROCOPY for frames this large; 0 = off
+};
+
+namespace Config {
+
+// Fill *config from argv. On a bad option returns false with *error set.
+bool ParseArgs(int argc, char** argv, ServerConfig* config, std::string* error);
+
+// One line per option, for usage messages.
+std::string Usage();
+
+} // namespace Config
+
+#endif // CONFIG_H_
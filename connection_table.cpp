@@ -0,0 +1,258 @@
+#include "connection_table.h"
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "affinity.h"
+#include "locks.h"
+
+namespace ConnectionTable {
+
+namespace {
+
+constexpr size_t kDefaultCapacity = 65536;
+
+// Everything a send or a broadcast scan reads, in one cache line.
+struct alignas(64) HotSlot {
+    Socket socket = -1;
+    uint32_t generation = 0;
+    ConnState state = ConnState::kFree;
+    Outbound::Mailbox* mailbox = nullptr;
+    std::atomic<uint64_t> frames_in{0};
+    std::atomic<uint64_t> frames_out{0};
+    std::atomic<uint64_t> bytes_out{0};
+};
+
+struct ColdSlot {
+    UserId user = kNoUser;
+    long long joined_at = 0;
+};
+
+Locks::SharedMutex g_mutex{"conn_table"};
+HotSlot* g_hot = nullptr;           // on the I/O node; never freed
+ColdSlot* g_cold = nullptr;
+size_t g_capacity = 0;
+size_t g_high_water = 0;            // slots [0, g_high_water) have been used
+size_t g_live = 0;
+std::vector<uint32_t> g_freelist;
+std::vector<uint32_t> g_fd_index;   // fd -> slot index + 1 (0 = none)
+
+void InitLocked(size_t capacity) {
+    if (g_hot) return;
+    g_capacity = capacity ? capacity : kDefaultCapacity;
+    const int node = Affinity::IoNode();
+    g_hot = Affinity::NewArrayOnNode<HotSlot>(g_capacity, node);
+    g_cold = Affinity::NewArrayOnNode<ColdSlot>(g_capacity, node);
+}
+
+// Caller holds g_mutex (shared or exclusive).
+HotSlot* Resolve(ConnId id) {
+    if (!id.Valid() || id.index >= g_high_water) return nullptr;
+    HotSlot* slot = &g_hot[id.index];
+    if (slot->generation != id.generation || slot->state == ConnState::kFree) return nullptr;
+    return slot;
+}
+
+ConnId IdOf(uint32_t index) {
+    ConnId id;
+    id.index = index;
+    id.generation = g_hot[index].generation;
+    return id;
+}
+
+} // namespace
+
+void Init(size_t capacity) {
+    Locks::WriteLock lock(g_mutex);
+    InitLocked(capacity);
+}
+
+ConnId Acquire(Socket client_socket) {
+    Locks::WriteLock lock(g_mutex);
+    InitLocked(kDefaultCapacity);
+
+    uint32_t index;
+    if (!g_freelist.empty()) {
+        index = g_freelist.back();
+        g_freelist.pop_back();
+    } else if (g_high_water < g_capacity) {
+        index = static_cast<uint32_t>(g_high_water++);
+    } else {
+        return ConnId{};
+    }
+
+    HotSlot& hot = g_hot[index];
+    if (++hot.generation == 0) hot.generation = 1;
+    hot.socket = client_socket;
+    hot.state = ConnState::kHandshake;
+    hot.mailbox = nullptr;
+    hot.frames_in.store(0, std::memory_order_relaxed);
+    hot.frames_out.store(0, std::memory_order_relaxed);
+    hot.bytes_out.store(0, std::memory_order_relaxed);
+    g_cold[index] = ColdSlot{};
+
+    if (client_socket >= 0) {
+        if (static_cast<size_t>(client_socket) >= g_fd_index.size()) {
+            g_fd_index.resize(static_cast<size_t>(client_socket) + 1, 0);
+        }
+        g_fd_index[client_socket] = index + 1;
+    }
+    ++g_live;
+    return IdOf(index);
+}
+
+void Release(ConnId id) {
+    Locks::WriteLock lock(g_mutex);
+    HotSlot* slot = Resolve(id);
+    if (!slot) return;
+    if (slot->socket >= 0 && static_cast<size_t>(slot->socket) < g_fd_index.size() &&
+        g_fd_index[slot->socket] == id.index + 1) {
+        g_fd_index[slot->socket] = 0;
+    }
+    slot->state = ConnState::kFree;
+    slot->socket = -1;
+    slot->mailbox = nullptr;
+    // Bump now so ids handed out before the release are stale immediately.
+    if (++slot->generation == 0) slot->generation = 1;
+    g_cold[id.index] = ColdSlot{};
+    g_freelist.push_back(id.index);
+    --g_live;
+}
+
+bool SetOnline(ConnId id, UserId user, long long joined_at) {
+    Locks::WriteLock lock(g_mutex);
+    HotSlot* slot = Resolve(id);
+    if (!slot) return false;
+    slot->state = ConnState::kOnline;
+    g_cold[id.index].user = user;
+    g_cold[id.index].joined_at = joined_at;
+    return true;
+}
+
+bool SetState(ConnId id, ConnState state) {
+    if (state == ConnState::kFree) return false;   // use Release()
+    Locks::WriteLock lock(g_mutex);
+    HotSlot* slot = Resolve(id);
+    if (!slot) return false;
+    slot->state = state;
+    return true;
+}
+
+Socket GetSocket(ConnId id) {
+    Locks::ReadLock lock(g_mutex);
+    HotSlot* slot = Resolve(id);
+    return slot ? slot->socket : static_cast<Socket>(-1);
+}
+
+ConnId FindBySocket(Socket client_socket) {
+    Locks::ReadLock lock(g_mutex);
+    if (client_socket < 0 || static_cast<size_t>(client_socket) >= g_fd_index.size()) return ConnId{};
+    uint32_t entry = g_fd_index[client_socket];
+    if (entry == 0) return ConnId{};
+    return IdOf(entry - 1);
+}
+
+bool IsLive(ConnId id) {
+    Locks::ReadLock lock(g_mutex);
+    return Resolve(id) != nullptr;
+}
+
+UserId GetUser(ConnId id) {
+    Locks::ReadLock lock(g_mutex);
+    return Resolve(id) ? g_cold[id.index].user : kNoUser;
+}
+
+bool GetCounters(ConnId id, ConnCounters* out) {
+    Locks::ReadLock lock(g_mutex);
+    HotSlot* slot = Resolve(id);
+    if (!slot || !out) return false;
+    out->frames_in = slot->frames_in.load(std::memory_order_relaxed);
+    out->frames_out = slot->frames_out.load(std::memory_order_relaxed);
+    out->bytes_out = slot->bytes_out.load(std::memory_order_relaxed);
+    return true;
+}
+
+bool AttachMailbox(ConnId id, Outbound::Mailbox* mailbox) {
+    Locks::WriteLock lock(g_mutex);
+    HotSlot* slot = Resolve(id);
+    if (!slot || slot->mailbox) return false;
+    slot->mailbox = mailbox;
+    return true;
+}
+
+Outbound::Mailbox* DetachMailbox(ConnId id) {
+    Locks::WriteLock lock(g_mutex);
+    HotSlot* slot = Resolve(id);
+    if (!slot) return nullptr;
+    Outbound::Mailbox* mailbox = slot->mailbox;
+    slot->mailbox = nullptr;
+    return mailbox;
+}
+
+bool WithMailbox(Socket client_socket, const std::function<void(Outbound::Mailbox*)>& fn) {
+    Locks::ReadLock lock(g_mutex);
+    if (client_socket < 0 || static_cast<size_t>(client_socket) >= g_fd_index.size()) return false;
+    uint32_t entry = g_fd_index[client_socket];
+    if (entry == 0) return false;
+    fn(g_hot[entry - 1].mailbox);
+    return true;
+}
+
+void ForEachOnline(const std::function<void(Socket, Outbound::Mailbox*)>& fn) {
+    Locks::ReadLock lock(g_mutex);
+    for (size_t i = 0; i < g_high_water; ++i) {
+        const HotSlot& slot = g_hot[i];
+        if (slot.state == ConnState::kOnline) fn(slot.socket, slot.mailbox);
+    }
+}
+
+void ForEachLive(const std::function<void(Socket)>& fn) {
+    Locks::ReadLock lock(g_mutex);
+    for (size_t i = 0; i < g_high_water; ++i) {
+        const HotSlot& slot = g_hot[i];
+        if (slot.state != ConnState::kFree) fn(slot.socket);
+    }
+}
+
+void ForEachOnlineInRange(size_t begin, size_t end, const std::function<void(Socket, Outbound::Mailbox*)>& fn) {
+    Locks::ReadLock lock(g_mutex);
+    end = std::min(end, g_high_water);
+    for (size_t i = begin; i < end; ++i) {
+        const HotSlot& slot = g_hot[i];
+        if (slot.state == ConnState::kOnline) fn(slot.socket, slot.mailbox);
+    }
+}
+
+size_t SlotHighWater() {
+    Locks::ReadLock lock(g_mutex);
+    return g_high_water;
+}
+
+void ForEachOnlineUser(const std::function<void(UserId)>& fn) {
+    Locks::ReadLock lock(g_mutex);
+    for (size_t i = 0; i < g_high_water; ++i) {
+        if (g_hot[i].state == ConnState::kOnline) fn(g_cold[i].user);
+    }
+}
+
+void CountInbound(ConnId id) {
+    Locks::ReadLock lock(g_mutex);
+    HotSlot* slot = Resolve(id);
+    if (slot) slot->frames_in.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CountOutbound(ConnId id, uint64_t frames, uint64_t bytes) {
+    Locks::ReadLock lock(g_mutex);
+    HotSlot* slot = Resolve(id);
+    if (!slot) return;
+    slot->frames_out.fetch_add(frames, std::memory_order_relaxed);
+    slot->bytes_out.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+size_t LiveCount() {
+    Locks::ReadLock lock(g_mutex);
+    return g_live;
+}
+
+} // namespace ConnectionTable
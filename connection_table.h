@@ -0,0 +1,97 @@
+#ifndef CONNECTION_TABLE_H_
+#define CONNECTION_TABLE_H_
+
+#include <cstdint>
+#include <functional>
+
+#include "common.h"
+
+namespace Outbound { class Mailbox; }
+
+/**
+ * @file connection_table.h
+ * @brief Dense, generation-checked table of live connections.
+ *
+ * Slots live in one preallocated array and are recycled through a freelist.
+ * Fields touched on every send (socket, state, mailbox, counters) are packed
+ * into one cache line per slot; rarely read fields (user id, joined_at) sit
+ * in a parallel cold array. Broadcast is a linear scan of the hot array up to
+ * the highest slot ever used.
+ *
+ * A ConnId carries the slot generation, so an id kept across a disconnect
+ * (or a recycled fd) is detected as stale instead of reaching a new peer.
+ *
+ * Thread-safety: lookups and scans share a reader lock; Acquire/Release and
+ * state changes take it exclusively. Counters are atomics.
+ */
+namespace ConnectionTable {
+
+struct ConnId {
+    uint32_t index = 0;
+    uint32_t generation = 0;    ///< 0 never names a live slot
+    bool Valid() const { return generation != 0; }
+    bool operator==(const ConnId& o) const { return index == o.index && generation == o.generation; }
+};
+
+enum class ConnState : uint8_t {
+    kFree,                      ///< On the freelist
+    kHandshake,                 ///< Accepted, not yet authenticated
+    kOnline,                    ///< Authenticated; receives broadcasts
+    kClosing                    ///< Left the room; writer still flushing
+};
+
+struct ConnCounters {
+    uint64_t frames_in;
+    uint64_t frames_out;
+    uint64_t bytes_out;
+};
+
+// Size the table before first use (default 65536 slots). No-op afterwards.
+void Init(size_t capacity);
+
+// Claim a slot for client_socket in kHandshake. Invalid id if the table is full.
+ConnId Acquire(Socket client_socket);
+
+// Return the slot to the freelist; every outstanding copy of id goes stale.
+void Release(ConnId id);
+
+bool SetOnline(ConnId id, UserId user, long long joined_at);
+bool SetState(ConnId id, ConnState state);
+
+// Lookups; -1 / invalid id / false when stale or unknown.
+Socket GetSocket(ConnId id);
+ConnId FindBySocket(Socket client_socket);
+bool IsLive(ConnId id);
+UserId GetUser(ConnId id);
+bool GetCounters(ConnId id, ConnCounters* out);
+
+// Mailbox pointer stored in the hot slot (owned by Outbound). Attach fails
+// if the id is stale or a mailbox is already attached.
+bool AttachMailbox(ConnId id, Outbound::Mailbox* mailbox);
+Outbound::Mailbox* DetachMailbox(ConnId id);
+
+// Run fn with the slot's mailbox (may be null) while the slot cannot be
+// released. Returns false without calling fn if the socket is unknown.
+bool WithMailbox(Socket client_socket, const std::function<void(Outbound::Mailbox*)>& fn);
+
+// Linear scan over kOnline slots under the reader lock.
+void ForEachOnline(const std::function<void(Socket, Outbound::Mailbox*)>& fn);
+void ForEachOnlineUser(const std::function<void(UserId)>& fn);
+// Every slot that is not free (handshake, online or closing); used to end
+// all sessions at shutdown.
+void ForEachLive(const std::function<void(Socket)>& fn);
+
+// ForEachOnline restricted to slots [begin, end); lets a broadcast be split
+// into chunks (see fanout.h). Slots past SlotHighWater() are never online.
+void ForEachOnlineInRange(size_t begin, size_t end, const std::function<void(Socket, Outbound::Mailbox*)>& fn);
+size_t SlotHighWater();
+
+void CountInbound(ConnId id);
+void CountOutbound(ConnId id, uint64_t frames, uint64_t bytes);
+
+// Number of slots currently not free.
+size_t LiveCount();
+
+} // namespace ConnectionTable
+
+#endif // CONNECTION_TABLE_H_
@@ -0,0 +1,137 @@
+#include "fanout.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "affinity.h"
+#include "metrics.h"
+
+namespace Fanout {
+
+namespace {
+
+struct Worker {
+    std::mutex mutex;
+    std::condition_variable ready;      ///< task queued or stopping
+    std::condition_variable space;      ///< queue shrank
+    std::deque<std::function<void()>> tasks;
+    bool stopping = false;
+    std::thread thread;
+};
+
+Options g_options;
+std::vector<std::unique_ptr<Worker>> g_workers;
+std::atomic<bool> g_running{false};
+std::atomic<size_t> g_in_flight{0};
+
+std::atomic<int64_t>& Tasks() {
+    static std::atomic<int64_t>& c = Metrics::Counter("fanout.tasks");
+    return c;
+}
+
+std::atomic<int64_t>& Stalls() {
+    static std::atomic<int64_t>& c = Metrics::Counter("fanout.post_stalls");
+    return c;
+}
+
+void Run(Worker* w, int index) {
+    Affinity::PinSelf(Affinity::Role::kWorker, index);
+    for (;;) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(w->mutex);
+            w->ready.wait(lock, [w] { return w->stopping || !w->tasks.empty(); });
+            if (w->tasks.empty()) return;       // stopping and drained
+            task = std::move(w->tasks.front());
+            w->tasks.pop_front();
+        }
+        w->space.notify_one();
+        task();
+        g_in_flight.fetch_sub(1, std::memory_order_acq_rel);
+        Tasks().fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+} // namespace
+
+void Start(const Options& options) {
+    Stop();
+    g_options = options;
+    if (g_options.workers < 0) {
+        int cores = static_cast<int>(std::thread::hardware_concurrency());
+        g_options.workers = std::min(cores - 1, 8);
+    }
+    if (g_options.workers <= 0 || g_options.chunk_slots == 0) return;
+    static std::once_flag gauges;
+    std::call_once(gauges, [] {
+        Metrics::RegisterGauge("fanout.in_flight", [] {
+            return static_cast<int64_t>(g_in_flight.load(std::memory_order_relaxed));
+        });
+    });
+    for (int i = 0; i < g_options.workers; ++i) {
+        g_workers.emplace_back(new Worker());
+        Worker* w = g_workers.back().get();
+        w->thread = std::thread([w, i] { Run(w, i); });
+    }
+    g_running.store(true, std::memory_order_release);
+}
+
+void Stop() {
+    g_running.store(false, std::memory_order_release);
+    for (auto& w : g_workers) {
+        {
+            std::lock_guard<std::mutex> lock(w->mutex);
+            w->stopping = true;
+        }
+        w->ready.notify_one();
+        w->thread.join();
+    }
+    g_workers.clear();
+}
+
+bool Running() {
+    return g_running.load(std::memory_order_acquire);
+}
+
+const Options& Config() {
+    return g_options;
+}
+
+void Post(size_t chunk, std::function<void()> fn) {
+    if (!Running()) {
+        fn();
+        return;
+    }
+    Worker* w = g_workers[chunk % g_workers.size()].get();
+    g_in_flight.fetch_add(1, std::memory_order_acq_rel);
+    {
+        std::unique_lock<std::mutex> lock(w->mutex);
+        if (w->tasks.size() >= g_options.max_queued) {
+            Stalls().fetch_add(1, std::memory_order_relaxed);
+            w->space.wait(lock, [&] { return w->tasks.size() < g_options.max_queued; });
+        }
+        w->tasks.push_back(std::move(fn));
+    }
+    w->ready.notify_one();
+}
+
+void Drain(size_t chunk) {
+    if (!Running()) return;
+    std::promise<void> done;
+    std::future<void> ran = done.get_future();
+    Post(chunk, [&done] { done.set_value(); });
+    ran.wait();
+}
+
+size_t InFlight() {
+    return g_in_flight.load(std::memory_order_acquire);
+}
+
+} // namespace Fanout
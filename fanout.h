@@ -0,0 +1,51 @@
+#ifndef FANOUT_H_
+#define FANOUT_H_
+
+#include <cstddef>
+#include <functional>
+
+// Fan-out worker pool for large broadcasts.
+//
+// Outbound::Broadcast splits the ConnectionTable slot range into chunks of
+// chunk_slots and posts one task per chunk, so the sender's thread only pays
+// for enqueueing and the pushes into mailboxes run on several cores.
+//
+// Chunk c is always run by worker c % workers and each worker runs its tasks
+// in FIFO order, so every recipient sees broadcasts from one producer in the
+// order they were posted. While tasks are in flight, Outbound also routes
+// smaller broadcasts and bulk unicasts through the pool (see outbound.cpp) so
+// they cannot overtake a queued chunk.
+//
+// Each worker queue is bounded; Post blocks when it is full, which throttles
+// a sender that outruns the pool instead of growing memory without limit.
+
+namespace Fanout {
+
+struct Options {
+    int workers = 0;                ///< 0: pool disabled; < 0: one per extra core (max 8)
+    size_t chunk_slots = 2048;      ///< table slots per task
+    size_t inline_below = 1024;     ///< live connections below which to stay inline
+    size_t max_queued = 1024;       ///< tasks per worker before Post blocks
+};
+
+// Start the workers (replacing a previous pool, after draining it).
+void Start(const Options& options);
+
+// Drain every queue and join the workers.
+void Stop();
+
+bool Running();
+const Options& Config();
+
+// Run fn on the worker that owns chunk.
+void Post(size_t chunk, std::function<void()> fn);
+
+// Block until every task already posted for chunk has run.
+void Drain(size_t chunk);
+
+// Tasks posted but not yet finished, across all workers.
+size_t InFlight();
+
+} // namespace Fanout
+
+#endif // FANOUT_H_
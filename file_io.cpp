@@ -14,14 +14,15 @@ void OpenAppend(const std::string& filename) {
     // The file is automatically closed when `logfile` goes out of scope.
 }
 
-void AppendLine(const std::string& filename, const std::string& line) {
+bool AppendLine(const std::string& filename, const std::string& line) {
     std::ofstream logfile(filename, std::ios::app); // Open in append mode
     if (logfile.is_open()) {
         logfile << line << std::endl;
-    } else {
-        // [修正] 同样为写入失败增加错误处理
-        std::cerr << "Error: Could not write to log file: " << filename << std::endl;
+        if (logfile) return true;
     }
+    // [修正] 同样为写入失败增加错误处理
+    std::cerr << "Error: Could not write to log file: " << filename << std::endl;
+    return false;
 }
 
 } // namespace File
\ No newline at end of file
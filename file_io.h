@@ -7,7 +7,7 @@
 namespace File {
 
 void OpenAppend(const std::string& filename);
-void AppendLine(const std::string& filename, const std::string& line);
+bool AppendLine(const std::string& filename, const std::string& line);
 
 } // namespace File
 
@@ -0,0 +1,285 @@
+#include "file_transfer.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <deque>
+#include <map>
+#include <memory>
+
+#include "locks.h"
+#include "metrics.h"
+#include "outbound.h"
+#include "services.h"
+#include "topics.h"
+#include "user_ids.h"
+
+namespace FileTransfer {
+
+namespace {
+
+struct Transfer {
+    uint64_t id = 0;
+    UserId owner = kNoUser;
+    std::string name;
+    uint64_t received = 0;          ///< only the owner's session writes it
+    bool complete = false;
+    std::shared_ptr<Outbound::FileSource> source;
+};
+
+Options g_options;
+Locks::Mutex g_mutex{"files"};
+std::map<uint64_t, std::shared_ptr<Transfer>> g_transfers;
+std::deque<uint64_t> g_complete;    // oldest first, for eviction
+size_t g_spooled = 0;               // declared sizes of everything in g_transfers
+uint64_t g_next_id = 1;
+
+void Reply(Socket client_socket, MessageType type, const std::string& text) {
+    Message m;
+    m.type = type;
+    m.timestamp = NowEpochMs();
+    m.sender_username = "Server";
+    m.target_username = "";
+    m.content = text;
+    Outbound::Send(client_socket, m);
+}
+
+bool ParseU64(const std::string& s, uint64_t* out) {
+    if (s.empty() || s.size() > 19) return false;
+    char* end = nullptr;
+    errno = 0;
+    unsigned long long v = std::strtoull(s.c_str(), &end, 10);
+    if (errno != 0 || *end != '\0' || s[0] == '-') return false;
+    *out = v;
+    return true;
+}
+
+// Keep the name as a label only: no directories, no control characters.
+std::string CleanName(const std::string& raw) {
+    std::string name;
+    for (char c : raw) {
+        if (static_cast<unsigned char>(c) < 0x20 || c == '/' || c == '\\') continue;
+        name.push_back(c);
+    }
+    if (name.size() > 255) name.resize(255);
+    return name;
+}
+
+// Caller holds g_mutex.
+void Forget(uint64_t id) {
+    auto it = g_transfers.find(id);
+    if (it == g_transfers.end()) return;
+    g_spooled -= it->second->source->size;
+    g_transfers.erase(it);
+}
+
+void Offer(const Message& msg, UserId sender, Socket client_socket) {
+    static std::atomic<int64_t>& rejected = Metrics::Counter("file.rejected");
+    size_t space = msg.content.find(' ');
+    uint64_t size = 0;
+    std::string name = space == std::string::npos ? "" : CleanName(msg.content.substr(space + 1));
+    if (space == std::string::npos || !ParseU64(msg.content.substr(0, space), &size) || size == 0 || name.empty()) {
+        rejected.fetch_add(1, std::memory_order_relaxed);
+        Reply(client_socket, MessageType::COMMAND_RESPONSE, "FILE_REJECTED usage: SIZE NAME");
+        return;
+    }
+    if (size > g_options.max_file_bytes || size > g_options.spool_bytes) {
+        rejected.fetch_add(1, std::memory_order_relaxed);
+        Reply(client_socket, MessageType::COMMAND_RESPONSE,
+              "FILE_REJECTED larger than " + std::to_string(g_options.max_file_bytes) + " bytes");
+        return;
+    }
+
+    auto t = std::make_shared<Transfer>();
+    t->owner = sender;
+    t->name = name;
+    t->source = std::make_shared<Outbound::FileSource>();
+    t->source->size = size;
+    {
+        Locks::Lock lock(g_mutex);
+        // Make room by forgetting the oldest complete files; uploads still
+        // in progress are never evicted.
+        while (g_spooled + size > g_options.spool_bytes && !g_complete.empty()) {
+            Forget(g_complete.front());
+            g_complete.pop_front();
+            Metrics::Counter("file.evicted").fetch_add(1, std::memory_order_relaxed);
+        }
+        if (g_spooled + size > g_options.spool_bytes) {
+            rejected.fetch_add(1, std::memory_order_relaxed);
+            Reply(client_socket, MessageType::COMMAND_RESPONSE, "FILE_REJECTED spool full");
+            return;
+        }
+        t->id = g_next_id++;
+        t->source->id = t->id;
+        g_spooled += size;
+        g_transfers[t->id] = t;
+    }
+
+    std::string path = g_options.spool_dir + "/" + std::to_string(::getpid()) + "-" + std::to_string(t->id);
+    int fd = ::open(path.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0600);
+    if (fd >= 0) ::unlink(path.c_str());
+    if (fd < 0) {
+        Locks::Lock lock(g_mutex);
+        Forget(t->id);
+        rejected.fetch_add(1, std::memory_order_relaxed);
+        Reply(client_socket, MessageType::COMMAND_RESPONSE, "FILE_REJECTED cannot spool");
+        return;
+    }
+    t->source->fd = fd;
+    Reply(client_socket, MessageType::COMMAND_RESPONSE,
+          "FILE_READY " + std::to_string(t->id) + " " + std::to_string(g_options.chunk_bytes) + " " +
+              std::to_string(g_options.window_bytes));
+}
+
+void Chunk(const Message& msg, UserId sender, Socket client_socket) {
+    static std::atomic<int64_t>& uploads = Metrics::Counter("file.uploads");
+    static std::atomic<int64_t>& upload_bytes = Metrics::Counter("file.upload_bytes");
+    uint64_t id = 0;
+    std::shared_ptr<Transfer> t;
+    if (ParseU64(msg.target_username, &id)) {
+        Locks::Lock lock(g_mutex);
+        auto it = g_transfers.find(id);
+        if (it != g_transfers.end()) t = it->second;
+    }
+    const size_t n = msg.content.size();
+    if (!t || t->owner != sender || t->complete || n == 0 || n > g_options.chunk_bytes ||
+        t->received + n > t->source->size) {
+        Reply(client_socket, MessageType::COMMAND_RESPONSE, "FILE_REJECTED " + msg.target_username + " bad chunk");
+        return;
+    }
+
+    // Only the owner's session reaches here, so received needs no lock.
+    size_t done = 0;
+    while (done < n) {
+        ssize_t w = ::pwrite(t->source->fd, msg.content.data() + done, n - done,
+                             static_cast<off_t>(t->received + done));
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) {
+            Locks::Lock lock(g_mutex);
+            Forget(t->id);
+            Reply(client_socket, MessageType::COMMAND_RESPONSE,
+                  "FILE_REJECTED " + msg.target_username + " write failed");
+            return;
+        }
+        done += static_cast<size_t>(w);
+    }
+    t->received += n;
+    upload_bytes.fetch_add(static_cast<int64_t>(n), std::memory_order_relaxed);
+    Reply(client_socket, MessageType::FILE_ACK, std::to_string(t->id) + " " + std::to_string(t->received));
+    if (t->received < t->source->size) return;
+
+    {
+        Locks::Lock lock(g_mutex);
+        if (!g_transfers.count(t->id)) return;  // aborted meanwhile
+        t->complete = true;
+        g_complete.push_back(t->id);
+    }
+    uploads.fetch_add(1, std::memory_order_relaxed);
+    Message avail;
+    avail.type = MessageType::FILE_AVAILABLE;
+    avail.timestamp = NowEpochMs();
+    avail.sender_username = UserIds::Name(sender);
+    avail.target_username = "";
+    avail.content = std::to_string(t->id) + " " + std::to_string(t->source->size) + " " + t->name;
+    Outbound::Broadcast(NetworkLayer::EncodeFrame(avail));
+    Topics::Publish("file.shared." + Topics::Level(avail.sender_username), avail.sender_username, avail.content,
+                    avail.timestamp);
+    LoggingService::LogSystem(avail.sender_username + " shared " + t->name + " (" +
+                              std::to_string(t->source->size) + " bytes) as file " + std::to_string(t->id));
+}
+
+void Get(const Message& msg, Socket client_socket) {
+    static std::atomic<int64_t>& downloads = Metrics::Counter("file.downloads");
+    uint64_t id = 0;
+    uint64_t transfer = 0;
+    std::shared_ptr<Transfer> t;
+    if (ParseU64(msg.content, &id)) {
+        Locks::Lock lock(g_mutex);
+        auto it = g_transfers.find(id);
+        if (it != g_transfers.end() && it->second->complete) {
+            t = it->second;
+            transfer = g_next_id++;
+        }
+    }
+    if (!t) {
+        Reply(client_socket, MessageType::COMMAND_RESPONSE, "FILE_NOT_FOUND " + msg.content);
+        return;
+    }
+    // Queued with the job, so the client sees it before any file chunk.
+    Message start;
+    start.type = MessageType::COMMAND_RESPONSE;
+    start.timestamp = NowEpochMs();
+    start.sender_username = "Server";
+    start.target_username = "";
+    start.content = "FILE_START " + std::to_string(t->id) + " " + std::to_string(transfer) + " " +
+                    std::to_string(t->source->size) + " " + t->name;
+    if (!Outbound::SendFile(client_socket, start, transfer, t->source, g_options.chunk_bytes,
+                            g_options.window_bytes)) {
+        Reply(client_socket, MessageType::COMMAND_RESPONSE, "FILE_REJECTED busy " + std::to_string(t->id));
+        return;
+    }
+    downloads.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Ack(const Message& msg, Socket client_socket) {
+    size_t space = msg.content.find(' ');
+    uint64_t transfer = 0, bytes = 0;
+    if (space == std::string::npos || !ParseU64(msg.content.substr(0, space), &transfer) ||
+        !ParseU64(msg.content.substr(space + 1), &bytes)) {
+        return;
+    }
+    Outbound::AckFile(client_socket, transfer, bytes);
+}
+
+} // namespace
+
+bool Configure(const Options& options, std::string* error) {
+    g_options = options;
+    if (::mkdir(options.spool_dir.c_str(), 0700) != 0 && errno != EEXIST) {
+        *error = "cannot create spool directory " + options.spool_dir;
+        return false;
+    }
+    if (::access(options.spool_dir.c_str(), W_OK | X_OK) != 0) {
+        *error = "spool directory " + options.spool_dir + " is not writable";
+        return false;
+    }
+    Metrics::RegisterGauge("file.spool_bytes", [] {
+        Locks::Lock lock(g_mutex);
+        return static_cast<int64_t>(g_spooled);
+    });
+    return true;
+}
+
+bool IsFileMessage(MessageType type) {
+    return type == MessageType::FILE_OFFER || type == MessageType::FILE_CHUNK || type == MessageType::FILE_ACK ||
+           type == MessageType::FILE_GET;
+}
+
+void Handle(const Message& msg, UserId sender, Socket client_socket) {
+    switch (msg.type) {
+        case MessageType::FILE_OFFER: Offer(msg, sender, client_socket); break;
+        case MessageType::FILE_CHUNK: Chunk(msg, sender, client_socket); break;
+        case MessageType::FILE_GET: Get(msg, client_socket); break;
+        case MessageType::FILE_ACK: Ack(msg, client_socket); break;
+        default: break;
+    }
+}
+
+void AbortUploads(UserId user) {
+    Locks::Lock lock(g_mutex);
+    for (auto it = g_transfers.begin(); it != g_transfers.end();) {
+        const Transfer& t = *it->second;
+        if (t.owner == user && !t.complete) {
+            g_spooled -= t.source->size;
+            it = g_transfers.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+} // namespace FileTransfer
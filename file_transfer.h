@@ -0,0 +1,62 @@
+#ifndef FILE_TRANSFER_H_
+#define FILE_TRANSFER_H_
+
+#include <cstddef>
+#include <string>
+
+#include "common.h"
+
+// Sharing files in the room over the chat connection.
+//
+// Upload:
+//   FILE_OFFER "SIZE NAME"          -> COMMAND_RESPONSE "FILE_READY ID CHUNK WINDOW"
+//                                      or "FILE_REJECTED <reason>"
+//   FILE_CHUNK (target ID, bytes)   -> FILE_ACK "ID RECEIVED" on the control lane
+// The uploader sends chunks of at most CHUNK bytes and keeps at most WINDOW
+// bytes unacknowledged. The session thread appends each chunk to a spool
+// file, so no file body is held in memory. After the last byte the room gets
+// FILE_AVAILABLE "ID SIZE NAME" from the uploader.
+//
+// Download:
+//   FILE_GET "ID"                   -> COMMAND_RESPONSE "FILE_START ID XFER SIZE NAME"
+//                                      (or "FILE_NOT_FOUND ID", or "FILE_REJECTED
+//                                      busy ID"), then FILE_DATA (target XFER)
+//   FILE_ACK "XFER STORED"          from the downloader opens the window
+// XFER is a fresh id for each download, so one session can fetch the same
+// file twice at once without the two windows sharing acks. Upload ids are
+// unique per upload already and double as the transfer id.
+// FILE_DATA goes from the spool to the socket with sendfile() on the
+// connection's background lane (Outbound::SendFile), behind any chat frame.
+// A session runs at most Outbound::kMaxDownloads downloads at once and is
+// told "busy" beyond that; a download left without acks for
+// Outbound::kDownloadStallMs is dropped, releasing its spool file.
+//
+// Spool files are unlinked right after they are created and live on as open
+// descriptors: nothing is left on disk when the process exits. When spooled
+// bytes would exceed spool_bytes the oldest complete files are forgotten
+// (downloads already running keep theirs open).
+
+namespace FileTransfer {
+
+struct Options {
+    std::string spool_dir = "chat_spool";
+    size_t max_file_bytes = size_t(64) << 20;   ///< 64 MiB
+    size_t chunk_bytes = size_t(64) << 10;      ///< FILE_CHUNK / FILE_DATA payload
+    size_t window_bytes = size_t(256) << 10;    ///< unacknowledged bytes per transfer
+    size_t spool_bytes = size_t(1) << 30;       ///< uploads kept at once
+};
+
+// Create spool_dir if needed. False with *error if it cannot hold files.
+bool Configure(const Options& options, std::string* error);
+
+bool IsFileMessage(MessageType type);
+
+// Handle a FILE_OFFER / FILE_CHUNK / FILE_ACK / FILE_GET from sender.
+void Handle(const Message& msg, UserId sender, Socket client_socket);
+
+// The user's session ended: drop its unfinished uploads.
+void AbortUploads(UserId user);
+
+} // namespace FileTransfer
+
+#endif // FILE_TRANSFER_H_
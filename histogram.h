@@ -0,0 +1,77 @@
+#ifndef HISTOGRAM_H_
+#define HISTOGRAM_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Log-linear latency histogram for the load tools.
+//
+// Values (microseconds) are bucketed with ~1.5% relative error: each power
+// of two is split into kSubBuckets linear buckets. Recording is O(1) and
+// allocation free; not thread-safe, keep one per thread and Merge().
+
+class Histogram {
+public:
+    static constexpr int kSubBits = 6;
+    static constexpr int kSubBuckets = 1 << kSubBits;
+    static constexpr int kMaxExp = 40;              // ~12 days in us
+
+    Histogram() : counts_((kMaxExp + 1) * kSubBuckets, 0) {}
+
+    void Record(double us) {
+        uint64_t v = us <= 0 ? 0 : static_cast<uint64_t>(us);
+        ++counts_[Index(v)];
+        ++count_;
+        sum_ += us;
+        max_ = std::max(max_, us);
+    }
+
+    void Merge(const Histogram& other) {
+        for (size_t i = 0; i < counts_.size(); ++i) counts_[i] += other.counts_[i];
+        count_ += other.count_;
+        sum_ += other.sum_;
+        max_ = std::max(max_, other.max_);
+    }
+
+    uint64_t Count() const { return count_; }
+    double Max() const { return max_; }
+    double Mean() const { return count_ ? sum_ / count_ : 0; }
+
+    // Upper bound of the bucket holding the p-th value, p in [0, 1].
+    double Percentile(double p) const {
+        if (count_ == 0) return 0;
+        uint64_t rank = static_cast<uint64_t>(std::ceil(p * count_));
+        if (rank == 0) rank = 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts_.size(); ++i) {
+            seen += counts_[i];
+            if (seen >= rank) return std::min(static_cast<double>(UpperBound(i)), max_);
+        }
+        return max_;
+    }
+
+private:
+    static size_t Index(uint64_t v) {
+        if (v < kSubBuckets) return static_cast<size_t>(v);
+        int shift = 63 - __builtin_clzll(v) - kSubBits;        // >= 0
+        if (shift + 1 > kMaxExp) return (kMaxExp + 1) * kSubBuckets - 1;
+        size_t sub = static_cast<size_t>(v >> shift) - kSubBuckets;
+        return static_cast<size_t>(shift + 1) * kSubBuckets + sub;
+    }
+
+    static uint64_t UpperBound(size_t index) {
+        size_t exp = index / kSubBuckets;
+        uint64_t sub = index % kSubBuckets;
+        if (exp == 0) return sub;
+        return ((uint64_t(kSubBuckets) + sub + 1) << (exp - 1)) - 1;
+    }
+
+    std::vector<uint64_t> counts_;
+    uint64_t count_ = 0;
+    double sum_ = 0;
+    double max_ = 0;
+};
+
+#endif // HISTOGRAM_H_
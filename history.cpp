@@ -0,0 +1,284 @@
+#include "history.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "locks.h"
+#include "memory_budget.h"
+#include "metrics.h"
+#include "network.h"
+#include "user_ids.h"
+
+namespace History {
+
+namespace {
+
+// Where an entry's frame sits. The writer fills the fields, then sets
+// ready; a frame that is never written stays not ready.
+struct Stored {
+    std::atomic<bool> ready{false};
+    std::shared_ptr<Outbound::FileSource> segment;
+    uint64_t offset = 0;
+    uint64_t bytes = 0;
+};
+using Slot = std::shared_ptr<Stored>;
+
+struct Ring {
+    Locks::Mutex mutex{"history"};
+    std::deque<Entry> entries;
+    std::deque<Slot> stored;        // parallel to entries when segments are on; null: none
+    size_t capacity = 500;
+    uint64_t log_offset = 0;
+    uint64_t version = 0;
+    bool segments = false;
+};
+
+Ring& GetRing() {
+    static Ring* ring = new Ring();   // used until exit
+    return *ring;
+}
+
+// Appends frames to the segments on its own thread, in Record() order.
+// Segment state belongs to that thread once it runs.
+struct SegmentWriter {
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<std::pair<Entry, Slot>> queue;
+    size_t max_queue = 500;         // the ring's capacity: older ones are evicted anyway
+    std::string dir;
+    std::shared_ptr<Outbound::FileSource> segment;  // appended to; size is its end
+    uint64_t seq = 0;
+    std::thread thread;
+};
+
+SegmentWriter& GetWriter() {
+    static SegmentWriter* writer = new SegmentWriter();   // used until exit
+    return *writer;
+}
+
+// Announcements are left out: LogSystem() writes internal notes with the
+// same type, and those were never shown to the room.
+bool Retained(MessageType type) {
+    switch (type) {
+        case MessageType::PUBLIC_MESSAGE:
+        case MessageType::USER_JOINED:
+        case MessageType::USER_LEFT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+size_t Footprint(const LogEntry& e) {
+    return sizeof(LogEntry) + e.content.size() + e.target_name.size();
+}
+
+// Caller holds r.mutex.
+void PopOldestLocked(Ring& r) {
+    MemoryBudget::ReleaseGlobal(MemoryBudget::Category::kHistory, Footprint(*r.entries.front()));
+    r.entries.pop_front();
+    if (!r.stored.empty()) r.stored.pop_front();
+}
+
+// A fresh segment, already unlinked. Writer thread (or before it starts).
+std::shared_ptr<Outbound::FileSource> OpenSegment(SegmentWriter& w) {
+    std::string path = w.dir + "/" + std::to_string(::getpid()) + "-history-" + std::to_string(++w.seq);
+    int fd = ::open(path.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0600);
+    if (fd < 0) return nullptr;
+    ::unlink(path.c_str());
+    auto segment = std::make_shared<Outbound::FileSource>();
+    segment->fd = fd;
+    return segment;
+}
+
+// Writer thread. Appends e's replay frame to the current segment and
+// publishes where it went in slot.
+void Store(SegmentWriter& w, const LogEntry& e, Stored& slot) {
+    static std::atomic<int64_t>& errors = Metrics::Counter("history.segment_errors");
+    NetworkLayer::Frame frame = NetworkLayer::EncodeFrame(ReplayMessage(e));
+    if (!w.segment || w.segment->size + frame->size() > kSegmentBytes) w.segment = OpenSegment(w);
+    if (!w.segment) {
+        errors.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    size_t done = 0;
+    while (done < frame->size()) {
+        ssize_t n = ::pwrite(w.segment->fd, frame->data() + done, frame->size() - done,
+                             static_cast<off_t>(w.segment->size + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            // The next frame overwrites the partial one.
+            errors.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        done += static_cast<size_t>(n);
+    }
+    slot.segment = w.segment;
+    slot.offset = w.segment->size;
+    slot.bytes = frame->size();
+    w.segment->size += frame->size();
+    slot.ready.store(true, std::memory_order_release);
+}
+
+void WriterLoop() {
+    SegmentWriter& w = GetWriter();
+    for (;;) {
+        std::pair<Entry, Slot> job;
+        {
+            std::unique_lock<std::mutex> lock(w.mutex);
+            w.wake.wait(lock, [&] { return !w.queue.empty(); });
+            job = std::move(w.queue.front());
+            w.queue.pop_front();
+        }
+        // Evicted from the ring meanwhile: nobody can ask for it.
+        if (job.second.use_count() == 1) continue;
+        Store(w, *job.first, *job.second);
+    }
+}
+
+// Hand e to the writer. Caller holds the ring's mutex, which orders the
+// queue like the ring.
+void EnqueueStore(const Entry& e, const Slot& slot) {
+    static std::atomic<int64_t>& dropped = Metrics::Counter("history.segment_dropped");
+    SegmentWriter& w = GetWriter();
+    {
+        std::lock_guard<std::mutex> lock(w.mutex);
+        if (w.queue.size() >= w.max_queue) {
+            w.queue.pop_front();
+            dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+        w.queue.emplace_back(e, slot);
+    }
+    w.wake.notify_one();
+}
+
+// Caller holds r.mutex. Evicts until e fits both the ring and the budget.
+void PushLocked(Ring& r, Entry e) {
+    if (r.capacity == 0) return;
+    size_t bytes = Footprint(*e);
+    while (r.entries.size() >= r.capacity) PopOldestLocked(r);
+    while (!MemoryBudget::TryChargeGlobal(MemoryBudget::Category::kHistory, bytes)) {
+        if (r.entries.empty()) return;   // budget exhausted elsewhere: keep nothing
+        PopOldestLocked(r);
+    }
+    if (r.segments) {
+        r.stored.push_back(std::make_shared<Stored>());
+        EnqueueStore(e, r.stored.back());
+    }
+    r.entries.push_back(std::move(e));
+}
+
+} // namespace
+
+void Configure(size_t capacity) {
+    Ring& r = GetRing();
+    Locks::Lock lock(r.mutex);
+    r.capacity = capacity;
+    while (r.entries.size() > r.capacity) PopOldestLocked(r);
+    SegmentWriter& w = GetWriter();
+    std::lock_guard<std::mutex> wl(w.mutex);
+    w.max_queue = std::max<size_t>(capacity, 1);
+}
+
+bool StoreFrames(const std::string& dir, std::string* error) {
+    Ring& r = GetRing();
+    SegmentWriter& w = GetWriter();
+    Locks::Lock lock(r.mutex);
+    if (r.segments) return true;
+    w.dir = dir;
+    w.segment = OpenSegment(w);
+    if (!w.segment) {
+        *error = "cannot create history segments in " + dir;
+        return false;
+    }
+    w.thread = std::thread(WriterLoop);
+    r.segments = true;
+    // Entries already retained have no frames; leave them to the fallback.
+    r.stored.assign(r.entries.size(), nullptr);
+    return true;
+}
+
+Message ReplayMessage(const LogEntry& entry) {
+    Message m;
+    m.type = entry.event_type;
+    m.timestamp = entry.timestamp;
+    m.sender_username = UserIds::Name(entry.actor_id);
+    m.target_username = "";
+    m.content = entry.content;
+    return m;
+}
+
+void Record(const LogEntry& entry, uint64_t log_offset_after) {
+    Ring& r = GetRing();
+    Entry e = Retained(entry.event_type) ? std::make_shared<const LogEntry>(entry) : nullptr;
+    Locks::Lock lock(r.mutex);
+    if (e) PushLocked(r, std::move(e));
+    r.log_offset = log_offset_after;
+    ++r.version;
+}
+
+void Restore(std::vector<Entry> entries, uint64_t log_offset) {
+    Ring& r = GetRing();
+    Locks::Lock lock(r.mutex);
+    while (!r.entries.empty()) PopOldestLocked(r);
+    for (Entry& e : entries) PushLocked(r, std::move(e));
+    r.log_offset = log_offset;
+    ++r.version;
+}
+
+State Capture() {
+    Ring& r = GetRing();
+    State s;
+    Locks::Lock lock(r.mutex);
+    s.entries.assign(r.entries.begin(), r.entries.end());
+    s.log_offset = r.log_offset;
+    s.version = r.version;
+    return s;
+}
+
+std::vector<Entry> Recent(size_t n) {
+    Ring& r = GetRing();
+    Locks::Lock lock(r.mutex);
+    size_t k = std::min(n, r.entries.size());
+    return std::vector<Entry>(r.entries.end() - k, r.entries.end());
+}
+
+std::vector<Span> RecentSpans(size_t n, std::vector<Entry>* rest) {
+    Ring& r = GetRing();
+    Locks::Lock lock(r.mutex);
+    rest->clear();
+    size_t k = std::min(n, r.entries.size());
+    size_t first = r.entries.size() - k;
+    std::vector<Span> spans;
+    size_t i = first;
+    for (; i < r.entries.size() && r.stored.size() == r.entries.size(); ++i) {
+        const Slot& s = r.stored[i];
+        if (!s || !s->ready.load(std::memory_order_acquire)) break;
+        Span* last = spans.empty() ? nullptr : &spans.back();
+        if (last && last->file == s->segment && last->offset + last->len == s->offset) {
+            last->len += s->bytes;
+            ++last->frames;
+        } else {
+            spans.push_back(Span{s->segment, s->offset, s->bytes, 1});
+        }
+    }
+    rest->assign(r.entries.begin() + static_cast<std::ptrdiff_t>(i), r.entries.end());
+    return spans;
+}
+
+uint64_t Version() {
+    Ring& r = GetRing();
+    Locks::Lock lock(r.mutex);
+    return r.version;
+}
+
+} // namespace History
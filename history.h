@@ -0,0 +1,81 @@
+#ifndef HISTORY_H_
+#define HISTORY_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "outbound.h"
+
+// Retained chat history.
+//
+// A bounded ring of the most recent room-visible events (public messages,
+// joins and leaves). Entries are immutable and shared, so a
+// reader copies pointers under the lock and does its work afterwards; the
+// snapshot writer never blocks logging for longer than that copy.
+//
+// Every log line passes through Record() with the log file offset just past
+// it, so a captured state knows exactly which prefix of the log it covers.
+// Retained bytes are charged to MemoryBudget::Category::kHistory; when the
+// budget is short the oldest entries go first.
+//
+// With StoreFrames() every retained entry is also appended to a segment
+// file exactly as /history sends it (ReplayMessage, wire-encoded), so a
+// replay is a few byte ranges handed to sendfile() instead of one encode and
+// copy per entry and recipient. A background thread encodes and writes the
+// frames, so Record() (called in log order, under the log lock in
+// best-effort mode) never waits for the disk; an entry's frame counts only
+// once it is written. Segments are unlinked when created, rotate every
+// kSegmentBytes, and are closed once no retained entry or queued replay
+// refers to them.
+
+namespace History {
+
+using Entry = std::shared_ptr<const LogEntry>;
+
+constexpr uint64_t kSegmentBytes = uint64_t(4) << 20;
+
+// Consecutive stored frames in one segment.
+using Span = Outbound::StoredRange;
+
+struct State {
+    std::vector<Entry> entries;     ///< Oldest first
+    uint64_t log_offset = 0;        ///< Log bytes reflected in entries
+    uint64_t version = 0;           ///< Bumped by every Record()/Restore()
+};
+
+// Maximum retained entries (default 500). Call before serving.
+void Configure(size_t capacity);
+
+// Keep segments in dir from now on. False with *error if a segment cannot
+// be created there; history then stays in memory only.
+bool StoreFrames(const std::string& dir, std::string* error);
+
+// The message /history sends for an entry.
+Message ReplayMessage(const LogEntry& entry);
+
+// Note one log line. Only room-visible events are kept.
+void Record(const LogEntry& entry, uint64_t log_offset_after);
+
+// Replace the whole state (warm start).
+void Restore(std::vector<Entry> entries, uint64_t log_offset);
+
+// Consistent copy of the ring (pointer copies only).
+State Capture();
+
+// The last n entries, oldest first.
+std::vector<Entry> Recent(size_t n);
+
+// The same entries as stored frames, oldest first, as far as their frames
+// are written; *rest gets the entries after the first one without a frame
+// (not written yet, a failed write, or StoreFrames() not called), to be
+// encoded by the caller and sent after the spans.
+std::vector<Span> RecentSpans(size_t n, std::vector<Entry>* rest);
+
+uint64_t Version();
+
+} // namespace History
+
+#endif // HISTORY_H_
@@ -0,0 +1,179 @@
+#include "load_client.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include "memory_budget.h"
+
+namespace LoadClient {
+
+Socket Login(const std::string& host, int port, const std::string& name) {
+    Socket sock;
+    try {
+        sock = NetworkLayer::Connect(host, port);
+    } catch (const std::exception&) {
+        return -1;
+    }
+    for (;;) {
+        std::optional<Message> m = NetworkLayer::ReceiveMessage(sock);
+        if (!m.has_value() || m->type != MessageType::COMMAND_RESPONSE) break;
+        if (m->content == "ENTER_USERNAME") {
+            NetworkLayer::SendMessage(sock, MakeMessage(MessageType::COMMAND_RESPONSE, name));
+        } else if (m->content == "USERNAME_ACCEPTED") {
+            return sock;
+        } else {
+            break;   // USERNAME_TAKEN / USERNAME_INVALID / AUTH_FAILED: a load tool does not retry
+        }
+    }
+    NetworkLayer::Close(sock);
+    return -1;
+}
+
+Message MakeMessage(MessageType type, const std::string& content, const std::string& target) {
+    Message m;
+    m.type = type;
+    m.timestamp = NowEpochMs();
+    m.sender_username = "";
+    m.target_username = target;
+    m.content = content;
+    return m;
+}
+
+uint64_t Upload(Socket sock, const std::string& name, const std::string& data) {
+    if (!NetworkLayer::SendMessage(sock, MakeMessage(MessageType::FILE_OFFER,
+                                                     std::to_string(data.size()) + " " + name))) {
+        return 0;
+    }
+    unsigned long long id = 0, chunk = 0, window = 0;
+    for (;;) {
+        std::optional<Message> m = NetworkLayer::ReceiveMessage(sock);
+        if (!m.has_value()) return 0;
+        if (m->type != MessageType::COMMAND_RESPONSE) continue;   // room chatter
+        if (m->content.rfind("FILE_READY ", 0) == 0 &&
+            std::sscanf(m->content.c_str() + 11, "%llu %llu %llu", &id, &chunk, &window) == 3 && chunk > 0) {
+            break;
+        }
+        if (m->content.rfind("FILE_REJECTED", 0) == 0) return 0;
+    }
+    window = std::max(window, chunk);
+    const std::string target = std::to_string(id);
+    uint64_t sent = 0, acked = 0;
+    while (acked < data.size()) {
+        while (sent < data.size() && sent - acked < window) {
+            size_t n = static_cast<size_t>(std::min<uint64_t>(chunk, data.size() - sent));
+            if (!NetworkLayer::SendMessage(sock, MakeMessage(MessageType::FILE_CHUNK, data.substr(sent, n), target))) {
+                return 0;
+            }
+            sent += n;
+        }
+        std::optional<Message> m = NetworkLayer::ReceiveMessage(sock);
+        if (!m.has_value()) return 0;
+        if (m->type == MessageType::COMMAND_RESPONSE && m->content.rfind("FILE_REJECTED", 0) == 0) return 0;
+        unsigned long long ack_id = 0, bytes = 0;
+        if (m->type == MessageType::FILE_ACK && std::sscanf(m->content.c_str(), "%llu %llu", &ack_id, &bytes) == 2 &&
+            ack_id == id) {
+            acked = std::max<uint64_t>(acked, bytes);
+        }
+    }
+    return id;
+}
+
+Receiver::Receiver(std::function<void(Socket, const Message&)> on_message,
+                   std::function<void(Socket)> on_closed, bool busy_poll)
+    : on_message_(std::move(on_message)), on_closed_(std::move(on_closed)), busy_poll_(busy_poll) {
+    epfd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    stop_fd_ = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (epfd_ < 0 || stop_fd_ < 0) throw std::runtime_error("epoll/eventfd failed");
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = stop_fd_;
+    ::epoll_ctl(epfd_, EPOLL_CTL_ADD, stop_fd_, &ev);
+    thread_ = std::thread(&Receiver::Run, this);
+}
+
+Receiver::~Receiver() {
+    Stop();
+    ::close(stop_fd_);
+    ::close(epfd_);
+}
+
+void Receiver::Add(Socket sock) {
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = sock;
+    ::epoll_ctl(epfd_, EPOLL_CTL_ADD, sock, &ev);
+}
+
+void Receiver::Stop() {
+    if (!thread_.joinable()) return;
+    uint64_t one = 1;
+    (void)::write(stop_fd_, &one, sizeof(one));
+    thread_.join();
+}
+
+void Receiver::Run() {
+    epoll_event events[64];
+    for (;;) {
+        int n = ::epoll_wait(epfd_, events, 64, busy_poll_ ? 0 : -1);
+        for (int i = 0; i < n; ++i) {
+            Socket sock = events[i].data.fd;
+            if (sock == stop_fd_) return;
+            if (!Drain(sock)) {
+                ::epoll_ctl(epfd_, EPOLL_CTL_DEL, sock, nullptr);
+                buffers_.erase(sock);
+                on_closed_(sock);
+            }
+        }
+    }
+}
+
+bool Receiver::Drain(Socket sock) {
+    // Never block here: one slow or half-sent frame must not stall every
+    // other socket on this thread. Partial frames wait in the socket's buffer.
+    std::vector<char>& buf = buffers_[sock];
+    char chunk[64 << 10];
+    for (;;) {
+        ssize_t n = ::recv(sock, chunk, sizeof(chunk), MSG_DONTWAIT);
+        if (n > 0) {
+            buf.insert(buf.end(), chunk, chunk + n);
+            continue;
+        }
+        if (n == 0) return false;
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        return false;
+    }
+    size_t pos = 0;
+    while (buf.size() - pos >= sizeof(int32_t)) {
+        int32_t net_len;
+        std::memcpy(&net_len, buf.data() + pos, sizeof(net_len));
+        int32_t total_len = ntohl(net_len);
+        if (total_len <= 0 || static_cast<size_t>(total_len) > MemoryBudget::GetLimits().max_frame_bytes) {
+            return false;
+        }
+        if (buf.size() - pos - sizeof(net_len) < static_cast<size_t>(total_len)) break;
+        pos += sizeof(net_len);
+        std::vector<char> body(buf.begin() + pos, buf.begin() + pos + total_len);
+        pos += static_cast<size_t>(total_len);
+        Message m;
+        try {
+            m = NetworkLayer::Deserialize(body);
+        } catch (...) {
+            return false;
+        }
+        on_message_(sock, m);
+    }
+    buf.erase(buf.begin(), buf.begin() + pos);
+    return true;
+}
+
+} // namespace LoadClient
@@ -0,0 +1,71 @@
+#ifndef LOAD_CLIENT_H_
+#define LOAD_CLIENT_H_
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "common.h"
+#include "network.h"
+
+// Client-side helpers shared by the load tools (chat_replay, chat_loadgen).
+//
+// Login() runs the same handshake as chat_client. Receiver multiplexes many
+// logged-in sockets on one epoll thread and hands each complete frame to a
+// callback, so a tool can hold thousands of connections with two threads.
+// It reads without blocking and keeps each socket's partial frame, so a
+// frame that arrives in pieces holds up only its own connection.
+
+namespace LoadClient {
+
+// Connect and authenticate as name. Returns the socket, or -1 if the server
+// is unreachable or refuses the name.
+Socket Login(const std::string& host, int port, const std::string& name);
+
+// Build a client->server message (sender is filled in by the server).
+Message MakeMessage(MessageType type, const std::string& content,
+                    const std::string& target = "");
+
+// Share data as a file named name over a logged-in socket that no Receiver
+// watches, honouring the server's chunk size and window (file_transfer.h).
+// Returns the file id, or 0 if the server refused it or the link failed.
+uint64_t Upload(Socket sock, const std::string& name, const std::string& data);
+
+class Receiver {
+public:
+    // on_message(sock, msg) for every frame; on_closed(sock) once at EOF,
+    // after which the socket is no longer watched. Sockets stay owned by the
+    // caller, who closes them (never while they are still being watched).
+    // busy_poll: spin on epoll_wait(0) instead of sleeping in it, so the
+    // measuring side adds no wake-up latency (costs a core).
+    Receiver(std::function<void(Socket, const Message&)> on_message,
+             std::function<void(Socket)> on_closed, bool busy_poll = false);
+    ~Receiver();
+
+    // Start watching a logged-in socket.
+    void Add(Socket sock);
+
+    // Stop the thread.
+    void Stop();
+
+private:
+    void Run();
+    // Read what sock has without blocking and hand on every complete frame;
+    // false at EOF, on a read error or on a malformed frame.
+    bool Drain(Socket sock);
+
+    std::function<void(Socket, const Message&)> on_message_;
+    std::function<void(Socket)> on_closed_;
+    int epfd_ = -1;
+    int stop_fd_ = -1;              ///< eventfd that wakes Run() for Stop()
+    bool busy_poll_ = false;
+    std::unordered_map<Socket, std::vector<char>> buffers_;    ///< partial frames; Run() thread only
+    std::thread thread_;
+};
+
+} // namespace LoadClient
+
+#endif // LOAD_CLIENT_H_
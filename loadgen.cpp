@@ -0,0 +1,353 @@
+// loadgen.cpp
+// chat_loadgen: synthetic open-loop load against a running chat_server.
+//
+// Logs in --clients sessions; the first --senders of them send public
+// messages at a fixed total --rate for --duration-s seconds. Every session
+// receives every broadcast, and each delivery is timed from just before the
+// sender's send() until a receiver thread has decoded it (same host, same
+// monotonic clock). Deliveries during --warmup-s are not counted.
+//
+// --presence-rate=N adds N status updates per second across all sessions
+// (alternating typing/online), and reports how many presence frames and
+// bytes that cost each receiver next to the chat traffic.
+//
+// --file-size=BYTES shares one file of that size from an extra session, and
+// --file-downloaders=K has the last K sessions download it over and over
+// while the chat load runs, so delivery latency with and without transfers
+// can be compared.
+//
+// --socket-profile=A,B runs one phase per client-side TCP preset
+// (socket_profile.h), each with fresh logins, and prefixes the report lines
+// with the preset name so the two can be compared side by side.
+//
+// Usage: chat_loadgen [--host=127.0.0.1] [--port=12345] [--clients=N]
+//                     [--senders=N] [--rate=N] [--size=BYTES]
+//                     [--duration-s=N] [--warmup-s=N] [--receivers=N]
+//                     [--prefix=NAME] [--busy-poll] [--socket-profile=A[,B...]]
+//                     [--presence-rate=N] [--file-size=BYTES] [--file-downloaders=K]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common.h"
+#include "histogram.h"
+#include "load_client.h"
+#include "network.h"
+#include "socket_profile.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 12345;
+    int clients = 10;
+    int senders = 1;
+    double rate = 1000;             ///< messages/s across all senders
+    size_t size = 64;               ///< content bytes per message
+    double duration_s = 5;
+    double warmup_s = 1;
+    int receivers = 1;              ///< epoll threads reading server frames
+    std::string prefix = "lg_";
+    bool busy_poll = false;         ///< spin in receivers and between sends
+    std::vector<std::string> profiles;  ///< client TCP presets, one phase each
+    double presence_rate = 0;       ///< status updates/s across all sessions
+    size_t file_size = 0;           ///< shared before the run when > 0
+    int file_downloaders = 0;       ///< last K sessions download it repeatedly
+    std::string report_prefix = "loadgen.";
+};
+
+constexpr char kTag[] = "LG ";
+
+long long NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+
+// "LG <send_ns> " padded with 'x' to size bytes.
+std::string Payload(long long send_ns, size_t size) {
+    std::string s = kTag + std::to_string(send_ns) + " ";
+    if (s.size() < size) s.append(size - s.size(), 'x');
+    return s;
+}
+
+// Per receiver thread; only that thread touches it until Stop().
+struct Sink {
+    Histogram latency;
+    uint64_t delivered = 0;
+    uint64_t chat_bytes = 0;        ///< content bytes of measured deliveries
+    uint64_t presence_frames = 0;
+    uint64_t presence_bytes = 0;
+    std::map<Socket, uint64_t> file_received;   // per downloading socket
+    uint64_t file_bytes = 0;
+    uint64_t files_done = 0;
+};
+
+class LoadGen {
+public:
+    explicit LoadGen(const Options& opt) : opt_(opt) {}
+
+    bool Connect() {
+        for (int i = 0; i < opt_.receivers; ++i) {
+            sinks_.emplace_back(new Sink());
+            Sink* sink = sinks_.back().get();
+            receivers_.emplace_back(new LoadClient::Receiver(
+                [this, sink](Socket s, const Message& m) { OnMessage(sink, s, m); },
+                [](Socket) {}, opt_.busy_poll));
+        }
+        for (int i = 0; i < opt_.clients; ++i) {
+            Socket s = LoadClient::Login(opt_.host, opt_.port, opt_.prefix + std::to_string(i));
+            if (s < 0) {
+                std::cerr << "login failed for " << opt_.prefix << i << "\n";
+                return false;
+            }
+            socks_.push_back(s);
+            receivers_[i % receivers_.size()]->Add(s);
+        }
+        if (opt_.file_size > 0) {
+            // Uploaded before the clock starts; only downloads overlap chat.
+            Socket up = LoadClient::Login(opt_.host, opt_.port, opt_.prefix + "file");
+            file_id_ = up < 0 ? 0 : LoadClient::Upload(up, "loadgen.bin", std::string(opt_.file_size, 'f'));
+            if (up >= 0) NetworkLayer::Close(up);
+            if (file_id_ == 0) {
+                std::cerr << "file upload failed\n";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void Run() {
+        // Join/leave chatter from the logins is not measured.
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        measure_from_ns_.store(NowNs() + static_cast<long long>(opt_.warmup_s * 1e9));
+        const long long end_ns = NowNs() + static_cast<long long>((opt_.warmup_s + opt_.duration_s) * 1e9);
+
+        // Downloaders: the last sessions, never senders, so only their
+        // receiver thread writes to them (acks and the next FILE_GET).
+        if (file_id_ != 0) {
+            for (int i = 0; i < opt_.file_downloaders; ++i) {
+                Socket s = socks_[socks_.size() - 1 - i];
+                NetworkLayer::SendMessage(s, LoadClient::MakeMessage(MessageType::FILE_GET, std::to_string(file_id_)));
+            }
+        }
+        files_until_ns_.store(end_ns);
+
+        std::vector<std::thread> senders;
+        std::atomic<uint64_t> measured_sent{0};
+        const int n = std::min(opt_.senders, opt_.clients);
+        const double interval_ns = 1e9 * n / opt_.rate;
+        for (int i = 0; i < n; ++i) {
+            senders.emplace_back([&, i] {
+                Socket s = socks_[i];
+                // Stagger senders across one interval.
+                double next = NowNs() + interval_ns * i / n;
+                while (next < end_ns) {
+                    WaitUntil(static_cast<long long>(next));
+                    long long t = NowNs();
+                    Message m = LoadClient::MakeMessage(MessageType::PUBLIC_MESSAGE, Payload(t, opt_.size));
+                    if (!NetworkLayer::SendMessage(s, m)) return;
+                    if (t >= measure_from_ns_.load()) measured_sent.fetch_add(1);
+                    next += interval_ns;
+                }
+            });
+        }
+        if (opt_.presence_rate > 0) {
+            senders.emplace_back([&] {
+                // One thread cycles through every session: typing, then online.
+                const double step_ns = 1e9 / opt_.presence_rate;
+                double next = NowNs();
+                for (uint64_t k = 0; next < end_ns; ++k, next += step_ns) {
+                    WaitUntil(static_cast<long long>(next));
+                    Socket s = socks_[k % socks_.size()];
+                    const char* status = (k / socks_.size()) % 2 == 0 ? "typing" : "online";
+                    NetworkLayer::SendMessage(s, LoadClient::MakeMessage(MessageType::PRESENCE_UPDATE, status));
+                }
+            });
+        }
+        for (std::thread& t : senders) t.join();
+        const double sent = static_cast<double>(measured_sent.load());
+
+        // Let the tail arrive, then stop reading before closing anything.
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        for (auto& r : receivers_) r->Stop();
+        for (Socket s : socks_) NetworkLayer::Close(s);
+
+        Histogram all;
+        uint64_t delivered = 0, chat_bytes = 0, presence_frames = 0, presence_bytes = 0, file_bytes = 0,
+                 files_done = 0;
+        for (auto& sink : sinks_) {
+            file_bytes += sink->file_bytes;
+            files_done += sink->files_done;
+            all.Merge(sink->latency);
+            delivered += sink->delivered;
+            chat_bytes += sink->chat_bytes;
+            presence_frames += sink->presence_frames;
+            presence_bytes += sink->presence_bytes;
+        }
+        Report("clients", opt_.clients, "sessions");
+        Report("send_rate", sent / opt_.duration_s, "msgs/s");
+        Report("deliveries", (double)delivered, "frames");
+        Report("expected", sent * opt_.clients, "frames");
+        Report("delivery_rate", delivered / opt_.duration_s, "frames/s");
+        Report("delivery_p50", all.Percentile(0.50), "us");
+        Report("delivery_p90", all.Percentile(0.90), "us");
+        Report("delivery_p99", all.Percentile(0.99), "us");
+        Report("delivery_p999", all.Percentile(0.999), "us");
+        Report("delivery_max", all.Max(), "us");
+        if (file_id_ != 0) {
+            Report("file_downloads", files_done, "files");
+            Report("file_rate", file_bytes / (opt_.duration_s + opt_.warmup_s), "bytes/s");
+        }
+        if (opt_.presence_rate > 0) {
+            Report("presence_frames", presence_frames / (opt_.duration_s + opt_.warmup_s) / opt_.clients,
+                   "frames/s/session");
+            Report("presence_bytes_share",
+                   100.0 * presence_bytes / std::max<double>(1, presence_bytes + chat_bytes), "%");
+        }
+        std::fflush(stdout);
+    }
+
+private:
+    void Report(const std::string& name, double value, const std::string& unit) {
+        std::printf("%-36s %14.2f %s\n", (opt_.report_prefix + name).c_str(), value, unit.c_str());
+    }
+
+    void WaitUntil(long long ns) {
+        if (opt_.busy_poll) {
+            while (NowNs() < ns) {
+            }
+            return;
+        }
+        long long d = ns - NowNs();
+        if (d > 0) std::this_thread::sleep_for(std::chrono::nanoseconds(d));
+    }
+
+    void OnMessage(Sink* sink, Socket sock, const Message& m) {
+        long long now = NowNs();
+        if (m.type == MessageType::FILE_DATA) {
+            uint64_t& got = sink->file_received[sock];
+            got += m.content.size();
+            sink->file_bytes += m.content.size();
+            NetworkLayer::SendMessage(sock, LoadClient::MakeMessage(MessageType::FILE_ACK,
+                                                                    m.target_username + " " + std::to_string(got)));
+            if (got >= opt_.file_size) {
+                got = 0;
+                ++sink->files_done;
+                if (now < files_until_ns_.load(std::memory_order_relaxed)) {
+                    NetworkLayer::SendMessage(sock, LoadClient::MakeMessage(MessageType::FILE_GET, std::to_string(file_id_)));
+                }
+            }
+            return;
+        }
+        if (m.type == MessageType::PRESENCE_DELTA) {
+            ++sink->presence_frames;
+            sink->presence_bytes += m.content.size();
+            return;
+        }
+        if (m.type != MessageType::PUBLIC_MESSAGE || m.content.compare(0, 3, kTag) != 0) return;
+        long long sent = std::strtoll(m.content.c_str() + 3, nullptr, 10);
+        if (sent < measure_from_ns_.load(std::memory_order_relaxed)) return;
+        ++sink->delivered;
+        sink->chat_bytes += m.content.size();
+        sink->latency.Record((now - sent) / 1000.0);
+    }
+
+    Options opt_;
+    std::vector<Socket> socks_;
+    std::vector<std::unique_ptr<Sink>> sinks_;
+    std::vector<std::unique_ptr<LoadClient::Receiver>> receivers_;
+    std::atomic<long long> measure_from_ns_{0};
+    std::atomic<long long> files_until_ns_{0};
+    uint64_t file_id_ = 0;
+};
+
+bool ParseArgs(int argc, char** argv, Options* opt) {
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        auto value = [&](const char* key) -> const char* {
+            size_t n = std::char_traits<char>::length(key);
+            return a.compare(0, n, key) == 0 ? a.c_str() + n : nullptr;
+        };
+        if (const char* v = value("--host=")) opt->host = v;
+        else if (const char* v = value("--port=")) opt->port = std::atoi(v);
+        else if (const char* v = value("--clients=")) opt->clients = std::atoi(v);
+        else if (const char* v = value("--senders=")) opt->senders = std::atoi(v);
+        else if (const char* v = value("--rate=")) opt->rate = std::atof(v);
+        else if (const char* v = value("--size=")) opt->size = std::strtoull(v, nullptr, 10);
+        else if (const char* v = value("--duration-s=")) opt->duration_s = std::atof(v);
+        else if (const char* v = value("--warmup-s=")) opt->warmup_s = std::atof(v);
+        else if (const char* v = value("--receivers=")) opt->receivers = std::atoi(v);
+        else if (const char* v = value("--prefix=")) opt->prefix = v;
+        else if (a == "--busy-poll") opt->busy_poll = true;
+        else if (const char* v = value("--presence-rate=")) opt->presence_rate = std::atof(v);
+        else if (const char* v = value("--file-size=")) opt->file_size = std::strtoull(v, nullptr, 10);
+        else if (const char* v = value("--file-downloaders=")) opt->file_downloaders = std::atoi(v);
+        else if (const char* v = value("--socket-profile=")) {
+            std::string list = v;
+            for (size_t pos = 0; pos <= list.size();) {
+                size_t comma = list.find(',', pos);
+                if (comma == std::string::npos) comma = list.size();
+                opt->profiles.push_back(list.substr(pos, comma - pos));
+                pos = comma + 1;
+            }
+        }
+        else {
+            std::cerr << "unknown argument: " << a << "\n";
+            return false;
+        }
+    }
+    return opt->port > 0 && opt->clients > 0 && opt->senders > 0 && opt->rate > 0 && opt->duration_s > 0 &&
+           opt->warmup_s >= 0 && opt->receivers > 0 && opt->presence_rate >= 0 &&
+           opt->file_downloaders >= 0 && opt->file_downloaders <= opt->clients - std::min(opt->senders, opt->clients);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options opt;
+    if (!ParseArgs(argc, argv, &opt)) {
+        std::cerr << "usage: chat_loadgen [--host=H] [--port=N] [--clients=N] [--senders=N] [--rate=N] "
+                     "[--size=BYTES] [--duration-s=N] [--warmup-s=N] [--receivers=N] [--prefix=NAME] "
+                     "[--busy-poll] [--socket-profile=A[,B...]] [--presence-rate=N] "
+                     "[--file-size=BYTES] [--file-downloaders=K]\n";
+        return 2;
+    }
+    if (opt.profiles.empty()) {
+        LoadGen gen(opt);
+        if (!gen.Connect()) return 1;
+        gen.Run();
+        return 0;
+    }
+    for (const std::string& name : opt.profiles) {
+        SocketProfile::Profile profile;
+        if (!SocketProfile::Preset(name, &profile)) {
+            std::cerr << "unknown socket profile '" << name << "' (" << SocketProfile::PresetNames() << ")\n";
+            return 2;
+        }
+    }
+    for (const std::string& name : opt.profiles) {
+        SocketProfile::Profile profile;
+        SocketProfile::Preset(name, &profile);
+        SocketProfile::SetClient(profile);
+        std::printf("# client socket profile: %s\n", SocketProfile::Describe(profile).c_str());
+        Options phase = opt;
+        phase.prefix = opt.prefix + name + "_";
+        phase.report_prefix = "loadgen." + name + ".";
+        LoadGen gen(phase);
+        if (!gen.Connect()) return 1;
+        gen.Run();
+    }
+    return 0;
+}
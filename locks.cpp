@@ -0,0 +1,107 @@
+#include "locks.h"
+
+#if defined(CHATROOM_LOCK_PROFILE) && CHATROOM_LOCK_PROFILE
+
+#include <cstring>
+#include <string>
+
+#include "metrics.h"
+
+namespace Locks {
+namespace Profile {
+
+namespace {
+
+std::mutex g_site_mutex;     ///< serializes site insertion only
+
+int Bucket(uint64_t ns) {
+    int b = ns ? 64 - __builtin_clzll(ns) : 0;
+    return b < kBuckets ? b : kBuckets - 1;
+}
+
+// Upper bound of the bucket holding the p-th percentile, in ns.
+int64_t Percentile(const std::atomic<uint64_t>* hist, double p) {
+    uint64_t total = 0;
+    for (int i = 0; i < kBuckets; ++i) total += hist[i].load(std::memory_order_relaxed);
+    if (total == 0) return 0;
+    uint64_t rank = static_cast<uint64_t>(p * static_cast<double>(total - 1));
+    uint64_t seen = 0;
+    for (int i = 0; i < kBuckets; ++i) {
+        seen += hist[i].load(std::memory_order_relaxed);
+        if (seen > rank) return i ? int64_t(1) << i : 0;
+    }
+    return int64_t(1) << (kBuckets - 1);
+}
+
+const char* BaseName(const char* path) {
+    const char* slash = std::strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+void RegisterSite(const Stats* stats, const Site* site, const char* file, int line) {
+    std::string prefix = std::string("lock.") + stats->name + ".site." + BaseName(file) + ":" + std::to_string(line);
+    Metrics::RegisterGauge(prefix + ".wait_ns", [site] {
+        return static_cast<int64_t>(site->wait_ns.load(std::memory_order_relaxed));
+    });
+    Metrics::RegisterGauge(prefix + ".contended", [site] {
+        return static_cast<int64_t>(site->contended.load(std::memory_order_relaxed));
+    });
+}
+
+Site* FindSite(Stats* stats, const char* file, int line) {
+    for (Site& s : stats->sites) {
+        const char* f = s.file.load(std::memory_order_acquire);
+        if (!f) break;
+        if (f == file && s.line.load(std::memory_order_relaxed) == line) return &s;
+    }
+    std::lock_guard<std::mutex> lock(g_site_mutex);
+    for (Site& s : stats->sites) {
+        const char* f = s.file.load(std::memory_order_acquire);
+        if (f == file && s.line.load(std::memory_order_relaxed) == line) return &s;
+        if (!f) {
+            s.line.store(line, std::memory_order_relaxed);
+            s.file.store(file, std::memory_order_release);
+            RegisterSite(stats, &s, file, line);
+            return &s;
+        }
+    }
+    return nullptr;     // table full: still counted in the per-mutex totals
+}
+
+} // namespace
+
+Stats::Stats(const char* n) : name(n) {
+    const std::string prefix = std::string("lock.") + name;
+    auto total = [](const std::atomic<uint64_t>& v) {
+        return [&v] { return static_cast<int64_t>(v.load(std::memory_order_relaxed)); };
+    };
+    Metrics::RegisterGauge(prefix + ".acquisitions", total(acquisitions));
+    Metrics::RegisterGauge(prefix + ".contended", total(contended));
+    Metrics::RegisterGauge(prefix + ".wait_ns", total(wait_ns));
+    Metrics::RegisterGauge(prefix + ".hold_ns", total(hold_ns));
+    Metrics::RegisterGauge(prefix + ".wait_p50_ns", [this] { return Percentile(wait_hist, 0.50); });
+    Metrics::RegisterGauge(prefix + ".wait_p99_ns", [this] { return Percentile(wait_hist, 0.99); });
+    Metrics::RegisterGauge(prefix + ".hold_p99_ns", [this] { return Percentile(hold_hist, 0.99); });
+}
+
+void Stats::OnAcquired(const char* file, int line, uint64_t wait, bool was_contended) {
+    acquisitions.fetch_add(1, std::memory_order_relaxed);
+    wait_hist[Bucket(wait)].fetch_add(1, std::memory_order_relaxed);
+    if (!was_contended) return;
+    contended.fetch_add(1, std::memory_order_relaxed);
+    wait_ns.fetch_add(wait, std::memory_order_relaxed);
+    if (Site* site = FindSite(this, file, line)) {
+        site->contended.fetch_add(1, std::memory_order_relaxed);
+        site->wait_ns.fetch_add(wait, std::memory_order_relaxed);
+    }
+}
+
+void Stats::OnHeld(uint64_t hold) {
+    hold_ns.fetch_add(hold, std::memory_order_relaxed);
+    hold_hist[Bucket(hold)].fetch_add(1, std::memory_order_relaxed);
+}
+
+} // namespace Profile
+} // namespace Locks
+
+#endif
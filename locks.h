@@ -0,0 +1,193 @@
+#ifndef LOCKS_H_
+#define LOCKS_H_
+
+#include <mutex>
+#include <shared_mutex>
+
+// Server mutexes, optionally contention-profiled.
+//
+//   Locks::Mutex m{"name"};            Locks::Lock lock(m);
+//   Locks::SharedMutex s{"name"};      Locks::WriteLock w(s);  Locks::ReadLock r(s);
+//
+// Normally these are the std types (the name is ignored). Built with
+// -DCHATROOM_LOCK_PROFILE=ON every acquisition records, per mutex:
+//   lock.<name>.acquisitions / .contended / .wait_ns / .hold_ns  (totals)
+//   lock.<name>.wait_p50_ns / .wait_p99_ns / .hold_p99_ns         (log2 buckets)
+//   lock.<name>.site.<file>:<line>.wait_ns / .contended           (per call site)
+// all exported through Metrics (metrics.h). Call sites are captured by the
+// guard constructors, so use these guards rather than std::lock_guard on a
+// Locks mutex. Hold times are tracked for exclusive holds only.
+
+#if defined(CHATROOM_LOCK_PROFILE) && CHATROOM_LOCK_PROFILE
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace Locks {
+
+namespace Profile {
+
+constexpr int kBuckets = 40;                // log2(ns)
+constexpr int kMaxSites = 64;
+
+struct Site {
+    std::atomic<const char*> file{nullptr};
+    std::atomic<int> line{0};
+    std::atomic<uint64_t> wait_ns{0};
+    std::atomic<uint64_t> contended{0};
+};
+
+struct Stats {
+    explicit Stats(const char* name);
+
+    void OnAcquired(const char* file, int line, uint64_t wait_ns, bool contended);
+    void OnHeld(uint64_t hold_ns);
+
+    const char* name;
+    std::atomic<uint64_t> acquisitions{0};
+    std::atomic<uint64_t> contended{0};
+    std::atomic<uint64_t> wait_ns{0};
+    std::atomic<uint64_t> hold_ns{0};
+    std::atomic<uint64_t> wait_hist[kBuckets] = {};
+    std::atomic<uint64_t> hold_hist[kBuckets] = {};
+    Site sites[kMaxSites];
+};
+
+inline uint64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// try_fn, then lock_fn if that fails; a blocked acquisition is "contended".
+template <class TryFn, class LockFn>
+void Acquire(Stats& stats, const char* file, int line, TryFn try_fn, LockFn lock_fn) {
+    if (try_fn()) {
+        stats.OnAcquired(file, line, 0, false);
+        return;
+    }
+    uint64_t t0 = NowNs();
+    lock_fn();
+    stats.OnAcquired(file, line, NowNs() - t0, true);
+}
+
+} // namespace Profile
+
+class Mutex {
+public:
+    explicit Mutex(const char* name) : stats_(new Profile::Stats(name)) {}
+    Mutex(const Mutex&) = delete;
+    Mutex& operator=(const Mutex&) = delete;
+
+    void lock(const char* file = __builtin_FILE(), int line = __builtin_LINE()) {
+        Profile::Acquire(*stats_, file, line, [&] { return m_.try_lock(); }, [&] { m_.lock(); });
+        held_since_ = Profile::NowNs();
+    }
+    bool try_lock() {
+        if (!m_.try_lock()) return false;
+        held_since_ = Profile::NowNs();
+        return true;
+    }
+    void unlock() {
+        stats_->OnHeld(Profile::NowNs() - held_since_);
+        m_.unlock();
+    }
+
+private:
+    std::mutex m_;
+    Profile::Stats* stats_;         ///< registered with Metrics; never freed
+    uint64_t held_since_ = 0;       ///< written by the holder only
+};
+
+class SharedMutex {
+public:
+    explicit SharedMutex(const char* name) : stats_(new Profile::Stats(name)) {}
+    SharedMutex(const SharedMutex&) = delete;
+    SharedMutex& operator=(const SharedMutex&) = delete;
+
+    void lock(const char* file = __builtin_FILE(), int line = __builtin_LINE()) {
+        Profile::Acquire(*stats_, file, line, [&] { return m_.try_lock(); }, [&] { m_.lock(); });
+        held_since_ = Profile::NowNs();
+    }
+    void unlock() {
+        stats_->OnHeld(Profile::NowNs() - held_since_);
+        m_.unlock();
+    }
+    void lock_shared(const char* file = __builtin_FILE(), int line = __builtin_LINE()) {
+        Profile::Acquire(*stats_, file, line, [&] { return m_.try_lock_shared(); }, [&] { m_.lock_shared(); });
+    }
+    void unlock_shared() { m_.unlock_shared(); }
+
+private:
+    std::shared_mutex m_;
+    Profile::Stats* stats_;
+    uint64_t held_since_ = 0;
+};
+
+// Guards take the call site from their construction point.
+class Lock {
+public:
+    explicit Lock(Mutex& m, const char* file = __builtin_FILE(), int line = __builtin_LINE()) : m_(m) {
+        m_.lock(file, line);
+    }
+    ~Lock() { m_.unlock(); }
+    Lock(const Lock&) = delete;
+    Lock& operator=(const Lock&) = delete;
+
+private:
+    Mutex& m_;
+};
+
+class WriteLock {
+public:
+    explicit WriteLock(SharedMutex& m, const char* file = __builtin_FILE(), int line = __builtin_LINE())
+        : m_(m) {
+        m_.lock(file, line);
+    }
+    ~WriteLock() { m_.unlock(); }
+    WriteLock(const WriteLock&) = delete;
+    WriteLock& operator=(const WriteLock&) = delete;
+
+private:
+    SharedMutex& m_;
+};
+
+class ReadLock {
+public:
+    explicit ReadLock(SharedMutex& m, const char* file = __builtin_FILE(), int line = __builtin_LINE())
+        : m_(m) {
+        m_.lock_shared(file, line);
+    }
+    ~ReadLock() { m_.unlock_shared(); }
+    ReadLock(const ReadLock&) = delete;
+    ReadLock& operator=(const ReadLock&) = delete;
+
+private:
+    SharedMutex& m_;
+};
+
+} // namespace Locks
+
+#else
+
+namespace Locks {
+
+class Mutex : public std::mutex {
+public:
+    explicit Mutex(const char* /*name*/) {}
+};
+
+class SharedMutex : public std::shared_mutex {
+public:
+    explicit SharedMutex(const char* /*name*/) {}
+};
+
+using Lock = std::lock_guard<std::mutex>;
+using WriteLock = std::lock_guard<std::shared_mutex>;
+using ReadLock = std::shared_lock<std::shared_mutex>;
+
+} // namespace Locks
+
+#endif
+
+#endif // LOCKS_H_
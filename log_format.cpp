@@ -0,0 +1,54 @@
+#include "log_format.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <sstream>
+
+#include "user_ids.h"
+
+namespace LogFormat {
+
+namespace {
+
+const char kSep[] = " | ";
+constexpr size_t kSepLen = sizeof(kSep) - 1;
+
+} // namespace
+
+std::string FormatLine(const LogEntry& e) {
+    std::ostringstream oss;
+    oss << e.timestamp
+        << kSep << static_cast<int>(e.event_type)
+        << kSep << UserIds::Name(e.actor_id)
+        << kSep << (e.target_id != kNoUser ? UserIds::Name(e.target_id) : e.target_name)
+        << kSep << e.content;
+    return oss.str();
+}
+
+bool ParseLine(const std::string& line, LogEntry* out) {
+    std::string fields[4];
+    size_t pos = 0;
+    for (std::string& f : fields) {
+        size_t sep = line.find(kSep, pos);
+        if (sep == std::string::npos) return false;
+        f = line.substr(pos, sep - pos);
+        pos = sep + kSepLen;
+    }
+
+    errno = 0;
+    char* end = nullptr;
+    long long ts = std::strtoll(fields[0].c_str(), &end, 10);
+    if (errno != 0 || fields[0].empty() || *end != '\0') return false;
+    long type = std::strtol(fields[1].c_str(), &end, 10);
+    if (fields[1].empty() || *end != '\0' || type < 0) return false;
+
+    out->timestamp = ts;
+    out->event_type = static_cast<MessageType>(type);
+    out->actor_id = UserIds::Intern(fields[2]);
+    out->target_id = UserIds::Find(fields[3]);
+    out->target_name = out->target_id == kNoUser ? fields[3] : std::string();
+    out->content = line.substr(pos);
+    return true;
+}
+
+} // namespace LogFormat
@@ -0,0 +1,27 @@
+#ifndef LOG_FORMAT_H_
+#define LOG_FORMAT_H_
+
+#include <string>
+
+#include "common.h"
+
+// Text encoding of one chat log line:
+//
+//   <timestamp> | <type as int> | <actor name> | <target name> | <content>
+//
+// Ids are written as names so the log stays readable and independent of the
+// intern table of the process that wrote it. Content is the last field and
+// may itself contain " | ".
+
+namespace LogFormat {
+
+std::string FormatLine(const LogEntry& e);
+
+// Parse a line produced by FormatLine. The actor is interned (it was an
+// accepted user when the line was written); the target is only looked up and
+// kept as target_name if unknown. Returns false for malformed lines.
+bool ParseLine(const std::string& line, LogEntry* out);
+
+} // namespace LogFormat
+
+#endif // LOG_FORMAT_H_
@@ -0,0 +1,101 @@
+#include "memory_budget.h"
+
+#include "metrics.h"
+
+namespace MemoryBudget {
+
+namespace {
+
+constexpr size_t kCategories = static_cast<size_t>(Category::kCount);
+const char* const kCategoryNames[kCategories] = {"receive", "send_queue", "history"};
+
+// Atomic so Configure may run again (tests, benchmarks) while other threads
+// charge; each charge reads the limit it checks against once.
+std::atomic<size_t> g_max_frame_bytes{Limits{}.max_frame_bytes};
+std::atomic<size_t> g_per_connection_bytes{Limits{}.per_connection_bytes};
+std::atomic<size_t> g_global_bytes{Limits{}.global_bytes};
+std::atomic<int64_t> g_total{0};
+std::atomic<int64_t> g_by_category[kCategories];
+
+bool TryAdd(std::atomic<int64_t>& counter, size_t bytes, size_t limit) {
+    int64_t cur = counter.load(std::memory_order_relaxed);
+    for (;;) {
+        if (cur + static_cast<int64_t>(bytes) > static_cast<int64_t>(limit)) return false;
+        if (counter.compare_exchange_weak(cur, cur + bytes, std::memory_order_relaxed)) return true;
+    }
+}
+
+} // namespace
+
+void Configure(const Limits& limits) {
+    g_max_frame_bytes.store(limits.max_frame_bytes, std::memory_order_relaxed);
+    g_per_connection_bytes.store(limits.per_connection_bytes, std::memory_order_relaxed);
+    g_global_bytes.store(limits.global_bytes, std::memory_order_relaxed);
+    for (size_t i = 0; i < kCategories; ++i) {
+        Metrics::RegisterGauge(std::string("mem.") + kCategoryNames[i] + ".bytes",
+                               [i] { return g_by_category[i].load(std::memory_order_relaxed); });
+    }
+    Metrics::RegisterGauge("mem.global.bytes", [] { return GlobalUsed(); });
+    Metrics::RegisterGauge("mem.global.limit_bytes", [] { return (int64_t)g_global_bytes.load(); });
+    Metrics::RegisterGauge("mem.connection.limit_bytes", [] { return (int64_t)g_per_connection_bytes.load(); });
+    Metrics::RegisterGauge("mem.max_frame_bytes", [] { return (int64_t)g_max_frame_bytes.load(); });
+}
+
+Limits GetLimits() {
+    Limits limits;
+    limits.max_frame_bytes = g_max_frame_bytes.load(std::memory_order_relaxed);
+    limits.per_connection_bytes = g_per_connection_bytes.load(std::memory_order_relaxed);
+    limits.global_bytes = g_global_bytes.load(std::memory_order_relaxed);
+    return limits;
+}
+
+bool TryChargeGlobal(Category category, size_t bytes, bool control) {
+    size_t limit = g_global_bytes.load(std::memory_order_relaxed) * (control ? kControlHeadroom : 1);
+    if (!TryAdd(g_total, bytes, limit)) return false;
+    g_by_category[static_cast<size_t>(category)].fetch_add(bytes, std::memory_order_relaxed);
+    return true;
+}
+
+void ReleaseGlobal(Category category, size_t bytes) {
+    g_total.fetch_sub(bytes, std::memory_order_relaxed);
+    g_by_category[static_cast<size_t>(category)].fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+bool TryChargeAccount(Account& account, size_t bytes, bool control) {
+    size_t limit = g_per_connection_bytes.load(std::memory_order_relaxed) * (control ? kControlHeadroom : 1);
+    return TryAdd(account.used, bytes, limit);
+}
+
+void ReleaseAccount(Account& account, size_t bytes) {
+    account.used.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+int64_t Used(Category category) {
+    return g_by_category[static_cast<size_t>(category)].load(std::memory_order_relaxed);
+}
+
+int64_t GlobalUsed() {
+    return g_total.load(std::memory_order_relaxed);
+}
+
+void CountOversizedFrame() {
+    static std::atomic<int64_t>& c = Metrics::Counter("mem.shed.oversized_frames");
+    c.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CountShedReceive() {
+    static std::atomic<int64_t>& c = Metrics::Counter("mem.shed.receive_frames");
+    c.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CountShedFrame() {
+    static std::atomic<int64_t>& c = Metrics::Counter("mem.shed.frames");
+    c.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CountShedConnection() {
+    static std::atomic<int64_t>& c = Metrics::Counter("mem.shed.connections");
+    c.fetch_add(1, std::memory_order_relaxed);
+}
+
+} // namespace MemoryBudget
@@ -0,0 +1,75 @@
+#ifndef MEMORY_BUDGET_H_
+#define MEMORY_BUDGET_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Memory accounting for per-client buffers.
+//
+// Every byte a peer can make the server hold is charged to a category and to
+// the process-wide total; queued outbound bytes are also charged to the
+// receiving connection's Account. Limits and what happens when they are hit:
+//
+//  - max_frame_bytes: an inbound length prefix above it is a protocol
+//    violation; ReceiveMessage refuses the frame and the connection closes.
+//  - global_bytes: receive buffers that do not fit are refused the same way;
+//    outbound frames that do not fit are not queued at all (shed for everyone).
+//  - per_connection_bytes: bulk frames that would push one connection's
+//    queue over it are dropped for that connection only.
+//  - Control frames may use up to kControlHeadroom times both limits so auth
+//    replies and GOODBYE still get through; a connection that exceeds even
+//    that is disconnected as a slow consumer.
+//
+// Broadcast frames are shared between mailboxes: the global total counts the
+// buffer once, each connection's Account counts what it pins.
+
+namespace MemoryBudget {
+
+enum class Category {
+    kReceive,                   ///< Inbound frame buffers being decoded
+    kSendQueue,                 ///< Frames waiting in connection mailboxes
+    kHistory,                   ///< Retained chat history
+    kCount
+};
+
+struct Limits {
+    size_t max_frame_bytes = 1 << 20;           ///< 1 MiB
+    size_t per_connection_bytes = 8 << 20;      ///< 8 MiB queued per connection
+    size_t global_bytes = size_t(1) << 30;      ///< 1 GiB across all categories
+};
+
+constexpr size_t kControlHeadroom = 2;
+
+// Per-connection usage (queued outbound bytes).
+struct Account {
+    std::atomic<int64_t> used{0};
+};
+
+// Set limits and register the mem.* metrics. The server calls it once at
+// startup; calling it again (benchmarks, tests) is allowed and takes effect
+// for the next charge, without re-checking bytes already charged.
+void Configure(const Limits& limits);
+Limits GetLimits();
+
+// Charge bytes to the global total. With control=true the headroom applies.
+// Returns false (nothing charged) if the budget would be exceeded.
+bool TryChargeGlobal(Category category, size_t bytes, bool control = false);
+void ReleaseGlobal(Category category, size_t bytes);
+
+// Charge bytes to one connection. Same headroom rule as above.
+bool TryChargeAccount(Account& account, size_t bytes, bool control = false);
+void ReleaseAccount(Account& account, size_t bytes);
+
+int64_t Used(Category category);
+int64_t GlobalUsed();
+
+// Shedding counters, also exported as metrics.
+void CountOversizedFrame();
+void CountShedReceive();
+void CountShedFrame();
+void CountShedConnection();
+
+} // namespace MemoryBudget
+
+#endif // MEMORY_BUDGET_H_
@@ -0,0 +1,76 @@
+#include "metrics.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+namespace Metrics {
+
+namespace {
+
+struct Registry {
+    std::mutex mutex;
+    std::map<std::string, std::unique_ptr<std::atomic<int64_t>>> counters;
+    std::map<std::string, std::function<int64_t()>> gauges;
+};
+
+Registry& GetRegistry() {
+    static Registry* registry = new Registry();   // used until exit
+    return *registry;
+}
+
+} // namespace
+
+std::atomic<int64_t>& Counter(const std::string& name) {
+    Registry& r = GetRegistry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    auto& slot = r.counters[name];
+    if (!slot) slot.reset(new std::atomic<int64_t>(0));
+    return *slot;
+}
+
+void RegisterGauge(const std::string& name, std::function<int64_t()> fn) {
+    Registry& r = GetRegistry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.gauges[name] = std::move(fn);
+}
+
+std::string Render() {
+    Registry& r = GetRegistry();
+    std::map<std::string, int64_t> values;
+    std::map<std::string, std::function<int64_t()>> gauges;
+    {
+        std::lock_guard<std::mutex> lock(r.mutex);
+        for (const auto& kv : r.counters) values[kv.first] = kv.second->load(std::memory_order_relaxed);
+        gauges = r.gauges;
+    }
+    // Sample gauges unlocked: they may take other subsystems' locks.
+    for (const auto& kv : gauges) values[kv.first] = kv.second();
+
+    std::ostringstream oss;
+    for (const auto& kv : values) oss << kv.first << " " << kv.second << "\n";
+    return oss.str();
+}
+
+void StartReporter(const std::string& path, int interval_ms) {
+    if (path.empty() || interval_ms <= 0) return;
+    std::thread([path, interval_ms] {
+        const std::string tmp = path + ".tmp";
+        for (;;) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+            {
+                std::ofstream out(tmp, std::ios::trunc);
+                if (!out.is_open()) continue;
+                out << Render();
+            }
+            std::rename(tmp.c_str(), path.c_str());
+        }
+    }).detach();
+}
+
+} // namespace Metrics
@@ -0,0 +1,32 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// Process-wide metrics surface.
+//
+// Counters are plain atomics registered by name; call sites look them up once
+// (function-local static reference) and then only pay a relaxed fetch_add.
+// Gauges are callbacks sampled at render time. Render() produces one
+// "name value" line per metric, sorted by name, and the optional reporter
+// thread rewrites a file with it periodically (atomically via rename).
+
+namespace Metrics {
+
+// Stable reference; never invalidated.
+std::atomic<int64_t>& Counter(const std::string& name);
+
+// fn is called from Render(); it must be thread-safe.
+void RegisterGauge(const std::string& name, std::function<int64_t()> fn);
+
+std::string Render();
+
+// Rewrite path with Render() every interval_ms on a background thread.
+void StartReporter(const std::string& path, int interval_ms);
+
+} // namespace Metrics
+
+#endif // METRICS_H_
@@ -0,0 +1,97 @@
+#ifndef MPSC_QUEUE_H_
+#define MPSC_QUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+/**
+ * @file mpsc_queue.h
+ * @brief Bounded lock-free multi-producer / single-consumer ring.
+ *
+ * Each cell carries a sequence number (Vyukov's bounded queue): producers
+ * claim a slot with one CAS on the tail and publish it by bumping the cell
+ * sequence; the single consumer walks the head without any atomic RMW.
+ * A producer that has claimed but not yet published a cell stalls the
+ * consumer at that cell only until it publishes, so per-producer FIFO order
+ * is preserved.
+ */
+template <typename T>
+class MpscQueue {
+public:
+    /// @param capacity Rounded up to the next power of two (minimum 2).
+    explicit MpscQueue(size_t capacity) {
+        size_t cap = 2;
+        while (cap < capacity) cap <<= 1;
+        mask_ = cap - 1;
+        cells_.reset(new Cell[cap]);
+        for (size_t i = 0; i < cap; ++i) {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+        tail_.store(0, std::memory_order_relaxed);
+        head_ = 0;
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    size_t Capacity() const { return mask_ + 1; }
+
+    /// Any thread. Returns false (and leaves @p value untouched) when full.
+    bool TryPush(T&& value) {
+        Cell* cell;
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = std::move(value);
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Consumer thread only. Appends up to @p max_items to @p out and
+    /// returns how many were taken.
+    size_t PopBatch(std::vector<T>& out, size_t max_items) {
+        size_t n = 0;
+        while (n < max_items) {
+            Cell* cell = &cells_[head_ & mask_];
+            if (cell->seq.load(std::memory_order_acquire) != head_ + 1) break;
+            out.push_back(std::move(cell->value));
+            cell->value = T();
+            cell->seq.store(head_ + mask_ + 1, std::memory_order_release);
+            ++head_;
+            ++n;
+        }
+        return n;
+    }
+
+    /// Consumer thread only. True when the next cell has not been published.
+    bool Empty() const {
+        const Cell* cell = &cells_[head_ & mask_];
+        return cell->seq.load(std::memory_order_acquire) != head_ + 1;
+    }
+
+private:
+    struct alignas(64) Cell {
+        std::atomic<size_t> seq;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> cells_;
+    size_t mask_ = 0;
+    alignas(64) std::atomic<size_t> tail_;
+    alignas(64) size_t head_;
+};
+
+#endif // MPSC_QUEUE_H_
@@ -0,0 +1,411 @@
+#include "netsim.h"
+
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include "memory_budget.h"
+#include "network.h"
+
+namespace NetSim {
+
+namespace {
+
+struct Segment {
+    long long arrive_us;
+    std::vector<char> bytes;
+};
+
+struct Endpoint {
+    Socket peer = -1;
+    bool closed = false;                ///< Local Close() or Disconnect()
+    bool read_shut = false;             ///< ShutdownRead(): reads end, writes go on
+    LinkParams link;                    ///< For data leaving this endpoint
+    long long link_busy_until = 0;      ///< Serialization queue on the link
+    std::deque<Segment> inbound;        ///< Toward this endpoint, not yet arrived
+    std::vector<char> rx;               ///< Arrived, not yet consumed
+    size_t rx_pos = 0;
+    size_t buffered = 0;                ///< In flight + unread toward this endpoint
+    EndpointStats stats;
+};
+
+struct Listener {
+    std::deque<Socket> pending;
+    bool closed = false;
+};
+
+std::mutex g_mutex;
+std::condition_variable g_cv;
+long long g_now = 0;
+uint64_t g_version = 0;
+LinkParams g_default_link;
+Socket g_next_fd = 3;
+std::map<Socket, std::unique_ptr<Endpoint>> g_endpoints;
+std::map<Socket, std::unique_ptr<Listener>> g_listeners;   // by listen socket
+std::map<int, Socket> g_ports;                             // port -> listen socket
+
+Endpoint* Find(Socket sock) {
+    auto it = g_endpoints.find(sock);
+    return it == g_endpoints.end() ? nullptr : it->second.get();
+}
+
+// Move arrived segments into the receive buffer. Caller holds g_mutex.
+void Settle(Endpoint* ep) {
+    while (!ep->inbound.empty() && ep->inbound.front().arrive_us <= g_now) {
+        std::vector<char>& b = ep->inbound.front().bytes;
+        ep->rx.insert(ep->rx.end(), b.begin(), b.end());
+        ep->inbound.pop_front();
+    }
+}
+
+// Whether more data can still reach ep. Caller holds g_mutex.
+bool PeerGone(Endpoint* ep) {
+    Endpoint* peer = Find(ep->peer);
+    return ep->closed || !peer || peer->closed;
+}
+
+// Pop one complete frame from rx, if present. Caller holds g_mutex.
+std::optional<std::vector<char>> TakeFrame(Endpoint* ep) {
+    size_t avail = ep->rx.size() - ep->rx_pos;
+    if (avail < 4) return std::nullopt;
+    int32_t net_len;
+    std::memcpy(&net_len, ep->rx.data() + ep->rx_pos, 4);
+    int32_t len = ntohl(net_len);
+    if (len > 0 && static_cast<size_t>(len) > MemoryBudget::GetLimits().max_frame_bytes) {
+        // Same policy as the socket layer: refuse and drop the connection.
+        MemoryBudget::CountOversizedFrame();
+        ep->closed = true;
+        return std::nullopt;
+    }
+    if (len <= 0 || avail < 4 + static_cast<size_t>(len)) return std::nullopt;
+    std::vector<char> payload(ep->rx.begin() + ep->rx_pos + 4,
+                              ep->rx.begin() + ep->rx_pos + 4 + len);
+    ep->rx_pos += 4 + len;
+    ep->buffered -= 4 + len;
+    if (ep->rx_pos == ep->rx.size()) {
+        ep->rx.clear();
+        ep->rx_pos = 0;
+    }
+    ep->stats.bytes_received += 4 + len;
+    ep->stats.frames_received++;
+    return payload;
+}
+
+// Write len bytes from sock toward its peer, honouring partial writes and the
+// receiver window. Blocks on the window; returns false once either end closes.
+bool Transmit(Socket sock, const char* data, size_t len) {
+    std::unique_lock<std::mutex> lock(g_mutex);
+    size_t off = 0;
+    bool blocked = false;
+    while (off < len) {
+        Endpoint* ep = Find(sock);
+        if (!ep || PeerGone(ep)) return false;
+        Endpoint* peer = Find(ep->peer);
+
+        size_t chunk = len - off;
+        if (ep->link.max_write_bytes && chunk > ep->link.max_write_bytes) {
+            chunk = ep->link.max_write_bytes;
+        }
+        if (ep->link.recv_window_bytes) {
+            size_t buffered = peer->buffered;
+            if (buffered >= ep->link.recv_window_bytes) {
+                if (!blocked) ep->stats.blocked_writes++;
+                blocked = true;
+                g_cv.wait(lock);
+                continue;
+            }
+            chunk = std::min(chunk, ep->link.recv_window_bytes - buffered);
+        }
+
+        long long start = std::max(g_now, ep->link_busy_until);
+        long long xmit = ep->link.bandwidth_bps
+            ? static_cast<long long>(chunk * 1000000ULL / ep->link.bandwidth_bps) : 0;
+        ep->link_busy_until = start + xmit;
+        peer->inbound.push_back(Segment{ep->link_busy_until + ep->link.latency_us,
+                                        std::vector<char>(data + off, data + off + chunk)});
+        peer->buffered += chunk;
+        peer->stats.max_buffered_bytes = std::max(peer->stats.max_buffered_bytes, peer->buffered);
+        ep->stats.bytes_sent += chunk;
+        ep->stats.write_calls++;
+        off += chunk;
+        ++g_version;
+        g_cv.notify_all();
+    }
+    return true;
+}
+
+} // namespace
+
+void Reset() {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    // Threads still blocked on an old endpoint look it up again when they
+    // wake, find nothing and return as if it had closed. Fds are never
+    // reused, so an old one cannot name an endpoint made after the reset.
+    g_endpoints.clear();
+    g_listeners.clear();
+    g_ports.clear();
+    g_now = 0;
+    ++g_version;
+    g_cv.notify_all();
+}
+
+void SetDefaultLink(const LinkParams& params) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_default_link = params;
+}
+
+void SetLink(Socket sock, const LinkParams& params) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    if (Endpoint* ep = Find(sock)) ep->link = params;
+    g_cv.notify_all();
+}
+
+long long Now() {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    return g_now;
+}
+
+void Advance(long long us) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_now += us;
+    g_cv.notify_all();
+}
+
+bool AdvanceToNextEvent() {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    long long next = -1;
+    for (auto& kv : g_endpoints) {
+        for (const auto& seg : kv.second->inbound) {
+            if (seg.arrive_us > g_now && (next < 0 || seg.arrive_us < next)) next = seg.arrive_us;
+        }
+    }
+    if (next < 0) return false;
+    g_now = next;
+    g_cv.notify_all();
+    return true;
+}
+
+uint64_t Version() {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    return g_version;
+}
+
+bool WaitForChange(uint64_t since, int timeout_ms) {
+    std::unique_lock<std::mutex> lock(g_mutex);
+    return g_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                         [since] { return g_version != since; });
+}
+
+std::optional<Message> TryReceive(Socket sock) {
+    std::vector<char> payload;
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        Endpoint* ep = Find(sock);
+        if (!ep) return std::nullopt;
+        Settle(ep);
+        auto frame = TakeFrame(ep);
+        if (!frame) return std::nullopt;
+        payload = std::move(*frame);
+        g_cv.notify_all();   // window opened
+    }
+    try {
+        return NetworkLayer::Deserialize(payload);
+    } catch (...) {
+        return std::nullopt;
+    }
+}
+
+void Disconnect(Socket sock) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    Endpoint* ep = Find(sock);
+    if (!ep) return;
+    ep->closed = true;
+    if (Endpoint* peer = Find(ep->peer)) peer->closed = true;
+    ++g_version;
+    g_cv.notify_all();
+}
+
+bool IsClosed(Socket sock) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    Endpoint* ep = Find(sock);
+    if (!ep) return true;
+    Settle(ep);
+    return PeerGone(ep) && ep->inbound.empty() && ep->rx.size() == ep->rx_pos;
+}
+
+EndpointStats GetStats(Socket sock) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    Endpoint* ep = Find(sock);
+    return ep ? ep->stats : EndpointStats{};
+}
+
+} // namespace NetSim
+
+// ====================================================================
+// NetworkLayer socket API served by the simulator
+// ====================================================================
+namespace NetworkLayer {
+
+using namespace NetSim;
+
+Socket StartServer(int listen_port) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    if (g_ports.count(listen_port)) throw std::runtime_error("bind() failed");
+    Socket fd = g_next_fd++;
+    g_listeners[fd] = std::make_unique<Listener>();
+    g_ports[listen_port] = fd;
+    return fd;
+}
+
+Socket Accept(Socket server_socket) {
+    return Accept(server_socket, -1);
+}
+
+Socket Accept(Socket server_socket, int wake_fd) {
+    std::unique_lock<std::mutex> lock(g_mutex);
+    for (;;) {
+        // wake_fd is a real descriptor; the simulator cannot wait on it, so
+        // it is polled between short condition-variable waits.
+        pollfd wake{wake_fd, POLLIN, 0};
+        if (wake_fd >= 0 && ::poll(&wake, 1, 0) > 0) return -1;
+        auto it = g_listeners.find(server_socket);
+        if (it == g_listeners.end() || it->second->closed) throw std::runtime_error("accept() failed");
+        if (!it->second->pending.empty()) {
+            Socket s = it->second->pending.front();
+            it->second->pending.pop_front();
+            return s;
+        }
+        if (wake_fd >= 0) {
+            g_cv.wait_for(lock, std::chrono::milliseconds(10));
+        } else {
+            g_cv.wait(lock);
+        }
+    }
+}
+
+Socket Connect(const std::string & /*server_host*/, int server_port) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    auto port = g_ports.find(server_port);
+    if (port == g_ports.end()) throw std::runtime_error("connect() failed");
+    Socket client = g_next_fd++;
+    Socket server = g_next_fd++;
+    auto c = std::make_unique<Endpoint>();
+    auto s = std::make_unique<Endpoint>();
+    c->peer = server;
+    s->peer = client;
+    c->link = g_default_link;
+    s->link = g_default_link;
+    g_endpoints[client] = std::move(c);
+    g_endpoints[server] = std::move(s);
+    g_listeners[port->second]->pending.push_back(server);
+    ++g_version;
+    g_cv.notify_all();
+    return client;
+}
+
+bool SendFrame(Socket sock, const Frame &frame) {
+    if (!frame) return false;
+    return Transmit(sock, frame->data(), frame->size());
+}
+
+bool SendFrames(Socket sock, const std::vector<Frame> &frames) {
+    for (const Frame &f : frames) {
+        if (!SendFrame(sock, f)) return false;
+    }
+    return true;
+}
+
+// Simulated sockets always copy.
+bool EnableZeroCopy(Socket) {
+    return false;
+}
+
+bool SendFramesZeroCopy(Socket sock, const std::vector<Frame> &frames, size_t *calls) {
+    *calls = 0;
+    return SendFrames(sock, frames);
+}
+
+size_t ReadZeroCopyDone(Socket, std::vector<ZeroCopyDone> *) {
+    return 0;
+}
+
+bool SendFileFrame(Socket sock, const Frame &header, int fd, uint64_t offset, size_t len) {
+    return SendFrame(sock, header) && SendFileRange(sock, fd, offset, len);
+}
+
+bool SendFileRange(Socket sock, int fd, uint64_t offset, size_t len) {
+    // No zero-copy path in the simulator: read the range, then transmit it.
+    std::vector<char> data(len);
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = ::pread(fd, data.data() + got, len - got, static_cast<off_t>(offset + got));
+        if (n <= 0) return false;
+        got += static_cast<size_t>(n);
+    }
+    return Transmit(sock, data.data(), data.size());
+}
+
+bool SendMessage(Socket sock, const Message &msg) {
+    return SendFrame(sock, EncodeFrame(msg));
+}
+
+std::optional<Message> ReceiveMessage(Socket sock) {
+    std::vector<char> payload;
+    {
+        std::unique_lock<std::mutex> lock(g_mutex);
+        for (;;) {
+            Endpoint* ep = Find(sock);
+            if (!ep || ep->closed || ep->read_shut) return std::nullopt;
+            Settle(ep);
+            if (auto frame = TakeFrame(ep)) {
+                payload = std::move(*frame);
+                g_cv.notify_all();
+                break;
+            }
+            if (PeerGone(ep) && ep->inbound.empty()) return std::nullopt;
+            g_cv.wait(lock);
+        }
+    }
+    try {
+        return Deserialize(payload);
+    } catch (...) {
+        return std::nullopt;
+    }
+}
+
+void Shutdown(Socket sock) {
+    NetSim::Disconnect(sock);
+}
+
+void Abort(Socket sock) {
+    NetSim::Disconnect(sock);
+}
+
+void ShutdownRead(Socket sock) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    if (Endpoint* ep = Find(sock)) ep->read_shut = true;
+    ++g_version;
+    g_cv.notify_all();
+}
+
+void Close(Socket sock) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    if (Endpoint* ep = Find(sock)) ep->closed = true;
+    auto it = g_listeners.find(sock);
+    if (it != g_listeners.end()) it->second->closed = true;
+    ++g_version;
+    g_cv.notify_all();
+}
+
+} // namespace NetworkLayer
@@ -0,0 +1,91 @@
+#ifndef NETSIM_H_
+#define NETSIM_H_
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "common.h"
+
+/**
+ * @file netsim.h
+ * @brief Deterministic in-process implementation of the NetworkLayer API.
+ *
+ * Link netsim.cpp (plus codec.cpp) instead of network.cpp and every
+ * NetworkLayer call is served by simulated connections:
+ *
+ *  - StartServer/Connect/Accept pair endpoints through an in-memory listener.
+ *  - Bytes written to an endpoint become segments that arrive at its peer
+ *    after the link's latency and serialization delay (bandwidth), measured
+ *    on a virtual microsecond clock that only moves when the driver calls
+ *    Advance()/AdvanceToNextEvent(). Per-link ordering does not depend on
+ *    thread scheduling. Arrival times are stamped from the clock when the
+ *    bytes are written, so they are reproducible only when nothing writes
+ *    while the clock moves: a scenario driven from one thread, or one whose
+ *    driver waits for the server threads to go quiet before advancing.
+ *  - max_write_bytes splits every send into partial writes, so readers see
+ *    frames arrive in pieces.
+ *  - recv_window_bytes bounds bytes in flight plus unread at the receiver;
+ *    a sender blocks (as a real send() would) until the reader catches up,
+ *    which is how slow consumers and backpressure are reproduced.
+ *  - Disconnect() resets a connection from outside, for reconnect storms.
+ *
+ * The driver owns the "client" ends and reads them with TryReceive(); the
+ * server under test uses the blocking NetworkLayer calls on its own threads.
+ */
+namespace NetSim {
+
+struct LinkParams {
+    long long latency_us = 0;       ///< One-way propagation delay
+    uint64_t bandwidth_bps = 0;     ///< Bytes per second; 0 = unlimited
+    size_t max_write_bytes = 0;     ///< Cap per send call; 0 = whole buffer
+    size_t recv_window_bytes = 0;   ///< Receiver buffer; 0 = unlimited
+};
+
+struct EndpointStats {
+    uint64_t bytes_sent = 0;        ///< Accepted from the application
+    uint64_t bytes_received = 0;    ///< Consumed by the application
+    uint64_t frames_received = 0;
+    uint64_t write_calls = 0;       ///< Partial writes count separately
+    uint64_t blocked_writes = 0;    ///< Writes that waited on the window
+    size_t max_buffered_bytes = 0;  ///< Peak in-flight + unread toward this endpoint
+};
+
+// Free every endpoint and listener and rewind the clock to 0. Threads still
+// blocked on them return as if the connection had closed.
+void Reset();
+
+// Parameters for links created afterwards (both directions).
+void SetDefaultLink(const LinkParams& params);
+
+// Parameters for data sent *from* sock toward its peer.
+void SetLink(Socket sock, const LinkParams& params);
+
+// Virtual clock (microseconds since Reset()).
+long long Now();
+void Advance(long long us);
+
+// Jump the clock to the earliest pending arrival. False if nothing is in flight.
+bool AdvanceToNextEvent();
+
+// Change counter bumped by every write, connect, close and disconnect.
+uint64_t Version();
+
+// Wait (real time) until Version() moves past since. Used by drivers while
+// server threads are still producing, so they sleep instead of spinning.
+bool WaitForChange(uint64_t since, int timeout_ms);
+
+// Non-blocking receive of one complete frame that has already arrived.
+std::optional<Message> TryReceive(Socket sock);
+
+// Both directions closed; blocked readers and writers on either end return.
+void Disconnect(Socket sock);
+
+// True once no further frame can arrive at sock.
+bool IsClosed(Socket sock);
+
+EndpointStats GetStats(Socket sock);
+
+} // namespace NetSim
+
+#endif // NETSIM_H_
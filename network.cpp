@@ -1,15 +1,25 @@
 #include "network.h"
 
 #include <arpa/inet.h>
+#include <linux/errqueue.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <optional>
 
+#include <cerrno>
 #include <cstring>
 #include <stdexcept>
 #include <vector>
 
+#include "busy_poll.h"
+#include "memory_budget.h"
+#include "socket_profile.h"
+#include "trace.h"
+
 namespace NetworkLayer {
 
 // ------------------ Helpers ------------------
@@ -18,6 +28,7 @@ static bool send_all(Socket sock, const char *buf, size_t len) {
     size_t sent = 0;
     while (sent < len) {
         ssize_t n = ::send(sock, buf + sent, len - sent, MSG_NOSIGNAL); 
+        if (n < 0 && errno == EINTR) continue;  // e.g. a profiler SIGPROF
         if (n <= 0) return false;
         sent += n;
     }
@@ -26,89 +37,35 @@ static bool send_all(Socket sock, const char *buf, size_t len) {
 
 static bool recv_all(Socket sock, char *buf, size_t len) {
     size_t recvd = 0;
+    if (BusyPoll::Enabled()) {
+        // Spin on non-blocking reads; park in recv() only if the window
+        // passes without the rest of the data.
+        bool closed = false;
+        BusyPoll::SpinUntil([&] {
+            ssize_t n = ::recv(sock, buf + recvd, len - recvd, MSG_DONTWAIT);
+            if (n > 0) {
+                recvd += n;
+            } else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                closed = true;
+            }
+            return closed || recvd == len;
+        });
+        if (closed) return false;
+        if (recvd == len) {
+            BusyPoll::CountSpinHit();
+            return true;
+        }
+        BusyPoll::CountPark();
+    }
     while (recvd < len) {
         ssize_t n = ::recv(sock, buf + recvd, len - recvd, 0);
+        if (n < 0 && errno == EINTR) continue;
         if (n <= 0) return false;
         recvd += n;
     }
     return true;
 }
 
-// ------------------ Serialization ------------------
-
-std::vector<char> Serialize(const Message &msg) {
-    std::vector<char> buffer;
-
-    auto write_int32 = [&](int32_t v) {
-        int32_t netv = htonl(v);
-        const char *p = reinterpret_cast<const char *>(&netv);
-        buffer.insert(buffer.end(), p, p + sizeof(netv));
-    };
-    auto write_int64 = [&](int64_t v) {
-        // convert to network order manually (big-endian)
-        uint64_t uv = static_cast<uint64_t>(v);
-        for (int i = 7; i >= 0; --i) {
-            buffer.push_back(static_cast<char>((uv >> (i * 8)) & 0xFF));
-        }
-    };
-    auto write_string = [&](const std::string &s) {
-        write_int32(static_cast<int32_t>(s.size()));
-        buffer.insert(buffer.end(), s.begin(), s.end());
-    };
-
-    write_int32(static_cast<int32_t>(msg.type));
-    write_int64(msg.timestamp);
-    write_string(msg.sender_username);
-    write_string(msg.target_username);
-    write_string(msg.content);
-
-    return buffer;
-}
-
-// network.cpp
-
-Message Deserialize(const std::vector<char> &data) {
-    size_t pos = 0;
-    auto read_int32 = [&](int32_t &out) {
-        if (pos + 4 > data.size()) throw std::runtime_error("Deserialize: truncated int32");
-        int32_t netv;
-        std::memcpy(&netv, &data[pos], 4);
-        pos += 4;
-        out = ntohl(netv);
-    };
-
-    // [修正] 将参数类型从 int64_t& 改为 long long&
-    auto read_int64 = [&](long long &out) {
-        if (pos + 8 > data.size()) throw std::runtime_error("Deserialize: truncated int64");
-        uint64_t uv = 0;
-        for (int i = 0; i < 8; ++i) {
-            uv = (uv << 8) | (static_cast<unsigned char>(data[pos + i]));
-        }
-        pos += 8;
-        out = static_cast<long long>(uv);
-    };
-
-    auto read_string = [&](std::string &out) {
-        int32_t len;
-        read_int32(len);
-        if (len < 0 || pos + static_cast<size_t>(len) > data.size())
-            throw std::runtime_error("Deserialize: invalid string length");
-        out.assign(&data[pos], &data[pos + len]);
-        pos += len;
-    };
-
-    Message msg;
-    int32_t type_i32;
-    read_int32(type_i32);
-    msg.type = static_cast<MessageType>(type_i32);
-    read_int64(msg.timestamp); // 现在类型完全匹配了
-    read_string(msg.sender_username);
-    read_string(msg.target_username);
-    read_string(msg.content);
-
-    return msg;
-}
-
 // ------------------ Network API ------------------
 
 Socket StartServer(int listen_port) {
@@ -128,7 +85,10 @@ Socket StartServer(int listen_port) {
         throw std::runtime_error("bind() failed");
     }
 
-    if (::listen(sock, SOMAXCONN) < 0) {
+    // Buffer sizes must be set before listen() to size the window scale;
+    // accepted sockets inherit them.
+    SocketProfile::Apply(sock, SocketProfile::Server());
+    if (::listen(sock, SocketProfile::Backlog(SocketProfile::Server())) < 0) {
         ::close(sock);
         throw std::runtime_error("listen() failed");
     }
@@ -139,11 +99,28 @@ Socket StartServer(int listen_port) {
 Socket Accept(Socket server_socket) {
     sockaddr_in client_addr{};
     socklen_t len = sizeof(client_addr);
-    Socket cs = ::accept(server_socket, reinterpret_cast<sockaddr *>(&client_addr), &len);
+    Socket cs;
+    do {
+        cs = ::accept(server_socket, reinterpret_cast<sockaddr *>(&client_addr), &len);
+    } while (cs < 0 && errno == EINTR);
     if (cs < 0) throw std::runtime_error("accept() failed");
+    SocketProfile::Apply(cs, SocketProfile::Server());
+    BusyPoll::ApplySocket(cs);
+    CHAT_TRACE(kAccept, cs, 0);
     return cs;
 }
 
+Socket Accept(Socket server_socket, int wake_fd) {
+    pollfd fds[2] = {{server_socket, POLLIN, 0}, {wake_fd, POLLIN, 0}};
+    for (;;) {
+        int n = ::poll(fds, 2, -1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) throw std::runtime_error("poll() failed");
+        if (fds[1].revents) return -1;
+        if (fds[0].revents) return Accept(server_socket);
+    }
+}
+
 Socket Connect(const std::string &server_host, int server_port) {
     Socket sock = ::socket(AF_INET, SOCK_STREAM, 0);
     if (sock < 0) throw std::runtime_error("socket() failed");
@@ -157,6 +134,7 @@ Socket Connect(const std::string &server_host, int server_port) {
         throw std::runtime_error("inet_pton() failed");
     }
 
+    SocketProfile::Apply(sock, SocketProfile::Client());
     if (::connect(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
         ::close(sock);
         throw std::runtime_error("connect() failed");
@@ -166,16 +144,137 @@ Socket Connect(const std::string &server_host, int server_port) {
 }
 
 bool SendMessage(Socket sock, const Message &msg) {
-    std::vector<char> serialized = Serialize(msg);
+    // One buffer, one send: the length prefix travels with the payload.
+    return SendFrame(sock, EncodeFrame(msg));
+}
+
+bool SendFrame(Socket sock, const Frame &frame) {
+    if (!frame) return false;
+    CHAT_TRACE(kSend, sock, frame->size());
+    return send_all(sock, frame->data(), frame->size());
+}
 
-    int32_t total_len = static_cast<int32_t>(serialized.size());
-    int32_t net_len = htonl(total_len);
+// sendmsg() loop over the batch; *calls counts the calls that sent data.
+static bool SendFramesWith(Socket sock, const std::vector<Frame> &frames, int flags, size_t *calls) {
+    size_t idx = 0;      // first frame not yet fully written
+    size_t offset = 0;   // bytes of frames[idx] already written
+    int send_flags = flags;
+    while (idx < frames.size()) {
+        iovec iov[64];
+        int iovcnt = 0;
+        for (size_t i = idx; i < frames.size() && iovcnt < 64; ++i) {
+            const std::vector<char> &f = *frames[i];
+            size_t skip = (i == idx) ? offset : 0;
+            iov[iovcnt].iov_base = const_cast<char *>(f.data() + skip);
+            iov[iovcnt].iov_len = f.size() - skip;
+            ++iovcnt;
+        }
+        msghdr mh{};
+        mh.msg_iov = iov;
+        mh.msg_iovlen = iovcnt;
+        ssize_t n = ::sendmsg(sock, &mh, MSG_NOSIGNAL | send_flags);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == ENOBUFS && send_flags != 0) {
+            // Out of option memory for pending notifications: copy this
+            // piece, then go back to the caller's flags for the next one.
+            send_flags = 0;
+            continue;
+        }
+        if (n <= 0) return false;
+        if (send_flags != 0) ++*calls;
+        send_flags = flags;
+        CHAT_TRACE(kSend, sock, n);
+        size_t left = static_cast<size_t>(n);
+        while (left > 0) {
+            size_t remain = frames[idx]->size() - offset;
+            if (left >= remain) {
+                left -= remain;
+                ++idx;
+                offset = 0;
+            } else {
+                offset += left;
+                left = 0;
+            }
+        }
+    }
+    return true;
+}
 
-    if (!send_all(sock, reinterpret_cast<const char *>(&net_len), sizeof(net_len)))
-        return false;
-    if (!send_all(sock, serialized.data(), serialized.size()))
-        return false;
+bool SendFrames(Socket sock, const std::vector<Frame> &frames) {
+    size_t calls = 0;
+    return SendFramesWith(sock, frames, 0, &calls);
+}
 
+bool EnableZeroCopy(Socket sock) {
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+    int one = 1;
+    return ::setsockopt(sock, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+#else
+    (void)sock;
+    return false;
+#endif
+}
+
+bool SendFramesZeroCopy(Socket sock, const std::vector<Frame> &frames, size_t *calls) {
+#ifdef MSG_ZEROCOPY
+    return SendFramesWith(sock, frames, MSG_ZEROCOPY, calls);
+#else
+    return SendFramesWith(sock, frames, 0, calls);
+#endif
+}
+
+size_t ReadZeroCopyDone(Socket sock, std::vector<ZeroCopyDone> *out) {
+    size_t n = 0;
+#ifdef SO_EE_ORIGIN_ZEROCOPY
+    for (;;) {
+        char control[128];
+        msghdr mh{};
+        mh.msg_control = control;
+        mh.msg_controllen = sizeof(control);
+        if (::recvmsg(sock, &mh, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            if (errno == EINTR) continue;
+            break;      // EAGAIN: queue empty
+        }
+        for (cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+            bool recverr = (cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                           (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR);
+            if (!recverr) continue;
+            sock_extended_err err;
+            std::memcpy(&err, CMSG_DATA(cm), sizeof(err));
+            if (err.ee_errno != 0 || err.ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+            out->push_back(ZeroCopyDone{err.ee_info, err.ee_data, (err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0});
+            ++n;
+        }
+    }
+#else
+    (void)sock;
+    (void)out;
+#endif
+    return n;
+}
+
+bool SendFileFrame(Socket sock, const Frame &header, int fd, uint64_t offset, size_t len) {
+    if (!header) return false;
+    CHAT_TRACE(kSend, sock, header->size() + len);
+    // MSG_MORE lets the header share a segment with the file data.
+    size_t sent = 0;
+    while (sent < header->size()) {
+        ssize_t n = ::send(sock, header->data() + sent, header->size() - sent, MSG_NOSIGNAL | MSG_MORE);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return SendFileRange(sock, fd, offset, len);
+}
+
+bool SendFileRange(Socket sock, int fd, uint64_t offset, size_t len) {
+    off_t off = static_cast<off_t>(offset);
+    while (len > 0) {
+        ssize_t n = ::sendfile(sock, fd, &off, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;   // 0: the file is shorter than promised
+        len -= static_cast<size_t>(n);
+    }
     return true;
 }
 
@@ -188,11 +287,26 @@ std::optional<Message> ReceiveMessage(Socket sock) {
     if (total_len <= 0) {
         return std::nullopt; // [修正]
     }
+    // Never trust the peer's length prefix with an allocation.
+    if (static_cast<size_t>(total_len) > MemoryBudget::GetLimits().max_frame_bytes) {
+        MemoryBudget::CountOversizedFrame();
+        return std::nullopt;
+    }
+    if (!MemoryBudget::TryChargeGlobal(MemoryBudget::Category::kReceive, total_len)) {
+        MemoryBudget::CountShedReceive();
+        return std::nullopt;
+    }
+    struct Charge {
+        size_t n;
+        ~Charge() { MemoryBudget::ReleaseGlobal(MemoryBudget::Category::kReceive, n); }
+    } charge{static_cast<size_t>(total_len)};
 
     std::vector<char> buf(total_len);
     if (!recv_all(sock, buf.data(), buf.size())) {
         return std::nullopt; // [修正]
     }
+    CHAT_TRACE(kReceive, sock, total_len);
+    SocketProfile::AfterReceive(sock);
 
     try {
         Message msg = Deserialize(buf);
@@ -202,6 +316,25 @@ std::optional<Message> ReceiveMessage(Socket sock) {
     }
 }
 
+void Shutdown(Socket sock) {
+    if (sock >= 0) ::shutdown(sock, SHUT_RDWR);
+}
+
+void Abort(Socket sock) {
+    if (sock < 0) return;
+    linger lg{1, 0};
+    ::setsockopt(sock, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    // connect(AF_UNSPEC) disconnects a TCP socket in place: RST, send
+    // queue purged.
+    sockaddr sa{};
+    sa.sa_family = AF_UNSPEC;
+    ::connect(sock, &sa, sizeof(sa));
+}
+
+void ShutdownRead(Socket sock) {
+    if (sock >= 0) ::shutdown(sock, SHUT_RD);
+}
+
 void Close(Socket sock) {
     if (sock >= 0) ::close(sock);
 }
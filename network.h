@@ -4,6 +4,7 @@
 #include <string>
 #include <vector>
 #include <optional>
+#include <memory>
 #include "common.h"
 
 namespace NetworkLayer {
@@ -12,13 +13,58 @@ namespace NetworkLayer {
 std::vector<char> Serialize(const Message &msg);
 Message Deserialize(const std::vector<char> &data);
 
+// A complete wire frame (4-byte length prefix + serialized message).
+// Shared so one broadcast is encoded once and handed to every recipient.
+using Frame = std::shared_ptr<const std::vector<char>>;
+Frame EncodeFrame(const Message &msg);
+// Everything of msg's frame except the content bytes, with the lengths
+// already counting content_bytes; msg.content is ignored. The caller sends
+// the content separately, e.g. straight from a file.
+Frame EncodeFrameHeader(const Message &msg, size_t content_bytes);
+
 // === Socket API ===
 Socket StartServer(int listen_port);
 Socket Accept(Socket server_socket);
+// Same, but also returns -1 (without accepting) once wake_fd is readable;
+// lets the acceptor be stopped from another thread.
+Socket Accept(Socket server_socket, int wake_fd);
 Socket Connect(const std::string &server_host, int server_port);
 bool SendMessage(Socket sock, const Message &msg);
+bool SendFrame(Socket sock, const Frame &frame);
+// Writes a batch of frames with as few syscalls as possible (writev-style).
+bool SendFrames(Socket sock, const std::vector<Frame> &frames);
+// MSG_ZEROCOPY (see zerocopy.h, which tracks the completions). Enable sets
+// SO_ZEROCOPY and is false where the kernel or socket does not support it.
+// The zero-copy send lets the kernel read the frames' buffers after it
+// returns, until a completion for each of its *calls sendmsg() calls that
+// sent data has been read back from the socket's error queue.
+struct ZeroCopyDone {
+    uint32_t lo;                    ///< completed send calls lo..hi (inclusive,
+    uint32_t hi;                    ///< counted per socket from 0, wrapping)
+    bool copied;                    ///< the kernel copied after all
+};
+bool EnableZeroCopy(Socket sock);
+bool SendFramesZeroCopy(Socket sock, const std::vector<Frame> &frames, size_t *calls);
+// Appends the completions queued so far to *out without blocking; returns
+// how many were read.
+size_t ReadZeroCopyDone(Socket sock, std::vector<ZeroCopyDone> *out);
+// Writes header (from EncodeFrameHeader) followed by len bytes of fd from
+// offset, without copying them through user space (sendfile).
+bool SendFileFrame(Socket sock, const Frame &header, int fd, uint64_t offset, size_t len);
+// Writes len bytes of fd from offset that already hold complete frames.
+bool SendFileRange(Socket sock, int fd, uint64_t offset, size_t len);
 // [修正] 返回一个optional对象，而不是原始指针
+// Frames above MemoryBudget max_frame_bytes are refused (nullopt) unread.
 std::optional<Message> ReceiveMessage(Socket sock);  // returns nullptr on disconnect/empty
+// Abort both directions without releasing the fd; blocked readers return.
+void Shutdown(Socket sock);
+// Reset the connection now, without releasing the fd: the kernel drops
+// everything still queued for the peer (including zero-copy data it would
+// otherwise read later) and a later Close() sends nothing more.
+void Abort(Socket sock);
+// Stop reading only: a blocked reader returns as if the peer had closed,
+// while frames still queued for the peer can be written.
+void ShutdownRead(Socket sock);
 void Close(Socket sock);
 
 } // namespace NetworkLayer
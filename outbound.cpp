@@ -0,0 +1,582 @@
+#include "outbound.h"
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "busy_poll.h"
+#include "fanout.h"
+#include "memory_budget.h"
+#include "metrics.h"
+#include "mpsc_queue.h"
+#include "trace.h"
+#include "zerocopy.h"
+
+namespace Outbound {
+
+namespace {
+
+constexpr size_t kControlCapacity = 256;    // control frames per connection
+constexpr size_t kBulkCapacity = 4096;      // bulk frames per connection
+constexpr size_t kWriterBatch = 64;         // frames per writev
+constexpr int kZeroCopyPollMs = 10;         // completion polling while parked
+constexpr int kZeroCopyDrainMs = 1000;      // wait for completions at close
+constexpr int kFileSweepMs = 1000;          // stalled-download checks while parked
+
+std::atomic<int64_t>& QueueFullDrops() {
+    static std::atomic<int64_t>& c = Metrics::Counter("outbound.queue_full_drops");
+    return c;
+}
+
+// Charge a frame's buffer to the global send-queue budget once, however many
+// mailboxes end up holding it; the charge is returned when the last
+// reference is dropped. Null if the budget is exhausted.
+NetworkLayer::Frame ChargeFrame(const NetworkLayer::Frame& frame, Lane lane) {
+    size_t bytes = frame->size();
+    if (!MemoryBudget::TryChargeGlobal(MemoryBudget::Category::kSendQueue, bytes,
+                                       lane == Lane::kControl)) {
+        MemoryBudget::CountShedFrame();
+        return nullptr;
+    }
+    NetworkLayer::Frame holder = frame;
+    return NetworkLayer::Frame(frame.get(), [holder, bytes](const std::vector<char>*) {
+        MemoryBudget::ReleaseGlobal(MemoryBudget::Category::kSendQueue, bytes);
+    });
+}
+
+} // namespace
+
+// One connection's queue plus the thread that owns its socket for writing.
+class Mailbox {
+public:
+    Mailbox(ConnectionTable::ConnId conn, Socket sock)
+        : conn_(conn), sock_(sock), control_(kControlCapacity), bulk_(kBulkCapacity),
+          efd_(::eventfd(0, EFD_CLOEXEC)) {}
+
+    ~Mailbox() {
+        if (efd_ >= 0) ::close(efd_);
+    }
+
+    void Start() {
+        writer_ = std::thread([this] {
+            // Made on the writer thread, the only one that uses it.
+            if (ZeroCopy::Threshold() > 0) zerocopy_.reset(new ZeroCopy::Sender(sock_, ZeroCopy::Threshold()));
+            WriterLoop();
+            if (zerocopy_) zerocopy_->Drain(kZeroCopyDrainMs);
+        });
+    }
+
+    bool Push(const NetworkLayer::Frame& frame, Lane lane) {
+        if (failed_.load(std::memory_order_relaxed)) return false;
+        const bool control = lane == Lane::kControl;
+        const size_t bytes = frame->size();
+        if (!MemoryBudget::TryChargeAccount(account_, bytes, control)) {
+            if (control) {
+                // Not even control traffic drains: give up on this peer.
+                MemoryBudget::CountShedConnection();
+                Fail();
+            } else {
+                MemoryBudget::CountShedFrame();
+            }
+            return false;
+        }
+        NetworkLayer::Frame copy = frame;
+        MpscQueue<NetworkLayer::Frame>& queue = control ? control_ : bulk_;
+        if (!queue.TryPush(std::move(copy))) {
+            MemoryBudget::ReleaseAccount(account_, bytes);
+            QueueFullDrops().fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        // Counted once visible, so a stored range never waits for a frame
+        // the writer cannot pop yet.
+        if (!control) bulk_pushed_.fetch_add(1, std::memory_order_release);
+        // Dekker handshake with the writer's park(): publish, then check.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (parked_.load(std::memory_order_relaxed) && parked_.exchange(false)) {
+            Wake();
+        }
+        return true;
+    }
+
+    // start goes on the control lane in the same step, so it always
+    // precedes the first chunk. False, with nothing queued, when
+    // kMaxDownloads are already running.
+    bool AddFile(const NetworkLayer::Frame& start, uint64_t transfer, std::shared_ptr<const FileSource> file,
+                 size_t chunk, size_t window) {
+        {
+            std::lock_guard<std::mutex> lock(files_mu_);
+            SweepFilesLocked();
+            if (files_.size() >= kMaxDownloads || !Push(start, Lane::kControl)) return false;
+            files_.push_back(FileJob{transfer, std::move(file), chunk, window, 0, 0, std::chrono::steady_clock::now()});
+            files_pending_.store(files_.size(), std::memory_order_relaxed);
+        }
+        Wake();
+        return true;
+    }
+
+    void AckFile(uint64_t transfer, uint64_t bytes) {
+        {
+            std::lock_guard<std::mutex> lock(files_mu_);
+            for (FileJob& job : files_) {
+                if (job.transfer != transfer || bytes <= job.acked) continue;
+                job.acked = bytes;
+                job.progress = std::chrono::steady_clock::now();
+            }
+        }
+        // Unconditional: the eventfd counter keeps a wake-up for a writer
+        // that is just about to park.
+        Wake();
+    }
+
+    bool AddStored(const std::vector<StoredRange>& ranges) {
+        {
+            std::lock_guard<std::mutex> lock(files_mu_);
+            if (stored_.size() + ranges.size() > kMaxStoredRanges) return false;
+            const uint64_t barrier = bulk_pushed_.load(std::memory_order_acquire);
+            for (const StoredRange& range : ranges) stored_.push_back(StoredJob{range, barrier});
+            stored_pending_.store(stored_.size(), std::memory_order_relaxed);
+        }
+        Wake();
+        return true;
+    }
+
+    // Drain what is queued, then stop the writer thread. Unfinished file
+    // downloads are dropped; stored ranges are sent like frames.
+    void Shutdown() {
+        closing_.store(true);
+        Wake();
+        if (writer_.joinable()) writer_.join();
+    }
+
+private:
+    // Stop writing and kick the reader out of recv() so the session ends.
+    void Fail() {
+        if (!failed_.exchange(true)) NetworkLayer::Shutdown(sock_);
+    }
+
+    void Wake() {
+        uint64_t one = 1;
+        ssize_t n = ::write(efd_, &one, sizeof(one));
+        (void)n;
+    }
+
+    void Park() {
+        const bool reap = zerocopy_ && zerocopy_->Pending() > 0;
+        if (reap || files_pending_.load(std::memory_order_relaxed) > 0) {
+            // Frames are held for the kernel: come back to reap them.
+            // Downloads wait for acks: come back to drop them once stalled.
+            pollfd p{efd_, POLLIN, 0};
+            if (::poll(&p, 1, reap ? kZeroCopyPollMs : kFileSweepMs) <= 0) {
+                if (reap) zerocopy_->Reap();
+                return;
+            }
+        }
+        uint64_t v;
+        ssize_t n = ::read(efd_, &v, sizeof(v));
+        (void)n;
+    }
+
+    bool Write(const std::vector<NetworkLayer::Frame>& batch) {
+        return zerocopy_ ? zerocopy_->Send(batch) : NetworkLayer::SendFrames(sock_, batch);
+    }
+
+    struct FileJob {
+        uint64_t transfer;
+        std::shared_ptr<const FileSource> file;
+        size_t chunk;
+        size_t window;
+        uint64_t sent;
+        uint64_t acked;
+        std::chrono::steady_clock::time_point progress;   ///< start or last ack that moved
+    };
+
+    struct StoredJob {
+        StoredRange range;
+        uint64_t barrier;           ///< bulk frames that must go out first
+    };
+
+    // Bulk frames the writer may pop before the next stored range is due;
+    // unlimited when none is pending.
+    size_t BulkRoom(size_t room) {
+        if (stored_pending_.load(std::memory_order_relaxed) == 0) return room;
+        std::lock_guard<std::mutex> lock(files_mu_);
+        if (stored_.empty()) return room;
+        uint64_t barrier = stored_.front().barrier;
+        return barrier > bulk_popped_ ? static_cast<size_t>(std::min<uint64_t>(room, barrier - bulk_popped_)) : 0;
+    }
+
+    // The first stored range once everything queued before it is written.
+    bool SendStoredRange() {
+        static std::atomic<int64_t>& bytes_out = Metrics::Counter("history.sendfile_bytes");
+        if (stored_pending_.load(std::memory_order_relaxed) == 0) return false;
+        StoredJob job;
+        {
+            std::lock_guard<std::mutex> lock(files_mu_);
+            if (stored_.empty() || stored_.front().barrier > bulk_popped_) return false;
+            job = std::move(stored_.front());
+            stored_.pop_front();
+            stored_pending_.store(stored_.size(), std::memory_order_relaxed);
+        }
+        if (!failed_.load(std::memory_order_relaxed)) {
+            const StoredRange& r = job.range;
+            if (NetworkLayer::SendFileRange(sock_, r.file->fd, r.offset, static_cast<size_t>(r.len))) {
+                ConnectionTable::CountOutbound(conn_, r.frames, r.len);
+                bytes_out.fetch_add(static_cast<int64_t>(r.len), std::memory_order_relaxed);
+            } else {
+                failed_.store(true, std::memory_order_relaxed);
+            }
+        }
+        return true;
+    }
+
+    // One chunk of the first download the window allows. Called by the
+    // writer only when both frame lanes are empty.
+    bool SendFileChunk() {
+        static std::atomic<int64_t>& bytes_out = Metrics::Counter("file.download_bytes");
+        std::shared_ptr<const FileSource> file;
+        uint64_t transfer = 0;
+        uint64_t offset = 0;
+        size_t len = 0;
+        {
+            std::lock_guard<std::mutex> lock(files_mu_);
+            SweepFilesLocked();
+            for (FileJob& job : files_) {
+                if (!WindowOpen(job)) continue;
+                file = job.file;
+                transfer = job.transfer;
+                offset = job.sent;
+                len = static_cast<size_t>(std::min<uint64_t>(job.chunk, file->size - offset));
+                job.sent += len;
+                break;
+            }
+        }
+        if (!file) return false;
+        if (!failed_.load(std::memory_order_relaxed)) {
+            Message m;
+            m.type = MessageType::FILE_DATA;
+            m.timestamp = static_cast<long long>(offset);
+            m.sender_username = "Server";
+            m.target_username = std::to_string(transfer);
+            if (NetworkLayer::SendFileFrame(sock_, NetworkLayer::EncodeFrameHeader(m, len), file->fd, offset, len)) {
+                ConnectionTable::CountOutbound(conn_, 1, len);
+                bytes_out.fetch_add(static_cast<int64_t>(len), std::memory_order_relaxed);
+            } else {
+                failed_.store(true, std::memory_order_relaxed);
+            }
+        }
+        return true;
+    }
+
+    // Caller holds files_mu_. A job is done once fully sent (acks only pace
+    // the sending), and dropped once its window has waited for an ack for
+    // kDownloadStallMs: its file stays open for as long as the job exists.
+    void SweepFilesLocked() {
+        static std::atomic<int64_t>& stalled = Metrics::Counter("file.download_stalled");
+        const auto deadline = std::chrono::steady_clock::now() - std::chrono::milliseconds(kDownloadStallMs);
+        files_.erase(std::remove_if(files_.begin(), files_.end(),
+                                    [&](const FileJob& job) {
+                                        if (job.sent >= job.file->size) return true;
+                                        if (WindowOpen(job) || job.progress > deadline) return false;
+                                        stalled.fetch_add(1, std::memory_order_relaxed);
+                                        return true;
+                                    }),
+                     files_.end());
+        files_pending_.store(files_.size(), std::memory_order_relaxed);
+    }
+
+    static bool WindowOpen(const FileJob& job) {
+        return job.sent < job.file->size && job.sent - std::min(job.acked, job.sent) < job.window;
+    }
+
+    bool FileReady() {
+        std::lock_guard<std::mutex> lock(files_mu_);
+        return std::any_of(files_.begin(), files_.end(), WindowOpen);
+    }
+
+    void WriterLoop() {
+        std::vector<NetworkLayer::Frame> batch;
+        batch.reserve(kWriterBatch);
+        for (;;) {
+            if (SendStoredRange()) continue;
+            batch.clear();
+            // Control first; bulk only fills what is left of the batch.
+            control_.PopBatch(batch, kWriterBatch);
+            const size_t controls = batch.size();
+            bulk_.PopBatch(batch, BulkRoom(kWriterBatch - controls));
+            bulk_popped_ += batch.size() - controls;
+            if (!batch.empty()) {
+                uint64_t bytes = 0;
+                for (const auto& f : batch) bytes += f->size();
+                if (!failed_.load(std::memory_order_relaxed)) {
+                    if (Write(batch)) {
+                        ConnectionTable::CountOutbound(conn_, batch.size(), bytes);
+                    } else {
+                        // Peer is gone; keep draining so producers never block.
+                        failed_.store(true, std::memory_order_relaxed);
+                    }
+                }
+                MemoryBudget::ReleaseAccount(account_, bytes);
+                continue;
+            }
+            if (closing_.load()) break;
+            // Background lane: only when no frame is waiting.
+            if (SendFileChunk()) continue;
+
+            if (BusyPoll::Enabled()) {
+                if (BusyPoll::SpinUntil([this] {
+                        return !control_.Empty() || !bulk_.Empty() || closing_.load() ||
+                               stored_pending_.load(std::memory_order_relaxed) > 0;
+                    })) {
+                    BusyPoll::CountSpinHit();
+                    continue;
+                }
+                BusyPoll::CountPark();
+            }
+            parked_.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            // A pending stored range is either due or waits for bulk frames.
+            if (!control_.Empty() || !bulk_.Empty() || closing_.load() ||
+                stored_pending_.load(std::memory_order_relaxed) > 0 || FileReady()) {
+                parked_.store(false, std::memory_order_relaxed);
+                continue;
+            }
+            Park();
+            parked_.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    ConnectionTable::ConnId conn_;
+    Socket sock_;
+    MpscQueue<NetworkLayer::Frame> control_;
+    MpscQueue<NetworkLayer::Frame> bulk_;
+    int efd_;
+    std::thread writer_;
+    MemoryBudget::Account account_;
+    std::atomic<bool> parked_{false};
+    std::atomic<bool> closing_{false};
+    std::atomic<bool> failed_{false};
+    std::unique_ptr<ZeroCopy::Sender> zerocopy_;    // writer only; null when off
+    std::atomic<uint64_t> bulk_pushed_{0};
+    uint64_t bulk_popped_ = 0;      // writer only
+    std::atomic<size_t> stored_pending_{0};
+    std::atomic<size_t> files_pending_{0};         ///< files_.size(), read without files_mu_
+    std::mutex files_mu_;
+    std::deque<FileJob> files_;
+    std::deque<StoredJob> stored_;
+};
+
+FileSource::~FileSource() {
+    if (fd >= 0) ::close(fd);
+}
+
+Lane LaneFor(MessageType type) {
+    switch (type) {
+        case MessageType::COMMAND_RESPONSE:
+        case MessageType::USER_LIST_RESPONSE:
+        case MessageType::FILE_ACK:
+            return Lane::kControl;
+        default:
+            return Lane::kBulk;
+    }
+}
+
+void Open(ConnectionTable::ConnId conn, Socket client_socket) {
+    Mailbox* box = new Mailbox(conn, client_socket);
+    if (!ConnectionTable::AttachMailbox(conn, box)) {
+        // Stale id or a mailbox is already attached.
+        delete box;
+        return;
+    }
+    // Frames pushed before the thread starts simply wait in the ring.
+    box->Start();
+}
+
+void Quiesce(ConnectionTable::ConnId conn) {
+    if (Fanout::Running() && Fanout::InFlight() > 0) {
+        Fanout::Drain(conn.index / Fanout::Config().chunk_slots);
+    }
+}
+
+void Close(ConnectionTable::ConnId conn) {
+    // Let pooled frames posted before the close reach this mailbox first.
+    Quiesce(conn);
+    // Once detached no producer can reach the mailbox (they push under the
+    // table's reader lock), so it is safe to flush and free it here.
+    Mailbox* box = ConnectionTable::DetachMailbox(conn);
+    if (!box) return;
+    box->Shutdown();
+    delete box;
+}
+
+namespace {
+
+// Completion tracking for one broadcast split across the fan-out pool.
+struct FanoutJob {
+    FanoutJob(size_t chunks, size_t frame_bytes)
+        : remaining(chunks), bytes(frame_bytes), started(std::chrono::steady_clock::now()) {}
+    std::atomic<size_t> remaining;
+    std::atomic<size_t> recipients{0};
+    size_t bytes;
+    std::chrono::steady_clock::time_point started;
+};
+
+// Runs under the table's reader lock, so a connection without a mailbox is
+// only noted: its blocking send happens in SendDirect(), after the scan.
+void PushOrDefer(Socket s, Mailbox* box, const NetworkLayer::Frame& charged, Lane lane, std::vector<Socket>* direct) {
+    if (box) {
+        box->Push(charged, lane);
+    } else {
+        direct->push_back(s);
+    }
+}
+
+void SendDirect(const std::vector<Socket>& direct, const NetworkLayer::Frame& frame) {
+    for (Socket s : direct) NetworkLayer::SendFrame(s, frame);
+}
+
+// Pool when the room is large, and also whenever earlier chunks are still
+// queued so that this frame cannot overtake them.
+bool UsePool() {
+    if (!Fanout::Running()) return false;
+    return Fanout::InFlight() > 0 || ConnectionTable::LiveCount() >= Fanout::Config().inline_below;
+}
+
+void BroadcastPooled(const NetworkLayer::Frame& frame, const NetworkLayer::Frame& charged, Lane lane) {
+    static std::atomic<int64_t>& broadcasts = Metrics::Counter("fanout.broadcasts");
+    static std::atomic<int64_t>& total_us = Metrics::Counter("fanout.broadcast_us");
+    const size_t chunk = Fanout::Config().chunk_slots;
+    const size_t chunks = (ConnectionTable::SlotHighWater() + chunk - 1) / chunk;
+    if (chunks == 0) return;
+    auto job = std::make_shared<FanoutJob>(chunks, frame->size());
+    for (size_t c = 0; c < chunks; ++c) {
+        Fanout::Post(c, [=] {
+            size_t n = 0;
+            std::vector<Socket> direct;
+            ConnectionTable::ForEachOnlineInRange(c * chunk, (c + 1) * chunk, [&](Socket s, Mailbox* box) {
+                ++n;
+                PushOrDefer(s, box, charged, lane, &direct);
+            });
+            SendDirect(direct, frame);
+            job->recipients.fetch_add(n, std::memory_order_relaxed);
+            if (job->remaining.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+            // Last chunk: the broadcast is fully enqueued.
+            auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - job->started).count();
+            broadcasts.fetch_add(1, std::memory_order_relaxed);
+            total_us.fetch_add(us, std::memory_order_relaxed);
+            CHAT_TRACE(kBroadcast, job->recipients.load(std::memory_order_relaxed), job->bytes);
+        });
+    }
+}
+
+bool SendFrameNow(Socket client_socket, const NetworkLayer::Frame& frame, Lane lane) {
+    bool ok = false;
+    bool direct = false;
+    bool known = ConnectionTable::WithMailbox(client_socket, [&](Mailbox* box) {
+        if (!box) {
+            direct = true;  // send below, outside the table lock
+            return;
+        }
+        NetworkLayer::Frame charged = ChargeFrame(frame, lane);
+        ok = charged && box->Push(charged, lane);
+    });
+    if (!known || direct) return NetworkLayer::SendFrame(client_socket, frame);
+    return ok;
+}
+
+} // namespace
+
+SendResult SendFrame(Socket client_socket, const NetworkLayer::Frame& frame, Lane lane) {
+    static std::atomic<int64_t>& deferred = Metrics::Counter("outbound.deferred");
+    static std::atomic<int64_t>& deferred_rejected = Metrics::Counter("outbound.deferred_rejected");
+    if (lane == Lane::kBulk && Fanout::Running() && Fanout::InFlight() > 0) {
+        // Queue behind the broadcast chunk that covers this connection.
+        ConnectionTable::ConnId id = ConnectionTable::FindBySocket(client_socket);
+        if (id.Valid()) {
+            deferred.fetch_add(1, std::memory_order_relaxed);
+            Fanout::Post(id.index / Fanout::Config().chunk_slots, [client_socket, id, frame, lane] {
+                // The fd may have been recycled for another peer meanwhile.
+                if (!(ConnectionTable::FindBySocket(client_socket) == id) ||
+                    !SendFrameNow(client_socket, frame, lane)) {
+                    deferred_rejected.fetch_add(1, std::memory_order_relaxed);
+                }
+            });
+            return SendResult::kDeferred;
+        }
+    }
+    return SendFrameNow(client_socket, frame, lane) ? SendResult::kQueued : SendResult::kRejected;
+}
+
+void Broadcast(const NetworkLayer::Frame& frame, Lane lane) {
+    NetworkLayer::Frame charged = ChargeFrame(frame, lane);
+    if (!charged) return;   // over the global budget: shed for everyone
+    if (UsePool()) {
+        BroadcastPooled(frame, charged, lane);
+        return;
+    }
+    size_t recipients = 0;
+    std::vector<Socket> direct;
+    ConnectionTable::ForEachOnline([&](Socket s, Mailbox* box) {
+        ++recipients;
+        PushOrDefer(s, box, charged, lane, &direct);
+    });
+    SendDirect(direct, frame);
+    CHAT_TRACE(kBroadcast, recipients, frame->size());
+}
+
+SendResult Send(Socket client_socket, const Message& msg) {
+    return SendFrame(client_socket, NetworkLayer::EncodeFrame(msg), LaneFor(msg.type));
+}
+
+bool SendFile(Socket client_socket, const Message& start, uint64_t transfer, std::shared_ptr<const FileSource> file,
+              size_t chunk, size_t window) {
+    static std::atomic<int64_t>& busy = Metrics::Counter("file.download_busy");
+    if (!file || chunk == 0) return false;
+    NetworkLayer::Frame frame = ChargeFrame(NetworkLayer::EncodeFrame(start), Lane::kControl);
+    if (!frame) return false;
+    bool queued = false;
+    ConnectionTable::WithMailbox(client_socket, [&](Mailbox* box) {
+        if (!box) return;
+        queued = box->AddFile(frame, transfer, std::move(file), chunk, std::max(window, chunk));
+        if (!queued) busy.fetch_add(1, std::memory_order_relaxed);
+    });
+    return queued;
+}
+
+void AckFile(Socket client_socket, uint64_t transfer, uint64_t bytes) {
+    ConnectionTable::WithMailbox(client_socket, [&](Mailbox* box) {
+        if (box) box->AckFile(transfer, bytes);
+    });
+}
+
+bool SendStored(Socket client_socket, const std::vector<StoredRange>& ranges) {
+    static std::atomic<int64_t>& rejected = Metrics::Counter("outbound.stored_rejected");
+    if (ranges.empty()) return false;
+    for (const StoredRange& range : ranges) {
+        if (!range.file || range.len == 0) return false;
+    }
+    ConnectionTable::ConnId id = ConnectionTable::FindBySocket(client_socket);
+    if (!id.Valid()) return false;
+    Quiesce(id);
+    bool queued = false;
+    ConnectionTable::WithMailbox(client_socket, [&](Mailbox* box) {
+        if (!box) return;
+        queued = box->AddStored(ranges);
+        if (!queued) rejected.fetch_add(1, std::memory_order_relaxed);
+    });
+    return queued;
+}
+
+unsigned long long DroppedFrames() {
+    return QueueFullDrops().load(std::memory_order_relaxed);
+}
+
+} // namespace Outbound
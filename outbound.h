@@ -0,0 +1,139 @@
+#ifndef OUTBOUND_H_
+#define OUTBOUND_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "connection_table.h"
+#include "network.h"
+
+// Per-connection outbound delivery.
+//
+// Every registered connection owns a mailbox (bounded lock-free MPSC
+// queues) and a single writer thread that drains it. Any thread may enqueue;
+// only the writer touches the socket, so frames for one socket are never
+// interleaved and arrive in enqueue order per producer and lane.
+//
+// A mailbox has two lanes. Control frames (auth replies, GOODBYE, command
+// errors, user lists) go ahead of bulk chat traffic: every writer batch is
+// filled from the control lane first, so a /bye or login is answered within
+// one batch even when the bulk lane holds thousands of broadcasts.
+//
+// File downloads use a third, background lane (SendFile): the writer sends
+// one file chunk only when both frame lanes are empty, and never more than a
+// window of unacknowledged bytes, so a transfer delays a chat frame by at
+// most one chunk and never fills the socket buffer ahead of it.
+//
+// Stored frames (SendStored) are byte ranges of a file that already hold
+// encoded frames, e.g. history segments. The writer sends them with
+// sendfile() in bulk-lane order: after every bulk frame queued before the
+// call and ahead of those queued after it.
+//
+// The mailbox pointer lives in the connection's ConnectionTable hot slot.
+// Sockets without a mailbox (e.g. before ServeClient registers them) fall
+// back to a direct NetworkLayer write on the calling thread.
+
+namespace Outbound {
+
+class Mailbox;
+
+enum class Lane {
+    kControl,                   ///< Drained first; small, latency sensitive
+    kBulk                       ///< Chat and broadcast traffic
+};
+
+// A spooled file that downloads and stored ranges read from; the fd is closed when the last
+// reference goes (see file_transfer.h).
+struct FileSource {
+    uint64_t id = 0;
+    int fd = -1;
+    uint64_t size = 0;
+    ~FileSource();
+};
+
+// Outcome of Send / SendFrame.
+enum class SendResult {
+    kRejected,                  ///< Lane full, connection failed, or shed by MemoryBudget
+    kQueued,                    ///< In the mailbox (or written, without one)
+    kDeferred                   ///< Handed to the fan-out pool; not yet known
+};
+
+// Default lane for a message of the given type.
+Lane LaneFor(MessageType type);
+
+// Attach a mailbox to conn and start its writer thread. Idempotent.
+void Open(ConnectionTable::ConnId conn, Socket client_socket);
+
+// Wait until pooled fan-out tasks already posted have passed conn. Call
+// before conn joins or leaves the online set, so that it gets exactly the
+// broadcasts sent while it was online, as with an inline scan.
+void Quiesce(ConnectionTable::ConnId conn);
+
+// Flush what is already queued (including pooled frames still in flight for
+// this connection), stop the writer and detach the mailbox.
+// Does not close the socket or release the slot.
+void Close(ConnectionTable::ConnId conn);
+
+// Queue a message for client_socket on LaneFor(msg.type).
+// kRejected if the lane is full, the connection already failed, or a
+// MemoryBudget limit sheds the frame (see memory_budget.h).
+SendResult Send(Socket client_socket, const Message& msg);
+
+// Queue a pre-encoded frame; used by broadcast paths to share one encoding.
+// A bulk frame sent while pooled broadcasts are in flight is handed to the
+// fan-out pool behind them and reported as kDeferred: whether it was queued
+// then is only counted, under outbound.deferred / outbound.deferred_rejected.
+SendResult SendFrame(Socket client_socket, const NetworkLayer::Frame& frame, Lane lane = Lane::kBulk);
+
+// Queue frame for every online connection. Scans the table inline, or, with
+// the fan-out pool running and a large room, in chunks on the pool
+// (fanout.h); either way per-recipient order is kept.
+void Broadcast(const NetworkLayer::Frame& frame, Lane lane = Lane::kBulk);
+
+// Downloads a connection may have running. Each keeps its file open, so a
+// peer that asks and never acks is capped here, and a download whose window
+// has waited kDownloadStallMs for an ack is dropped.
+constexpr size_t kMaxDownloads = 4;
+constexpr int kDownloadStallMs = 30000;
+
+// Queue start on the control lane, then a download of file on
+// client_socket's background lane as FILE_DATA frames of chunk bytes
+// (content sent with sendfile) tagged with transfer, keeping at most window
+// bytes beyond the last AckFile() for that transfer. False, with nothing
+// queued, if the connection has no mailbox or already runs kMaxDownloads.
+bool SendFile(Socket client_socket, const Message& start, uint64_t transfer, std::shared_ptr<const FileSource> file,
+              size_t chunk, size_t window);
+
+// The peer has stored bytes of download transfer; lets the next chunks go
+// out. The same file may be downloaded twice at once, so acks go by
+// transfer, never by file id.
+void AckFile(Socket client_socket, uint64_t transfer, uint64_t bytes);
+
+// Bytes [offset, offset + len) of file, which must be exactly frames whole
+// encoded frames.
+struct StoredRange {
+    std::shared_ptr<const FileSource> file;
+    uint64_t offset = 0;
+    uint64_t len = 0;
+    size_t frames = 0;
+};
+
+// Stored ranges a connection may have waiting. They hold no memory but keep
+// their files open, so a peer that asks faster than it reads is capped here.
+constexpr size_t kMaxStoredRanges = 64;
+
+// Queue ranges, all or none, in bulk-lane order. Waits for pooled broadcasts
+// already posted for the connection, so the ranges cannot overtake them.
+// False if the connection has no mailbox or would exceed kMaxStoredRanges.
+bool SendStored(Socket client_socket, const std::vector<StoredRange>& ranges);
+
+// Frames rejected because a mailbox ring was full (all connections, since
+// start). Budget shedding is counted separately under mem.shed.*.
+unsigned long long DroppedFrames();
+
+} // namespace Outbound
+
+#endif // OUTBOUND_H_
@@ -0,0 +1,195 @@
+#include "presence.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "affinity.h"
+#include "locks.h"
+#include "metrics.h"
+#include "network.h"
+#include "outbound.h"
+#include "user_ids.h"
+
+namespace Presence {
+
+namespace {
+
+struct Entry {
+    Status current = Status::kOnline;
+    Status published = Status::kOnline;
+    bool dirty = false;             ///< listed in g_dirty
+    bool watched = false;           ///< listed in g_typing
+    long long typing_ms = 0;        ///< last typing refresh
+};
+
+Locks::Mutex g_mutex{"presence"};
+std::vector<Entry> g_users;         // by UserId; grown on demand
+std::vector<UserId> g_dirty;        // changed since the last tick, in order
+std::vector<UserId> g_typing;       // candidates for typing expiry
+std::atomic<bool> g_enabled{false};
+
+long long NowMs() {
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Caller holds g_mutex.
+void MarkDirty(UserId user, Entry& e) {
+    if (e.dirty) return;
+    e.dirty = true;
+    g_dirty.push_back(user);
+}
+
+void Append(std::string* out, UserId user, Status status) {
+    if (!out->empty()) out->push_back(',');
+    *out += UserIds::Name(user);
+    out->push_back('=');
+    out->push_back(Code(status));
+}
+
+} // namespace
+
+bool Parse(const std::string& name, Status* out) {
+    if (name == "online") *out = Status::kOnline;
+    else if (name == "typing") *out = Status::kTyping;
+    else if (name == "away") *out = Status::kAway;
+    else if (name == "busy") *out = Status::kBusy;
+    else return false;
+    return true;
+}
+
+const char* Name(Status status) {
+    switch (status) {
+        case Status::kOnline: return "online";
+        case Status::kTyping: return "typing";
+        case Status::kAway: return "away";
+        case Status::kBusy: return "busy";
+    }
+    return "online";
+}
+
+char Code(Status status) {
+    return Name(status)[0];
+}
+
+bool FromCode(char code, Status* out) {
+    switch (code) {
+        case 'o': *out = Status::kOnline; return true;
+        case 't': *out = Status::kTyping; return true;
+        case 'a': *out = Status::kAway; return true;
+        case 'b': *out = Status::kBusy; return true;
+    }
+    return false;
+}
+
+void Start(int tick_ms) {
+    if (tick_ms <= 0 || g_enabled.exchange(true)) return;
+    std::thread([tick_ms] {
+        Affinity::PinSelf(Affinity::Role::kIo);
+        for (;;) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(tick_ms));
+            Flush();
+        }
+    }).detach();
+}
+
+bool Enabled() {
+    return g_enabled.load(std::memory_order_relaxed);
+}
+
+void Set(UserId user, Status status) {
+    static std::atomic<int64_t>& updates = Metrics::Counter("presence.updates");
+    static std::atomic<int64_t>& coalesced = Metrics::Counter("presence.coalesced");
+    if (!Enabled() || user == kNoUser) return;
+    updates.fetch_add(1, std::memory_order_relaxed);
+
+    Locks::Lock lock(g_mutex);
+    if (user >= g_users.size()) g_users.resize(user + 1);
+    Entry& e = g_users[user];
+    if (status == Status::kTyping) {
+        e.typing_ms = NowMs();
+        if (!e.watched) {
+            e.watched = true;
+            g_typing.push_back(user);
+        }
+    }
+    // Absorbed when nothing changes or a change is already waiting for the
+    // tick; only the last status per tick is sent.
+    if (e.current == status || e.dirty) coalesced.fetch_add(1, std::memory_order_relaxed);
+    e.current = status;
+    if (e.current != e.published) MarkDirty(user, e);
+}
+
+void Remove(UserId user) {
+    Locks::Lock lock(g_mutex);
+    if (user >= g_users.size()) return;
+    // Keep the list flags: the ids stay in g_dirty / g_typing until the
+    // next tick skips them.
+    Entry& e = g_users[user];
+    e.current = Status::kOnline;
+    e.published = Status::kOnline;
+}
+
+std::string Snapshot() {
+    Locks::Lock lock(g_mutex);
+    std::string out;
+    for (UserId u = 0; u < g_users.size(); ++u) {
+        if (g_users[u].published != Status::kOnline) Append(&out, u, g_users[u].published);
+    }
+    return out;
+}
+
+size_t Flush() {
+    static std::atomic<int64_t>& published = Metrics::Counter("presence.published");
+    static std::atomic<int64_t>& frames = Metrics::Counter("presence.frames");
+    static std::atomic<int64_t>& expired = Metrics::Counter("presence.expired");
+
+    std::string delta;
+    size_t n = 0;
+    {
+        Locks::Lock lock(g_mutex);
+        const long long now = NowMs();
+        size_t keep = 0;
+        for (UserId u : g_typing) {
+            Entry& e = g_users[u];
+            if (e.current == Status::kTyping && now - e.typing_ms >= kTypingTtlMs) {
+                e.current = Status::kOnline;
+                expired.fetch_add(1, std::memory_order_relaxed);
+                if (e.current != e.published) MarkDirty(u, e);
+            }
+            if (e.current == Status::kTyping) {
+                g_typing[keep++] = u;
+            } else {
+                e.watched = false;
+            }
+        }
+        g_typing.resize(keep);
+
+        size_t i = 0;
+        for (; i < g_dirty.size() && n < kMaxDeltaEntries; ++i) {
+            Entry& e = g_users[g_dirty[i]];
+            e.dirty = false;
+            if (e.current == e.published) continue;  // changed back within the tick
+            e.published = e.current;
+            Append(&delta, g_dirty[i], e.current);
+            ++n;
+        }
+        g_dirty.erase(g_dirty.begin(), g_dirty.begin() + static_cast<std::ptrdiff_t>(i));
+    }
+    if (n == 0) return 0;
+
+    Message m;
+    m.type = MessageType::PRESENCE_DELTA;
+    m.timestamp = NowEpochMs();
+    m.sender_username = "Server";
+    m.target_username = "";
+    m.content = std::move(delta);
+    Outbound::Broadcast(NetworkLayer::EncodeFrame(m));
+    published.fetch_add(static_cast<int64_t>(n), std::memory_order_relaxed);
+    frames.fetch_add(1, std::memory_order_relaxed);
+    return n;
+}
+
+} // namespace Presence
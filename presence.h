@@ -0,0 +1,67 @@
+#ifndef PRESENCE_H_
+#define PRESENCE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "common.h"
+
+// Typing and away/busy status.
+//
+// Clients send PRESENCE_UPDATE with a status name. Set() only records it in
+// a table indexed by UserId and marks the user dirty, so a burst of changes
+// costs one table write each and no network traffic. Every tick a ticker
+// thread takes the users whose status differs from what was last published
+// and broadcasts them together in one PRESENCE_DELTA frame, encoded once and
+// shared by every recipient (Outbound::Broadcast). A session thus gets at
+// most one presence frame per tick however many users change status, and a
+// user who goes typing -> online within one tick sends nothing at all. One
+// frame carries at most kMaxDeltaEntries users; the rest go out on the next
+// tick. Each item is a name and a one-letter code (o online, t typing,
+// a away, b busy):
+//
+//   "alice=t,bob=a,carol=o"
+//
+// Names are written raw; the server refuses usernames containing ',' or
+// '=' at login (USERNAME_INVALID), so the items always split cleanly.
+//
+// "typing" falls back to "online" after kTypingTtlMs without a refresh, so a
+// client that disappears mid-sentence does not stay typing forever. A new
+// session is sent Snapshot() directly instead of waiting for changes.
+
+namespace Presence {
+
+enum class Status : uint8_t { kOnline, kTyping, kAway, kBusy };
+
+constexpr size_t kMaxDeltaEntries = 512;
+constexpr long long kTypingTtlMs = 5000;
+
+// Full names ("online", "typing", ...) as sent by clients.
+bool Parse(const std::string& name, Status* out);
+const char* Name(Status status);
+
+// One-letter wire codes used in PRESENCE_DELTA.
+char Code(Status status);
+bool FromCode(char code, Status* out);
+
+// Start the ticker. tick_ms <= 0 leaves presence off and Set() ignored.
+void Start(int tick_ms);
+bool Enabled();
+
+void Set(UserId user, Status status);
+
+// The user left: drop the status without publishing it (USER_LEFT says so).
+void Remove(UserId user);
+
+// Every user whose published status is not kOnline, in the delta format;
+// empty if there are none.
+std::string Snapshot();
+
+// One tick: publish pending changes. Returns the number of users sent.
+// Called by the ticker; exposed for benchmarks.
+size_t Flush();
+
+} // namespace Presence
+
+#endif // PRESENCE_H_
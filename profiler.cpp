@@ -0,0 +1,373 @@
+#include "profiler.h"
+
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <elf.h>
+#include <link.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "metrics.h"
+
+namespace Profiler {
+
+namespace {
+
+constexpr int kMaxDepth = 64;
+
+struct Sample {
+    std::atomic<bool> done{false};  ///< set last by the handler
+    pid_t tid = 0;
+    int depth = 0;
+    uintptr_t pcs[kMaxDepth];       ///< interrupted pc, then return addresses
+};
+
+// Written by the SIGPROF handler: plain memory and atomics only.
+Sample* g_samples = nullptr;
+size_t g_capacity = 0;
+std::atomic<size_t> g_next{0};
+std::atomic<uint64_t> g_dropped{0};
+std::atomic<bool> g_sampling{false};
+pid_t g_pid = 0;
+
+// Executable segments loaded when sampling started; a return address outside
+// them means the walk has left the frame-pointer chain.
+constexpr int kMaxCodeRanges = 64;
+uintptr_t g_code[kMaxCodeRanges][2];
+int g_code_ranges = 0;
+
+std::mutex g_mu;
+std::condition_variable g_cv;
+bool g_running = false;
+
+// The interrupted pc and frame pointer from the signal context.
+bool InterruptedFrame(const void* context, uintptr_t* pc, uintptr_t* fp) {
+    const auto* uc = static_cast<const ucontext_t*>(context);
+#if defined(__x86_64__)
+    *pc = static_cast<uintptr_t>(uc->uc_mcontext.gregs[REG_RIP]);
+    *fp = static_cast<uintptr_t>(uc->uc_mcontext.gregs[REG_RBP]);
+    return true;
+#elif defined(__aarch64__)
+    *pc = static_cast<uintptr_t>(uc->uc_mcontext.pc);
+    *fp = static_cast<uintptr_t>(uc->uc_mcontext.regs[29]);
+    return true;
+#else
+    (void)uc;
+    (void)pc;
+    (void)fp;
+    return false;
+#endif
+}
+
+bool InCode(uintptr_t pc) {
+    for (int i = 0; i < g_code_ranges; ++i) {
+        if (pc >= g_code[i][0] && pc < g_code[i][1]) return true;
+    }
+    return false;
+}
+
+// Frame-pointer walk from the interrupted context. backtrace() is not
+// async-signal-safe (the unwinder takes locks and may allocate), so the
+// handler only follows saved frame pointers. Frames are read with
+// process_vm_readv(), which fails with EFAULT rather than faulting when fp
+// is garbage (code built without frame pointers), so the walk is safe
+// wherever the signal lands; such frames just end the stack early.
+int WalkFrames(uintptr_t pc, uintptr_t fp, uintptr_t* pcs) {
+    int depth = 0;
+    pcs[depth++] = pc;
+    while (depth < kMaxDepth && fp != 0 && fp % sizeof(uintptr_t) == 0) {
+        uintptr_t frame[2];         // saved fp, return address
+        iovec local{frame, sizeof(frame)};
+        iovec remote{reinterpret_cast<void*>(fp), sizeof(frame)};
+        if (::process_vm_readv(g_pid, &local, 1, &remote, 1, 0) != static_cast<ssize_t>(sizeof(frame))) break;
+        if (!InCode(frame[1])) break;
+        pcs[depth++] = frame[1];
+        // Callers live higher up the stack; anything else is not a chain.
+        if (frame[0] <= fp) break;
+        fp = frame[0];
+    }
+    return depth;
+}
+
+void OnSigprof(int, siginfo_t*, void* context) {
+    if (!g_sampling.load(std::memory_order_relaxed)) return;
+    int saved_errno = errno;
+    uintptr_t pc = 0, fp = 0;
+    size_t i = InterruptedFrame(context, &pc, &fp) ? g_next.fetch_add(1, std::memory_order_relaxed) : g_capacity;
+    if (i < g_capacity) {
+        Sample& s = g_samples[i];
+        s.tid = static_cast<pid_t>(::syscall(SYS_gettid));
+        s.depth = WalkFrames(pc, fp, s.pcs);
+        s.done.store(true, std::memory_order_release);
+    } else {
+        g_dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+    errno = saved_errno;
+}
+
+std::string Demangle(const char* name) {
+    int status = 0;
+    char* out = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+    if (status != 0 || !out) return name;
+    std::string s = out;
+    std::free(out);
+    return s;
+}
+
+int CollectCode(dl_phdr_info* info, size_t, void*) {
+    for (int i = 0; i < info->dlpi_phnum && g_code_ranges < kMaxCodeRanges; ++i) {
+        const ElfW(Phdr)& ph = info->dlpi_phdr[i];
+        if (ph.p_type != PT_LOAD || !(ph.p_flags & PF_X)) continue;
+        g_code[g_code_ranges][0] = info->dlpi_addr + ph.p_vaddr;
+        g_code[g_code_ranges][1] = info->dlpi_addr + ph.p_vaddr + ph.p_memsz;
+        ++g_code_ranges;
+    }
+    return 0;
+}
+
+int FindMainBase(dl_phdr_info* info, size_t, void* data) {
+    // The first object reported is the executable.
+    *static_cast<uintptr_t*>(data) = info->dlpi_addr;
+    return 1;
+}
+
+// Resolves program counters to function names. Built after a capture, off
+// the signal path, so it may read files and allocate freely.
+class Symbolizer {
+public:
+    Symbolizer() { LoadExecutable(); }
+
+    const std::string& Name(uintptr_t pc) {
+        auto it = cache_.find(pc);
+        if (it != cache_.end()) return it->second;
+        return cache_.emplace(pc, Resolve(pc)).first->second;
+    }
+
+private:
+    struct Symbol {
+        uintptr_t begin;
+        uintptr_t end;
+        std::string name;
+    };
+
+    // .symtab of /proc/self/exe (.dynsym if stripped), relocated by the
+    // executable's load base so PIE builds resolve as well.
+    void LoadExecutable() {
+        std::ifstream in("/proc/self/exe", std::ios::binary);
+        std::vector<char> image((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        if (image.size() < sizeof(Elf64_Ehdr) || std::memcmp(image.data(), ELFMAG, SELFMAG) != 0 ||
+            image[EI_CLASS] != ELFCLASS64) {
+            return;
+        }
+        const auto* eh = reinterpret_cast<const Elf64_Ehdr*>(image.data());
+        if (eh->e_shoff == 0 || eh->e_shoff + eh->e_shnum * sizeof(Elf64_Shdr) > image.size()) return;
+        const auto* sh = reinterpret_cast<const Elf64_Shdr*>(image.data() + eh->e_shoff);
+        const Elf64_Shdr* symtab = nullptr;
+        for (int i = 0; i < eh->e_shnum; ++i) {
+            if (sh[i].sh_type == SHT_SYMTAB) symtab = &sh[i];
+            if (sh[i].sh_type == SHT_DYNSYM && !symtab) symtab = &sh[i];
+        }
+        if (!symtab || symtab->sh_link >= eh->e_shnum) return;
+        const Elf64_Shdr& strtab = sh[symtab->sh_link];
+        if (symtab->sh_offset + symtab->sh_size > image.size() || strtab.sh_offset + strtab.sh_size > image.size()) {
+            return;
+        }
+        uintptr_t base = 0;
+        ::dl_iterate_phdr(FindMainBase, &base);
+        const auto* syms = reinterpret_cast<const Elf64_Sym*>(image.data() + symtab->sh_offset);
+        size_t count = symtab->sh_size / sizeof(Elf64_Sym);
+        for (size_t i = 0; i < count; ++i) {
+            const Elf64_Sym& s = syms[i];
+            if (ELF64_ST_TYPE(s.st_info) != STT_FUNC || s.st_value == 0 || s.st_name >= strtab.sh_size) continue;
+            uintptr_t begin = base + s.st_value;
+            exe_.push_back({begin, begin + std::max<uint64_t>(s.st_size, 1),
+                            Demangle(image.data() + strtab.sh_offset + s.st_name)});
+        }
+        std::sort(exe_.begin(), exe_.end(), [](const Symbol& a, const Symbol& b) { return a.begin < b.begin; });
+    }
+
+    std::string Resolve(uintptr_t pc) {
+        auto it = std::upper_bound(exe_.begin(), exe_.end(), pc,
+                                   [](uintptr_t v, const Symbol& s) { return v < s.begin; });
+        if (it != exe_.begin() && pc < std::prev(it)->end) return Clean(std::prev(it)->name);
+        Dl_info info;
+        if (::dladdr(reinterpret_cast<void*>(pc), &info) != 0) {
+            if (info.dli_sname) return Clean(Demangle(info.dli_sname));
+            if (info.dli_fname) {
+                const char* slash = std::strrchr(info.dli_fname, '/');
+                char off[32];
+                std::snprintf(off, sizeof(off), "+0x%lx",
+                              static_cast<unsigned long>(pc - reinterpret_cast<uintptr_t>(info.dli_fbase)));
+                return std::string(slash ? slash + 1 : info.dli_fname) + off;
+            }
+        }
+        char hex[32];
+        std::snprintf(hex, sizeof(hex), "0x%lx", static_cast<unsigned long>(pc));
+        return hex;
+    }
+
+    // ';' separates frames in the folded format.
+    static std::string Clean(std::string name) {
+        std::replace(name.begin(), name.end(), ';', ':');
+        return name;
+    }
+
+    std::vector<Symbol> exe_;
+    std::unordered_map<uintptr_t, std::string> cache_;
+};
+
+std::string ThreadName(pid_t tid) {
+    std::ifstream in("/proc/self/task/" + std::to_string(tid) + "/comm");
+    std::string name;
+    if (!std::getline(in, name) || name.empty()) return "thread-" + std::to_string(tid);
+    std::replace(name.begin(), name.end(), ' ', '_');
+    return name;
+}
+
+Result Write(const std::string& path, size_t taken) {
+    Result result;
+    result.path = path;
+    result.dropped = g_dropped.load();
+    Symbolizer symbols;
+    std::unordered_map<pid_t, std::string> threads;
+    std::map<std::string, uint64_t> folded;
+    for (size_t i = 0; i < taken; ++i) {
+        const Sample& s = g_samples[i];
+        if (!s.done.load(std::memory_order_acquire) || s.depth <= 0) continue;
+        auto t = threads.find(s.tid);
+        if (t == threads.end()) t = threads.emplace(s.tid, ThreadName(s.tid)).first;
+        std::string line = t->second;
+        // Outermost first; return addresses point past the call, so step
+        // back one byte to stay inside the calling function.
+        for (int f = s.depth - 1; f >= 0; --f) {
+            uintptr_t pc = s.pcs[f];
+            if (f > 0) --pc;
+            line += ';';
+            line += symbols.Name(pc);
+        }
+        ++folded[line];
+        ++result.samples;
+    }
+    result.stacks = folded.size();
+
+    FILE* f = std::fopen(path.c_str(), "w");
+    if (!f) return result;
+    for (const auto& kv : folded) {
+        std::fprintf(f, "%s %llu\n", kv.first.c_str(), static_cast<unsigned long long>(kv.second));
+    }
+    result.ok = std::fclose(f) == 0;
+    return result;
+}
+
+void Disarm() {
+    itimerval off{};
+    ::setitimer(ITIMER_PROF, &off, nullptr);
+    g_sampling.store(false, std::memory_order_relaxed);
+    // A SIGPROF already queued would otherwise kill the process once the
+    // handler is gone.
+    ::signal(SIGPROF, SIG_IGN);
+}
+
+} // namespace
+
+bool Start(const Options& options, const std::string& path, std::function<void(const Result&)> on_done,
+           std::string* error) {
+    static std::atomic<int64_t>& captures = Metrics::Counter("profiler.captures");
+    static std::atomic<int64_t>& samples = Metrics::Counter("profiler.samples");
+    static std::atomic<int64_t>& dropped = Metrics::Counter("profiler.dropped");
+
+    if (options.seconds <= 0 || options.hz <= 0 || options.hz > 10000 || options.max_samples == 0) {
+        *error = "bad profiler options";
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(g_mu);
+    if (g_running) {
+        *error = "a capture is already running";
+        return false;
+    }
+
+    // No handler can still be running here: a finished capture disarmed the
+    // timer and ignored SIGPROF before clearing g_running.
+    if (g_capacity < options.max_samples) {
+        delete[] g_samples;
+        g_samples = new Sample[options.max_samples];
+        g_capacity = options.max_samples;
+    }
+    for (size_t i = 0; i < g_capacity; ++i) g_samples[i].done.store(false, std::memory_order_relaxed);
+    g_next.store(0);
+    g_dropped.store(0);
+
+    g_pid = ::getpid();
+    g_code_ranges = 0;
+    ::dl_iterate_phdr(CollectCode, nullptr);
+    struct sigaction sa{};
+    sa.sa_sigaction = OnSigprof;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART | SA_SIGINFO;
+    if (::sigaction(SIGPROF, &sa, nullptr) != 0) {
+        *error = "sigaction(SIGPROF) failed";
+        return false;
+    }
+    g_sampling.store(true, std::memory_order_relaxed);
+    itimerval tv{};
+    tv.it_interval.tv_sec = 0;
+    tv.it_interval.tv_usec = std::max(1, 1000000 / options.hz);
+    tv.it_value = tv.it_interval;
+    if (::setitimer(ITIMER_PROF, &tv, nullptr) != 0) {
+        Disarm();
+        *error = "setitimer(ITIMER_PROF) failed";
+        return false;
+    }
+    g_running = true;
+    captures.fetch_add(1, std::memory_order_relaxed);
+
+    // Detached so that exiting mid-capture does not trip over a joinable
+    // std::thread; Wait() covers orderly shutdown.
+    std::thread([seconds = options.seconds, path, on_done = std::move(on_done)] {
+        std::this_thread::sleep_for(std::chrono::seconds(seconds));
+        Disarm();
+        size_t taken = std::min(g_next.load(), g_capacity);
+        Result result = Write(path, taken);
+        samples.fetch_add(static_cast<int64_t>(result.samples), std::memory_order_relaxed);
+        dropped.fetch_add(static_cast<int64_t>(result.dropped), std::memory_order_relaxed);
+        if (on_done) on_done(result);
+        {
+            std::lock_guard<std::mutex> done(g_mu);
+            g_running = false;
+        }
+        g_cv.notify_all();
+    }).detach();
+    return true;
+}
+
+bool Running() {
+    std::lock_guard<std::mutex> lock(g_mu);
+    return g_running;
+}
+
+void Wait() {
+    std::unique_lock<std::mutex> lock(g_mu);
+    g_cv.wait(lock, [] { return !g_running; });
+}
+
+} // namespace Profiler
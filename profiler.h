@@ -0,0 +1,53 @@
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// In-process sampling CPU profiler.
+//
+// Start() arms ITIMER_PROF for a fixed number of seconds. Every 1/hz seconds
+// of process CPU time the kernel sends SIGPROF to a thread that is running,
+// and the handler records the interrupted pc and the return addresses found
+// by walking saved frame pointers (async-signal-safe, unlike backtrace();
+// the build keeps frame pointers for this) into a buffer allocated up
+// front. When the capture ends, a collector thread disarms the timer,
+// symbolizes the program counters (the executable's own ELF symbol table,
+// so static functions resolve too; dladdr() for shared libraries) and
+// writes folded stacks, one "thread;outer;...;inner count" line per
+// distinct stack, ready for flamegraph.pl or speedscope.
+//
+// Idle cost is zero: no handler is installed and no timer runs outside a
+// capture. Nothing needs to be installed on the host.
+
+namespace Profiler {
+
+struct Options {
+    int seconds = 10;
+    int hz = 99;                    ///< samples per CPU-second
+    size_t max_samples = 1 << 16;   ///< further samples are counted as dropped
+};
+
+struct Result {
+    std::string path;
+    bool ok = false;                ///< false if path could not be written
+    uint64_t samples = 0;
+    uint64_t dropped = 0;
+    size_t stacks = 0;              ///< distinct folded lines
+};
+
+// Begin a capture written to path; on_done runs on the collector thread when
+// it has been written. Returns false with *error set if a capture is already
+// running or the timer cannot be armed.
+bool Start(const Options& options, const std::string& path, std::function<void(const Result&)> on_done,
+           std::string* error);
+
+bool Running();
+
+// Block until the current capture (if any) has been written.
+void Wait();
+
+} // namespace Profiler
+
+#endif // PROFILER_H_
@@ -0,0 +1,372 @@
+// replay.cpp
+// chat_replay: re-drive captured traffic against a running chat_server.
+//
+// Reads a chat log (LogFormat lines) or a state snapshot (snapshot.h),
+// rebuilds each user's join / message / leave timeline and replays it with
+// one real connection per user, preserving the recorded gaps scaled by
+// --speed (or with no gaps at all for --speed=max).
+//
+// Latency is measured per public message as the time until the sender gets
+// its own broadcast back, i.e. server receive + route + fan-out to it. This
+// is measured client-side only: the wire carries millisecond timestamps, so
+// the server's share comes from its metrics file (--metrics-file), not from here.
+//
+// Usage: chat_replay [--host=127.0.0.1] [--port=12345] [--speed=1|N|max]
+//                    [--prefix=NAME] [--limit=N] [--drain-ms=N]
+//                    [--receivers=N] FILE
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "common.h"
+#include "histogram.h"
+#include "load_client.h"
+#include "log_format.h"
+#include "network.h"
+#include "snapshot.h"
+#include "user_ids.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 12345;
+    double speed = 1.0;             ///< 0 = as fast as possible
+    std::string prefix;             ///< prepended to every replayed name
+    size_t limit = 0;               ///< 0 = whole input
+    int drain_ms = 2000;
+    int receivers = 1;              ///< epoll threads reading server frames
+    std::string input;
+};
+
+enum class Kind { kJoin, kMessage, kLeave };
+
+struct Event {
+    long long ts;
+    Kind kind;
+    size_t user;
+    MessageType type;
+    std::string target;
+    std::string content;
+};
+
+struct Session {
+    std::string name;
+    Socket sock = -1;
+    bool peer_closed = false;
+    std::deque<Clock::time_point> echoes;   ///< send times of public messages in flight
+};
+
+// ------------------------------------------------------------------ input
+
+bool LoadEntries(const std::string& path, size_t limit, std::vector<LogEntry>* out) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) return false;
+    char magic[8] = {};
+    in.read(magic, sizeof(magic));
+    if (in.gcount() == 8 && std::memcmp(magic, "CHATSNAP", 8) == 0) {
+        std::vector<std::shared_ptr<const LogEntry>> entries;
+        if (!Snapshot::ReadEntries(path, &entries)) return false;
+        for (const auto& e : entries) {
+            if (limit && out->size() >= limit) break;
+            out->push_back(*e);
+        }
+        return true;
+    }
+    in.clear();
+    in.seekg(0);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (limit && out->size() >= limit) break;
+        LogEntry e;
+        if (LogFormat::ParseLine(line, &e)) out->push_back(std::move(e));
+    }
+    return true;
+}
+
+// Users seen only mid-session get an implicit join before their first event
+// and everyone still online at the end leaves after the last one.
+std::vector<Event> BuildTimeline(const std::vector<LogEntry>& entries, const std::string& prefix,
+                                 std::vector<Session>* sessions) {
+    std::unordered_map<UserId, size_t> index;
+    std::vector<bool> online;
+    std::vector<Event> events;
+    auto session_of = [&](UserId id) {
+        auto it = index.find(id);
+        if (it != index.end()) return it->second;
+        size_t i = sessions->size();
+        index.emplace(id, i);
+        sessions->push_back(Session{prefix + UserIds::Name(id)});
+        online.push_back(false);
+        return i;
+    };
+
+    long long last_ts = 0;
+    for (const LogEntry& e : entries) {
+        if (e.actor_id == kNoUser || e.actor_id == UserIds::kServerId) continue;
+        size_t u = session_of(e.actor_id);
+        last_ts = e.timestamp;
+        switch (e.event_type) {
+            case MessageType::USER_JOINED:
+                if (!online[u]) events.push_back({e.timestamp, Kind::kJoin, u, e.event_type, "", ""});
+                online[u] = true;
+                break;
+            case MessageType::USER_LEFT:
+                if (online[u]) events.push_back({e.timestamp, Kind::kLeave, u, e.event_type, "", ""});
+                online[u] = false;
+                break;
+            case MessageType::PUBLIC_MESSAGE:
+            case MessageType::PRIVATE_MESSAGE: {
+                if (!online[u]) events.push_back({e.timestamp, Kind::kJoin, u, MessageType::USER_JOINED, "", ""});
+                online[u] = true;
+                std::string target;
+                if (e.event_type == MessageType::PRIVATE_MESSAGE) {
+                    target = prefix + (e.target_id != kNoUser ? UserIds::Name(e.target_id) : e.target_name);
+                }
+                events.push_back({e.timestamp, Kind::kMessage, u, e.event_type, target, e.content});
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    for (size_t u = 0; u < online.size(); ++u) {
+        if (online[u]) events.push_back({last_ts, Kind::kLeave, u, MessageType::USER_LEFT, "", ""});
+    }
+    return events;
+}
+
+// ------------------------------------------------------------------ replay
+
+class Replayer {
+public:
+    Replayer(const Options& opt, std::vector<Session> sessions)
+        : opt_(opt), sessions_(std::move(sessions)) {
+        for (int i = 0; i < std::max(1, opt.receivers); ++i) {
+            receivers_.emplace_back(new LoadClient::Receiver(
+                [this](Socket s, const Message& m) { OnMessage(s, m); },
+                [this](Socket s) { OnClosed(s); }));
+        }
+    }
+
+    void Run(const std::vector<Event>& events);
+
+private:
+    void OnMessage(Socket sock, const Message& m);
+    void OnClosed(Socket sock);
+    void Join(size_t u);
+    void Send(size_t u, const Event& e);
+    void Leave(size_t u);
+    void Report(const std::string& name, double value, const std::string& unit) {
+        std::printf("%-36s %14.2f %s\n", name.c_str(), value, unit.c_str());
+    }
+
+    const Options& opt_;
+    std::mutex mutex_;                          ///< guards sessions_, by_socket_, stats below
+    std::vector<Session> sessions_;
+    std::unordered_map<Socket, size_t> by_socket_;
+    size_t open_ = 0;
+    Histogram latency_;
+    uint64_t frames_received_ = 0;
+    uint64_t not_found_ = 0;
+    uint64_t sent_ = 0;
+    uint64_t skipped_ = 0;
+    uint64_t failed_logins_ = 0;
+    std::vector<std::unique_ptr<LoadClient::Receiver>> receivers_;
+};
+
+void Replayer::OnMessage(Socket sock, const Message& m) {
+    Clock::time_point now = Clock::now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++frames_received_;
+    auto it = by_socket_.find(sock);
+    if (it == by_socket_.end()) return;
+    Session& s = sessions_[it->second];
+    if (m.type == MessageType::PUBLIC_MESSAGE && m.sender_username == s.name && !s.echoes.empty()) {
+        latency_.Record(std::chrono::duration<double, std::micro>(now - s.echoes.front()).count());
+        s.echoes.pop_front();
+    } else if (m.content.rfind("USER_NOT_FOUND:", 0) == 0) {
+        ++not_found_;
+    }
+}
+
+void Replayer::OnClosed(Socket sock) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = by_socket_.find(sock);
+    if (it == by_socket_.end()) return;
+    Session& s = sessions_[it->second];
+    by_socket_.erase(it);
+    --open_;
+    if (s.sock == sock) {
+        // Still ours: the scheduler closes it on its next touch.
+        s.peer_closed = true;
+    } else {
+        NetworkLayer::Close(sock);   // already left; the scheduler let go of it
+    }
+}
+
+void Replayer::Join(size_t u) {
+    Socket sock = LoadClient::Login(opt_.host, opt_.port, sessions_[u].name);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (sock < 0) {
+        ++failed_logins_;
+        return;
+    }
+    Session& s = sessions_[u];
+    s.sock = sock;
+    s.peer_closed = false;
+    s.echoes.clear();
+    by_socket_[sock] = u;
+    ++open_;
+    receivers_[static_cast<size_t>(sock) % receivers_.size()]->Add(sock);
+}
+
+// Only this (scheduler) thread changes s.sock, and OnClosed never closes a
+// socket that is still s.sock, so the writes below can run without mutex_
+// and never hold up the receivers.
+void Replayer::Send(size_t u, const Event& e) {
+    NetworkLayer::Frame frame = NetworkLayer::EncodeFrame(LoadClient::MakeMessage(e.type, e.content, e.target));
+    Socket sock;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Session& s = sessions_[u];
+        if (s.sock < 0 || s.peer_closed) {
+            ++skipped_;
+            return;
+        }
+        sock = s.sock;
+        if (e.type == MessageType::PUBLIC_MESSAGE) s.echoes.push_back(Clock::now());
+        ++sent_;
+    }
+    NetworkLayer::SendFrame(sock, frame);
+}
+
+void Replayer::Leave(size_t u) {
+    Socket sock;
+    bool peer_closed;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sock = sessions_[u].sock;
+        peer_closed = sessions_[u].peer_closed;
+    }
+    if (sock < 0) return;
+    // The receiver sees GOODBYE, then EOF, and OnClosed closes the socket.
+    if (!peer_closed) NetworkLayer::SendMessage(sock, LoadClient::MakeMessage(MessageType::COMMAND_RESPONSE, "BYE"));
+    std::lock_guard<std::mutex> lock(mutex_);
+    Session& s = sessions_[u];
+    if (s.peer_closed) NetworkLayer::Close(sock);   // closed before it got BYE; OnClosed left it to us
+    s.sock = -1;
+}
+
+void Replayer::Run(const std::vector<Event>& events) {
+    if (events.empty()) return;
+    const long long ts0 = events.front().ts;
+    Clock::time_point start = Clock::now();
+    for (const Event& e : events) {
+        if (opt_.speed > 0) {
+            auto offset = std::chrono::duration<double, std::milli>((e.ts - ts0) / opt_.speed);
+            std::this_thread::sleep_until(start + std::chrono::duration_cast<Clock::duration>(offset));
+        }
+        switch (e.kind) {
+            case Kind::kJoin: Join(e.user); break;
+            case Kind::kMessage: Send(e.user, e); break;
+            case Kind::kLeave: Leave(e.user); break;
+        }
+    }
+    double send_s = std::chrono::duration<double>(Clock::now() - start).count();
+
+    // Wait for the last echoes and goodbyes.
+    Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(opt_.drain_ms);
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (open_ == 0) break;
+        }
+        if (Clock::now() > deadline) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    double total_s = std::chrono::duration<double>(Clock::now() - start).count();
+    for (auto& r : receivers_) r->Stop();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t lost = 0;
+    for (Session& s : sessions_) lost += s.echoes.size();
+    for (auto& kv : by_socket_) NetworkLayer::Close(kv.first);
+
+    Report("replay.sessions", (double)sessions_.size(), "users");
+    Report("replay.failed_logins", (double)failed_logins_, "users");
+    Report("replay.messages_sent", (double)sent_, "msgs");
+    Report("replay.messages_skipped", (double)skipped_, "msgs");
+    Report("replay.send_rate", sent_ / std::max(send_s, 1e-9), "msgs/s");
+    Report("replay.frames_received", (double)frames_received_, "frames");
+    Report("replay.delivery_rate", frames_received_ / std::max(total_s, 1e-9), "frames/s");
+    Report("replay.echo_p50", latency_.Percentile(0.50), "us");
+    Report("replay.echo_p90", latency_.Percentile(0.90), "us");
+    Report("replay.echo_p99", latency_.Percentile(0.99), "us");
+    Report("replay.echo_p999", latency_.Percentile(0.999), "us");
+    Report("replay.echo_max", latency_.Max(), "us");
+    Report("replay.echo_lost", (double)lost, "msgs");
+    Report("replay.user_not_found", (double)not_found_, "msgs");
+    std::fflush(stdout);
+}
+
+bool ParseArgs(int argc, char** argv, Options* opt) {
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        auto value = [&](const char* key) -> const char* {
+            size_t n = std::char_traits<char>::length(key);
+            return a.compare(0, n, key) == 0 ? a.c_str() + n : nullptr;
+        };
+        if (const char* v = value("--host=")) opt->host = v;
+        else if (const char* v = value("--port=")) opt->port = std::atoi(v);
+        else if (const char* v = value("--speed=")) opt->speed = std::strcmp(v, "max") == 0 ? 0 : std::atof(v);
+        else if (const char* v = value("--prefix=")) opt->prefix = v;
+        else if (const char* v = value("--limit=")) opt->limit = std::strtoull(v, nullptr, 10);
+        else if (const char* v = value("--drain-ms=")) opt->drain_ms = std::atoi(v);
+        else if (const char* v = value("--receivers=")) opt->receivers = std::atoi(v);
+        else if (a.compare(0, 2, "--") != 0 && opt->input.empty()) opt->input = a;
+        else {
+            std::cerr << "unknown argument: " << a << "\n";
+            return false;
+        }
+    }
+    return !opt->input.empty() && opt->port > 0 && opt->speed >= 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options opt;
+    if (!ParseArgs(argc, argv, &opt)) {
+        std::cerr << "usage: chat_replay [--host=H] [--port=N] [--speed=1|N|max] "
+                     "[--prefix=NAME] [--limit=N] [--drain-ms=N] [--receivers=N] FILE\n";
+        return 2;
+    }
+    std::vector<LogEntry> entries;
+    if (!LoadEntries(opt.input, opt.limit, &entries)) {
+        std::cerr << "cannot read " << opt.input << "\n";
+        return 1;
+    }
+    std::vector<Session> sessions;
+    std::vector<Event> events = BuildTimeline(entries, opt.prefix, &sessions);
+    std::cout << "Replaying " << events.size() << " events from " << entries.size()
+              << " log entries, " << sessions.size() << " users" << std::endl;
+
+    Replayer replayer(opt, std::move(sessions));
+    replayer.Run(events);
+    return 0;
+}
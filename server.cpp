@@ -3,32 +3,69 @@
 // Uses POSIX threads for concurrency (pthread).
 
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <string>
 #include <cstdlib>
 #include <csignal>
 #include <pthread.h>
 #include <memory>
 #include <atomic>
+#include <chrono>
+#include <thread>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 #include "common.h"
 #include "network.h"
 #include "services.h"
-
-// Module-scope server socket for graceful shutdown
-static Socket g_server_socket = -1;
-
-// Forward declaration of graceful shutdown handler used by signal()
-extern "C" void GracefulShutdownHandler(int signo);
+#include "connection_table.h"
+#include "outbound.h"
+#include "fanout.h"
+#include "file_transfer.h"
+#include "affinity.h"
+#include "busy_poll.h"
+#include "socket_profile.h"
+#include "zerocopy.h"
+#include "config.h"
+#include "memory_budget.h"
+#include "metrics.h"
+#include "history.h"
+#include "snapshot.h"
+#include "wal.h"
+#include "trace.h"
+#include "presence.h"
+#include "topics.h"
+#include "watchlist.h"
+#include "profiler.h"
+#include "bootstrap.h"
+#include "signals.h"
+
+// Set once SIGINT/SIGTERM asks for a drain (see ConnectionManager::Drain)
+static std::atomic<bool> g_draining{false};
 
 namespace ClientHandler {
 
     // ServeClient implements the complete lifecycle for a single client connection
     // as described in Appendix A pseudocode.
     void ServeClient(Socket client_socket) {
+        // Claim a connection slot; its id stays valid only for this session
+        ConnectionTable::ConnId conn = ConnectionTable::Acquire(client_socket);
+        if (!conn.Valid()) {
+            LoggingService::LogSystem("Connection table full, rejecting client");
+            NetworkLayer::Close(client_socket);
+            return;
+        }
+
+        // From here on every write to this socket goes through its writer thread
+        Outbound::Open(conn, client_socket);
+
         // Authenticate user
         std::optional<User> opt_user = UserManager::Authenticate(client_socket);
         if (!opt_user.has_value()) {
             // Authentication failed or client disconnected during handshake
+            Outbound::Close(conn);
+            ConnectionTable::Release(conn);
             NetworkLayer::Close(client_socket);
             return;
         }
@@ -44,7 +81,24 @@ namespace ClientHandler {
         joinMsg.content = user.username + " joined";
 
         MessageRouter::BroadcastPublic(joinMsg);
-        LoggingService::LogFromMessage(joinMsg);
+        LoggingService::LogFromMessage(joinMsg, user.uid, kNoUser);
+        Topics::Publish("presence.join." + Topics::Level(user.username), user.username, joinMsg.content,
+                        joinMsg.timestamp);
+
+        // Current away/busy/typing states; later changes arrive as deltas
+        if (Presence::Enabled()) {
+            std::string statuses = Presence::Snapshot();
+            if (!statuses.empty()) {
+                Message presenceMsg;
+                presenceMsg.type = MessageType::PRESENCE_DELTA;
+                presenceMsg.timestamp = NowEpochMs();
+                presenceMsg.sender_username = "Server";
+                presenceMsg.target_username = "";
+                presenceMsg.content = statuses;
+                Outbound::Send(client_socket, presenceMsg);
+            }
+        }
+        Watchlist::AddUser(user.uid);
        
         // Main receive loop
         while (user.connected) {
@@ -56,6 +110,7 @@ namespace ClientHandler {
                 break;
             }
             
+            ConnectionTable::CountInbound(conn);
             Message incoming = incoming_opt.value();
             // Populate sender username
             incoming.sender_username = user.username;
@@ -73,7 +128,11 @@ namespace ClientHandler {
         }
         
         // Remove user from user manager
-        UserManager::RemoveUser(user.username);
+        UserManager::RemoveUserById(user.uid);
+        Presence::Remove(user.uid);
+        Watchlist::RemoveUser(user.uid);
+        Topics::RemoveSubscriber(user.uid);
+        FileTransfer::AbortUploads(user.uid);
 
         // Broadcast leave message
         Message leaveMsg;
@@ -83,10 +142,18 @@ namespace ClientHandler {
         leaveMsg.target_username = "";
         leaveMsg.content = user.username + " left";
 
-        MessageRouter::BroadcastPublic(leaveMsg);
-        LoggingService::LogFromMessage(leaveMsg);
+        // While draining everyone is leaving: log it, but do not send every
+        // departure to every other session on its way out
+        if (!g_draining.load()) {
+            MessageRouter::BroadcastPublic(leaveMsg);
+            Topics::Publish("presence.leave." + Topics::Level(user.username), user.username, leaveMsg.content,
+                            leaveMsg.timestamp);
+        }
+        LoggingService::LogFromMessage(leaveMsg, user.uid, kNoUser);
 
-        // Close socket
+        // Flush pending frames (e.g. GOODBYE), free the slot, then close socket
+        Outbound::Close(conn);
+        ConnectionTable::Release(conn);
         NetworkLayer::Close(client_socket);
     }
 
@@ -135,83 +202,342 @@ namespace ConnectionManager {
         return true;
     }
 
-    // Run: accept loop that spawns a detached thread for each accepted client
+    // Readable once a drain is requested; the acceptor polls it next to the
+    // listening socket
+    static int DrainWakeFd() {
+        static int fd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        return fd;
+    }
+
+    // Run: accept loop that spawns a detached thread for each accepted client.
+    // Returns once RequestDrain() has been called.
     void Run(Socket server_socket) {
-        (void)server_socket; // parameter named to match pseudocode; not used to store globally here
-        while (true) {
-            Socket client_socket = NetworkLayer::Accept(server_socket);
-            if (client_socket >= 0) {
-                // spawn detached thread to serve client
-                bool ok = SpawnThreadForClient(client_socket);
-                if (!ok) {
-                    LoggingService::LogSystem("Failed to spawn thread for client");
-                    // close the client socket to avoid leak
-                    NetworkLayer::Close(client_socket);
-                }
-            } else {
+        while (!g_draining.load()) {
+            Socket client_socket;
+            try {
+                client_socket = NetworkLayer::Accept(server_socket, DrainWakeFd());
+            } catch (const std::exception&) {
+                // e.g. out of descriptors; back off instead of spinning
                 LoggingService::LogSystem("Accept failed");
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+            if (client_socket < 0) {
+                break;  // woken by RequestDrain()
+            }
+            // spawn detached thread to serve client
+            bool ok = SpawnThreadForClient(client_socket);
+            if (!ok) {
+                LoggingService::LogSystem("Failed to spawn thread for client");
+                // close the client socket to avoid leak
+                NetworkLayer::Close(client_socket);
             }
-            // Keep looping forever as per pseudocode
         }
     }
 
-    // ShutdownAll broadcasts shutdown message, closes all user sockets, and logs.
-    void ShutdownAll() {
-        AnnouncementService::Broadcast("Server is shutting down");
-        // Close every user socket using UserManager.ForEachUserSocket
-        UserManager::ForEachUserSocket([](Socket s) {
-            NetworkLayer::Close(s);
-        });
-        LoggingService::LogSystem("Server shutdown broadcasted");
+    // Signal callback (runs on the Signals watcher thread, not in a handler).
+    // The first call stops the acceptor; a second one exits at once.
+    void RequestDrain() {
+        if (g_draining.exchange(true)) {
+            std::cerr << "Second shutdown signal: exiting without draining" << std::endl;
+            std::_Exit(1);
+        }
+        LoggingService::LogSystem("Shutdown requested, draining connections");
+        uint64_t one = 1;
+        ssize_t n = ::write(DrainWakeFd(), &one, sizeof(one));
+        (void)n;
     }
 
-} // namespace ConnectionManager
+    // Drain: announce the shutdown, then stop reading from every connection
+    // so each session ends the normal way (its writer flushes what is queued,
+    // including the notice) and wait for the table to empty. Sessions left at
+    // the deadline, typically peers that stopped reading, are cut off.
+    void Drain(int timeout_ms) {
+        using Clock = std::chrono::steady_clock;
+        const Clock::time_point start = Clock::now();
+        const size_t sessions = ConnectionTable::LiveCount();
+        AnnouncementService::Broadcast("Server is shutting down");
+        ConnectionTable::ForEachLive([](Socket s) {
+            NetworkLayer::ShutdownRead(s);
+        });
 
-// Graceful shutdown handler for signals (SIGINT)
-extern "C" void GracefulShutdownHandler(int /*signo*/) {
-    // Notify clients and close their sockets
-    ConnectionManager::ShutdownAll();
+        Clock::time_point deadline = start + std::chrono::milliseconds(timeout_ms);
+        size_t cut_off = 0;
+        bool forced = false;
+        while (ConnectionTable::LiveCount() > 0) {
+            if (Clock::now() >= deadline) {
+                if (forced) {
+                    break;  // still stuck after the hard close; give up waiting
+                }
+                // Abort both directions: blocked writers fail, drop the rest
+                // of their queue and let the session finish
+                forced = true;
+                cut_off = ConnectionTable::LiveCount();
+                ConnectionTable::ForEachLive([](Socket s) {
+                    NetworkLayer::Shutdown(s);
+                });
+                deadline = Clock::now() + std::chrono::seconds(1);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
 
-    // Close server main socket if open
-    if (g_server_socket >= 0) {
-        NetworkLayer::Close(g_server_socket);
-        g_server_socket = -1;
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        std::string summary = "Drained " + std::to_string(sessions) + " sessions in " +
+                              std::to_string(static_cast<long long>(ms)) + " ms, " + std::to_string(cut_off) +
+                              " cut off at the deadline, " + std::to_string(ConnectionTable::LiveCount()) +
+                              " still open";
+        LoggingService::LogSystem(summary);
+        std::cout << summary << std::endl;
     }
 
-    // Exit program
-    std::_Exit(0);
-}
+} // namespace ConnectionManager
 #ifndef TEST_BUILD
+// Module-scope server socket for graceful shutdown
+static Socket g_server_socket = -1;
+
 // Server bootstrap functions
-static void StartServerMain(int port) {
-    // Initialize logging system
-    LoggingService::Initialize("chat_history.log");
+// Begin a CPU profile capture; returns a one-line status for the log or an
+// admin reply.
+static std::string StartProfile(const Profiler::Options& options, const std::string& prefix) {
+    static std::atomic<int> captures{0};
+    std::string path = prefix + "." + std::to_string(::getpid()) + "." + std::to_string(++captures) + ".folded";
+    std::string error;
+    bool ok = Profiler::Start(options, path, [](const Profiler::Result& r) {
+        LoggingService::LogSystem("Profile " + std::string(r.ok ? "written" : "NOT written") + ": " +
+                                  std::to_string(r.samples) + " samples (" + std::to_string(r.dropped) +
+                                  " dropped), " + std::to_string(r.stacks) + " stacks -> " + r.path);
+    }, &error);
+    if (!ok) return "profile not started: " + error;
+    std::string status = "profiling " + std::to_string(options.seconds) + "s at " + std::to_string(options.hz) +
+                         " Hz -> " + path;
+    LoggingService::LogSystem("CPU " + status);
+    return status;
+}
+
+static void StartServerMain(const ServerConfig& config) {
+    // Phases a client depends on run before the listener, in parallel where
+    // the dependencies allow; the rest follow in the background.
+    Bootstrap::Plan plan;
+
+    // CPU placement must be known before any role thread starts
+    plan.Add("affinity", {}, [&config] {
+        std::string error;
+        if (Affinity::Configure(config.affinity, &error)) return true;
+        Bootstrap::PrintLine(std::cerr, "Error: " + error);
+        return false;
+    });
+    plan.Add("logging", {}, [&config] {
+        LoggingService::Initialize(config.log_file);
+        return true;
+    });
 
-    // Start server listening socket
-    g_server_socket = NetworkLayer::StartServer(port);
+    // Buffer limits must be in place before clients arrive
+    plan.Add("limits", {}, [&config] {
+        MemoryBudget::Configure(config.limits);
+        return true;
+    });
+
+    // File sharing: chunks are spooled to disk and served with sendfile
+    plan.Add("files", {"limits"}, [&config] {
+        // One chunk plus the frame's fixed fields must fit a frame
+        if (config.files.chunk_bytes + 1024 > config.limits.max_frame_bytes) {
+            Bootstrap::PrintLine(std::cerr, "Error: --file-chunk must be at least 1K below --max-frame");
+            return false;
+        }
+        std::string error;
+        if (FileTransfer::Configure(config.files, &error)) return true;
+        Bootstrap::PrintLine(std::cerr, "Error: " + error);
+        return false;
+    });
+
+    // Warm start: latest snapshot plus the log written after it, with the
+    // replay frames kept in segments next to the file spool
+    plan.Add("history", {"logging", "files"}, [&config] {
+        History::Configure(config.history_entries);
+        std::string error;
+        if (!History::StoreFrames(config.files.spool_dir, &error)) {
+            Bootstrap::PrintLine(std::cerr, "Warning: " + error + ", /history is encoded per request");
+        }
+        Snapshot::WarmStartStats warm = Snapshot::WarmStart(config.snapshot_file, config.log_file);
+        std::ostringstream line;
+        line << "Warm start: " << (warm.from_snapshot ? "snapshot" : "log tail only") << ", " << warm.users
+             << " users, " << warm.entries << " history entries, " << warm.replayed_lines
+             << " log lines replayed in " << warm.elapsed_ms << " ms";
+        Bootstrap::PrintLine(std::cout, line.str());
+        return true;
+    });
+
+    // Durable mode: the chat log becomes a group-committed write-ahead log
+    plan.Add("wal", {"history", "affinity"}, [&config] {
+        if (!config.durable) return true;
+        Wal::Options wal;
+        wal.path = config.log_file;
+        wal.group_window_us = config.group_commit_us;
+        wal.max_batch = config.group_commit_max;
+        return Wal::Open(wal);
+    });
+
+    // Large-room broadcasts fan out on a worker pool
+    plan.Add("fanout", {"affinity"}, [&config] {
+        Fanout::Start(config.fanout);
+        return true;
+    });
+
+    // Spin-then-park waits for latency-critical deployments
+    plan.Add("busy_poll", {}, [&config] {
+        BusyPoll::Configure(config.busy_poll);
+        return true;
+    });
+
+    // TCP options for the listening and accepted sockets
+    plan.Add("socket_profile", {}, [&config] {
+        SocketProfile::Profile profile;
+        SocketProfile::Preset(config.socket_profile, &profile);
+        SocketProfile::SetServer(SocketProfile::Resolve(profile, config.socket_overrides));
+        Bootstrap::PrintLine(std::cout, "Socket profile: " + SocketProfile::Describe(SocketProfile::Server()));
+        // Applies to mailboxes opened from now on
+        ZeroCopy::Configure(config.zerocopy_bytes);
+        return true;
+    });
+
+    // Status changes are batched per tick from the first session on
+    plan.Add("presence", {"affinity"}, [&config] {
+        Presence::Start(config.presence_tick_ms);
+        return true;
+    });
+
+    // Probes record from the first connection when --trace=on
+    plan.Add("trace", {}, [&config] {
+        Trace::SetEnabled(config.trace);
+        return true;
+    });
+
+    // The admin tables are not locked, so they are filled before serving
+    plan.Add("admin", {}, [&config] {
+        std::string token;
+        if (!config.admins.empty()) {
+            // First line of the file, trailing whitespace dropped
+            std::ifstream in(config.admin_token_file);
+            std::getline(in, token);
+            token.erase(token.find_last_not_of(" \t\r\n") + 1);
+            if (token.size() < 16) {
+                Bootstrap::PrintLine(std::cerr,
+                                     "Error: " + config.admin_token_file + " must hold a token of at least 16 bytes");
+                return false;
+            }
+        }
+        CommandProcessor::SetAdmins(config.admins, token);
+        CommandProcessor::RegisterAdminCommand("PROFILE", [options = config.profiler,
+                                                           prefix = config.profile_file](const std::string& args) {
+            Profiler::Options o = options;
+            if (!args.empty()) {
+                char* end = nullptr;
+                long s = std::strtol(args.c_str(), &end, 10);
+                if (*end != '\0' || s <= 0 || s > 3600) return std::string("usage: PROFILE [seconds]");
+                o.seconds = static_cast<int>(s);
+            }
+            return StartProfile(o, prefix);
+        });
+        CommandProcessor::RegisterAdminCommand("TRACE", [](const std::string& args) {
+            if (args == "on" || args == "off") {
+                Trace::SetEnabled(args == "on");
+                LoggingService::LogSystem(std::string("Tracing ") + (args == "on" ? "enabled" : "disabled") +
+                                          " by ADMIN TRACE");
+            } else if (!args.empty()) {
+                return std::string("usage: TRACE [on|off]");
+            }
+            return std::string("TRACE ") + (Trace::Enabled() ? "on" : "off");
+        });
+        return true;
+    });
+
+    // Handlers go in before READY: a supervisor may send SIGTERM as soon as
+    // it is told the server is up, and that must drain, not kill
+    plan.Add("signals", {"logging"}, [&config] {
+        // SIGINT/SIGTERM: drain and exit (a second one exits at once)
+        Signals::On(SIGINT, ConnectionManager::RequestDrain);
+        Signals::On(SIGTERM, ConnectionManager::RequestDrain);
+
+        // SIGUSR1: dump the trace rings, whether or not they are recording
+        // now ("ADMIN TRACE on|off" arms them)
+        Signals::On(SIGUSR1, [prefix = config.trace_file] {
+            static int dumps = 0;
+            std::string path = prefix + "." + std::to_string(::getpid()) + "." + std::to_string(++dumps) + ".txt";
+            long n = Trace::Dump(path);
+            LoggingService::LogSystem("Trace dump: " + std::to_string(n) + " events -> " + path);
+        });
+
+        // SIGUSR2: sample CPU stacks to a folded file (also "ADMIN PROFILE")
+        Signals::On(SIGUSR2, [options = config.profiler, prefix = config.profile_file] {
+            StartProfile(options, prefix);
+        });
+        return true;
+    });
+
+    // Start server listening socket once everything a session touches is up
+    plan.Add("listen", {"logging", "limits", "history", "wal", "fanout", "busy_poll", "socket_profile", "presence",
+                        "files", "trace", "admin", "signals"},
+             [&config] {
+                 g_server_socket = NetworkLayer::StartServer(config.port);
+                 return true;
+             });
+
+    // Not needed by the first client: started after the listener is up
+    plan.AddDeferred("metrics", {"affinity"}, [&config] {
+        Metrics::StartReporter(config.metrics_file, config.metrics_interval_ms);
+        return true;
+    });
+    plan.AddDeferred("snapshot_writer", {"history", "affinity"}, [&config] {
+        Snapshot::StartWriter(config.snapshot_file, config.snapshot_interval_s);
+        return true;
+    });
 
     // Welcome announcement
-    AnnouncementService::Broadcast("Welcome to the chat room!");
+    plan.AddDeferred("welcome", {"listen"}, [] {
+        AnnouncementService::Broadcast("Welcome to the chat room!");
+        return true;
+    });
 
-    // Register graceful shutdown handler for SIGINT
-    std::signal(SIGINT, GracefulShutdownHandler);
+    std::string failed;
+    if (!plan.RunCritical(&failed)) {
+        std::cerr << "Error: startup phase " << failed << std::endl;
+        std::exit(1);
+    }
+    if (!Bootstrap::NotifyReady("listening on port " + std::to_string(config.port), config.ready_fd)) {
+        std::cerr << "Warning: readiness notification failed" << std::endl;
+    }
+    plan.StartDeferred();
 
-    // Enter main connection loop
+    // Enter main connection loop; connection threads inherit its CPU mask
+    Affinity::PinSelf(Affinity::Role::kIo);
     ConnectionManager::Run(g_server_socket);
+
+    // Draining: no new clients, let the sessions flush, then make the log
+    // durable
+    NetworkLayer::Close(g_server_socket);
+    g_server_socket = -1;
+    ConnectionManager::Drain(config.drain_timeout_ms);
+    LoggingService::LogSystem("Server shutdown complete");
+    if (Wal::IsOpen()) {
+        Wal::Close();
+    }
+
+    // Metrics, snapshot and fan-out threads never stop; skip the static
+    // destructors they may still be using
+    std::cout.flush();
+    std::_Exit(0);
 }
 
 int main(int argc, char** argv) {
     std::signal(SIGPIPE, SIG_IGN);
-    int port = 12345; // default
-    if (argc >= 2) {
-        try {
-            port = std::stoi(argv[1]);
-        } catch (...) {
-            std::cerr << "Invalid port argument, using default 12345\n";
-        }
+    ServerConfig config;
+    std::string error;
+    if (!Config::ParseArgs(argc, argv, &config, &error)) {
+        std::cerr << error << "\n" << Config::Usage();
+        return 2;
     }
 
-    StartServerMain(port);
+    StartServerMain(config);
     return 0;
 }
 #endif // TEST_BUILD
\ No newline at end of file
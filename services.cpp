@@ -1,7 +1,20 @@
 #include "services.h"
+#include "outbound.h"
+#include "file_transfer.h"
+#include "history.h"
+#include "locks.h"
+#include "log_format.h"
+#include "metrics.h"
+#include "presence.h"
+#include "topics.h"
+#include "trace.h"
+#include "watchlist.h"
 
 #include <sstream>
 #include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <sys/stat.h>
 
 // ===============================
 // helpers (internal linkage)
@@ -9,6 +22,8 @@
 namespace {
 
 constexpr int kAuthMaxRetries = 3;
+constexpr size_t kHistoryReplayDefault = 50;
+constexpr size_t kHistoryReplayMax = 1000;
 
 // Simple string join utility.
 static std::string Join(const std::vector<std::string>& parts, const std::string& sep) {
@@ -20,18 +35,6 @@ static std::string Join(const std::vector<std::string>& parts, const std::string
     return oss.str();
 }
 
-// Lightweight "format" for a LogEntry line. Tests only check substring presence,
-// so we keep a readable, stable delimiter-based encoding.
-static std::string FormatLogLine(const LogEntry& e) {
-    std::ostringstream oss;
-    oss << e.timestamp
-        << " | " << static_cast<int>(e.event_type)
-        << " | " << e.actor
-        << " | " << e.target
-        << " | " << e.content;
-    return oss.str();
-}
-
 } // namespace
 
 // ===============================
@@ -39,10 +42,16 @@ static std::string FormatLogLine(const LogEntry& e) {
 // ===============================
 namespace UserManager {
 
-using Pair = std::pair<User, Socket>;
+// UserId -> slot in the dense ConnectionTable (socket, state and counters
+// live there). Indexed directly by id, so no hashing on the routing path.
+static std::vector<ConnectionTable::ConnId> g_users;
+static Locks::Mutex g_mutex{"user_manager"};
 
-static std::unordered_map<std::string, Pair> g_users;
-static std::mutex g_mutex;
+// Caller holds g_mutex.
+static ConnectionTable::ConnId LookupLocked(UserId user) {
+    if (user == kNoUser || user >= g_users.size()) return ConnectionTable::ConnId{};
+    return g_users[user];
+}
 
 static Message MakeServerCommand(const std::string& content) {
     Message m;
@@ -54,13 +63,32 @@ static Message MakeServerCommand(const std::string& content) {
     return m;
 }
 
+static std::optional<User> AuthenticateImpl(Socket client_socket);
+
+// ',' and '=' separate the "name=code" items of PRESENCE_DELTA; a name
+// holding them could forge other users' statuses. The reserved names are
+// UserIds' kNoUser ("") and kServerId ("Server"): CheckUniqueness would pass
+// the first for any number of sessions, and the second would make a user's
+// lines indistinguishable from the server's own entries.
+bool ValidUsername(const std::string& username) {
+    return !username.empty() && username != UserIds::Name(UserIds::kServerId) &&
+           username.find_first_of(",=") == std::string::npos;
+}
+
 std::optional<User> Authenticate(Socket client_socket) {
+    CHAT_TRACE(kAuthBegin, client_socket, 0);
+    std::optional<User> user = AuthenticateImpl(client_socket);
+    CHAT_TRACE(kAuthEnd, client_socket, user.has_value());
+    return user;
+}
+
+static std::optional<User> AuthenticateImpl(Socket client_socket) {
     int retries = 0;
 
     while (retries < kAuthMaxRetries) {
         // Prompt for username
         Message prompt = MakeServerCommand("ENTER_USERNAME");
-        NetworkLayer::SendMessage(client_socket, prompt);
+        Outbound::Send(client_socket, prompt);
 
         // Wait for reply
         auto replyOpt = NetworkLayer::ReceiveMessage(client_socket);
@@ -70,11 +98,17 @@ std::optional<User> Authenticate(Socket client_socket) {
         const Message& reply = *replyOpt;
         std::string username = reply.content;
 
+        if (!ValidUsername(username)) {
+            Outbound::Send(client_socket, MakeServerCommand("USERNAME_INVALID"));
+            ++retries;
+            continue;
+        }
         bool unique = CheckUniqueness(username);
         if (unique) {
             User user;
             // In this project, Socket serves as the id surrogate.
             user.id = client_socket;
+            user.uid = UserIds::Intern(username);
             user.username = username;
             user.connected = true;
             user.joined_at = NowEpochMs();
@@ -82,64 +116,90 @@ std::optional<User> Authenticate(Socket client_socket) {
             AddUser(user, client_socket);
 
             Message ok = MakeServerCommand("USERNAME_ACCEPTED");
-            NetworkLayer::SendMessage(client_socket, ok);
+            Outbound::Send(client_socket, ok);
 
             return user;
         } else {
             Message taken = MakeServerCommand("USERNAME_TAKEN");
-            NetworkLayer::SendMessage(client_socket, taken);
+            Outbound::Send(client_socket, taken);
             ++retries;
         }
     }
 
     // Too many attempts
     Message fail = MakeServerCommand("AUTH_FAILED");
-    NetworkLayer::SendMessage(client_socket, fail);
+    Outbound::Send(client_socket, fail);
     return std::nullopt;
 }
 
 void AddUser(const User& user, Socket client_socket) {
-    std::lock_guard<std::mutex> lock(g_mutex);
-    g_users[user.username] = std::make_pair(user, client_socket);
+    // ServeClient acquires the slot at accept time; callers outside that
+    // path (tools, tests) get one here.
+    ConnectionTable::ConnId conn = ConnectionTable::FindBySocket(client_socket);
+    if (!conn.Valid()) conn = ConnectionTable::Acquire(client_socket);
+    UserId uid = user.uid != kNoUser ? user.uid : UserIds::Intern(user.username);
+    Outbound::Quiesce(conn);
+    Locks::Lock lock(g_mutex);
+    if (uid >= g_users.size()) g_users.resize(uid + 1);
+    g_users[uid] = conn;
+    ConnectionTable::SetOnline(conn, uid, user.joined_at);
 }
 
 void RemoveUser(const std::string& username) {
-    std::lock_guard<std::mutex> lock(g_mutex);
-    g_users.erase(username);
+    RemoveUserById(UserIds::Find(username));
+}
+
+void RemoveUserById(UserId uid) {
+    ConnectionTable::ConnId conn;
+    {
+        Locks::Lock lock(g_mutex);
+        conn = LookupLocked(uid);
+    }
+    if (!conn.Valid()) return;
+    Outbound::Quiesce(conn);
+    Locks::Lock lock(g_mutex);
+    if (!(LookupLocked(uid) == conn)) return;   // removed meanwhile
+    // Leave the slot to its owner (ServeClient releases it after flushing);
+    // only stop it from receiving broadcasts.
+    ConnectionTable::SetState(conn, ConnectionTable::ConnState::kClosing);
+    g_users[uid] = ConnectionTable::ConnId{};
 }
 
 bool CheckUniqueness(const std::string& username) {
-    std::lock_guard<std::mutex> lock(g_mutex);
-    return g_users.find(username) == g_users.end();
+    UserId uid = UserIds::Find(username);
+    if (uid == kNoUser) return true;     // never seen, so certainly not online
+    Locks::Lock lock(g_mutex);
+    return !LookupLocked(uid).Valid();
+}
+
+ConnectionTable::ConnId GetConn(UserId user) {
+    Locks::Lock lock(g_mutex);
+    return LookupLocked(user);
+}
+
+Socket GetSocketById(UserId user) {
+    // Generation check: a stale entry never resolves to a recycled fd.
+    return ConnectionTable::GetSocket(GetConn(user));
 }
 
 Socket GetSocket(const std::string& username) {
-    std::lock_guard<std::mutex> lock(g_mutex);
-    auto it = g_users.find(username);
-    if (it == g_users.end()) return static_cast<Socket>(-1);
-    return it->second.second;
+    return GetSocketById(UserIds::Find(username));
 }
 
 std::vector<std::string> GetAllUsernames() {
-    std::lock_guard<std::mutex> lock(g_mutex);
     std::vector<std::string> names;
-    names.reserve(g_users.size());
-    for (const auto& kv : g_users) {
-        names.push_back(kv.first);
-    }
+    ConnectionTable::ForEachOnlineUser([&](UserId uid) {
+        names.push_back(UserIds::Name(uid));
+    });
     return names;
 }
 
 void ForEachUserSocket(const std::function<void(Socket)>& callback) {
-    // Snapshot sockets under lock, then invoke callbacks without holding lock.
+    // Snapshot sockets with one table scan, then invoke callbacks unlocked.
     std::vector<Socket> sockets;
-    {
-        std::lock_guard<std::mutex> lock(g_mutex);
-        sockets.reserve(g_users.size());
-        for (const auto& kv : g_users) {
-            sockets.push_back(kv.second.second);
-        }
-    }
+    ConnectionTable::ForEachOnline([&](Socket s, Outbound::Mailbox*) {
+        sockets.push_back(s);
+    });
     for (Socket s : sockets) {
         callback(s);
     }
@@ -152,7 +212,109 @@ void ForEachUserSocket(const std::function<void(Socket)>& callback) {
 // ===============================
 namespace CommandProcessor {
 
+// The durable log refused the message, so it was not delivered either.
+static void RejectNotDurable(UserId sender) {
+    Socket s = UserManager::GetSocketById(sender);
+    if (s == static_cast<Socket>(-1)) return;
+    Message err;
+    err.type = MessageType::COMMAND_RESPONSE;
+    err.timestamp = NowEpochMs();
+    err.sender_username = "Server";
+    err.target_username = "";
+    err.content = "NOT_DURABLE";
+    Outbound::Send(s, err);
+}
+
+static std::vector<std::string> g_admins;
+static std::string g_admin_token;
+static std::unordered_map<std::string, std::function<std::string(const std::string&)>> g_admin_commands;
+
+void SetAdmins(const std::vector<std::string>& names, const std::string& token) {
+    g_admins = names;
+    g_admin_token = token;
+}
+
+// Compare without leaking the matching prefix length through timing.
+static bool TokenMatches(const std::string& given) {
+    if (g_admin_token.empty() || given.size() != g_admin_token.size()) return false;
+    unsigned char diff = 0;
+    for (size_t i = 0; i < given.size(); ++i) {
+        diff |= static_cast<unsigned char>(given[i] ^ g_admin_token[i]);
+    }
+    return diff == 0;
+}
+
+void RegisterAdminCommand(const std::string& name, std::function<std::string(const std::string& args)> fn) {
+    g_admin_commands[name] = std::move(fn);
+}
+
+// ADMIN_REQUEST "<name> [args]" from sender.
+static std::string RunAdminCommand(const Message& msg, UserId sender) {
+    static std::atomic<int64_t>& forbidden = Metrics::Counter("admin.forbidden");
+    if (sender == kNoUser) return "FORBIDDEN";
+    const std::string& who = UserIds::Name(sender);
+    if (std::find(g_admins.begin(), g_admins.end(), who) == g_admins.end() || !TokenMatches(msg.target_username)) {
+        forbidden.fetch_add(1, std::memory_order_relaxed);
+        return "FORBIDDEN";
+    }
+    const std::string& rest = msg.content;
+    size_t space = rest.find(' ');
+    std::string name = rest.substr(0, space);
+    std::string args = space == std::string::npos ? "" : rest.substr(space + 1);
+    auto it = g_admin_commands.find(name);
+    if (it == g_admin_commands.end()) return "UNKNOWN_ADMIN_COMMAND " + name;
+    LoggingService::LogSystem("Admin command from " + who + ": " + rest);
+    return it->second(args);
+}
+
+// A per-session list edited with "+ITEM", "-ITEM" or "" (list only), as
+// WATCH_UPDATE and TOPIC_SUBSCRIBE do. Session state only: not logged,
+// dropped on leave.
+struct ListCommand {
+    bool (*add)(UserId, const std::string&, std::string*);
+    void (*remove)(UserId, const std::string&);
+    std::vector<std::string> (*list)(UserId);
+    const char* usage;
+    const char* accepted;       ///< reply prefix, followed by the whole list
+    const char* rejected;       ///< reply prefix, followed by the error
+};
+
+static void EditList(const ListCommand& cmd, const Message& msg, UserId sender, Socket client_socket) {
+    std::string error;
+    bool ok = true;
+    if (!msg.content.empty() && msg.content[0] == '+') {
+        ok = cmd.add(sender, msg.content.substr(1), &error);
+    } else if (!msg.content.empty() && msg.content[0] == '-') {
+        cmd.remove(sender, msg.content.substr(1));
+    } else if (!msg.content.empty()) {
+        ok = false;
+        error = cmd.usage;
+    }
+    Message resp;
+    resp.type = MessageType::COMMAND_RESPONSE;
+    resp.timestamp = NowEpochMs();
+    resp.sender_username = "Server";
+    resp.target_username = "";
+    resp.content = ok ? std::string(cmd.accepted) + " " + Join(cmd.list(sender), ",")
+                      : std::string(cmd.rejected) + " " + error;
+    Outbound::Send(client_socket, resp);
+}
+
+static std::string ProcessImpl(const Message& msg, Socket client_socket);
+
 std::string Process(const Message& msg, Socket client_socket) {
+    CHAT_TRACE(kProcessBegin, client_socket, static_cast<int>(msg.type));
+    std::string result = ProcessImpl(msg, client_socket);
+    CHAT_TRACE(kProcessEnd, client_socket, result == "DISCONNECT");
+    return result;
+}
+
+static std::string ProcessImpl(const Message& msg, Socket client_socket) {
+    // Resolve the sender once from its connection slot; the name in msg is
+    // only consulted for callers that never registered the socket.
+    UserId sender = ConnectionTable::GetUser(ConnectionTable::FindBySocket(client_socket));
+    if (sender == kNoUser) sender = UserIds::Find(msg.sender_username);
+
     if (msg.type == MessageType::USER_LIST_REQUEST) {
         auto names = UserManager::GetAllUsernames();
         std::string content = Join(names, ",");
@@ -164,16 +326,84 @@ std::string Process(const Message& msg, Socket client_socket) {
         resp.target_username = "";
         resp.content = content;
 
-        NetworkLayer::SendMessage(client_socket, resp);
-        LoggingService::LogFromMessage(resp);
+        Outbound::Send(client_socket, resp);
+        LoggingService::LogFromMessage(resp, UserIds::kServerId, kNoUser);
+        return "CONTINUE";
+    } else if (msg.type == MessageType::HISTORY_REQUEST) {
+        // Replayed as the original events, oldest first.
+        size_t n = kHistoryReplayDefault;
+        if (!msg.content.empty()) {
+            char* end = nullptr;
+            long v = std::strtol(msg.content.c_str(), &end, 10);
+            if (*end == '\0' && v > 0) n = std::min<size_t>(static_cast<size_t>(v), kHistoryReplayMax);
+        }
+        // Stored frames go out with sendfile, followed by the newest entries
+        // whose frames are not written yet; everything is encoded when the
+        // segments do not cover the start, the socket has no mailbox, or it
+        // already has too many ranges waiting.
+        std::vector<History::Entry> rest;
+        std::vector<History::Span> spans = History::RecentSpans(n, &rest);
+        if (spans.empty() || !Outbound::SendStored(client_socket, spans)) rest = History::Recent(n);
+        for (const History::Entry& e : rest) {
+            Outbound::Send(client_socket, History::ReplayMessage(*e));
+        }
         return "CONTINUE";
     } else if (msg.type == MessageType::PRIVATE_MESSAGE) {
-        MessageRouter::SendPrivate(msg);
-        LoggingService::LogFromMessage(msg);
+        // Untrusted name: Find() never grows the intern table.
+        UserId target = UserIds::Find(msg.target_username);
+        LoggingService::LogFromMessage(msg, sender, target, [msg, sender, target](bool durable) {
+            if (durable) {
+                MessageRouter::SendPrivateById(msg, sender, target);
+            } else {
+                RejectNotDurable(sender);
+            }
+        });
         return "CONTINUE";
     } else if (msg.type == MessageType::PUBLIC_MESSAGE) {
-        MessageRouter::BroadcastPublic(msg);
-        LoggingService::LogFromMessage(msg);
+        // Logged first: in durable mode delivery waits for the group commit.
+        // The watch scan runs here, not in the callback, which may hold the
+        // log mutex or run on the WAL committer.
+        std::vector<Watchlist::Notification> notes = Watchlist::Scan(msg, sender);
+        LoggingService::LogFromMessage(msg, sender, kNoUser, [msg, sender, notes = std::move(notes)](bool durable) {
+            if (durable) {
+                MessageRouter::BroadcastPublic(msg);
+                Watchlist::Deliver(notes);
+                Topics::Publish("room.main.msg." + Topics::Level(msg.sender_username), msg.sender_username,
+                                msg.content, msg.timestamp);
+            } else {
+                RejectNotDurable(sender);
+            }
+        });
+        return "CONTINUE";
+    } else if (FileTransfer::IsFileMessage(msg.type)) {
+        // File bodies go to the spool, not to the log or history.
+        FileTransfer::Handle(msg, sender, client_socket);
+        return "CONTINUE";
+    } else if (msg.type == MessageType::PRESENCE_UPDATE) {
+        // Not logged: status chatter is coalesced and never part of history.
+        Presence::Status status;
+        if (!Presence::Parse(msg.content, &status)) {
+            Message err;
+            err.type = MessageType::COMMAND_RESPONSE;
+            err.timestamp = NowEpochMs();
+            err.sender_username = "Server";
+            err.target_username = "";
+            err.content = "BAD_STATUS";
+            Outbound::Send(client_socket, err);
+            return "CONTINUE";
+        }
+        Presence::Set(sender, status);
+        return "CONTINUE";
+    } else if (msg.type == MessageType::WATCH_UPDATE) {
+        static const ListCommand kWatch{Watchlist::Watch, Watchlist::Unwatch, Watchlist::Watches,
+                                        "usage: +WORD, -WORD or empty", "WATCHING", "WATCH_REJECTED"};
+        EditList(kWatch, msg, sender, client_socket);
+        return "CONTINUE";
+    } else if (msg.type == MessageType::TOPIC_SUBSCRIBE) {
+        static const ListCommand kSubscribe{Topics::Subscribe, Topics::Unsubscribe, Topics::Subscriptions,
+                                            "usage: +PATTERN, -PATTERN or empty", "SUBSCRIBED",
+                                            "SUBSCRIBE_REJECTED"};
+        EditList(kSubscribe, msg, sender, client_socket);
         return "CONTINUE";
     } else if (msg.type == MessageType::COMMAND_RESPONSE && msg.content == "BYE") {
         Message ack;
@@ -182,8 +412,17 @@ std::string Process(const Message& msg, Socket client_socket) {
         ack.sender_username = "Server";
         ack.target_username = "";
         ack.content = "GOODBYE";
-        NetworkLayer::SendMessage(client_socket, ack);
+        Outbound::Send(client_socket, ack);
         return "DISCONNECT";
+    } else if (msg.type == MessageType::ADMIN_REQUEST) {
+        Message resp;
+        resp.type = MessageType::COMMAND_RESPONSE;
+        resp.timestamp = NowEpochMs();
+        resp.sender_username = "Server";
+        resp.target_username = "";
+        resp.content = "ADMIN " + RunAdminCommand(msg, sender);
+        Outbound::Send(client_socket, resp);
+        return "CONTINUE";
     } else {
         Message err;
         err.type = MessageType::COMMAND_RESPONSE;
@@ -191,7 +430,7 @@ std::string Process(const Message& msg, Socket client_socket) {
         err.sender_username = "Server";
         err.target_username = "";
         err.content = "UNKNOWN_COMMAND";
-        NetworkLayer::SendMessage(client_socket, err);
+        Outbound::Send(client_socket, err);
         return "CONTINUE";
     }
 }
@@ -213,16 +452,18 @@ std::vector<Socket> CollectAllSockets() {
 }
 
 void BroadcastPublic(const Message& msg) {
-    auto sockets = CollectAllSockets();
-    for (Socket s : sockets) {
-        NetworkLayer::SendMessage(s, msg);
-    }
+    // Encode once; every recipient's writer shares the same frame buffer.
+    Outbound::Broadcast(NetworkLayer::EncodeFrame(msg));
 }
 
 void SendPrivate(const Message& msg) {
-    Socket target_socket = UserManager::GetSocket(msg.target_username);
+    SendPrivateById(msg, UserIds::Find(msg.sender_username), UserIds::Find(msg.target_username));
+}
+
+void SendPrivateById(const Message& msg, UserId sender, UserId target) {
+    Socket target_socket = UserManager::GetSocketById(target);
     if (target_socket != static_cast<Socket>(-1)) {
-        NetworkLayer::SendMessage(target_socket, msg);
+        Outbound::Send(target_socket, msg);
         return;
     }
 
@@ -234,9 +475,9 @@ void SendPrivate(const Message& msg) {
     notify.target_username = "";
     notify.content = std::string("USER_NOT_FOUND:") + msg.target_username;
 
-    Socket sender_socket = UserManager::GetSocket(msg.sender_username);
+    Socket sender_socket = UserManager::GetSocketById(sender);
     if (sender_socket != static_cast<Socket>(-1)) {
-        NetworkLayer::SendMessage(sender_socket, notify);
+        Outbound::Send(sender_socket, notify);
     }
 }
 
@@ -256,7 +497,7 @@ void Broadcast(const std::string& text) {
     m.content = text;
 
     MessageRouter::BroadcastPublic(m);
-    LoggingService::LogFromMessage(m);
+    LoggingService::LogFromMessage(m, UserIds::kServerId, kNoUser);
 }
 
 } // namespace AnnouncementService
@@ -267,35 +508,93 @@ void Broadcast(const std::string& text) {
 namespace LoggingService {
 
 static std::string g_current_log_file = "chat_history.log";
+// Serializes appends so History sees lines in file order with exact offsets.
+static Locks::Mutex g_log_mutex{"log"};
+static uint64_t g_log_offset = 0;
 
 void Initialize(const std::string& log_file_name) {
+    Locks::Lock lock(g_log_mutex);
     g_current_log_file = log_file_name;
     File::OpenAppend(g_current_log_file);
+    struct stat st;
+    g_log_offset = ::stat(g_current_log_file.c_str(), &st) == 0 ? static_cast<uint64_t>(st.st_size) : 0;
 }
 
 void LogFromMessage(const Message& msg) {
+    LogFromMessage(msg, UserIds::Find(msg.sender_username), UserIds::Find(msg.target_username));
+}
+
+void LogFromMessage(const Message& msg, UserId actor, UserId target) {
+    LogFromMessage(msg, actor, target, nullptr);
+}
+
+void LogFromMessage(const Message& msg, UserId actor, UserId target, Wal::Done then) {
     LogEntry e;
     e.timestamp = msg.timestamp;
     e.event_type = msg.type;
-    e.actor = msg.sender_username;
-    e.target = msg.target_username;
+    e.actor_id = actor;
+    e.target_id = target;
+    if (target == kNoUser) e.target_name = msg.target_username;
     e.content = msg.content;
-    Write(e);
+    Write(e, std::move(then));
 }
 
 void LogSystem(const std::string& text) {
     LogEntry e;
     e.timestamp = NowEpochMs();
     e.event_type = MessageType::SYSTEM_ANNOUNCEMENT;
-    e.actor = "Server";
-    e.target = "";
+    e.actor_id = UserIds::kServerId;
+    e.target_id = kNoUser;
     e.content = text;
     Write(e);
 }
 
 void Write(const LogEntry& entry) {
-    const std::string line = FormatLogLine(entry);
-    File::AppendLine(g_current_log_file, line);
+    Write(entry, nullptr);
+}
+
+void Write(const LogEntry& entry, Wal::Done then) {
+    std::string line = LogFormat::FormatLine(entry);
+    CHAT_TRACE(kLogWrite, static_cast<int>(entry.event_type), line.size());
+    static std::atomic<int64_t>& write_failed = Metrics::Counter("log.write_failed");
+    // then never runs under g_log_mutex: a refused WAL append or a best-effort
+    // write reports after the lock is released, a queued one from the WAL
+    // committer. Only the WAL refuses delivery; without it a failed write is
+    // counted and the message still goes out.
+    bool delivered = false;
+    {
+        Locks::Lock lock(g_log_mutex);
+        // The offset only advances once the line is accepted, so a refused
+        // write leaves no gap in the offsets History hands out.
+        const uint64_t offset = g_log_offset + line.size() + 1;
+        if (Wal::IsOpen()) {
+            // Offsets are assigned here, in append order; the committer runs
+            // callbacks in the same order once the batch is on disk.
+            line.push_back('\n');
+            if (Wal::Append(std::move(line), [entry, offset, then](bool durable) {
+                    if (durable) History::Record(entry, offset);
+                    if (then) then(durable);
+                })) {
+                g_log_offset = offset;
+                return;
+            }
+        } else {
+            // Best effort: a line the file refused is still recent history
+            // and is still delivered; only the offset stays where it was.
+            if (File::AppendLine(g_current_log_file, line)) {
+                g_log_offset = offset;
+            } else {
+                write_failed.fetch_add(1, std::memory_order_relaxed);
+            }
+            History::Record(entry, g_log_offset);
+            delivered = true;
+        }
+    }
+    if (then) then(delivered);
+}
+
+const std::string& CurrentFile() {
+    return g_current_log_file;
 }
 
 } // namespace LoggingService
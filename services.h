@@ -10,8 +10,11 @@
 #include <utility>
 
 #include "common.h"
+#include "connection_table.h"
 #include "network.h"
 #include "file_io.h"
+#include "user_ids.h"
+#include "wal.h"
 
 // Production-quality services for CLIChatRoom.
 //
@@ -26,22 +29,35 @@
 //  - LoggingService
 //
 // Thread-safety:
-//  - UserManager is thread-safe via an internal mutex protecting the map.
+//  - UserManager is thread-safe via an internal mutex protecting the
+//    name index; per-connection state lives in ConnectionTable.
+//
+// Identity:
+//  - Internally users are UserIds (user_ids.h). The string overloads below
+//    are the protocol boundary and resolve names once per call.
 
 namespace UserManager {
 
 // Auth handshake: prompts for username up to N retries.
 // Returns a constructed User on success; std::nullopt on failure/disconnect.
 std::optional<User> Authenticate(Socket client_socket);
+// False for names login refuses (USERNAME_INVALID): "", "Server", and any
+// name containing ',' or '='.
+bool ValidUsername(const std::string& username);
 
 // Map ops
 void AddUser(const User& user, Socket client_socket);
 void RemoveUser(const std::string& username);
+void RemoveUserById(UserId user);
 bool CheckUniqueness(const std::string& username);
 
 // Returns the socket for username or -1 if not found (aligns with tests).
 Socket GetSocket(const std::string& username);
 
+// Id-based lookups used on the routing path.
+ConnectionTable::ConnId GetConn(UserId user);
+Socket GetSocketById(UserId user);
+
 // Snapshot of all usernames (no specific ordering guaranteed).
 std::vector<std::string> GetAllUsernames();
 
@@ -56,6 +72,15 @@ namespace CommandProcessor {
 // Return values: "CONTINUE" or "DISCONNECT" (as per tests).
 std::string Process(const Message& msg, Socket client_socket);
 
+// Operator commands. A client sends ADMIN_REQUEST "<name> [args]" with the
+// admin token as target_username; only users named in SetAdmins() who also
+// present token may run one (user names alone are not authenticated), and
+// the string fn returns is sent back as COMMAND_RESPONSE "ADMIN <reply>".
+// An empty token disables admin commands. Configure before serving: the
+// tables are not locked.
+void SetAdmins(const std::vector<std::string>& names, const std::string& token);
+void RegisterAdminCommand(const std::string& name, std::function<std::string(const std::string& args)> fn);
+
 } // namespace CommandProcessor
 
 namespace MessageRouter {
@@ -66,6 +91,9 @@ void BroadcastPublic(const Message& msg);
 // Send a private message, or notify sender if user missing.
 void SendPrivate(const Message& msg);
 
+// Same, with sender/target already resolved (target may be kNoUser).
+void SendPrivateById(const Message& msg, UserId sender, UserId target);
+
 // Utility used internally and by tests via behavior: collect sockets snapshot.
 std::vector<Socket> CollectAllSockets();
 
@@ -86,11 +114,27 @@ void Initialize(const std::string& log_file_name);
 // Log using data extracted from a Message.
 void LogFromMessage(const Message& msg);
 
+// Log a message whose actor/target ids are already known.
+void LogFromMessage(const Message& msg, UserId actor, UserId target);
+
+// Same, then run `then`: right away when logging is best effort, or from the
+// write-ahead log's committer once the line is durable (wal.h). Routing that
+// must not outrun the log goes in `then`. It gets false only when the
+// write-ahead log refused or failed the line; a best-effort write that fails
+// is counted (log.write_failed) and still gets true. It never runs with the
+// log lock held.
+void LogFromMessage(const Message& msg, UserId actor, UserId target, Wal::Done then);
+
 // Log an arbitrary system text entry from "Server".
 void LogSystem(const std::string& text);
 
-// Low-level write API used by Log* above.
+// Low-level write API used by Log* above. Also feeds History (history.h).
+// Goes through the write-ahead log when one is open.
 void Write(const LogEntry& entry);
+void Write(const LogEntry& entry, Wal::Done then);
+
+// Path passed to Initialize().
+const std::string& CurrentFile();
 
 } // namespace LoggingService
 
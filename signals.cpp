@@ -0,0 +1,67 @@
+#include "signals.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <csignal>
+#include <map>
+#include <mutex>
+#include <thread>
+
+namespace Signals {
+
+namespace {
+
+int g_pipe[2] = {-1, -1};
+std::mutex g_mutex;
+std::map<int, std::function<void()>> g_handlers;
+
+extern "C" void OnSignal(int signo) {
+    int saved = errno;
+    unsigned char b = static_cast<unsigned char>(signo);
+    (void)::write(g_pipe[1], &b, 1);   // full pipe: the signal is coalesced
+    errno = saved;
+}
+
+void Watch() {
+    for (;;) {
+        unsigned char b;
+        ssize_t n = ::read(g_pipe[0], &b, 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        std::function<void()> fn;
+        {
+            std::lock_guard<std::mutex> lock(g_mutex);
+            auto it = g_handlers.find(b);
+            if (it != g_handlers.end()) fn = it->second;
+        }
+        if (fn) fn();
+    }
+}
+
+void StartOnce() {
+    static std::once_flag once;
+    std::call_once(once, [] {
+        if (::pipe2(g_pipe, O_CLOEXEC) != 0) return;
+        ::fcntl(g_pipe[1], F_SETFL, O_NONBLOCK);
+        std::thread(Watch).detach();
+    });
+}
+
+} // namespace
+
+void On(int signo, std::function<void()> fn) {
+    StartOnce();
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        g_handlers[signo] = std::move(fn);
+    }
+    struct sigaction sa {};
+    sa.sa_handler = OnSignal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    ::sigaction(signo, &sa, nullptr);
+}
+
+} // namespace Signals
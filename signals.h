@@ -0,0 +1,20 @@
+#ifndef SIGNALS_H_
+#define SIGNALS_H_
+
+#include <functional>
+
+// Deferred signal handling.
+//
+// The real handler only writes the signal number to a self-pipe; a watcher
+// thread reads it and runs the registered callback as ordinary code, so
+// callbacks may lock, allocate and do I/O.
+
+namespace Signals {
+
+// Run fn on the watcher thread whenever signo arrives. Replaces any previous
+// callback for signo. Starts the watcher on first use.
+void On(int signo, std::function<void()> fn);
+
+} // namespace Signals
+
+#endif // SIGNALS_H_
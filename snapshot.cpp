@@ -0,0 +1,358 @@
+#include "snapshot.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "affinity.h"
+#include "history.h"
+#include "log_format.h"
+#include "metrics.h"
+#include "user_ids.h"
+
+namespace Snapshot {
+
+namespace {
+
+const char kMagic[8] = {'C', 'H', 'A', 'T', 'S', 'N', 'A', 'P'};
+constexpr uint32_t kVersion = 1;
+
+enum SectionTag : uint32_t {
+    kUsersSection = 1,
+    kHistorySection = 2,
+};
+
+uint32_t Crc32(const char* data, size_t n) {
+    static uint32_t table[256];
+    static bool init = [] {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        return true;
+    }();
+    (void)init;
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < n; ++i) crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFu;
+}
+
+class Writer {
+public:
+    void U32(uint32_t v) { Bytes(v, 4); }
+    void U64(uint64_t v) { Bytes(v, 8); }
+    void Str(const std::string& s) {
+        U32(static_cast<uint32_t>(s.size()));
+        buf_.insert(buf_.end(), s.begin(), s.end());
+    }
+    void Raw(const char* p, size_t n) { buf_.insert(buf_.end(), p, p + n); }
+
+    // Sections are length-prefixed; the length is patched in at EndSection.
+    size_t BeginSection(uint32_t tag) {
+        U32(tag);
+        size_t at = buf_.size();
+        U64(0);
+        return at;
+    }
+    void EndSection(size_t at) {
+        uint64_t len = buf_.size() - at - 8;
+        for (int i = 0; i < 8; ++i) buf_[at + i] = static_cast<char>(len >> (8 * i));
+    }
+
+    std::vector<char>& Buffer() { return buf_; }
+
+private:
+    void Bytes(uint64_t v, int n) {
+        for (int i = 0; i < n; ++i) buf_.push_back(static_cast<char>(v >> (8 * i)));
+    }
+    std::vector<char> buf_;
+};
+
+class Reader {
+public:
+    Reader(const char* p, size_t n) : p_(p), end_(p + n) {}
+
+    bool U32(uint32_t* v) { uint64_t t; if (!Bytes(&t, 4)) return false; *v = static_cast<uint32_t>(t); return true; }
+    bool U64(uint64_t* v) { return Bytes(v, 8); }
+    bool Str(std::string* s) {
+        uint32_t n;
+        if (!U32(&n) || Left() < n) return false;
+        s->assign(p_, n);
+        p_ += n;
+        return true;
+    }
+    bool Skip(uint64_t n) {
+        if (Left() < n) return false;
+        p_ += n;
+        return true;
+    }
+    const char* Pos() const { return p_; }
+    size_t Left() const { return static_cast<size_t>(end_ - p_); }
+
+private:
+    bool Bytes(uint64_t* v, int n) {
+        if (Left() < static_cast<size_t>(n)) return false;
+        uint64_t r = 0;
+        for (int i = 0; i < n; ++i) r |= static_cast<uint64_t>(static_cast<uint8_t>(p_[i])) << (8 * i);
+        p_ += n;
+        *v = r;
+        return true;
+    }
+    const char* p_;
+    const char* end_;
+};
+
+std::vector<char> Encode(const History::State& state) {
+    Writer w;
+    w.Raw(kMagic, sizeof(kMagic));
+    w.U32(kVersion);
+    w.U64(static_cast<uint64_t>(NowEpochMs()));
+    w.U64(state.log_offset);
+
+    // Names in id order, starting after the two built-in ids.
+    size_t at = w.BeginSection(kUsersSection);
+    uint32_t count = static_cast<uint32_t>(UserIds::Count());
+    w.U32(count > UserIds::kServerId + 1 ? count - UserIds::kServerId - 1 : 0);
+    for (UserId id = UserIds::kServerId + 1; id < count; ++id) w.Str(UserIds::Name(id));
+    w.EndSection(at);
+
+    at = w.BeginSection(kHistorySection);
+    w.U32(static_cast<uint32_t>(state.entries.size()));
+    for (const History::Entry& e : state.entries) {
+        w.U64(static_cast<uint64_t>(e->timestamp));
+        w.U32(static_cast<uint32_t>(e->event_type));
+        w.U32(e->actor_id);
+        w.U32(e->target_id);
+        w.Str(e->target_name);
+        w.Str(e->content);
+    }
+    w.EndSection(at);
+
+    std::vector<char>& buf = w.Buffer();
+    uint32_t crc = Crc32(buf.data(), buf.size());
+    w.U32(crc);
+    return std::move(buf);
+}
+
+struct Decoded {
+    uint64_t log_offset = 0;
+    size_t users = 0;
+    std::vector<History::Entry> entries;
+};
+
+// Interns the stored names as it goes; ids in the file are remapped to this
+// process's ids, so the table does not have to be empty.
+bool Decode(const std::vector<char>& buf, Decoded* out) {
+    if (buf.size() < sizeof(kMagic) + 4 + 8 + 8 + 4) return false;
+    size_t body = buf.size() - 4;
+    Reader crc_reader(buf.data() + body, 4);
+    uint32_t stored_crc;
+    if (!crc_reader.U32(&stored_crc) || stored_crc != Crc32(buf.data(), body)) return false;
+    if (std::memcmp(buf.data(), kMagic, sizeof(kMagic)) != 0) return false;
+
+    Reader r(buf.data() + sizeof(kMagic), body - sizeof(kMagic));
+    uint32_t version;
+    uint64_t created_ms;
+    if (!r.U32(&version) || version != kVersion) return false;
+    if (!r.U64(&created_ms) || !r.U64(&out->log_offset)) return false;
+
+    std::vector<UserId> remap = {kNoUser, UserIds::kServerId};
+    auto map_id = [&](uint32_t id) { return id < remap.size() ? remap[id] : kNoUser; };
+
+    while (r.Left() > 0) {
+        uint32_t tag;
+        uint64_t len;
+        if (!r.U32(&tag) || !r.U64(&len) || r.Left() < len) return false;
+        Reader s(r.Pos(), static_cast<size_t>(len));
+        r.Skip(len);
+        if (tag == kUsersSection) {
+            uint32_t n;
+            if (!s.U32(&n)) return false;
+            for (uint32_t i = 0; i < n; ++i) {
+                std::string name;
+                if (!s.Str(&name)) return false;
+                remap.push_back(UserIds::Intern(name));
+            }
+            out->users = n;
+        } else if (tag == kHistorySection) {
+            uint32_t n;
+            if (!s.U32(&n)) return false;
+            for (uint32_t i = 0; i < n; ++i) {
+                uint64_t ts;
+                uint32_t type, actor, target;
+                auto e = std::make_shared<LogEntry>();
+                if (!s.U64(&ts) || !s.U32(&type) || !s.U32(&actor) || !s.U32(&target) ||
+                    !s.Str(&e->target_name) || !s.Str(&e->content)) {
+                    return false;
+                }
+                e->timestamp = static_cast<long long>(ts);
+                e->event_type = static_cast<MessageType>(type);
+                e->actor_id = map_id(actor);
+                e->target_id = map_id(target);
+                out->entries.push_back(std::move(e));
+            }
+        }
+        // Unknown sections come from newer writers; skip them.
+    }
+    return true;
+}
+
+bool ReadFile(const std::string& path, std::vector<char>* out) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) return false;
+    out->assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return !in.bad();
+}
+
+uint64_t FileSize(const std::string& path) {
+    struct stat st;
+    return ::stat(path.c_str(), &st) == 0 ? static_cast<uint64_t>(st.st_size) : 0;
+}
+
+std::string DirName(const std::string& path) {
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos) return ".";
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+// Feed log_file[start, end) to History line by line. A start inside a line
+// (cold start) skips to the next one.
+void ReplayTail(const std::string& log_file, uint64_t start, uint64_t end, bool align,
+                WarmStartStats* stats) {
+    if (end <= start) return;
+    std::ifstream in(log_file, std::ios::binary);
+    if (!in.is_open()) return;
+    in.seekg(static_cast<std::streamoff>(start));
+    std::string tail(static_cast<size_t>(end - start), '\0');
+    in.read(&tail[0], static_cast<std::streamsize>(tail.size()));
+    tail.resize(static_cast<size_t>(in.gcount()));
+
+    size_t pos = 0;
+    if (align) {
+        size_t nl = tail.find('\n');
+        pos = nl == std::string::npos ? tail.size() : nl + 1;
+    }
+    while (pos < tail.size()) {
+        size_t nl = tail.find('\n', pos);
+        size_t next = nl == std::string::npos ? tail.size() : nl + 1;
+        LogEntry e;
+        if (LogFormat::ParseLine(tail.substr(pos, next - pos - (nl == std::string::npos ? 0 : 1)), &e)) {
+            History::Record(e, start + next);
+            ++stats->replayed_lines;
+        }
+        pos = next;
+    }
+    stats->replayed_bytes = tail.size();
+}
+
+} // namespace
+
+bool Write(const std::string& path) {
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point t0 = Clock::now();
+    std::vector<char> buf = Encode(History::Capture());
+
+    const std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    size_t off = 0;
+    while (off < buf.size()) {
+        ssize_t n = ::write(fd, buf.data() + off, buf.size() - off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ::close(fd);
+            ::unlink(tmp.c_str());
+            return false;
+        }
+        off += static_cast<size_t>(n);
+    }
+    bool ok = ::fdatasync(fd) == 0;
+    ok = ::close(fd) == 0 && ok;
+    ok = ok && ::rename(tmp.c_str(), path.c_str()) == 0;
+    if (!ok) {
+        ::unlink(tmp.c_str());
+        return false;
+    }
+    // Make the rename itself durable.
+    int dir = ::open(DirName(path).c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir >= 0) {
+        ::fsync(dir);
+        ::close(dir);
+    }
+
+    static std::atomic<int64_t>& writes = Metrics::Counter("snapshot.writes");
+    static std::atomic<int64_t>& bytes = Metrics::Counter("snapshot.last_bytes");
+    static std::atomic<int64_t>& micros = Metrics::Counter("snapshot.last_write_us");
+    writes.fetch_add(1, std::memory_order_relaxed);
+    bytes.store(static_cast<int64_t>(buf.size()), std::memory_order_relaxed);
+    micros.store(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - t0).count(),
+                 std::memory_order_relaxed);
+    return true;
+}
+
+WarmStartStats WarmStart(const std::string& path, const std::string& log_file) {
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point t0 = Clock::now();
+    WarmStartStats stats;
+
+    const uint64_t log_size = FileSize(log_file);
+    uint64_t start = log_size > kMaxColdTailBytes ? log_size - kMaxColdTailBytes : 0;
+    bool align = start > 0;
+
+    std::vector<char> buf;
+    Decoded snap;
+    if (!path.empty() && ReadFile(path, &buf) && Decode(buf, &snap)) {
+        stats.from_snapshot = true;
+        stats.users = snap.users;
+        // A log shorter than the snapshot says was replaced; one that grew by
+        // more than the cold-tail bound is read from the bound instead.
+        if (snap.log_offset <= log_size && snap.log_offset >= start) {
+            start = snap.log_offset;
+            align = false;
+        }
+        History::Restore(std::move(snap.entries), start);
+    } else {
+        History::Restore({}, start);
+    }
+
+    ReplayTail(log_file, start, log_size, align, &stats);
+
+    stats.entries = History::Capture().entries.size();
+    stats.elapsed_ms = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+    return stats;
+}
+
+bool ReadEntries(const std::string& path, std::vector<std::shared_ptr<const LogEntry>>* out) {
+    std::vector<char> buf;
+    Decoded snap;
+    if (!ReadFile(path, &buf) || !Decode(buf, &snap)) return false;
+    *out = std::move(snap.entries);
+    return true;
+}
+
+void StartWriter(const std::string& path, int interval_s) {
+    if (path.empty() || interval_s <= 0) return;
+    std::thread([path, interval_s] {
+        Affinity::PinSelf(Affinity::Role::kLog);
+        uint64_t written = History::Version();
+        for (;;) {
+            std::this_thread::sleep_for(std::chrono::seconds(interval_s));
+            uint64_t v = History::Version();
+            if (v == written) continue;
+            if (Write(path)) written = v;
+        }
+    }).detach();
+}
+
+} // namespace Snapshot
@@ -0,0 +1,59 @@
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common.h"
+
+// Server state snapshots and warm start.
+//
+// A snapshot is a compact binary image of the state that would otherwise be
+// rebuilt from the chat log: the username intern table and the History ring,
+// together with the log offset that state covers. It is written off the
+// serving path from a History::Capture() (pointer copies of immutable
+// entries), to <path>.tmp, fsync'ed and renamed over <path>, so a crash
+// leaves either the old or the new snapshot.
+//
+// Layout (little-endian):
+//   "CHATSNAP" u32 version  i64 created_ms  u64 log_offset
+//   { u32 tag  u64 length  payload }*        tagged sections; unknown skipped
+//   u32 crc32 of everything before it
+//
+// WarmStart() restores the newest snapshot and replays only the log bytes
+// written after it. Without a usable snapshot it reads just the last
+// kMaxColdTailBytes of the log, so startup cost never grows with log size.
+
+namespace Snapshot {
+
+constexpr uint64_t kMaxColdTailBytes = 4u << 20;
+
+struct WarmStartStats {
+    bool from_snapshot = false;
+    size_t users = 0;               ///< Names restored from the snapshot
+    size_t entries = 0;             ///< History entries after warm start
+    uint64_t replayed_bytes = 0;    ///< Log tail bytes parsed
+    size_t replayed_lines = 0;
+    double elapsed_ms = 0;
+};
+
+// Write the current state to path. Returns false on I/O error.
+bool Write(const std::string& path);
+
+// Restore from path (if valid) and the tail of log_file. Call once, after
+// LoggingService::Initialize() and before any client is served.
+WarmStartStats WarmStart(const std::string& path, const std::string& log_file);
+
+// Read only the history entries of a snapshot (names are interned into this
+// process). For offline tools; does not touch History. False if invalid.
+bool ReadEntries(const std::string& path, std::vector<std::shared_ptr<const LogEntry>>* out);
+
+// Rewrite path every interval_s seconds on a background thread, skipping
+// rounds in which nothing was logged. interval_s <= 0 disables it.
+void StartWriter(const std::string& path, int interval_s);
+
+} // namespace Snapshot
+
+#endif // SNAPSHOT_H_
@@ -0,0 +1,160 @@
+#include "socket_profile.h"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <sstream>
+
+#include "metrics.h"
+
+namespace SocketProfile {
+
+namespace {
+
+Profile g_server;
+Profile g_client;
+std::atomic<bool> g_quickack{false};
+
+std::atomic<int64_t>& Errors() {
+    static std::atomic<int64_t>& c = Metrics::Counter("socket_profile.errors");
+    return c;
+}
+
+void SetInt(Socket sock, int level, int name, int value) {
+    if (::setsockopt(sock, level, name, &value, sizeof(value)) != 0) {
+        Errors().fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void UpdateQuickack() {
+    g_quickack.store(g_server.quickack || g_client.quickack, std::memory_order_relaxed);
+}
+
+bool ParsePositive(const std::string& s, int* out) {
+    if (s.empty() || s.find_first_not_of("0123456789") != std::string::npos || s.size() > 9) return false;
+    *out = std::atoi(s.c_str());
+    return *out > 0;
+}
+
+} // namespace
+
+bool Preset(const std::string& name, Profile* out) {
+    Profile p;
+    p.name = name;
+    if (name == "default") {
+        // Kernel defaults.
+    } else if (name == "latency") {
+        p.nodelay = true;
+        p.quickack = true;
+        p.notsent_lowat = 16 * 1024;
+        p.keepalive = Keepalive{30, 10, 3};
+    } else if (name == "throughput") {
+        p.sndbuf = 4 * 1024 * 1024;
+        p.rcvbuf = 4 * 1024 * 1024;
+        p.keepalive = Keepalive{60, 15, 5};
+        p.backlog = 65535;
+    } else if (name == "mobile") {
+        p.nodelay = true;
+        p.sndbuf = 64 * 1024;
+        p.rcvbuf = 64 * 1024;
+        p.notsent_lowat = 8 * 1024;
+        p.keepalive = Keepalive{15, 5, 4};
+    } else {
+        return false;
+    }
+    *out = p;
+    return true;
+}
+
+const char* PresetNames() {
+    return "default|latency|throughput|mobile";
+}
+
+Profile Resolve(const Profile& preset, const Overrides& o) {
+    Profile p = preset;
+    if (o.nodelay) p.nodelay = *o.nodelay;
+    if (o.quickack) p.quickack = *o.quickack;
+    if (o.sndbuf) p.sndbuf = *o.sndbuf;
+    if (o.rcvbuf) p.rcvbuf = *o.rcvbuf;
+    if (o.notsent_lowat) p.notsent_lowat = *o.notsent_lowat;
+    if (o.keepalive) p.keepalive = *o.keepalive;
+    if (o.backlog) p.backlog = *o.backlog;
+    return p;
+}
+
+bool ParseKeepalive(const std::string& text, Keepalive* out) {
+    if (text == "off") {
+        *out = Keepalive{};
+        return true;
+    }
+    size_t a = text.find(',');
+    size_t b = a == std::string::npos ? a : text.find(',', a + 1);
+    if (b == std::string::npos) return false;
+    Keepalive k;
+    if (!ParsePositive(text.substr(0, a), &k.idle_s) || !ParsePositive(text.substr(a + 1, b - a - 1), &k.interval_s) ||
+        !ParsePositive(text.substr(b + 1), &k.count)) {
+        return false;
+    }
+    *out = k;
+    return true;
+}
+
+void SetServer(const Profile& profile) {
+    g_server = profile;
+    UpdateQuickack();
+}
+
+void SetClient(const Profile& profile) {
+    g_client = profile;
+    UpdateQuickack();
+}
+
+const Profile& Server() {
+    return g_server;
+}
+
+const Profile& Client() {
+    return g_client;
+}
+
+int Backlog(const Profile& profile) {
+    return profile.backlog > 0 ? profile.backlog : SOMAXCONN;
+}
+
+void Apply(Socket sock, const Profile& p) {
+    if (sock < 0) return;
+    if (p.nodelay) SetInt(sock, IPPROTO_TCP, TCP_NODELAY, 1);
+    if (p.quickack) SetInt(sock, IPPROTO_TCP, TCP_QUICKACK, 1);
+    if (p.sndbuf > 0) SetInt(sock, SOL_SOCKET, SO_SNDBUF, p.sndbuf);
+    if (p.rcvbuf > 0) SetInt(sock, SOL_SOCKET, SO_RCVBUF, p.rcvbuf);
+    if (p.notsent_lowat > 0) SetInt(sock, IPPROTO_TCP, TCP_NOTSENT_LOWAT, p.notsent_lowat);
+    if (p.keepalive.idle_s > 0) {
+        SetInt(sock, SOL_SOCKET, SO_KEEPALIVE, 1);
+        SetInt(sock, IPPROTO_TCP, TCP_KEEPIDLE, p.keepalive.idle_s);
+        SetInt(sock, IPPROTO_TCP, TCP_KEEPINTVL, p.keepalive.interval_s);
+        SetInt(sock, IPPROTO_TCP, TCP_KEEPCNT, p.keepalive.count);
+    }
+}
+
+void AfterReceive(Socket sock) {
+    if (g_quickack.load(std::memory_order_relaxed)) SetInt(sock, IPPROTO_TCP, TCP_QUICKACK, 1);
+}
+
+std::string Describe(const Profile& p) {
+    std::ostringstream oss;
+    oss << p.name << " (nodelay=" << (p.nodelay ? "on" : "off") << ", quickack=" << (p.quickack ? "on" : "off")
+        << ", sndbuf=" << p.sndbuf << ", rcvbuf=" << p.rcvbuf << ", notsent_lowat=" << p.notsent_lowat
+        << ", keepalive=";
+    if (p.keepalive.idle_s > 0) {
+        oss << p.keepalive.idle_s << "," << p.keepalive.interval_s << "," << p.keepalive.count;
+    } else {
+        oss << "off";
+    }
+    oss << ", backlog=" << Backlog(p) << ")";
+    return oss.str();
+}
+
+} // namespace SocketProfile
@@ -0,0 +1,88 @@
+#ifndef SOCKET_PROFILE_H_
+#define SOCKET_PROFILE_H_
+
+#include <optional>
+#include <string>
+
+#include "common.h"
+
+// TCP options for listening, accepted and connected sockets.
+//
+// NetworkLayer applies the server profile in StartServer() (listen backlog)
+// and Accept(), and the client profile in Connect(). Presets:
+//
+//   default     kernel defaults, backlog SOMAXCONN (the historical behaviour)
+//   latency     TCP_NODELAY, TCP_QUICKACK, TCP_NOTSENT_LOWAT 16K, keepalive
+//   throughput  4M send/receive buffers, Nagle left on, large backlog
+//   mobile      TCP_NODELAY, 64K buffers and TCP_NOTSENT_LOWAT 8K against
+//               bufferbloat, aggressive keepalive to notice dead radios
+//
+// TCP_NOTSENT_LOWAT also throttles blocking sends: a mailbox writer then
+// waits while more than that many bytes are unsent in the kernel, so queued
+// frames stay in the mailbox where control traffic can still overtake them.
+// TCP_QUICKACK is not sticky on Linux; with it on, NetworkLayer re-arms it
+// after every received frame.
+
+namespace SocketProfile {
+
+struct Keepalive {
+    int idle_s = 0;                 ///< 0 = SO_KEEPALIVE off
+    int interval_s = 0;
+    int count = 0;
+};
+
+struct Profile {
+    std::string name = "default";
+    bool nodelay = false;
+    bool quickack = false;
+    int sndbuf = 0;                 ///< bytes, 0 = kernel default
+    int rcvbuf = 0;
+    int notsent_lowat = 0;          ///< bytes, 0 = unset
+    Keepalive keepalive;
+    int backlog = 0;                ///< listen backlog, 0 = SOMAXCONN
+};
+
+// Individual settings layered over a preset, whatever the flag order.
+struct Overrides {
+    std::optional<bool> nodelay;
+    std::optional<bool> quickack;
+    std::optional<int> sndbuf;
+    std::optional<int> rcvbuf;
+    std::optional<int> notsent_lowat;
+    std::optional<Keepalive> keepalive;
+    std::optional<int> backlog;
+};
+
+// Fill *out with a preset; false for an unknown name.
+bool Preset(const std::string& name, Profile* out);
+
+// "latency|throughput|mobile|default"
+const char* PresetNames();
+
+Profile Resolve(const Profile& preset, const Overrides& overrides);
+
+// "IDLE,INTERVAL,COUNT" (seconds, seconds, probes) or "off".
+bool ParseKeepalive(const std::string& text, Keepalive* out);
+
+// Profiles used by NetworkLayer; set before sockets are created.
+void SetServer(const Profile& profile);
+void SetClient(const Profile& profile);
+const Profile& Server();
+const Profile& Client();
+
+int Backlog(const Profile& profile);
+
+// setsockopt for every non-default field. Failures are counted
+// (socket_profile.errors), never fatal.
+void Apply(Socket sock, const Profile& profile);
+
+// Re-arm TCP_QUICKACK after a read if the server or client profile uses it
+// (a process only has sockets of one kind in practice).
+void AfterReceive(Socket sock);
+
+// One line for startup logs and reports.
+std::string Describe(const Profile& profile);
+
+} // namespace SocketProfile
+
+#endif // SOCKET_PROFILE_H_
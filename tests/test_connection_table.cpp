@@ -0,0 +1,83 @@
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "connection_table.h"
+#include "user_ids.h"
+
+using ConnectionTable::ConnCounters;
+using ConnectionTable::ConnId;
+using ConnectionTable::ConnState;
+
+namespace {
+
+// Fake fds: the table only uses them as keys.
+constexpr Socket kSockA = 1001;
+constexpr Socket kSockB = 1002;
+
+std::vector<Socket> OnlineSockets() {
+    std::vector<Socket> socks;
+    ConnectionTable::ForEachOnline([&](Socket s, Outbound::Mailbox*) { socks.push_back(s); });
+    return socks;
+}
+
+} // namespace
+
+TEST(ConnectionTableTest, ReleasedIdGoesStale) {
+    ConnId id = ConnectionTable::Acquire(kSockA);
+    ASSERT_TRUE(id.Valid());
+    UserId user = UserIds::Intern("ct_alice");
+    ASSERT_TRUE(ConnectionTable::SetOnline(id, user, 1));
+    ConnectionTable::CountInbound(id);
+    const size_t live = ConnectionTable::LiveCount();
+
+    ConnectionTable::Release(id);
+    EXPECT_EQ(ConnectionTable::LiveCount(), live - 1);
+    EXPECT_FALSE(ConnectionTable::IsLive(id));
+    EXPECT_EQ(ConnectionTable::GetSocket(id), -1);
+    EXPECT_EQ(ConnectionTable::GetUser(id), kNoUser);
+    ConnCounters counters{};
+    EXPECT_FALSE(ConnectionTable::GetCounters(id, &counters));
+    EXPECT_FALSE(ConnectionTable::SetOnline(id, user, 2));
+    EXPECT_FALSE(ConnectionTable::SetState(id, ConnState::kClosing));
+    EXPECT_FALSE(ConnectionTable::FindBySocket(kSockA).Valid());
+    EXPECT_TRUE(OnlineSockets().empty());
+    // A second release of the same id is a no-op.
+    ConnectionTable::Release(id);
+    EXPECT_EQ(ConnectionTable::LiveCount(), live - 1);
+}
+
+TEST(ConnectionTableTest, RecycledSlotDoesNotAnswerToTheOldId) {
+    ConnId old_id = ConnectionTable::Acquire(kSockA);
+    ASSERT_TRUE(old_id.Valid());
+    ConnectionTable::Release(old_id);
+
+    // The freelist hands the same slot back with a new generation.
+    ConnId new_id = ConnectionTable::Acquire(kSockB);
+    ASSERT_TRUE(new_id.Valid());
+    EXPECT_EQ(new_id.index, old_id.index);
+    EXPECT_NE(new_id.generation, old_id.generation);
+    EXPECT_FALSE(new_id == old_id);
+
+    // Nothing done through the old id reaches the new peer.
+    EXPECT_FALSE(ConnectionTable::SetOnline(old_id, UserIds::Intern("ct_mallory"), 1));
+    ConnectionTable::CountOutbound(old_id, 1, 100);
+    ConnCounters counters{};
+    ASSERT_TRUE(ConnectionTable::GetCounters(new_id, &counters));
+    EXPECT_EQ(counters.frames_out, 0u);
+    EXPECT_EQ(counters.bytes_out, 0u);
+    EXPECT_EQ(ConnectionTable::GetSocket(old_id), -1);
+    EXPECT_EQ(ConnectionTable::GetSocket(new_id), kSockB);
+    EXPECT_TRUE(ConnectionTable::FindBySocket(kSockB) == new_id);
+    EXPECT_TRUE(OnlineSockets().empty());
+
+    ConnectionTable::Release(new_id);
+    EXPECT_FALSE(ConnectionTable::IsLive(new_id));
+}
+
+TEST(ConnectionTableTest, InvalidIdIsNeverLive) {
+    ConnId none;
+    EXPECT_FALSE(none.Valid());
+    EXPECT_FALSE(ConnectionTable::IsLive(none));
+    EXPECT_EQ(ConnectionTable::GetSocket(none), -1);
+}
@@ -0,0 +1,87 @@
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mpsc_queue.h"
+
+TEST(MpscQueueTest, RoundsCapacityUpToAPowerOfTwo) {
+    EXPECT_EQ(MpscQueue<int>(0).Capacity(), 2u);
+    EXPECT_EQ(MpscQueue<int>(3).Capacity(), 4u);
+    EXPECT_EQ(MpscQueue<int>(64).Capacity(), 64u);
+}
+
+TEST(MpscQueueTest, RefusesPushesWhenFullAndLeavesTheValue) {
+    MpscQueue<std::unique_ptr<int>> queue(4);
+    for (int i = 0; i < 4; ++i) ASSERT_TRUE(queue.TryPush(std::make_unique<int>(i)));
+    auto extra = std::make_unique<int>(99);
+    EXPECT_FALSE(queue.TryPush(std::move(extra)));
+    ASSERT_TRUE(extra);
+    EXPECT_EQ(*extra, 99);
+
+    // One pop frees exactly one cell.
+    std::vector<std::unique_ptr<int>> out;
+    EXPECT_EQ(queue.PopBatch(out, 1), 1u);
+    EXPECT_TRUE(queue.TryPush(std::move(extra)));
+    EXPECT_FALSE(queue.TryPush(std::make_unique<int>(100)));
+}
+
+TEST(MpscQueueTest, EmptyUntilPushedAndAfterDrained) {
+    MpscQueue<std::string> queue(2);
+    std::vector<std::string> out;
+    EXPECT_TRUE(queue.Empty());
+    EXPECT_EQ(queue.PopBatch(out, 8), 0u);
+    ASSERT_TRUE(queue.TryPush("a"));
+    EXPECT_FALSE(queue.Empty());
+    EXPECT_EQ(queue.PopBatch(out, 8), 1u);
+    EXPECT_TRUE(queue.Empty());
+    EXPECT_EQ(out, std::vector<std::string>{"a"});
+}
+
+TEST(MpscQueueTest, KeepsFifoOrderAcrossWrapAround) {
+    MpscQueue<int> queue(4);
+    std::vector<int> out;
+    int next = 0;
+    for (int round = 0; round < 10; ++round) {
+        // 3 in, 3 out: the head and tail lap the ring several times.
+        for (int i = 0; i < 3; ++i) ASSERT_TRUE(queue.TryPush(next++));
+        EXPECT_EQ(queue.PopBatch(out, 2), 2u);
+        EXPECT_EQ(queue.PopBatch(out, 8), 1u);
+    }
+    ASSERT_EQ(out.size(), 30u);
+    for (int i = 0; i < 30; ++i) EXPECT_EQ(out[i], i);
+}
+
+TEST(MpscQueueTest, KeepsPerProducerOrder) {
+    constexpr int kProducers = 4;
+    constexpr int kItems = 20000;
+    MpscQueue<int> queue(64);
+    std::vector<std::thread> producers;
+    for (int p = 0; p < kProducers; ++p) {
+        producers.emplace_back([&queue, p] {
+            for (int i = 0; i < kItems; ++i) {
+                while (!queue.TryPush(p * kItems + i)) std::this_thread::yield();
+            }
+        });
+    }
+    std::vector<int> last(kProducers, -1);
+    std::vector<int> batch;
+    int received = 0;
+    while (received < kProducers * kItems) {
+        batch.clear();
+        if (queue.PopBatch(batch, 16) == 0) {
+            std::this_thread::yield();
+            continue;
+        }
+        for (int v : batch) {
+            int p = v / kItems;
+            EXPECT_GT(v % kItems, last[p]) << "producer " << p;
+            last[p] = v % kItems;
+        }
+        received += static_cast<int>(batch.size());
+    }
+    for (auto& t : producers) t.join();
+    EXPECT_TRUE(queue.Empty());
+}
@@ -0,0 +1,107 @@
+#include <gtest/gtest.h>
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "netsim.h"
+#include "network.h"
+
+namespace {
+
+using Trace = std::vector<std::string>;
+
+constexpr int kPort = 7100;
+
+Message Text(const std::string& content) {
+    return Message{MessageType::PUBLIC_MESSAGE, 0, "sim", "", content};
+}
+
+// Everything that has arrived at sock by now, as "<us> <tag> <content>".
+void Drain(Socket sock, const std::string& tag, Trace* trace) {
+    while (std::optional<Message> msg = NetSim::TryReceive(sock)) {
+        trace->push_back(std::to_string(NetSim::Now()) + " " + tag + " " + msg->content);
+    }
+}
+
+void Settle(Socket client, Socket server, Trace* trace) {
+    while (NetSim::AdvanceToNextEvent()) {
+        Drain(client, "client", trace);
+        Drain(server, "server", trace);
+    }
+}
+
+// One connection with asymmetric links, written to from this thread only:
+// split writes and serialization delay upstream, pure latency downstream.
+Trace RunScenario() {
+    NetSim::Reset();
+    NetSim::SetDefaultLink(NetSim::LinkParams{});
+    Socket listener = NetworkLayer::StartServer(kPort);
+    Socket client = NetworkLayer::Connect("sim", kPort);
+    Socket server = NetworkLayer::Accept(listener);
+    NetSim::SetLink(client, NetSim::LinkParams{500, 100000, 7, 0});
+    NetSim::SetLink(server, NetSim::LinkParams{200, 0, 0, 0});
+
+    Trace trace;
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_TRUE(NetworkLayer::SendMessage(client, Text("up" + std::to_string(i))));
+    }
+    EXPECT_TRUE(NetworkLayer::SendMessage(server, Text("down0")));
+    NetSim::Advance(150);
+    EXPECT_TRUE(NetworkLayer::SendMessage(server, Text("down1")));
+    Settle(client, server, &trace);
+
+    NetSim::Advance(1000);
+    EXPECT_TRUE(NetworkLayer::SendMessage(client, Text(std::string(64, 'x'))));
+    EXPECT_TRUE(NetworkLayer::SendMessage(server, Text("down2")));
+    Settle(client, server, &trace);
+
+    NetSim::Disconnect(client);
+    EXPECT_TRUE(NetSim::IsClosed(client));
+    return trace;
+}
+
+} // namespace
+
+TEST(NetSimTest, ReplayingAScenarioGivesTheSameTrace) {
+    Trace first = RunScenario();
+    Trace second = RunScenario();
+    ASSERT_EQ(first.size(), 7u);
+    EXPECT_EQ(first, second);
+}
+
+TEST(NetSimTest, KeepsPerLinkOrderAndTiming) {
+    Trace trace = RunScenario();
+    std::vector<std::string> up;
+    std::vector<std::string> down;
+    long long last = -1;
+    for (const std::string& line : trace) {
+        long long at = std::stoll(line.substr(0, line.find(' ')));
+        EXPECT_GE(at, last) << line;
+        last = at;
+        std::string rest = line.substr(line.find(' ') + 1);
+        std::string content = rest.substr(rest.find(' ') + 1);
+        (rest.compare(0, 6, "server") == 0 ? up : down).push_back(content);
+    }
+    EXPECT_EQ(up, (std::vector<std::string>{"up0", "up1", "up2", std::string(64, 'x')}));
+    EXPECT_EQ(down, (std::vector<std::string>{"down0", "down1", "down2"}));
+    // Downstream is latency only: sent at 0 and 150, both 200us later.
+    EXPECT_EQ(trace.front(), "200 client down0");
+}
+
+TEST(NetSimTest, ResetFreesTheOldEndpoints) {
+    NetSim::Reset();
+    Socket listener = NetworkLayer::StartServer(kPort);
+    Socket client = NetworkLayer::Connect("sim", kPort);
+    Socket server = NetworkLayer::Accept(listener);
+    ASSERT_TRUE(NetworkLayer::SendMessage(client, Text("before")));
+    ASSERT_FALSE(NetSim::IsClosed(server));
+
+    NetSim::Reset();
+    EXPECT_TRUE(NetSim::IsClosed(server));
+    EXPECT_EQ(NetSim::GetStats(client).bytes_sent, 0u);
+    EXPECT_FALSE(NetworkLayer::SendMessage(client, Text("after")));
+    EXPECT_EQ(NetSim::Now(), 0);
+    // The port is free again.
+    NetworkLayer::StartServer(kPort);
+}
@@ -0,0 +1,216 @@
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "history.h"
+#include "snapshot.h"
+#include "user_ids.h"
+
+namespace {
+
+using Entries = std::vector<std::shared_ptr<const LogEntry>>;
+using Bytes = std::vector<char>;
+
+// Magic, version, created_ms and log_offset.
+constexpr size_t kHeaderBytes = 8 + 4 + 8 + 8;
+
+// Builds a snapshot by hand, following the layout in snapshot.h, so ids in
+// the file can differ from this process's.
+class Image {
+public:
+    Image() {
+        Raw("CHATSNAP");
+        U32(1);             // version
+        U64(0);             // created_ms
+        U64(0);             // log_offset
+    }
+
+    void Users(const std::vector<std::string>& names) {
+        size_t at = Begin(1);
+        U32(static_cast<uint32_t>(names.size()));
+        for (const std::string& name : names) Str(name);
+        End(at);
+    }
+
+    // One public message per (actor, content), all with the given timestamp.
+    void History(const std::vector<std::pair<uint32_t, std::string>>& messages) {
+        size_t at = Begin(2);
+        U32(static_cast<uint32_t>(messages.size()));
+        for (const auto& m : messages) {
+            U64(1000);
+            U32(static_cast<uint32_t>(MessageType::PUBLIC_MESSAGE));
+            U32(m.first);
+            U32(kNoUser);
+            Str("");
+            Str(m.second);
+        }
+        End(at);
+    }
+
+    void Unknown() {
+        size_t at = Begin(77);
+        Raw("from a newer writer");
+        End(at);
+    }
+
+    void Poke(size_t at, char value) { buf_[at] = value; }
+
+    Bytes Finish() const {
+        Bytes out = buf_;
+        uint32_t crc = Crc32(out);
+        for (int i = 0; i < 4; ++i) out.push_back(static_cast<char>(crc >> (8 * i)));
+        return out;
+    }
+
+private:
+    static uint32_t Crc32(const Bytes& data) {
+        uint32_t crc = 0xFFFFFFFFu;
+        for (char ch : data) {
+            crc ^= static_cast<uint8_t>(ch);
+            for (int k = 0; k < 8; ++k) crc = (crc & 1) ? 0xEDB88320u ^ (crc >> 1) : crc >> 1;
+        }
+        return crc ^ 0xFFFFFFFFu;
+    }
+
+    void Raw(const std::string& s) { buf_.insert(buf_.end(), s.begin(), s.end()); }
+    void Int(uint64_t v, int n) {
+        for (int i = 0; i < n; ++i) buf_.push_back(static_cast<char>(v >> (8 * i)));
+    }
+    void U32(uint32_t v) { Int(v, 4); }
+    void U64(uint64_t v) { Int(v, 8); }
+    void Str(const std::string& s) {
+        U32(static_cast<uint32_t>(s.size()));
+        Raw(s);
+    }
+    size_t Begin(uint32_t tag) {
+        U32(tag);
+        size_t at = buf_.size();
+        U64(0);
+        return at;
+    }
+    void End(size_t at) {
+        uint64_t len = buf_.size() - at - 8;
+        for (int i = 0; i < 8; ++i) buf_[at + i] = static_cast<char>(len >> (8 * i));
+    }
+
+    Bytes buf_;
+};
+
+class SnapshotTest : public ::testing::Test {
+protected:
+    void TearDown() override { std::remove(path_.c_str()); }
+
+    void Save(const Bytes& bytes) {
+        std::ofstream out(path_, std::ios::binary | std::ios::trunc);
+        out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    }
+
+    Bytes Load() {
+        std::ifstream in(path_, std::ios::binary);
+        return Bytes(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    bool Read(Entries* out) { return Snapshot::ReadEntries(path_, out); }
+
+    const std::string path_ = ::testing::TempDir() + "chat_snapshot_test_" + std::to_string(::getpid());
+};
+
+LogEntry Said(UserId actor, const std::string& content) {
+    return LogEntry{1000, MessageType::PUBLIC_MESSAGE, actor, kNoUser, "", content};
+}
+
+} // namespace
+
+TEST_F(SnapshotTest, WriteThenReadGivesTheSameHistory) {
+    UserId alice = UserIds::Intern("snap_alice");
+    UserId bob = UserIds::Intern("snap_bob");
+    History::Restore({}, 0);
+    History::Record(Said(alice, "hello"), 10);
+    History::Record(Said(bob, "hi there"), 20);
+    History::Record(Said(UserIds::kServerId, "bye"), 30);
+    ASSERT_TRUE(Snapshot::Write(path_));
+
+    Entries entries;
+    ASSERT_TRUE(Read(&entries));
+    ASSERT_EQ(entries.size(), 3u);
+    EXPECT_EQ(entries[0]->actor_id, alice);
+    EXPECT_EQ(entries[0]->content, "hello");
+    EXPECT_EQ(entries[1]->actor_id, bob);
+    EXPECT_EQ(entries[1]->content, "hi there");
+    EXPECT_EQ(entries[2]->actor_id, UserIds::kServerId);
+    EXPECT_EQ(entries[2]->event_type, MessageType::PUBLIC_MESSAGE);
+    EXPECT_EQ(entries[2]->timestamp, 1000);
+}
+
+TEST_F(SnapshotTest, RemapsStoredIdsToThisProcess) {
+    // This process saw snap_amy first; the file numbers snap_zed first.
+    UserId amy = UserIds::Intern("snap_amy");
+    Image image;
+    image.Users({"snap_zed", "snap_amy"});          // file ids 2 and 3
+    image.Unknown();
+    image.History({{3, "from amy"}, {2, "from zed"}, {UserIds::kServerId, "from server"}, {99, "from nobody"}});
+    Save(image.Finish());
+
+    Entries entries;
+    ASSERT_TRUE(Read(&entries));
+    ASSERT_EQ(entries.size(), 4u);
+    EXPECT_EQ(entries[0]->actor_id, amy);
+    EXPECT_EQ(entries[1]->actor_id, UserIds::Find("snap_zed"));
+    EXPECT_NE(entries[1]->actor_id, kNoUser);
+    EXPECT_EQ(entries[2]->actor_id, UserIds::kServerId);
+    EXPECT_EQ(entries[3]->actor_id, kNoUser);       // not in the users section
+}
+
+TEST_F(SnapshotTest, RejectsTruncatedFiles) {
+    Image image;
+    image.Users({"snap_tina"});
+    image.History({{2, "short"}, {2, "lived"}});
+    const Bytes whole = image.Finish();
+    Save(whole);
+    Entries entries;
+    ASSERT_TRUE(Read(&entries));
+
+    for (size_t len = 0; len < whole.size(); ++len) {
+        Save(Bytes(whole.begin(), whole.begin() + static_cast<std::ptrdiff_t>(len)));
+        EXPECT_FALSE(Read(&entries)) << "truncated to " << len << " bytes";
+    }
+    std::remove(path_.c_str());
+    EXPECT_FALSE(Read(&entries));
+}
+
+TEST_F(SnapshotTest, RejectsCorruptFiles) {
+    UserId carol = UserIds::Intern("snap_carol");
+    History::Restore({}, 0);
+    History::Record(Said(carol, "payload"), 10);
+    ASSERT_TRUE(Snapshot::Write(path_));
+    const Bytes good = Load();
+
+    // Any flipped byte fails the CRC, including one inside the CRC itself.
+    Entries entries;
+    for (size_t i = 0; i < good.size(); ++i) {
+        Bytes bad = good;
+        bad[i] ^= 0x20;
+        Save(bad);
+        EXPECT_FALSE(Read(&entries)) << "byte " << i;
+    }
+
+    // Lengths that run past their data are refused even with a valid CRC.
+    Image overrun;
+    overrun.Users({"snap_dan"});
+    overrun.Poke(kHeaderBytes + 4, 0x7f);           // users section length
+    Save(overrun.Finish());
+    EXPECT_FALSE(Read(&entries));
+    Image short_name;
+    short_name.Users({"snap_dan"});
+    short_name.Poke(kHeaderBytes + 4 + 8 + 4, 0x7f); // first name length
+    Save(short_name.Finish());
+    EXPECT_FALSE(Read(&entries));
+}
@@ -0,0 +1,76 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "topics.h"
+
+namespace {
+
+constexpr UserId kAlice = 101;
+constexpr UserId kBob = 102;
+constexpr UserId kCarol = 103;
+
+class TopicsTest : public ::testing::Test {
+protected:
+    void TearDown() override {
+        for (UserId u : {kAlice, kBob, kCarol}) Topics::RemoveSubscriber(u);
+    }
+
+    static void Subscribe(UserId user, const std::string& pattern) {
+        std::string error;
+        ASSERT_TRUE(Topics::Subscribe(user, pattern, &error)) << pattern << ": " << error;
+    }
+};
+
+using Users = std::vector<UserId>;
+
+} // namespace
+
+TEST_F(TopicsTest, StarMatchesExactlyOneLevel) {
+    Subscribe(kAlice, "room.*.msg");
+    EXPECT_EQ(Topics::Match("room.main.msg"), Users{kAlice});
+    EXPECT_EQ(Topics::Match("room.msg"), Users{});
+    EXPECT_EQ(Topics::Match("room.a.b.msg"), Users{});
+    EXPECT_EQ(Topics::Match("room.main.msg.bob"), Users{});
+}
+
+TEST_F(TopicsTest, TrailingHashMatchesZeroOrMoreLevels) {
+    Subscribe(kAlice, "presence.#");
+    EXPECT_EQ(Topics::Match("presence"), Users{kAlice});
+    EXPECT_EQ(Topics::Match("presence.join"), Users{kAlice});
+    EXPECT_EQ(Topics::Match("presence.join.bob"), Users{kAlice});
+    EXPECT_EQ(Topics::Match("presences.join"), Users{});
+
+    Subscribe(kBob, "#");
+    EXPECT_EQ(Topics::Match("file.shared.carol"), Users{kBob});
+}
+
+TEST_F(TopicsTest, MatchIsSortedWithoutDuplicates) {
+    // Three of Carol's patterns and two of Alice's match the same topic.
+    Subscribe(kCarol, "room.#");
+    Subscribe(kCarol, "room.*.msg.*");
+    Subscribe(kCarol, "#");
+    Subscribe(kAlice, "room.main.msg.bob");
+    Subscribe(kAlice, "room.main.#");
+    Subscribe(kBob, "presence.#");
+    EXPECT_EQ(Topics::Match("room.main.msg.bob"), (Users{kAlice, kCarol}));
+}
+
+TEST_F(TopicsTest, RejectsMalformedPatterns) {
+    std::string error;
+    EXPECT_FALSE(Topics::Subscribe(kAlice, "room.#.msg", &error));
+    EXPECT_FALSE(Topics::Subscribe(kAlice, "room.ma*", &error));
+    EXPECT_FALSE(Topics::Subscribe(kAlice, "room..msg", &error));
+    EXPECT_FALSE(Topics::Subscribe(kAlice, "a.b.c.d.e.f.g.h.i", &error));
+    EXPECT_TRUE(Topics::Subscriptions(kAlice).empty());
+}
+
+TEST_F(TopicsTest, UnsubscribeAndLeaveStopMatching) {
+    Subscribe(kAlice, "presence.*.bob");
+    Subscribe(kBob, "presence.*.bob");
+    Topics::Unsubscribe(kAlice, "presence.*.bob");
+    EXPECT_EQ(Topics::Match("presence.join.bob"), Users{kBob});
+    Topics::RemoveSubscriber(kBob);
+    EXPECT_EQ(Topics::Match("presence.join.bob"), Users{});
+}
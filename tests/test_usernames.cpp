@@ -0,0 +1,25 @@
+#include <gtest/gtest.h>
+
+#include "services.h"
+#include "user_ids.h"
+
+TEST(UsernameTest, RefusesTheReservedNames) {
+    // kNoUser and kServerId: neither may be taken by a session.
+    EXPECT_FALSE(UserManager::ValidUsername(UserIds::Name(kNoUser)));
+    EXPECT_FALSE(UserManager::ValidUsername(UserIds::Name(UserIds::kServerId)));
+    EXPECT_FALSE(UserManager::ValidUsername(""));
+    EXPECT_FALSE(UserManager::ValidUsername("Server"));
+}
+
+TEST(UsernameTest, RefusesPresenceSeparators) {
+    EXPECT_FALSE(UserManager::ValidUsername("a,b"));
+    EXPECT_FALSE(UserManager::ValidUsername("alice=t"));
+    EXPECT_FALSE(UserManager::ValidUsername(","));
+}
+
+TEST(UsernameTest, AcceptsOrdinaryNames) {
+    EXPECT_TRUE(UserManager::ValidUsername("alice"));
+    EXPECT_TRUE(UserManager::ValidUsername("server"));
+    EXPECT_TRUE(UserManager::ValidUsername("Server2"));
+    EXPECT_TRUE(UserManager::ValidUsername("\xe5\xbc\xa0\xe4\xb8\x89"));
+}
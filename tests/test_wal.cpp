@@ -0,0 +1,101 @@
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "wal.h"
+
+namespace {
+
+class WalTest : public ::testing::Test {
+protected:
+    void TearDown() override {
+        Wal::Close();
+        std::remove(path_.c_str());
+    }
+
+    std::string Contents() {
+        std::ifstream in(path_, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    // Records each callback as "<index>:<durable>".
+    Wal::Done Note(int index) {
+        return [this, index](bool durable) {
+            std::lock_guard<std::mutex> lock(mu_);
+            done_.push_back(std::to_string(index) + (durable ? ":ok" : ":lost"));
+        };
+    }
+
+    std::vector<std::string> Done() {
+        std::lock_guard<std::mutex> lock(mu_);
+        return done_;
+    }
+
+    const std::string path_ = ::testing::TempDir() + "chat_wal_test_" + std::to_string(::getpid());
+    std::mutex mu_;
+    std::vector<std::string> done_;
+};
+
+} // namespace
+
+TEST_F(WalTest, RunsCallbacksInAppendOrder) {
+    std::remove(path_.c_str());
+    Wal::Options options;
+    options.path = path_;
+    options.group_window_us = 1000;
+    options.max_batch = 8;              // several batches
+    ASSERT_TRUE(Wal::Open(options));
+
+    std::vector<std::string> expected;
+    std::string written;
+    for (int i = 0; i < 100; ++i) {
+        std::string record = "record " + std::to_string(i) + "\n";
+        written += record;
+        ASSERT_TRUE(Wal::Append(record, Note(i)));
+        expected.push_back(std::to_string(i) + ":ok");
+        if (i % 17 == 0) std::this_thread::yield();
+    }
+    ASSERT_TRUE(Wal::Append("no callback\n", nullptr));
+    written += "no callback\n";
+    Wal::Flush();
+    EXPECT_EQ(Done(), expected);
+    EXPECT_EQ(Contents(), written);
+}
+
+TEST_F(WalTest, RefusesAppendsAfterAFailedCommit) {
+    if (::access("/dev/full", W_OK) != 0) GTEST_SKIP() << "needs /dev/full";
+    Wal::Options options;
+    options.path = "/dev/full";         // every write fails with ENOSPC
+    ASSERT_TRUE(Wal::Open(options));
+    ASSERT_TRUE(Wal::Append("doomed\n", Note(0)));
+    Wal::Flush();
+    EXPECT_EQ(Done(), std::vector<std::string>{"0:lost"});
+
+    // Failed stays failed: refused, and the callback never runs.
+    EXPECT_FALSE(Wal::Append("after\n", Note(1)));
+    Wal::Flush();
+    EXPECT_EQ(Done(), std::vector<std::string>{"0:lost"});
+
+    // Reopening clears it.
+    Wal::Close();
+    std::remove(path_.c_str());
+    options.path = path_;
+    ASSERT_TRUE(Wal::Open(options));
+    EXPECT_TRUE(Wal::Append("fresh\n", Note(2)));
+    Wal::Flush();
+    EXPECT_EQ(Done(), (std::vector<std::string>{"0:lost", "2:ok"}));
+}
+
+TEST_F(WalTest, RefusesAppendsWhenClosed) {
+    EXPECT_FALSE(Wal::IsOpen());
+    EXPECT_FALSE(Wal::Append("nowhere\n", Note(0)));
+    EXPECT_TRUE(Done().empty());
+}
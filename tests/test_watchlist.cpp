@@ -0,0 +1,145 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "metrics.h"
+#include "user_ids.h"
+#include "watchlist.h"
+
+namespace {
+
+using Users = std::vector<UserId>;
+using Hits = std::vector<std::pair<UserId, std::string>>;
+
+class WatchlistTest : public ::testing::Test {
+protected:
+    void TearDown() override {
+        for (UserId u : users_) Watchlist::RemoveUser(u);
+    }
+
+    // A user named name, online and watching "@name".
+    UserId Online(const std::string& name) {
+        UserId u = UserIds::Intern(name);
+        Watchlist::AddUser(u);
+        users_.push_back(u);
+        return u;
+    }
+
+    static void Watch(UserId user, const std::string& word) {
+        std::string error;
+        ASSERT_TRUE(Watchlist::Watch(user, word, &error)) << word << ": " << error;
+    }
+
+    // Users whose watch on pattern fires on text, sorted.
+    static Users Matching(const std::string& text, const std::string& pattern) {
+        Users users;
+        for (const auto& hit : Watchlist::Match(text)) {
+            if (hit.second == pattern) users.push_back(hit.first);
+        }
+        std::sort(users.begin(), users.end());
+        return users;
+    }
+
+    std::vector<UserId> users_;
+};
+
+} // namespace
+
+TEST_F(WatchlistTest, MatchesWholeWordsOnly) {
+    UserId alice = Online("wl_alice");
+    Watch(alice, "cat");
+    EXPECT_EQ(Matching("the cat sat", "cat"), Users{alice});
+    EXPECT_EQ(Matching("cat", "cat"), Users{alice});
+    EXPECT_EQ(Matching("cat, dog!", "cat"), Users{alice});
+    EXPECT_EQ(Matching("concatenate", "cat"), Users{});
+    EXPECT_EQ(Matching("cats", "cat"), Users{});
+    EXPECT_EQ(Matching("tomcat", "cat"), Users{});
+    EXPECT_EQ(Matching("_cat_", "cat"), Users{});
+    EXPECT_EQ(Matching("cat9", "cat"), Users{});
+    // A multi-byte UTF-8 letter next to the word is part of it.
+    EXPECT_EQ(Matching("\xc3\xa9" "cat", "cat"), Users{});
+}
+
+TEST_F(WatchlistTest, ReportsEachUserAndPatternOnce) {
+    UserId alice = Online("wl_alice");
+    UserId bob = Online("wl_bob");
+    Watch(alice, "deploy");
+    Watch(bob, "deploy");
+    Hits hits = Watchlist::Match("deploy, then deploy again @wl_bob");
+    std::sort(hits.begin(), hits.end());
+    EXPECT_EQ(hits, (Hits{{alice, "deploy"}, {bob, "@wl_bob"}, {bob, "deploy"}}));
+}
+
+TEST_F(WatchlistTest, FoldsAsciiCase) {
+    UserId alice = Online("WL_Alice");
+    Watch(alice, "  Deploy ");
+    EXPECT_EQ(Watchlist::Watches(alice), std::vector<std::string>{"deploy"});
+    EXPECT_EQ(Matching("DEPLOY now", "deploy"), Users{alice});
+    EXPECT_EQ(Matching("dEpLoY", "deploy"), Users{alice});
+    EXPECT_EQ(Matching("ping @wl_alice", "@wl_alice"), Users{alice});
+    EXPECT_EQ(Matching("ping @WL_ALICE", "@wl_alice"), Users{alice});
+    // Only ASCII folds: the UTF-8 bytes must match exactly.
+    Watch(alice, "\xc3\xa9t\xc3\xa9");
+    EXPECT_EQ(Matching("un \xc3\xa9t\xc3\xa9 chaud", "\xc3\xa9t\xc3\xa9"), Users{alice});
+    EXPECT_EQ(Matching("un \xc3\x89T\xc3\x89 chaud", "\xc3\xa9t\xc3\xa9"), Users{});
+}
+
+TEST_F(WatchlistTest, RejectsUnusableWords) {
+    UserId alice = Online("wl_alice");
+    std::string error;
+    EXPECT_FALSE(Watchlist::Watch(alice, "a", &error));
+    EXPECT_FALSE(Watchlist::Watch(alice, std::string(Watchlist::kMaxPatternBytes + 1, 'x'), &error));
+    EXPECT_FALSE(Watchlist::Watch(alice, "a,b", &error));
+    EXPECT_FALSE(Watchlist::Watch(kNoUser, "deploy", &error));
+    for (size_t i = 0; i < Watchlist::kMaxWatches; ++i) Watch(alice, "word" + std::to_string(i));
+    EXPECT_FALSE(Watchlist::Watch(alice, "onemore", &error));
+    Watch(alice, "word0");      // already watched: not one more
+}
+
+// Past kDeltaMin changes the delta and the mask fold into a new base; what
+// was removed, re-added or added on either side of a fold must still match.
+TEST_F(WatchlistTest, DeltaAndMaskSurviveARebuild) {
+    std::atomic<int64_t>& rebuilds = Metrics::Counter("watch.rebuilds");
+    const int64_t before = rebuilds.load();
+    std::vector<UserId> users;
+    for (size_t i = 0; i < 2 * Watchlist::kDeltaMin; ++i) users.push_back(Online("wl_user" + std::to_string(i)));
+    ASSERT_GT(rebuilds.load(), before) << "kDeltaMin joins should fold into a base";
+
+    // Removed from the base: masked, not matched; back again: unmasked.
+    Watchlist::RemoveUser(users[0]);
+    EXPECT_EQ(Matching("hi @wl_user0", "@wl_user0"), Users{});
+    Watchlist::AddUser(users[1]);
+    Watchlist::RemoveUser(users[2]);
+    Watchlist::AddUser(users[2]);
+    EXPECT_EQ(Matching("hi @wl_user2", "@wl_user2"), Users{users[2]});
+    // Added after the fold: in the delta.
+    Watch(users[3], "shipit");
+    EXPECT_EQ(Matching("shipit", "shipit"), Users{users[3]});
+    Watchlist::Unwatch(users[3], "shipit");
+    EXPECT_EQ(Matching("shipit", "shipit"), Users{});
+    Watch(users[4], "shipit");
+
+    // Enough changes to fold again.
+    const int64_t folded = rebuilds.load();
+    Users keyword;
+    for (size_t i = 0; i <= Watchlist::kDeltaMin; ++i) {
+        Watch(users[i + 5], "release");
+        keyword.push_back(users[i + 5]);
+    }
+    ASSERT_GT(rebuilds.load(), folded);
+    std::sort(keyword.begin(), keyword.end());
+
+    EXPECT_EQ(Matching("cut the release", "release"), keyword);
+    EXPECT_EQ(Matching("hi @wl_user0", "@wl_user0"), Users{});
+    EXPECT_EQ(Matching("hi @wl_user1", "@wl_user1"), Users{users[1]});
+    EXPECT_EQ(Matching("hi @wl_user2", "@wl_user2"), Users{users[2]});
+    EXPECT_EQ(Matching("shipit", "shipit"), Users{users[4]});
+    Watchlist::AddUser(users[0]);
+    EXPECT_EQ(Matching("hi @wl_user0", "@wl_user0"), Users{users[0]});
+    const std::string last = "wl_user" + std::to_string(users.size() - 1);
+    EXPECT_EQ(Matching("@" + last, "@" + last), Users{users.back()});
+}
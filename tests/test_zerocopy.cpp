@@ -0,0 +1,129 @@
+#include <gtest/gtest.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <memory>
+#include <vector>
+
+#include "metrics.h"
+#include "network.h"
+#include "zerocopy.h"
+
+namespace {
+
+constexpr size_t kFrameBytes = 32 << 10;
+constexpr size_t kFrames = 4;
+
+// Connected loopback pair. The accepted side gets a tiny receive buffer, so
+// nearly everything sent stays queued in the sender's kernel until it reads.
+bool LoopbackPair(int* tx, int* rx) {
+    int listener = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0) return false;
+    int small = 4096;
+    ::setsockopt(listener, SOL_SOCKET, SO_RCVBUF, &small, sizeof(small));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    bool ok = ::bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0 &&
+              ::listen(listener, 1) == 0 &&
+              ::getsockname(listener, reinterpret_cast<sockaddr*>(&addr), &len) == 0;
+    *tx = ok ? ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0) : -1;
+    ok = ok && *tx >= 0 && ::connect(*tx, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+    *rx = ok ? ::accept(listener, nullptr, nullptr) : -1;
+    ::close(listener);
+    return ok && *rx >= 0;
+}
+
+struct Sent {
+    std::vector<NetworkLayer::Frame> frames;
+    std::vector<std::weak_ptr<const std::vector<char>>> watched;
+};
+
+Sent MakeFrames() {
+    Sent s;
+    for (size_t i = 0; i < kFrames; ++i) {
+        s.frames.push_back(std::make_shared<const std::vector<char>>(kFrameBytes, static_cast<char>('a' + i)));
+        s.watched.push_back(s.frames.back());
+    }
+    return s;
+}
+
+size_t ReadAll(int sock, int* error) {
+    size_t got = 0;
+    char buf[16 << 10];
+    for (;;) {
+        ssize_t n = ::recv(sock, buf, sizeof(buf), 0);
+        if (n > 0) {
+            got += static_cast<size_t>(n);
+            continue;
+        }
+        *error = n < 0 ? errno : 0;
+        return got;
+    }
+}
+
+} // namespace
+
+TEST(ZeroCopySenderTest, DrainAbortsBeforeReleasingFramesANonReadingPeerHolds) {
+    int tx = -1, rx = -1;
+    ASSERT_TRUE(LoopbackPair(&tx, &rx));
+    ZeroCopy::Sender sender(tx, 1);
+    if (!sender.Active()) {
+        ::close(tx);
+        ::close(rx);
+        GTEST_SKIP() << "SO_ZEROCOPY not supported here";
+    }
+    const int64_t aborted = Metrics::Counter("zerocopy.aborted").load();
+
+    Sent sent = MakeFrames();
+    ASSERT_TRUE(sender.Send(sent.frames));
+    sent.frames.clear();
+    sender.Reap();
+    ASSERT_GT(sender.Pending(), 0u) << "the peer should be holding the data back";
+
+    sender.Drain(50);
+    EXPECT_EQ(sender.Pending(), 0u);
+    EXPECT_EQ(Metrics::Counter("zerocopy.aborted").load(), aborted + 1);
+    // Released only after the kernel gave them up, not retired.
+    for (const auto& w : sent.watched) EXPECT_TRUE(w.expired());
+
+    // The unsent data was discarded: the peer sees a reset, never the rest.
+    int error = 0;
+    size_t got = ReadAll(rx, &error);
+    EXPECT_LT(got, kFrames * kFrameBytes);
+    EXPECT_EQ(error, ECONNRESET);
+    ::close(tx);
+    ::close(rx);
+}
+
+TEST(ZeroCopySenderTest, DrainWaitsForCompletionsWhenThePeerReads) {
+    int tx = -1, rx = -1;
+    ASSERT_TRUE(LoopbackPair(&tx, &rx));
+    ZeroCopy::Sender sender(tx, 1);
+    if (!sender.Active()) {
+        ::close(tx);
+        ::close(rx);
+        GTEST_SKIP() << "SO_ZEROCOPY not supported here";
+    }
+    const int64_t aborted = Metrics::Counter("zerocopy.aborted").load();
+
+    Sent sent = MakeFrames();
+    ASSERT_TRUE(sender.Send(sent.frames));
+    sent.frames.clear();
+    ::shutdown(tx, SHUT_WR);
+    int error = 0;
+    EXPECT_EQ(ReadAll(rx, &error), kFrames * kFrameBytes);
+    EXPECT_EQ(error, 0);
+
+    sender.Drain(1000);
+    EXPECT_EQ(sender.Pending(), 0u);
+    EXPECT_EQ(Metrics::Counter("zerocopy.aborted").load(), aborted);
+    for (const auto& w : sent.watched) EXPECT_TRUE(w.expired());
+    ::close(tx);
+    ::close(rx);
+}
@@ -0,0 +1,194 @@
+#include "topics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string_view>
+
+#include "locks.h"
+#include "metrics.h"
+#include "outbound.h"
+#include "services.h"
+
+namespace Topics {
+
+namespace {
+
+struct Node {
+    std::map<std::string, std::unique_ptr<Node>, std::less<>> children;
+    std::unique_ptr<Node> star;     ///< "*": any one level
+    std::vector<UserId> here;       ///< patterns ending at this node
+    std::vector<UserId> rest;       ///< patterns ending in ".#" here
+};
+
+std::vector<std::string_view> Split(std::string_view s) {
+    std::vector<std::string_view> levels;
+    for (size_t pos = 0;;) {
+        size_t dot = s.find('.', pos);
+        levels.push_back(s.substr(pos, dot == std::string_view::npos ? std::string_view::npos : dot - pos));
+        if (dot == std::string_view::npos) return levels;
+        pos = dot + 1;
+    }
+}
+
+bool Validate(const std::string& pattern, std::string* error) {
+    if (pattern.empty() || pattern.size() > kMaxPatternBytes) {
+        *error = "length must be 1-" + std::to_string(kMaxPatternBytes);
+        return false;
+    }
+    for (char c : pattern) {
+        if (static_cast<unsigned char>(c) <= 0x20 || c == ',') {
+            *error = "no spaces, commas or control characters";
+            return false;
+        }
+    }
+    std::vector<std::string_view> levels = Split(pattern);
+    if (levels.size() > kMaxDepth) {
+        *error = "at most " + std::to_string(kMaxDepth) + " levels";
+        return false;
+    }
+    for (size_t i = 0; i < levels.size(); ++i) {
+        std::string_view l = levels[i];
+        if (l.empty()) {
+            *error = "empty level";
+            return false;
+        }
+        if ((l.find('*') != std::string_view::npos && l != "*") ||
+            (l.find('#') != std::string_view::npos && (l != "#" || i + 1 != levels.size()))) {
+            *error = "'*' must be a whole level, '#' the whole last level";
+            return false;
+        }
+    }
+    return true;
+}
+
+void Insert(Node* root, const std::string& pattern, UserId user) {
+    Node* n = root;
+    for (std::string_view l : Split(pattern)) {
+        if (l == "#") {
+            n->rest.push_back(user);
+            return;
+        }
+        if (l == "*") {
+            if (!n->star) n->star = std::make_unique<Node>();
+            n = n->star.get();
+        } else {
+            auto it = n->children.find(l);
+            if (it == n->children.end()) it = n->children.emplace(std::string(l), std::make_unique<Node>()).first;
+            n = it->second.get();
+        }
+    }
+    n->here.push_back(user);
+}
+
+void Walk(const Node& n, const std::vector<std::string_view>& levels, size_t i, std::vector<UserId>* out) {
+    out->insert(out->end(), n.rest.begin(), n.rest.end());
+    if (i == levels.size()) {
+        out->insert(out->end(), n.here.begin(), n.here.end());
+        return;
+    }
+    auto it = n.children.find(levels[i]);
+    if (it != n.children.end()) Walk(*it->second, levels, i + 1, out);
+    if (n.star) Walk(*n.star, levels, i + 1, out);
+}
+
+Locks::Mutex g_mutex{"topics"};
+std::map<UserId, std::vector<std::string>> g_subscriptions;
+std::shared_ptr<const Node> g_trie;     // std::atomic_load / atomic_store only; null = nobody
+
+// Caller holds g_mutex.
+void RebuildLocked() {
+    std::shared_ptr<const Node> trie;
+    if (!g_subscriptions.empty()) {
+        auto root = std::make_shared<Node>();
+        for (const auto& kv : g_subscriptions) {
+            for (const std::string& p : kv.second) Insert(root.get(), p, kv.first);
+        }
+        trie = std::move(root);
+    }
+    std::atomic_store(&g_trie, std::move(trie));
+}
+
+} // namespace
+
+std::string Level(const std::string& name) {
+    std::string level = name.empty() ? "_" : name;
+    for (char& c : level) {
+        if (c == '.' || c == '*' || c == '#' || c == ',' || static_cast<unsigned char>(c) <= 0x20) c = '_';
+    }
+    return level;
+}
+
+bool Subscribe(UserId user, const std::string& pattern, std::string* error) {
+    if (user == kNoUser || !Validate(pattern, error)) return false;
+    Locks::Lock lock(g_mutex);
+    std::vector<std::string>& mine = g_subscriptions[user];
+    if (std::find(mine.begin(), mine.end(), pattern) != mine.end()) return true;
+    if (mine.size() >= kMaxSubscriptions) {
+        *error = "at most " + std::to_string(kMaxSubscriptions) + " subscriptions";
+        return false;
+    }
+    mine.push_back(pattern);
+    RebuildLocked();
+    return true;
+}
+
+void Unsubscribe(UserId user, const std::string& pattern) {
+    Locks::Lock lock(g_mutex);
+    auto it = g_subscriptions.find(user);
+    if (it == g_subscriptions.end()) return;
+    auto p = std::find(it->second.begin(), it->second.end(), pattern);
+    if (p == it->second.end()) return;
+    it->second.erase(p);
+    if (it->second.empty()) g_subscriptions.erase(it);
+    RebuildLocked();
+}
+
+std::vector<std::string> Subscriptions(UserId user) {
+    Locks::Lock lock(g_mutex);
+    auto it = g_subscriptions.find(user);
+    return it == g_subscriptions.end() ? std::vector<std::string>{} : it->second;
+}
+
+void RemoveSubscriber(UserId user) {
+    Locks::Lock lock(g_mutex);
+    if (g_subscriptions.erase(user) > 0) RebuildLocked();
+}
+
+std::vector<UserId> Match(const std::string& topic) {
+    std::vector<UserId> users;
+    std::shared_ptr<const Node> trie = std::atomic_load(&g_trie);
+    if (!trie) return users;
+    Walk(*trie, Split(topic), 0, &users);
+    std::sort(users.begin(), users.end());
+    users.erase(std::unique(users.begin(), users.end()), users.end());
+    return users;
+}
+
+void Publish(const std::string& topic, const std::string& actor, const std::string& payload, long long timestamp) {
+    static std::atomic<int64_t>& published = Metrics::Counter("topics.published");
+    static std::atomic<int64_t>& deliveries = Metrics::Counter("topics.deliveries");
+    static std::atomic<int64_t>& deferred = Metrics::Counter("topics.deferred");
+    std::vector<UserId> users = Match(topic);
+    if (users.empty()) return;
+    Message m;
+    m.type = MessageType::TOPIC_EVENT;
+    m.timestamp = timestamp;
+    m.sender_username = actor;
+    m.target_username = topic;
+    m.content = payload;
+    NetworkLayer::Frame frame = NetworkLayer::EncodeFrame(m);
+    published.fetch_add(1, std::memory_order_relaxed);
+    for (UserId u : users) {
+        Socket s = UserManager::GetSocketById(u);
+        if (s == static_cast<Socket>(-1)) continue;
+        switch (Outbound::SendFrame(s, frame)) {
+            case Outbound::SendResult::kQueued: deliveries.fetch_add(1, std::memory_order_relaxed); break;
+            case Outbound::SendResult::kDeferred: deferred.fetch_add(1, std::memory_order_relaxed); break;
+            case Outbound::SendResult::kRejected: break;
+        }
+    }
+}
+
+} // namespace Topics
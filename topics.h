@@ -0,0 +1,64 @@
+#ifndef TOPICS_H_
+#define TOPICS_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "common.h"
+
+// Topic pub/sub for bots.
+//
+// Server events are published to dot-separated topics, next to the normal
+// room traffic sent by MessageRouter:
+//
+//   room.main.msg.<sender>     public message; payload is the text
+//   presence.join.<user>       payload "alice joined"
+//   presence.leave.<user>      payload "alice left" (not while draining)
+//   file.shared.<user>         payload "ID SIZE NAME"
+//
+// The server has a single room, published as "main". Private messages are
+// never published. A session subscribes with TOPIC_SUBSCRIBE ("+pattern",
+// "-pattern", or "" to list) to patterns where "*" stands for exactly one
+// level and a final "#" for any number of remaining levels, zero included:
+// "room.*.msg.#", "presence.join.*", "#". Each matching subscriber gets one
+// TOPIC_EVENT frame per event (sender_username = actor, target_username =
+// topic, content = payload), encoded once and shared.
+//
+// Subscriptions are compiled into a trie over pattern levels; publishing
+// walks the topic's levels once, following the exact and the "*" edge and
+// collecting "#" subscribers on the way. The cost depends on the topic's
+// depth and the distinct patterns that match, not on how many sessions
+// subscribe. The trie is immutable and shared with publishers, which never
+// take a lock; a subscription change rebuilds it, which is cheap for the
+// few hundred patterns bots use.
+//
+// Subscriptions belong to the session: they are dropped when it leaves.
+
+namespace Topics {
+
+constexpr size_t kMaxSubscriptions = 16;    ///< patterns per session
+constexpr size_t kMaxDepth = 8;             ///< levels per pattern
+constexpr size_t kMaxPatternBytes = 128;
+
+// name as one topic level: '.', '*', '#', ',' and spaces or control
+// characters become '_'; an empty name becomes "_".
+std::string Level(const std::string& name);
+
+// Subscribe returns false with *error for a malformed pattern or when the
+// session already has kMaxSubscriptions.
+bool Subscribe(UserId user, const std::string& pattern, std::string* error);
+void Unsubscribe(UserId user, const std::string& pattern);
+std::vector<std::string> Subscriptions(UserId user);
+void RemoveSubscriber(UserId user);
+
+// Subscribers whose patterns match topic, sorted and without duplicates.
+std::vector<UserId> Match(const std::string& topic);
+
+// Send a TOPIC_EVENT to every subscriber of topic. Cheap when nobody
+// subscribes at all.
+void Publish(const std::string& topic, const std::string& actor, const std::string& payload, long long timestamp);
+
+} // namespace Topics
+
+#endif // TOPICS_H_
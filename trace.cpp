@@ -0,0 +1,165 @@
+#include "trace.h"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "common.h"
+
+namespace Trace {
+
+std::atomic<bool> g_enabled{false};
+
+namespace {
+
+constexpr uint64_t kMask = kRingSize - 1;
+static_assert((kRingSize & kMask) == 0, "kRingSize must be a power of two");
+
+// Fields are relaxed atomics only so that Dump() may read a ring while its
+// owner writes it; the owner is the only writer.
+struct Slot {
+    std::atomic<uint64_t> ts{0};
+    std::atomic<uint64_t> meta{0};      ///< probe | tid << 16
+    std::atomic<uint64_t> a{0};
+    std::atomic<uint64_t> b{0};
+};
+
+struct Ring {
+    std::atomic<uint64_t> head{0};
+    Slot slots[kRingSize];
+};
+
+// Past this many undumped rings of exited threads, the oldest is reused.
+constexpr size_t kMaxRetiredRings = 64;
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<Ring*> all;
+    std::deque<Ring*> retired;          ///< owners exited, not dumped since; oldest first
+    std::vector<Ring*> idle;            ///< owners exited and dumped; reused before allocating
+};
+
+Registry& GetRegistry() {
+    static Registry* registry = new Registry();   // used until exit
+    return *registry;
+}
+
+struct Holder {
+    Ring* ring = nullptr;
+    uint64_t tid = 0;
+    ~Holder() {
+        if (!ring) return;
+        Registry& r = GetRegistry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.retired.push_back(ring);
+    }
+};
+
+thread_local Holder t_holder;
+
+Ring* AcquireRing() {
+    Registry& r = GetRegistry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    if (!r.idle.empty()) {
+        Ring* ring = r.idle.back();
+        r.idle.pop_back();
+        return ring;
+    }
+    if (r.retired.size() >= kMaxRetiredRings) {
+        Ring* ring = r.retired.front();
+        r.retired.pop_front();
+        return ring;
+    }
+    Ring* ring = new Ring();
+    r.all.push_back(ring);
+    return ring;
+}
+
+uint64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct Event {
+    uint64_t ts, meta, a, b;
+};
+
+} // namespace
+
+void SetEnabled(bool on) {
+    g_enabled.store(on, std::memory_order_relaxed);
+}
+
+void Record(Probe probe, uint64_t a, uint64_t b) {
+    Holder& h = t_holder;
+    if (!h.ring) {
+        h.ring = AcquireRing();
+        h.tid = static_cast<uint64_t>(::syscall(SYS_gettid));
+    }
+    Ring* ring = h.ring;
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    Slot& s = ring->slots[head & kMask];
+    s.ts.store(NowNs(), std::memory_order_relaxed);
+    s.meta.store(static_cast<uint64_t>(probe) | (h.tid << 16), std::memory_order_relaxed);
+    s.a.store(a, std::memory_order_relaxed);
+    s.b.store(b, std::memory_order_relaxed);
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+long Dump(const std::string& path) {
+    std::vector<Event> events;
+    {
+        Registry& r = GetRegistry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        for (Ring* ring : r.all) {
+            uint64_t head = ring->head.load(std::memory_order_acquire);
+            uint64_t n = std::min<uint64_t>(head, kRingSize);
+            for (uint64_t i = head - n; i < head; ++i) {
+                const Slot& s = ring->slots[i & kMask];
+                events.push_back({s.ts.load(std::memory_order_relaxed), s.meta.load(std::memory_order_relaxed),
+                                  s.a.load(std::memory_order_relaxed), s.b.load(std::memory_order_relaxed)});
+            }
+        }
+        // Their history is in this dump now; new threads may overwrite it.
+        r.idle.insert(r.idle.end(), r.retired.begin(), r.retired.end());
+        r.retired.clear();
+    }
+    std::sort(events.begin(), events.end(), [](const Event& x, const Event& y) { return x.ts < y.ts; });
+
+    FILE* f = std::fopen(path.c_str(), "w");
+    if (!f) return -1;
+    // Anchor the monotonic clock to wall time so events line up with the log.
+    std::fprintf(f, "# monotonic_ns %llu = epoch_ms %lld\n", (unsigned long long)NowNs(), NowEpochMs());
+    std::fprintf(f, "# ts_ns tid probe a b\n");
+    for (const Event& e : events) {
+        Probe p = static_cast<Probe>(e.meta & 0xFFFF);
+        std::fprintf(f, "%llu %llu %s %llu %llu\n", (unsigned long long)e.ts,
+                     (unsigned long long)(e.meta >> 16), ProbeName(p),
+                     (unsigned long long)e.a, (unsigned long long)e.b);
+    }
+    std::fclose(f);
+    return static_cast<long>(events.size());
+}
+
+const char* ProbeName(Probe probe) {
+    switch (probe) {
+        case Probe::kAccept: return "accept";
+        case Probe::kAuthBegin: return "auth_begin";
+        case Probe::kAuthEnd: return "auth_end";
+        case Probe::kReceive: return "receive";
+        case Probe::kProcessBegin: return "process_begin";
+        case Probe::kProcessEnd: return "process_end";
+        case Probe::kBroadcast: return "broadcast";
+        case Probe::kSend: return "send";
+        case Probe::kLogWrite: return "log_write";
+        default: return "unknown";
+    }
+}
+
+} // namespace Trace
@@ -0,0 +1,86 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Hot-path trace probes.
+//
+// CHAT_TRACE(probe, a, b) appends {timestamp, probe, a, b} to a ring owned by
+// the calling thread (kRingSize events, oldest overwritten). Cost:
+//  - compiled out (cmake -DCHATROOM_TRACE=OFF): nothing, arguments are not
+//    evaluated;
+//  - compiled in, disabled at run time: one relaxed load and a branch;
+//  - enabled: a clock read and three relaxed stores into a thread-local ring.
+//
+// Dump() merges all rings by time into a text file. Rings of exited threads
+// are kept untouched until the next dump (up to 64 of them; past that the
+// oldest is reused), so an incident's history survives the connection that
+// caused it even when new connections keep arriving. A dump taken while
+// threads are still tracing may contain a few torn events at the ring heads.
+//
+// When <sys/sdt.h> is available each probe is also a USDT probe
+// (provider "chatroom"), usable from perf/bpftrace without enabling rings.
+
+namespace Trace {
+
+enum class Probe : uint16_t {
+    kAccept,            ///< a = socket
+    kAuthBegin,         ///< a = socket
+    kAuthEnd,           ///< a = socket, b = 1 accepted / 0 rejected
+    kReceive,           ///< a = socket, b = frame bytes
+    kProcessBegin,      ///< a = socket, b = message type
+    kProcessEnd,        ///< a = socket, b = 1 if the client disconnects
+    kBroadcast,         ///< a = recipients, b = frame bytes
+    kSend,              ///< a = socket, b = bytes written
+    kLogWrite,          ///< a = event type, b = line bytes
+    kCount
+};
+
+constexpr size_t kRingSize = 4096;
+
+extern std::atomic<bool> g_enabled;
+
+inline bool Enabled() {
+    return g_enabled.load(std::memory_order_relaxed);
+}
+
+void SetEnabled(bool on);
+
+// Slow path of CHAT_TRACE; only called when Enabled().
+void Record(Probe probe, uint64_t a, uint64_t b);
+
+// Write every ring, merged by timestamp, to path. Returns events written,
+// or -1 if the file could not be created.
+long Dump(const std::string& path);
+
+const char* ProbeName(Probe probe);
+
+} // namespace Trace
+
+#if defined(CHATROOM_TRACE) && CHATROOM_TRACE
+
+#if defined(CHATROOM_HAVE_SDT)
+#include <sys/sdt.h>
+#define CHAT_TRACE_USDT(probe, a, b) STAP_PROBE2(chatroom, probe, a, b)
+#else
+#define CHAT_TRACE_USDT(probe, a, b) ((void)0)
+#endif
+
+#define CHAT_TRACE(probe, a, b)                                                    \
+    do {                                                                           \
+        CHAT_TRACE_USDT(probe, (uint64_t)(a), (uint64_t)(b));                      \
+        if (__builtin_expect(::Trace::Enabled(), 0)) {                             \
+            ::Trace::Record(::Trace::Probe::probe, (uint64_t)(a), (uint64_t)(b));  \
+        }                                                                          \
+    } while (0)
+
+#else
+
+// Unevaluated, but keeps variables that only feed probes "used".
+#define CHAT_TRACE(probe, a, b) ((void)sizeof(a), (void)sizeof(b))
+
+#endif
+
+#endif // TRACE_H_
@@ -0,0 +1,90 @@
+#include "user_ids.h"
+
+#include <atomic>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+
+#include "locks.h"
+
+namespace UserIds {
+
+namespace {
+
+// Names are stored in fixed-size chunks that are never moved, so Name() can
+// index them without a lock and the forward map can key on string_views.
+constexpr size_t kChunkBits = 12;
+constexpr size_t kChunkSize = size_t(1) << kChunkBits;
+constexpr size_t kMaxChunks = 1 << 14;                 // 64M names
+
+struct Table {
+    Locks::SharedMutex mutex{"user_ids"};
+    std::unordered_map<std::string_view, UserId> by_name;
+    std::atomic<std::string*> chunks[kMaxChunks] = {};
+    std::atomic<uint32_t> count{0};
+
+    Table() {
+        InternLocked("");          // kNoUser
+        InternLocked("Server");    // kServerId
+    }
+
+    UserId InternLocked(const std::string& name) {
+        uint32_t id = count.load(std::memory_order_relaxed);
+        size_t chunk = id >> kChunkBits;
+        if (chunk >= kMaxChunks) return kNoUser;
+        std::string* block = chunks[chunk].load(std::memory_order_relaxed);
+        if (!block) {
+            block = new std::string[kChunkSize];
+            chunks[chunk].store(block, std::memory_order_release);
+        }
+        std::string& slot = block[id & (kChunkSize - 1)];
+        slot = name;
+        by_name.emplace(std::string_view(slot), id);
+        count.store(id + 1, std::memory_order_release);
+        return id;
+    }
+};
+
+Table& GetTable() {
+    static Table* table = new Table();   // intentionally leaked: used until exit
+    return *table;
+}
+
+const std::string kEmpty;
+
+} // namespace
+
+UserId Intern(const std::string& name) {
+    if (name.empty()) return kNoUser;
+    Table& t = GetTable();
+    {
+        Locks::ReadLock lock(t.mutex);
+        auto it = t.by_name.find(std::string_view(name));
+        if (it != t.by_name.end()) return it->second;
+    }
+    Locks::WriteLock lock(t.mutex);
+    auto it = t.by_name.find(std::string_view(name));
+    if (it != t.by_name.end()) return it->second;
+    return t.InternLocked(name);
+}
+
+UserId Find(const std::string& name) {
+    if (name.empty()) return kNoUser;
+    Table& t = GetTable();
+    Locks::ReadLock lock(t.mutex);
+    auto it = t.by_name.find(std::string_view(name));
+    return it == t.by_name.end() ? kNoUser : it->second;
+}
+
+const std::string& Name(UserId id) {
+    Table& t = GetTable();
+    if (id >= t.count.load(std::memory_order_acquire)) return kEmpty;
+    const std::string* block = t.chunks[id >> kChunkBits].load(std::memory_order_acquire);
+    return block[id & (kChunkSize - 1)];
+}
+
+size_t Count() {
+    return GetTable().count.load(std::memory_order_acquire);
+}
+
+} // namespace UserIds
@@ -0,0 +1,36 @@
+#ifndef USER_IDS_H_
+#define USER_IDS_H_
+
+#include <string>
+
+#include "common.h"
+
+// Username interning.
+//
+// Every username that is ever accepted gets a stable 32-bit UserId. Services
+// route, track presence and log by id; strings are only produced again at
+// the protocol/log-file boundary via Name(), which is a lock-free array index.
+//
+// Ids are never recycled, so an id stays meaningful across reconnects and in
+// stored logs. kNoUser (0) maps to the empty name; kServerId maps to "Server".
+
+namespace UserIds {
+
+constexpr UserId kServerId = 1;
+
+// Return the id for name, assigning the next one on first sight.
+UserId Intern(const std::string& name);
+
+// Return the id for name if it was interned before, else kNoUser.
+// Use this for untrusted input so lookups never grow the table.
+UserId Find(const std::string& name);
+
+// Reverse lookup; O(1) and lock-free. Unknown ids map to "".
+const std::string& Name(UserId id);
+
+// Number of ids handed out so far (including kServerId).
+size_t Count();
+
+} // namespace UserIds
+
+#endif // USER_IDS_H_
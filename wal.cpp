@@ -0,0 +1,190 @@
+#include "wal.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "affinity.h"
+#include "metrics.h"
+
+namespace Wal {
+
+namespace {
+
+struct Pending {
+    std::string record;
+    Done done;
+};
+
+struct Log {
+    std::mutex mutex;
+    std::condition_variable wake;       ///< committer: work arrived / stop
+    std::condition_variable committed_cv;
+    std::vector<Pending> queue;
+    uint64_t appended = 0;
+    uint64_t committed = 0;
+    Options options;
+    int fd = -1;
+    bool open = false;
+    bool failed = false;
+    bool stopping = false;
+    std::thread committer;
+};
+
+Log& GetLog() {
+    static Log* log = new Log();   // used until exit
+    return *log;
+}
+
+bool WriteAll(int fd, const std::string& buf) {
+    size_t off = 0;
+    while (off < buf.size()) {
+        ssize_t n = ::write(fd, buf.data() + off, buf.size() - off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        off += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+void CommitLoop() {
+    using Clock = std::chrono::steady_clock;
+    Affinity::PinSelf(Affinity::Role::kLog);
+    static std::atomic<int64_t>& commits = Metrics::Counter("wal.commits");
+    static std::atomic<int64_t>& records = Metrics::Counter("wal.records");
+    static std::atomic<int64_t>& bytes = Metrics::Counter("wal.bytes");
+    static std::atomic<int64_t>& errors = Metrics::Counter("wal.errors");
+    static std::atomic<int64_t>& sync_us = Metrics::Counter("wal.last_sync_us");
+
+    Log& w = GetLog();
+    std::vector<Pending> batch;
+    std::string buf;
+    std::unique_lock<std::mutex> lock(w.mutex);
+    for (;;) {
+        w.wake.wait(lock, [&] { return !w.queue.empty() || w.stopping; });
+        if (w.queue.empty()) break;   // stopping with nothing left
+        if (w.options.group_window_us > 0 && !w.stopping) {
+            auto deadline = Clock::now() + std::chrono::microseconds(w.options.group_window_us);
+            w.wake.wait_until(lock, deadline, [&] {
+                return w.queue.size() >= w.options.max_batch || w.stopping;
+            });
+        }
+        if (w.queue.size() <= w.options.max_batch) {
+            batch.swap(w.queue);
+        } else {
+            auto cut = w.queue.begin() + static_cast<std::ptrdiff_t>(w.options.max_batch);
+            batch.assign(std::make_move_iterator(w.queue.begin()), std::make_move_iterator(cut));
+            w.queue.erase(w.queue.begin(), cut);
+        }
+        const uint64_t upto = w.committed + batch.size();
+        const bool failed = w.failed;
+        const int fd = w.fd;
+        lock.unlock();
+
+        bool ok = !failed;
+        if (ok) {
+            buf.clear();
+            for (const Pending& p : batch) buf += p.record;
+            Clock::time_point t0 = Clock::now();
+            ok = WriteAll(fd, buf) && ::fdatasync(fd) == 0;
+            sync_us.store(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - t0).count(),
+                          std::memory_order_relaxed);
+            if (ok) {
+                commits.fetch_add(1, std::memory_order_relaxed);
+                records.fetch_add(static_cast<int64_t>(batch.size()), std::memory_order_relaxed);
+                bytes.fetch_add(static_cast<int64_t>(buf.size()), std::memory_order_relaxed);
+            } else {
+                errors.fetch_add(1, std::memory_order_relaxed);
+                std::cerr << "Error: write-ahead log commit failed: " << std::strerror(errno) << std::endl;
+            }
+        }
+        for (Pending& p : batch) {
+            if (p.done) p.done(ok);
+        }
+        batch.clear();
+
+        lock.lock();
+        if (!ok) w.failed = true;
+        w.committed = upto;
+        w.committed_cv.notify_all();
+    }
+}
+
+} // namespace
+
+bool Open(const Options& options) {
+    Log& w = GetLog();
+    std::lock_guard<std::mutex> lock(w.mutex);
+    if (w.open) return true;
+    int fd = ::open(options.path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cerr << "Error: could not open write-ahead log: " << options.path << std::endl;
+        return false;
+    }
+    w.options = options;
+    if (w.options.max_batch == 0) w.options.max_batch = 1;
+    w.fd = fd;
+    w.open = true;
+    w.failed = false;
+    w.stopping = false;
+    w.committer = std::thread(CommitLoop);
+    Metrics::RegisterGauge("wal.pending", [] {
+        Log& l = GetLog();
+        std::lock_guard<std::mutex> g(l.mutex);
+        return static_cast<int64_t>(l.appended - l.committed);
+    });
+    return true;
+}
+
+bool IsOpen() {
+    Log& w = GetLog();
+    std::lock_guard<std::mutex> lock(w.mutex);
+    return w.open;
+}
+
+bool Append(std::string record, Done done) {
+    Log& w = GetLog();
+    std::lock_guard<std::mutex> lock(w.mutex);
+    if (!w.open || w.failed || w.stopping) return false;
+    w.queue.push_back(Pending{std::move(record), std::move(done)});
+    ++w.appended;
+    if (w.queue.size() == 1 || w.queue.size() >= w.options.max_batch) w.wake.notify_one();
+    return true;
+}
+
+void Flush() {
+    Log& w = GetLog();
+    std::unique_lock<std::mutex> lock(w.mutex);
+    const uint64_t target = w.appended;
+    w.committed_cv.wait(lock, [&] { return w.committed >= target || !w.open; });
+}
+
+void Close() {
+    Log& w = GetLog();
+    {
+        std::lock_guard<std::mutex> lock(w.mutex);
+        if (!w.open) return;
+        w.stopping = true;
+    }
+    w.wake.notify_one();
+    w.committer.join();
+    std::lock_guard<std::mutex> lock(w.mutex);
+    ::close(w.fd);
+    w.fd = -1;
+    w.open = false;
+    w.committed_cv.notify_all();
+}
+
+} // namespace Wal
@@ -0,0 +1,54 @@
+#ifndef WAL_H_
+#define WAL_H_
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+// Write-ahead log with group commit.
+//
+// Append() queues a record and returns at once. A single committer thread
+// takes everything queued, waits up to group_window_us for more (or until
+// max_batch records are pending), writes the batch with one write() and one
+// fdatasync(), and only then runs the batch's callbacks, in append order.
+// Records hit the file in append order too.
+//
+// Trade-offs: group_window_us = 0 syncs as soon as the previous sync is done
+// (lowest latency, batches form only under load); larger windows amortize
+// each fdatasync over more records at the cost of that much added latency.
+// max_batch bounds both the wait and the size of one write.
+//
+// On an I/O error the batch's callbacks run with durable = false, as do the
+// callbacks of records already queued behind it. The log then stays failed:
+// later appends are refused until it is closed and opened again.
+
+namespace Wal {
+
+struct Options {
+    std::string path;
+    int group_window_us = 200;
+    size_t max_batch = 256;
+};
+
+using Done = std::function<void(bool durable)>;
+
+// Open (append mode) and start the committer. Returns false if the file
+// cannot be opened.
+bool Open(const Options& options);
+
+bool IsOpen();
+
+// Queue record (written verbatim). done may be empty; it runs on the
+// committer thread. Returns false, without calling done, if the log is not
+// open, is closing or has failed.
+bool Append(std::string record, Done done);
+
+// Block until every record appended before the call has been committed.
+void Flush();
+
+// Flush, stop the committer and close the file.
+void Close();
+
+} // namespace Wal
+
+#endif // WAL_H_
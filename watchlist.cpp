@@ -0,0 +1,365 @@
+#include "watchlist.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "locks.h"
+#include "metrics.h"
+#include "outbound.h"
+#include "services.h"
+#include "user_ids.h"
+
+namespace Watchlist {
+
+namespace {
+
+constexpr uint32_t kNone = UINT32_MAX;
+
+using PatternMap = std::map<std::string, std::set<UserId>>;
+
+unsigned char Fold(unsigned char c) {
+    return c >= 'A' && c <= 'Z' ? static_cast<unsigned char>(c - 'A' + 'a') : c;
+}
+
+// UTF-8 continuation and lead bytes count as letters, so a match never
+// splits a multi-byte word.
+bool IsWordByte(unsigned char c) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c >= 0x80;
+}
+
+uint64_t Key(uint32_t pattern, UserId user) {
+    return (static_cast<uint64_t>(pattern) << 32) | user;
+}
+
+// Aho-Corasick over folded bytes. Built once, then only read.
+class Automaton {
+public:
+    explicit Automaton(const PatternMap& patterns) {
+        nodes_.emplace_back();
+        for (const auto& kv : patterns) {
+            if (kv.second.empty()) continue;
+            uint32_t id = static_cast<uint32_t>(patterns_.size());
+            patterns_.push_back(kv.first);
+            users_.emplace_back(kv.second.begin(), kv.second.end());   // sorted
+            pairs_ += kv.second.size();
+            uint32_t node = 0;
+            for (unsigned char c : kv.first) {
+                uint32_t next = Next(node, c);
+                if (next == kNone) {
+                    next = static_cast<uint32_t>(nodes_.size());
+                    auto& edges = nodes_[node].next;
+                    edges.insert(std::lower_bound(edges.begin(), edges.end(), std::make_pair(c, uint32_t{0})),
+                                 std::make_pair(c, next));
+                    nodes_.emplace_back();
+                }
+                node = next;
+            }
+            nodes_[node].pattern = id;
+        }
+        // Breadth first, so every fail target is finished before it is used.
+        std::vector<uint32_t> queue;
+        for (const auto& e : nodes_[0].next) queue.push_back(e.second);
+        for (size_t q = 0; q < queue.size(); ++q) {
+            const uint32_t u = queue[q];
+            for (const auto& e : nodes_[u].next) {
+                uint32_t f = nodes_[u].fail;
+                uint32_t t = Next(f, e.first);
+                while (t == kNone && f != 0) {
+                    f = nodes_[f].fail;
+                    t = Next(f, e.first);
+                }
+                Node& v = nodes_[e.second];
+                v.fail = t == kNone ? 0 : t;
+                v.out = nodes_[v.fail].pattern != kNone ? v.fail : nodes_[v.fail].out;
+                queue.push_back(e.second);
+            }
+        }
+    }
+
+    size_t Pairs() const { return pairs_; }
+    const std::string& Pattern(uint32_t id) const { return patterns_[id]; }
+    const std::vector<UserId>& Users(uint32_t id) const { return users_[id]; }
+
+    uint32_t Find(const std::string& pattern) const {
+        auto it = std::lower_bound(patterns_.begin(), patterns_.end(), pattern);
+        return it != patterns_.end() && *it == pattern ? static_cast<uint32_t>(it - patterns_.begin()) : kNone;
+    }
+
+    // fn(pattern id) for every whole-word occurrence in text.
+    template <typename Fn>
+    void Scan(const std::string& text, Fn&& fn) const {
+        const size_t n = text.size();
+        uint32_t s = 0;
+        for (size_t i = 0; i < n; ++i) {
+            const unsigned char c = Fold(static_cast<unsigned char>(text[i]));
+            uint32_t t = Next(s, c);
+            while (t == kNone && s != 0) {
+                s = nodes_[s].fail;
+                t = Next(s, c);
+            }
+            s = t == kNone ? 0 : t;
+            for (uint32_t o = nodes_[s].pattern != kNone ? s : nodes_[s].out; o != kNone; o = nodes_[o].out) {
+                const uint32_t p = nodes_[o].pattern;
+                const size_t start = i + 1 - patterns_[p].size();
+                if (start > 0 && IsWordByte(static_cast<unsigned char>(text[start - 1]))) continue;
+                if (i + 1 < n && IsWordByte(static_cast<unsigned char>(text[i + 1]))) continue;
+                fn(p);
+            }
+        }
+    }
+
+private:
+    struct Node {
+        std::vector<std::pair<unsigned char, uint32_t>> next;  ///< sorted by byte
+        uint32_t fail = 0;
+        uint32_t out = kNone;       ///< nearest node on the fail chain ending a pattern
+        uint32_t pattern = kNone;   ///< pattern ending here
+    };
+
+    uint32_t Next(uint32_t node, unsigned char c) const {
+        const auto& edges = nodes_[node].next;
+        auto it = std::lower_bound(edges.begin(), edges.end(), std::make_pair(c, uint32_t{0}));
+        return it != edges.end() && it->first == c ? it->second : kNone;
+    }
+
+    std::vector<Node> nodes_;
+    std::vector<std::string> patterns_;     // sorted: PatternMap order
+    std::vector<std::vector<UserId>> users_;
+    size_t pairs_ = 0;
+};
+
+// What scanners see; replaced whole on every change.
+struct Index {
+    std::shared_ptr<const Automaton> base;
+    std::shared_ptr<const Automaton> delta;     ///< pairs added since the base build
+    std::unordered_set<uint64_t> masked;        ///< base pairs removed since then
+};
+
+Locks::Mutex g_mutex{"watchlist"};
+PatternMap g_all;                               // every watch
+PatternMap g_added;                             // those not in g_base
+size_t g_added_pairs = 0;
+std::unordered_set<uint64_t> g_masked;
+std::shared_ptr<const Automaton> g_base;
+std::vector<std::vector<std::string>> g_keywords;  // by UserId
+std::shared_ptr<const Index> g_index;           // std::atomic_load / atomic_store only
+
+std::string MentionOf(UserId user) {
+    std::string p = "@" + UserIds::Name(user);
+    for (char& c : p) c = static_cast<char>(Fold(static_cast<unsigned char>(c)));
+    return p;
+}
+
+bool Normalize(const std::string& word, std::string* out, std::string* error) {
+    size_t b = word.find_first_not_of(' ');
+    size_t e = word.find_last_not_of(' ');
+    std::string w = b == std::string::npos ? "" : word.substr(b, e - b + 1);
+    if (w.size() < kMinPatternBytes || w.size() > kMaxPatternBytes) {
+        *error = "length must be " + std::to_string(kMinPatternBytes) + "-" + std::to_string(kMaxPatternBytes);
+        return false;
+    }
+    for (char& c : w) {
+        unsigned char u = static_cast<unsigned char>(c);
+        if (u < 0x20 || c == ',') {
+            *error = "no commas or control characters";
+            return false;
+        }
+        c = static_cast<char>(Fold(u));
+    }
+    *out = std::move(w);
+    return true;
+}
+
+// Caller holds g_mutex.
+bool InBase(const std::string& pattern, UserId user, uint32_t* id) {
+    if (!g_base) return false;
+    *id = g_base->Find(pattern);
+    if (*id == kNone) return false;
+    const std::vector<UserId>& users = g_base->Users(*id);
+    return std::binary_search(users.begin(), users.end(), user);
+}
+
+// Caller holds g_mutex.
+void AddLocked(const std::string& pattern, UserId user) {
+    if (!g_all[pattern].insert(user).second) return;
+    uint32_t id;
+    if (InBase(pattern, user, &id)) {
+        g_masked.erase(Key(id, user));
+    } else {
+        g_added[pattern].insert(user);
+        ++g_added_pairs;
+    }
+}
+
+// Caller holds g_mutex.
+void RemoveLocked(const std::string& pattern, UserId user) {
+    auto it = g_all.find(pattern);
+    if (it == g_all.end() || it->second.erase(user) == 0) return;
+    if (it->second.empty()) g_all.erase(it);
+    auto added = g_added.find(pattern);
+    if (added != g_added.end() && added->second.erase(user) > 0) {
+        if (added->second.empty()) g_added.erase(added);
+        --g_added_pairs;
+        return;
+    }
+    uint32_t id;
+    if (InBase(pattern, user, &id)) g_masked.insert(Key(id, user));
+}
+
+// Caller holds g_mutex. Rebuild the delta, or fold everything into a new
+// base once the delta or the mask is too large, and publish.
+void PublishLocked() {
+    static std::atomic<int64_t>& rebuilds = Metrics::Counter("watch.rebuilds");
+    static std::atomic<int64_t>& delta_builds = Metrics::Counter("watch.delta_builds");
+    const size_t limit =
+        std::max(kDeltaMin, static_cast<size_t>(std::sqrt(static_cast<double>(g_base ? g_base->Pairs() : 0))));
+    auto index = std::make_shared<Index>();
+    if (g_added_pairs > limit || g_masked.size() > limit) {
+        g_base = std::make_shared<const Automaton>(g_all);
+        g_added.clear();
+        g_added_pairs = 0;
+        g_masked.clear();
+        rebuilds.fetch_add(1, std::memory_order_relaxed);
+    } else if (!g_added.empty()) {
+        index->delta = std::make_shared<const Automaton>(g_added);
+        delta_builds.fetch_add(1, std::memory_order_relaxed);
+    }
+    index->base = g_base;
+    index->masked = g_masked;
+    std::atomic_store(&g_index, std::shared_ptr<const Index>(std::move(index)));
+}
+
+} // namespace
+
+void AddUser(UserId user) {
+    if (user == kNoUser) return;
+    Locks::Lock lock(g_mutex);
+    AddLocked(MentionOf(user), user);
+    PublishLocked();
+}
+
+void RemoveUser(UserId user) {
+    if (user == kNoUser) return;
+    Locks::Lock lock(g_mutex);
+    RemoveLocked(MentionOf(user), user);
+    if (user < g_keywords.size()) {
+        for (const std::string& w : g_keywords[user]) RemoveLocked(w, user);
+        g_keywords[user].clear();
+    }
+    PublishLocked();
+}
+
+bool Watch(UserId user, const std::string& word, std::string* error) {
+    std::string w;
+    if (user == kNoUser || !Normalize(word, &w, error)) return false;
+    if (w == MentionOf(user)) return true;     // implicit already
+    Locks::Lock lock(g_mutex);
+    if (user >= g_keywords.size()) g_keywords.resize(user + 1);
+    std::vector<std::string>& mine = g_keywords[user];
+    if (std::find(mine.begin(), mine.end(), w) != mine.end()) return true;
+    if (mine.size() >= kMaxWatches) {
+        *error = "at most " + std::to_string(kMaxWatches) + " watches";
+        return false;
+    }
+    mine.push_back(w);
+    AddLocked(w, user);
+    PublishLocked();
+    return true;
+}
+
+void Unwatch(UserId user, const std::string& word) {
+    std::string w, error;
+    if (!Normalize(word, &w, &error)) return;
+    Locks::Lock lock(g_mutex);
+    if (user >= g_keywords.size()) return;
+    std::vector<std::string>& mine = g_keywords[user];
+    auto it = std::find(mine.begin(), mine.end(), w);
+    if (it == mine.end()) return;
+    mine.erase(it);
+    RemoveLocked(w, user);
+    PublishLocked();
+}
+
+std::vector<std::string> Watches(UserId user) {
+    Locks::Lock lock(g_mutex);
+    return user < g_keywords.size() ? g_keywords[user] : std::vector<std::string>{};
+}
+
+std::vector<std::pair<UserId, std::string>> Match(const std::string& text) {
+    std::vector<std::pair<UserId, std::string>> hits;
+    std::shared_ptr<const Index> index = std::atomic_load(&g_index);
+    if (!index) return hits;
+    // A pattern may occur several times; report its users once.
+    std::unordered_set<uint32_t> seen;
+    if (index->base) {
+        const Automaton& a = *index->base;
+        a.Scan(text, [&](uint32_t p) {
+            if (!seen.insert(p).second) return;
+            for (UserId u : a.Users(p)) {
+                if (index->masked.empty() || !index->masked.count(Key(p, u))) hits.emplace_back(u, a.Pattern(p));
+            }
+        });
+    }
+    if (index->delta) {
+        seen.clear();
+        const Automaton& a = *index->delta;
+        a.Scan(text, [&](uint32_t p) {
+            if (!seen.insert(p).second) return;
+            for (UserId u : a.Users(p)) hits.emplace_back(u, a.Pattern(p));
+        });
+    }
+    return hits;
+}
+
+std::vector<Notification> Scan(const Message& msg, UserId sender) {
+    static std::atomic<int64_t>& scans = Metrics::Counter("watch.scans");
+    scans.fetch_add(1, std::memory_order_relaxed);
+    std::vector<Notification> notes;
+    std::vector<std::pair<UserId, std::string>> hits = Match(msg.content);
+    if (hits.empty()) return notes;
+
+    // One frame per recipient listing every pattern that fired for it.
+    std::unordered_map<UserId, std::string> per_user;
+    for (auto& hit : hits) {
+        if (hit.first == sender) continue;
+        std::string& patterns = per_user[hit.first];
+        if (!patterns.empty()) patterns.push_back(',');
+        patterns += hit.second;
+    }
+    const std::string from = sender != kNoUser ? UserIds::Name(sender) : msg.sender_username;
+    notes.reserve(per_user.size());
+    for (auto& kv : per_user) {
+        Notification n;
+        n.user = kv.first;
+        n.message.type = MessageType::WATCH_NOTIFY;
+        n.message.timestamp = msg.timestamp;
+        n.message.sender_username = from;
+        n.message.target_username = UserIds::Name(kv.first);
+        n.message.content = std::move(kv.second);
+        notes.push_back(std::move(n));
+    }
+    return notes;
+}
+
+void Deliver(const std::vector<Notification>& notes) {
+    static std::atomic<int64_t>& notifications = Metrics::Counter("watch.notifications");
+    static std::atomic<int64_t>& deferred = Metrics::Counter("watch.deferred");
+    for (const Notification& n : notes) {
+        Socket s = UserManager::GetSocketById(n.user);
+        if (s == static_cast<Socket>(-1)) continue;
+        switch (Outbound::Send(s, n.message)) {
+            case Outbound::SendResult::kQueued: notifications.fetch_add(1, std::memory_order_relaxed); break;
+            case Outbound::SendResult::kDeferred: deferred.fetch_add(1, std::memory_order_relaxed); break;
+            case Outbound::SendResult::kRejected: break;
+        }
+    }
+}
+
+} // namespace Watchlist
@@ -0,0 +1,72 @@
+#ifndef WATCHLIST_H_
+#define WATCHLIST_H_
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "common.h"
+
+// Mention and keyword notifications.
+//
+// Every online user implicitly watches "@name"; /watch adds keywords. Each
+// public message is scanned once, before it is logged, by an Aho-Corasick
+// automaton over every watched pattern, and once it is broadcast each
+// matching user except the sender gets a WATCH_NOTIFY frame naming the
+// patterns that hit:
+//
+//   WATCH_NOTIFY  sender "bob", content "@alice,deploy"
+//
+// so the cost per message is its length plus the matches, whatever the
+// number of users or watches. Patterns match case-insensitively (ASCII) and
+// as whole words: "cat" does not fire on "concatenate".
+//
+// The automaton is immutable and shared with the scanning threads, which
+// never take a lock. Changes are incremental: a pattern added since the last
+// full build goes into a small delta automaton rebuilt on its own, and a
+// removed one is masked until then. Once the delta or the mask outgrows the
+// square root of the base's size (at least kDeltaMin pairs), everything is
+// folded into a new base, so with n watches a join storm costs O(sqrt(n))
+// rebuild work per change instead of O(n).
+//
+// Watches belong to the session: they are dropped when the user leaves.
+
+namespace Watchlist {
+
+constexpr size_t kMaxWatches = 32;          ///< keywords per user
+constexpr size_t kMinPatternBytes = 2;
+constexpr size_t kMaxPatternBytes = 64;
+constexpr size_t kDeltaMin = 64;            ///< delta/mask pairs before a full rebuild
+
+// The user came online / went away: adds or drops "@name" and, on leave,
+// every keyword.
+void AddUser(UserId user);
+void RemoveUser(UserId user);
+
+// Keyword watches. Watch returns false with *error for an unusable word or
+// when the user already has kMaxWatches.
+bool Watch(UserId user, const std::string& word, std::string* error);
+void Unwatch(UserId user, const std::string& word);
+std::vector<std::string> Watches(UserId user);
+
+// (user, pattern) for every watch that fires on text; one entry per user
+// and pattern, unordered.
+std::vector<std::pair<UserId, std::string>> Match(const std::string& text);
+
+struct Notification {
+    UserId user;
+    Message message;                ///< the WATCH_NOTIFY frame for user
+};
+
+// Scan a public message: one WATCH_NOTIFY per matching user other than
+// sender. Runs on the sender's session thread, before the message is logged,
+// so the scan never holds up the WAL committer or the log mutex; the durable
+// callback only calls Deliver, after the broadcast.
+std::vector<Notification> Scan(const Message& msg, UserId sender);
+// Send notes to the users still online.
+void Deliver(const std::vector<Notification>& notes);
+
+} // namespace Watchlist
+
+#endif // WATCHLIST_H_
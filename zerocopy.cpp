@@ -0,0 +1,142 @@
+#include "zerocopy.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#include "metrics.h"
+
+namespace ZeroCopy {
+
+namespace {
+
+// Send calls in a row the kernel copied before a socket gives up.
+constexpr size_t kCopiedLimit = 64;
+// Wait for the completions of purged data after an abort.
+constexpr int kAbortGraceMs = 100;
+
+std::atomic<size_t> g_threshold{0};
+
+// Frames the kernel may still read; kept for the life of the process.
+std::mutex g_retired_mu;
+std::vector<NetworkLayer::Frame> g_retired;
+
+} // namespace
+
+void Configure(size_t bytes) {
+    g_threshold.store(bytes, std::memory_order_relaxed);
+}
+
+size_t Threshold() {
+    return g_threshold.load(std::memory_order_relaxed);
+}
+
+Sender::Sender(Socket sock, size_t threshold) : sock_(sock), threshold_(threshold) {
+    active_ = threshold > 0 && NetworkLayer::EnableZeroCopy(sock);
+}
+
+Sender::~Sender() {
+    Drain(0);
+}
+
+bool Sender::Send(const std::vector<NetworkLayer::Frame>& frames) {
+    static std::atomic<int64_t>& sends = Metrics::Counter("zerocopy.sends");
+    static std::atomic<int64_t>& bytes = Metrics::Counter("zerocopy.bytes");
+    if (!active_) {
+        bool ok = NetworkLayer::SendFrames(sock_, frames);
+        if (pending_frames_ > 0) Reap();
+        return ok;
+    }
+    size_t i = 0;
+    std::vector<NetworkLayer::Frame> run;
+    while (i < frames.size()) {
+        const bool large = frames[i]->size() >= threshold_;
+        size_t j = i;
+        size_t run_bytes = 0;
+        while (j < frames.size() && (frames[j]->size() >= threshold_) == large) run_bytes += frames[j++]->size();
+        run.assign(frames.begin() + static_cast<std::ptrdiff_t>(i), frames.begin() + static_cast<std::ptrdiff_t>(j));
+        i = j;
+        if (!large) {
+            if (!NetworkLayer::SendFrames(sock_, run)) return false;
+            continue;
+        }
+        size_t calls = 0;
+        bool ok = NetworkLayer::SendFramesZeroCopy(sock_, run, &calls);
+        if (calls > 0) {
+            // Held even if the send failed part way: the kernel may still
+            // read what it accepted.
+            pending_frames_ += run.size();
+            in_flight_.push_back(InFlight{next_id_, calls, 0, std::move(run)});
+            next_id_ += static_cast<uint32_t>(calls);
+            sends.fetch_add(static_cast<int64_t>(calls), std::memory_order_relaxed);
+            bytes.fetch_add(static_cast<int64_t>(run_bytes), std::memory_order_relaxed);
+        }
+        if (!ok) return false;
+    }
+    Reap();
+    return true;
+}
+
+void Sender::Reap() {
+    static std::atomic<int64_t>& copied = Metrics::Counter("zerocopy.copied");
+    static std::atomic<int64_t>& given_up = Metrics::Counter("zerocopy.disabled");
+    if (in_flight_.empty()) return;
+    done_.clear();
+    if (NetworkLayer::ReadZeroCopyDone(sock_, &done_) == 0) return;
+    for (const NetworkLayer::ZeroCopyDone& d : done_) {
+        const uint32_t span = d.hi - d.lo;   // ids wrap at 2^32
+        for (InFlight& f : in_flight_) {
+            for (size_t k = 0; k < f.calls; ++k) {
+                if (static_cast<uint32_t>(f.first + k - d.lo) <= span) ++f.done;
+            }
+        }
+        if (d.copied) {
+            // One notification may cover many calls.
+            copied.fetch_add(static_cast<int64_t>(span) + 1, std::memory_order_relaxed);
+            copied_streak_ += static_cast<size_t>(span) + 1;
+            if (copied_streak_ >= kCopiedLimit && active_) {
+                active_ = false;
+                given_up.fetch_add(1, std::memory_order_relaxed);
+            }
+        } else {
+            copied_streak_ = 0;
+        }
+    }
+    auto finished = [](const InFlight& f) { return f.done >= f.calls; };
+    for (const InFlight& f : in_flight_) {
+        if (finished(f)) pending_frames_ -= f.frames.size();
+    }
+    in_flight_.erase(std::remove_if(in_flight_.begin(), in_flight_.end(), finished), in_flight_.end());
+}
+
+bool Sender::ReapFor(int timeout_ms) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    for (;;) {
+        Reap();
+        if (in_flight_.empty()) return true;
+        if (std::chrono::steady_clock::now() >= deadline) return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+void Sender::Drain(int timeout_ms) {
+    static std::atomic<int64_t>& aborted = Metrics::Counter("zerocopy.aborted");
+    static std::atomic<int64_t>& retired = Metrics::Counter("zerocopy.retired");
+    if (ReapFor(timeout_ms)) return;
+    // Releasing now would let the kernel send reused heap memory to the
+    // peer. Make it drop the queued data first.
+    NetworkLayer::Abort(sock_);
+    aborted.fetch_add(1, std::memory_order_relaxed);
+    if (ReapFor(kAbortGraceMs)) return;
+    std::lock_guard<std::mutex> lock(g_retired_mu);
+    for (InFlight& f : in_flight_) {
+        retired.fetch_add(static_cast<int64_t>(f.frames.size()), std::memory_order_relaxed);
+        for (NetworkLayer::Frame& frame : f.frames) g_retired.push_back(std::move(frame));
+    }
+    in_flight_.clear();
+    pending_frames_ = 0;
+}
+
+} // namespace ZeroCopy
@@ -0,0 +1,85 @@
+#ifndef ZEROCOPY_H_
+#define ZEROCOPY_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "common.h"
+#include "network.h"
+
+// MSG_ZEROCOPY sends for large frames.
+//
+// A plain send copies the frame into the socket buffer once per recipient,
+// so a 64K paste broadcast to 1000 sessions costs 64M of memcpy. With
+// MSG_ZEROCOPY the kernel pins the frame's pages and transmits from them
+// instead; the buffer must then stay untouched until the socket's error
+// queue reports that the kernel is done with it. Frames are shared and
+// immutable (NetworkLayer::Frame), so a Sender only has to keep a reference
+// to each zero-copy frame until its completion is read; the frame's global
+// send-queue charge (memory_budget.h) is returned with that reference.
+//
+// Pinning pages and reading completions costs more than copying a small
+// frame, hence the threshold. Traffic to a local peer (loopback) is copied by
+// the kernel anyway; a Sender notices completions flagged as copied and
+// stops asking for zero-copy on that socket.
+
+namespace ZeroCopy {
+
+// Frames of at least bytes go zero-copy on new connections; 0 = off.
+void Configure(size_t bytes);
+size_t Threshold();
+
+// One socket's zero-copy state; used by its single writer thread only.
+class Sender {
+public:
+    // Enables SO_ZEROCOPY on sock; falls back to plain sends if that fails.
+    Sender(Socket sock, size_t threshold);
+    ~Sender();
+
+    bool Active() const { return active_; }
+
+    // Send frames in order: runs of frames below the threshold are copied,
+    // runs at or above it go zero-copy and are held until completed.
+    bool Send(const std::vector<NetworkLayer::Frame>& frames);
+
+    // Read completions without blocking and drop the frames they cover.
+    void Reap();
+
+    // Frames sent zero-copy whose completion has not been read yet.
+    size_t Pending() const { return pending_frames_; }
+
+    // Reap until nothing is pending or timeout_ms has passed. If frames are
+    // still held then (the peer is gone or no longer reading), the
+    // connection is aborted so the kernel drops its queued data, and they
+    // are released once it reports them done. Frames the kernel still has
+    // not let go of after that are never freed (zerocopy.retired): the
+    // kernel could read their memory after the allocator reused it.
+    // Call only once the socket carries nothing else.
+    void Drain(int timeout_ms);
+
+private:
+    // Reap until nothing is in flight (true) or timeout_ms has passed.
+    bool ReapFor(int timeout_ms);
+
+    struct InFlight {
+        uint32_t first;             ///< first send call id
+        size_t calls;               ///< ids first .. first + calls - 1
+        size_t done = 0;
+        std::vector<NetworkLayer::Frame> frames;
+    };
+
+    Socket sock_;
+    size_t threshold_;
+    bool active_ = false;
+    uint32_t next_id_ = 0;
+    std::deque<InFlight> in_flight_;
+    size_t pending_frames_ = 0;
+    size_t copied_streak_ = 0;      // send calls in a row the kernel copied
+    std::vector<NetworkLayer::ZeroCopyDone> done_;
+};
+
+} // namespace ZeroCopy
+
+#endif // ZEROCOPY_H_